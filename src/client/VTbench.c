@@ -0,0 +1,462 @@
+/*
+ * VTbench: IPC load generator and latency benchmark.
+ *
+ * N client threads replay a weighted mix of LIST, INSERT, REMOVE, STATUS
+ * and NEXT against a running server at a target aggregate rate, then
+ * print throughput, latency percentiles and error counts per command as
+ * one JSON object on stdout.
+ *
+ * Each client is open-loop: its requests are due at fixed intervals and
+ * latency is measured from when a request was due, not from when it
+ * could be sent, so a stalled server shows up as latency instead of
+ * silently lowering the offered load. --rate 0 runs closed-loop (every
+ * client sends its next request as soon as the last reply is in).
+ *
+ * Text mode opens one connection per request, like VTqueue; --framed
+ * keeps one framed connection per client. REMOVE deletes, by ID, an item
+ * the same client inserted (by position 1 while it has none).
+ *
+ *   VTbench -c 8 -r 2000 -t 30 -u /media/clip.mp4 > run.json
+ */
+
+#include "VTqueue.h"
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+/* Latency histogram: 16 linear sub-buckets per power of two of ns. */
+#define HIST_SUB_BITS   4
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_MAX_BIT    40
+#define HIST_BUCKETS    ((HIST_MAX_BIT - HIST_SUB_BITS + 2) * HIST_SUB)
+
+/* Remembered per client for REMOVE. */
+#define BENCH_IDS       4096
+/* A reply slower than this is a failure. */
+#define BENCH_TIMEOUT_S 5
+
+typedef enum {
+    OP_LIST = 0,
+    OP_INSERT,
+    OP_REMOVE,
+    OP_STATUS,
+    OP_NEXT,
+    OPS
+} BenchOp;
+
+static const char *op_names[OPS] = { "list", "insert", "remove", "status", "next" };
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;        /* E replies */
+    uint64_t failures;      /* connect/I/O errors and timeouts */
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} BenchStats;
+
+typedef struct {
+    pthread_t   thread;
+    int         index;
+    int         fd;         /* framed connection, -1 in text mode */
+    uint32_t    next_id;
+    unsigned int seed;
+    unsigned long long ids[BENCH_IDS];
+    int         nids;
+    BenchStats  stats[OPS];
+} BenchClient;
+
+static int clients = 4;
+static double rate = 1000.0;
+static double duration = 10.0;
+static int framed = 0;
+static int weights[OPS] = { 25, 15, 15, 40, 5 };
+static int weight_total = 100;
+static char uri[PATH_MAX] = "/dev/null";
+static char sockpath[sizeof(((struct sockaddr_un *) 0)->sun_path)] = UNIX_PATH;
+static int64_t bench_start, bench_end;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(uint64_t v)
+{
+    unsigned int e;
+
+    if(v < HIST_SUB)
+        return (unsigned int) v;
+    e = 63 - __builtin_clzll(v);
+    if(e > HIST_MAX_BIT)
+        return HIST_BUCKETS - 1;
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (unsigned int) ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* First value past bucket 'i'. */
+static uint64_t hist_upper(unsigned int i)
+{
+    unsigned int e;
+
+    if(++i >= HIST_BUCKETS)
+        return UINT64_MAX;
+    if(i < HIST_SUB)
+        return i;
+    e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    return (uint64_t) (HIST_SUB + i % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+static uint64_t hist_quantile(const BenchStats *st, double q)
+{
+    uint64_t seen = 0, want = (uint64_t) (q * st->count);
+    unsigned int i;
+
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        seen += st->buckets[i];
+        if(seen > want)
+            return hist_upper(i) - 1 < st->max ? hist_upper(i) - 1 : st->max;
+    }
+    return st->max;
+}
+
+static int bench_connect(void)
+{
+    struct sockaddr_un s;
+    struct timeval tv = { BENCH_TIMEOUT_S, 0 };
+    int fd;
+
+    memset(&s, 0, sizeof(s));
+    s.sun_family = AF_UNIX;
+    snprintf(s.sun_path, sizeof(s.sun_path), "%s", sockpath);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if(connect(fd, (struct sockaddr *) &s, sizeof(s)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+/* Text mode: one connection, one command; the reply runs to EOF. Caller frees. */
+static char *bench_text_request(const char *req)
+{
+    size_t len = 0, size = 4096;
+    char *buf;
+    ssize_t n = 0;
+    int fd;
+
+    if((fd = bench_connect()) < 0)
+        return NULL;
+    if(send_cmd(fd, req) <= 0 || !(buf = malloc(size))) {
+        close(fd);
+        return NULL;
+    }
+    for(;;) {
+        if(len + 1 == size) {
+            char *p = realloc(buf, size *= 2);
+            if(!p) {
+                n = -1;
+                break;
+            }
+            buf = p;
+        }
+        n = read(fd, buf + len, size - len - 1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        len += n;
+    }
+    close(fd);
+    if(n < 0 || len == 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+static char *bench_framed_request(BenchClient *c, const char *req)
+{
+    uint32_t id = ++c->next_id, got;
+    char *resp;
+
+    if(c->fd < 0) {
+        if((c->fd = bench_connect()) < 0)
+            return NULL;
+        if(write(c->fd, FRAME_MAGIC, FRAME_MAGIC_LEN) != FRAME_MAGIC_LEN) {
+            close(c->fd);
+            c->fd = -1;
+            return NULL;
+        }
+    }
+    if(send_frame(c->fd, id, req) < 0 || !(resp = recv_frame(c->fd, &got)) || got != id) {
+        /* Start over on a fresh connection next time. */
+        close(c->fd);
+        c->fd = -1;
+        return NULL;
+    }
+    return resp;
+}
+
+static BenchOp bench_pick(BenchClient *c)
+{
+    int r = rand_r(&c->seed) % weight_total;
+    int op;
+
+    for(op = 0; op < OPS - 1; op++) {
+        if((r -= weights[op]) < 0)
+            break;
+    }
+    return (BenchOp) op;
+}
+
+static void bench_build(BenchClient *c, BenchOp op, char *req, size_t size)
+{
+    switch(op) {
+        case OP_LIST:
+            snprintf(req, size, "%d", COMMAND_LIST);
+            break;
+        case OP_INSERT:
+            snprintf(req, size, "%d %s;0", COMMAND_INSERT, uri);
+            break;
+        case OP_REMOVE:
+            if(c->nids > 0)
+                snprintf(req, size, "%d %llu", COMMAND_REMOVE_ID, c->ids[--c->nids]);
+            else
+                snprintf(req, size, "%d 1", COMMAND_REMOVE);
+            break;
+        case OP_STATUS:
+            snprintf(req, size, "%d", COMMAND_STATUS);
+            break;
+        default:
+            snprintf(req, size, "%d", COMMAND_NEXT);
+            break;
+    }
+}
+
+static void bench_record(BenchStats *st, int64_t ns)
+{
+    uint64_t v = ns > 0 ? (uint64_t) ns : 0;
+
+    st->count++;
+    st->buckets[hist_bucket(v)]++;
+    if(v > st->max)
+        st->max = v;
+}
+
+static void *bench_client(void *data)
+{
+    BenchClient *c = data;
+    char req[PATH_MAX + 64];
+    double interval = rate > 0 ? clients * 1e9 / rate : 0;
+    /* Stagger the clients over one interval. */
+    int64_t due = bench_start + (int64_t) (interval * c->index / clients);
+    struct timespec ts;
+
+    while(due < bench_end) {
+        BenchOp op = bench_pick(c);
+        BenchStats *st = &c->stats[op];
+        char *resp, *p;
+        int64_t sent;
+
+        if(interval > 0) {
+            ts.tv_sec = due / 1000000000;
+            ts.tv_nsec = due % 1000000000;
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+            sent = due;
+            due += (int64_t) interval;
+        } else {
+            sent = now_ns();
+            if(sent >= bench_end)
+                break;
+        }
+
+        bench_build(c, op, req, sizeof(req));
+        resp = framed ? bench_framed_request(c, req) : bench_text_request(req);
+        bench_record(st, now_ns() - sent);
+
+        if(!resp) {
+            st->failures++;
+        } else if(*resp != COMMAND_OK) {
+            st->errors++;
+        } else if(op == OP_INSERT && (p = strstr(resp, "ID: ")) && c->nids < BENCH_IDS) {
+            c->ids[c->nids++] = strtoull(p + 4, NULL, 10);
+        }
+        free(resp);
+    }
+
+    if(c->fd >= 0)
+        close(c->fd);
+    return NULL;
+}
+
+/* "list=25,insert=15,..." Returns -1 on an unknown command or a zero total. */
+static int bench_parse_mix(const char *mix)
+{
+    char buf[256], *tok, *save = NULL, *eq;
+    int op, w[OPS] = { 0 }, total = 0;
+
+    snprintf(buf, sizeof(buf), "%s", mix);
+    for(tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if(!(eq = strchr(tok, '=')))
+            return -1;
+        *eq = '\0';
+        for(op = 0; op < OPS && strcmp(tok, op_names[op]); op++)
+            ;
+        if(op == OPS || atoi(eq + 1) < 0)
+            return -1;
+        w[op] = atoi(eq + 1);
+    }
+    for(op = 0; op < OPS; op++)
+        total += w[op];
+    if(total == 0)
+        return -1;
+
+    memcpy(weights, w, sizeof(weights));
+    weight_total = total;
+    return 0;
+}
+
+static void bench_print_stats(const char *indent, const char *name, const BenchStats *st, double elapsed, int last)
+{
+    printf("%s\"%s\": {\"count\": %llu, \"errors\": %llu, \"failures\": %llu, \"throughput\": %.1f, "
+            "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}%s\n",
+            indent, name, (unsigned long long) st->count, (unsigned long long) st->errors,
+            (unsigned long long) st->failures, st->count / elapsed,
+            hist_quantile(st, 0.50) / 1e3, hist_quantile(st, 0.99) / 1e3,
+            hist_quantile(st, 0.999) / 1e3, st->max / 1e3, last ? "" : ",");
+}
+
+static void show_help(const char *progname)
+{
+    fprintf(stdout, "use: %s OPTIONS\n"
+            "OPTIONS:\n"
+            "\t--clients,  -c N         Concurrent clients (default 4)\n"
+            "\t--rate,     -r N         Target requests per second, all clients together\n"
+            "\t                         (default 1000, 0: as fast as replies come)\n"
+            "\t--time,     -t SECONDS   Length of the run (default 10)\n"
+            "\t--mix,      -m MIX       Command weights (default\n"
+            "\t                         list=25,insert=15,remove=15,status=40,next=5)\n"
+            "\t--uri,      -u URI       What INSERT queues (default /dev/null)\n"
+            "\t--framed,   -F           One framed connection per client instead of\n"
+            "\t                         one text connection per request\n"
+            "\t--socket,   -s PATH      Server socket (default " UNIX_PATH ")\n"
+            "\t--help,     -h           this help\n", progname);
+
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+    BenchClient *cs;
+    BenchStats total;
+    double elapsed;
+    int c, i, op;
+    const char *opts = "c:r:t:m:u:Fs:h";
+    const struct option optl[] = {
+        { "clients",  1, 0, 'c' },
+        { "rate",     1, 0, 'r' },
+        { "time",     1, 0, 't' },
+        { "mix",      1, 0, 'm' },
+        { "uri",      1, 0, 'u' },
+        { "framed",   0, 0, 'F' },
+        { "socket",   1, 0, 's' },
+        { "help",     0, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    while((c = getopt_long(argc, argv, opts, optl, NULL)) != -1) {
+        switch(c) {
+            case 'c':
+                clients = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'm':
+                if(bench_parse_mix(optarg) < 0) {
+                    fprintf(stderr, "Invalid --mix: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                snprintf(uri, sizeof(uri), "%s", optarg);
+                break;
+            case 'F':
+                framed = 1;
+                break;
+            case 's':
+                snprintf(sockpath, sizeof(sockpath), "%s", optarg);
+                break;
+            default:
+                show_help(argv[0]);
+        }
+    }
+    if(clients <= 0 || rate < 0 || duration <= 0)
+        show_help(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+    if(!(cs = calloc(clients, sizeof(BenchClient)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    bench_start = now_ns() + 10000000;      /* let every thread start first */
+    bench_end = bench_start + (int64_t) (duration * 1e9);
+    for(i = 0; i < clients; i++) {
+        cs[i].index = i;
+        cs[i].fd = -1;
+        cs[i].seed = (unsigned int) (bench_start + i);
+        if(pthread_create(&cs[i].thread, NULL, bench_client, &cs[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(i = 0; i < clients; i++)
+        pthread_join(cs[i].thread, NULL);
+    elapsed = (now_ns() - bench_start) / 1e9;
+
+    printf("{\n  \"clients\": %d, \"rate\": %.1f, \"duration\": %.3f, \"mode\": \"%s\",\n  \"commands\": {\n",
+            clients, rate, elapsed, framed ? "framed" : "text");
+    memset(&total, 0, sizeof(total));
+    for(op = 0; op < OPS; op++) {
+        BenchStats sum;
+        unsigned int b;
+
+        memset(&sum, 0, sizeof(sum));
+        for(i = 0; i < clients; i++) {
+            const BenchStats *st = &cs[i].stats[op];
+
+            sum.count += st->count;
+            sum.errors += st->errors;
+            sum.failures += st->failures;
+            if(st->max > sum.max) sum.max = st->max;
+            for(b = 0; b < HIST_BUCKETS; b++)
+                sum.buckets[b] += st->buckets[b];
+        }
+        bench_print_stats("    ", op_names[op], &sum, elapsed, op == OPS - 1);
+
+        total.count += sum.count;
+        total.errors += sum.errors;
+        total.failures += sum.failures;
+        if(sum.max > total.max) total.max = sum.max;
+        for(b = 0; b < HIST_BUCKETS; b++)
+            total.buckets[b] += sum.buckets[b];
+    }
+    printf("  },\n");
+    bench_print_stats("  ", "total", &total, elapsed, 1);
+    printf("}\n");
+
+    free(cs);
+    return total.failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
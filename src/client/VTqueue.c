@@ -9,30 +9,48 @@
 
 #include "VTqueue.h"
 #include <sys/time.h>
+#include <time.h>
 #include <limits.h>
 
 static int debug = 0;
+static int use_shm = 0;
 
 static void VT_command_init(VTCommand *cmd)
 {
     if(!cmd) return;
     memset(cmd, 0, sizeof(VTCommand));
     cmd->idx = -1;
+    cmd->interval = -1;
 }
 
 static int VT_build_command_string(VTCommand *cmd, char *buf, int size)
 {
+    int n;
+
     if(!cmd || !buf || !size) return -1;
 
     memset(buf, 0, size);
     switch(cmd->cmd) {
         case ADD_CMD:
-            snprintf(buf, size, "%d %s;%d", 
-                    COMMAND_INSERT, cmd->uri, cmd->idx);
+            if(cmd->has_after)
+                n = snprintf(buf, size, "%d %s;%llu",
+                        COMMAND_INSERT_AFTER, cmd->uri, cmd->after);
+            else
+                n = snprintf(buf, size, "%d %s;%d", 
+                        COMMAND_INSERT, cmd->uri, cmd->idx);
+            /* In and out points follow the position; the server parses them. */
+            if((*cmd->in || *cmd->out) && n > 0 && n < size)
+                snprintf(buf + n, size - n, ";%s;%s", cmd->in, cmd->out);
             break;
         case REM_CMD:
             snprintf(buf, size, "%d %d", COMMAND_REMOVE, cmd->idx);
             break;
+        case REM_ID_CMD:
+            snprintf(buf, size, "%d %llu", COMMAND_REMOVE_ID, cmd->id);
+            break;
+        case MOVE_CMD:
+            snprintf(buf, size, "%d %llu;%llu", COMMAND_MOVE_ID, cmd->id, cmd->after);
+            break;
         case LIST_CMD:
             snprintf(buf, size, "%d", COMMAND_LIST);
             break;
@@ -48,24 +66,123 @@ static int VT_build_command_string(VTCommand *cmd, char *buf, int size)
         case RESUME_CMD:
             snprintf(buf, size, "%d", COMMAND_PLAY); /* Re-use Play to Resume */
             break;
+        case LIMITS_CMD:
+            snprintf(buf, size, "%d", COMMAND_LIMITS);
+            break;
+        case STATS_CMD:
+            snprintf(buf, size, "%d", COMMAND_STATS);
+            break;
+        case LOG_LEVEL_CMD:
+            if(*cmd->uri)
+                snprintf(buf, size, "%d %s", COMMAND_LOG_LEVEL, cmd->uri);
+            else
+                snprintf(buf, size, "%d", COMMAND_LOG_LEVEL);
+            break;
+        case GRAPHICS_CMD:
+            if(*cmd->uri)
+                snprintf(buf, size, "%d %s", COMMAND_GRAPHICS, cmd->uri);
+            else
+                snprintf(buf, size, "%d", COMMAND_GRAPHICS);
+            break;
+        case SEEK_CMD:
+            snprintf(buf, size, "%d %s;%s", COMMAND_SEEK, cmd->uri, cmd->accurate ? "accurate" : "key");
+            break;
+        case RATE_CMD:
+            snprintf(buf, size, "%d %s", COMMAND_RATE, cmd->uri);
+            break;
+        case WATCH_CMD:
+            if(cmd->interval >= 0)
+                snprintf(buf, size, "%d %s;%d", COMMAND_SUBSCRIBE, cmd->uri, cmd->interval);
+            else
+                snprintf(buf, size, "%d %s", COMMAND_SUBSCRIBE, cmd->uri);
+            break;
+        case STREAM_CMD:
+        case ADD_FROM_CMD:
+            return -1; /* Sent in framed mode, see VT_stream_commands()/VT_add_from_file() */
     }
 
     return 0;
 }
 
-static int VT_send_command(VTCommand *cmd)
+/* 
+ * Robust Path Resolution & Validation:
+ * 1. Resolve relative paths to absolute to ensure daemon can find file.
+ * 2. Validate length to prevent silent truncation.
+ * Returns 0 on success, -1 (after printing why) on failure.
+ */
+static int VT_resolve_uri(const char *arg, char *uri, size_t size)
 {
-    int r;
-    /* Expanded buffer to handle full path length + IPC overhead */
-    char buffer[PATH_MAX + 128];
-    FILE *fp;
-    int fd;
-    char *p;
-    struct sockaddr_un s;
+    if (strstr(arg, "://")) {
+        /* It's already a URI (e.g. http://), use as is */
+        if (strlen(arg) >= size) {
+            fprintf(stderr, "Error: URI too long (max %zu bytes).\n", size - 1);
+            return -1;
+        }
+        snprintf(uri, size, "%s", arg);
+    } else {
+        /* Local file path - resolve absolute path */
+        char resolved_path[PATH_MAX];
+        if (realpath(arg, resolved_path) == NULL) {
+            perror(arg);
+            return -1;
+        }
+        if (strlen(resolved_path) >= size) {
+            fprintf(stderr, "Error: Resolved path too long (max %zu bytes).\n", size - 1);
+            return -1;
+        }
+        snprintf(uri, size, "%s", resolved_path);
+    }
 
-    r = VT_build_command_string(cmd, buffer, sizeof(buffer));
-    if(r < 0)
+    return 0;
+}
+
+/*
+ * Copies a --graphics spec, resolving the image path of a bug or a
+ * standby slate to an absolute one since the daemon opens it from its
+ * own working directory.
+ * Returns 0 on success, -1 (after printing why) on failure.
+ */
+static int VT_graphics_spec(const char *arg, char *spec, size_t size)
+{
+    char path[PATH_MAX], resolved_path[PATH_MAX];
+    const char *start = NULL, *end;
+
+    /* The path is the 1st field of "bug;", the 2nd of "standby;". */
+    if(strncmp(arg, "bug;", 4) == 0)
+        start = arg + 4;
+    else if(strncmp(arg, "standby;", 8) == 0 && (start = strchr(arg + 8, ';')) != NULL)
+        start++;
+
+    if(!start || *start == '\0' || *start == ';') {
+        if(strlen(arg) >= size) {
+            fprintf(stderr, "Error: graphics spec too long (max %zu bytes).\n", size - 1);
+            return -1;
+        }
+        snprintf(spec, size, "%s", arg);
+        return 0;
+    }
+
+    end = strchr(start, ';');
+    snprintf(path, sizeof(path), "%.*s", end ? (int) (end - start) : (int) strlen(start), start);
+    if(realpath(path, resolved_path) == NULL) {
+        perror(path);
+        return -1;
+    }
+    if((size_t) (start - arg) + strlen(resolved_path) + (end ? strlen(end) : 0) >= size) {
+        fprintf(stderr, "Error: graphics spec too long (max %zu bytes).\n", size - 1);
         return -1;
+    }
+    snprintf(spec, size, "%.*s%s%s", (int) (start - arg), arg, resolved_path, end ? end : "");
+    return 0;
+}
+
+/* Number of framed requests kept in flight by --stream. */
+#define STREAM_WINDOW 64
+
+static int VT_connect(int timeout_sec)
+{
+    int fd;
+    struct sockaddr_un s;
 
     s.sun_family = AF_UNIX;
     snprintf(s.sun_path, sizeof(s.sun_path), UNIX_PATH);
@@ -86,13 +203,31 @@ static int VT_send_command(VTCommand *cmd)
      * deadlocks with stdio buffering.
      */
     struct timeval tv;
-    tv.tv_sec = 1;
+    tv.tv_sec = timeout_sec;
     tv.tv_usec = 0;
     if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv) < 0) {
         perror("setsockopt");
         /* Continue even if timeout setup fails, though behavior may block. */
     }
 
+    return fd;
+}
+
+static int VT_send_command(VTCommand *cmd)
+{
+    int r;
+    /* Expanded buffer to handle full path length + IPC overhead */
+    char buffer[PATH_MAX + 128];
+    FILE *fp;
+    int fd;
+    char *p;
+
+    r = VT_build_command_string(cmd, buffer, sizeof(buffer));
+    if(r < 0)
+        return -1;
+
+    fd = VT_connect(1);
+
     if(send_cmd(fd, buffer) <= 0)
         fprintf(stderr, "error sending command\n");
 
@@ -117,6 +252,279 @@ static int VT_send_command(VTCommand *cmd)
     return 0;
 }
 
+/*
+ * Subscribes to server events and prints them, one per line, until the
+ * server goes away. Returns -1 if the subscription is refused.
+ */
+static int VT_watch(VTCommand *cmd)
+{
+    char buffer[PATH_MAX + 128];
+    char line[MAX_RESULT_LINE_LEN];
+    int ok, fd;
+    FILE *fp;
+
+    if(VT_build_command_string(cmd, buffer, sizeof(buffer)) < 0)
+        return -1;
+
+    /* No receive timeout: events arrive whenever something happens. */
+    fd = VT_connect(0);
+    if(send_cmd(fd, buffer) <= 0) {
+        fprintf(stderr, "error sending command\n");
+        close(fd);
+        return -1;
+    }
+    if(!(fp = fdopen(fd, "r"))) {
+        perror("fdopen");
+        close(fd);
+        return -1;
+    }
+
+    /* The reply first, then the event stream. */
+    if(!fgets(line, sizeof(line), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    ok = (*line == COMMAND_OK);
+    while(fgets(line, sizeof(line), fp) && *line != COMMAND_DELIM)
+        fputs(line, stderr);
+    if(!ok) {
+        fclose(fp);
+        return -1;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    while(fgets(line, sizeof(line), fp))
+        printf("%s", line);
+
+    fclose(fp);
+    return 0;
+}
+
+/*
+ * --status --shm: reads the server's shared-memory status page instead
+ * of asking over the socket. Same first lines as STATUS.
+ */
+static int VT_status_shm(void)
+{
+    VTStatusBody st;
+    struct timespec t0, t1;
+    long long pos, dur;
+
+    if(status_page_attach() < 0) {
+        perror(STATUS_PAGE_NAME);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(status_page_read(&st) < 0) {
+        perror(STATUS_PAGE_NAME);
+        status_page_detach();
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    pos = st.position > 0 ? st.position / 1000000000LL : 0;
+    dur = st.duration > 0 ? st.duration / 1000000000LL : 0;
+    printf("Status: %s\n", status_page_state_name(st.state));
+    if(*st.uri) {
+        printf("File: %s\n", st.uri);
+        printf("Progress: %02lld:%02lld / %02lld:%02lld\n", pos / 60, pos % 60, dur / 60, dur % 60);
+        printf("Item: %llu\n", (unsigned long long) st.item_id);
+    } else {
+        printf("File: None\n");
+    }
+    printf("Queue: %lld items\n", (long long) st.queue_length);
+    printf("Played: %lld items (%lld gapless), %lld errors\n",
+            (long long) st.items_played, (long long) st.gapless, (long long) st.errors);
+    if(debug)
+        fprintf(stderr, "Page of pid %d, read in %ld ns\n", status_page_pid(),
+                (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
+
+    status_page_detach();
+    return 0;
+}
+
+/* Prints a framed response, each line tagged with its request ID. */
+static void VT_print_tagged(uint32_t id, char *resp)
+{
+    char *line, *save = NULL;
+
+    for(line = strtok_r(resp, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if(*line == COMMAND_DELIM)
+            break;
+        printf("%u\t%s\n", id, line);
+    }
+}
+
+/*
+ * Reads raw protocol commands (e.g. "2 /path/video.mp4;0"), one per
+ * line, and pipelines them over a single framed connection, keeping up
+ * to STREAM_WINDOW requests in flight.
+ */
+static int VT_stream_commands(FILE *in)
+{
+    char line[PATH_MAX + 128];
+    uint32_t next_id = 1, id;
+    unsigned int outstanding = 0;
+    int eof = 0, rc = 0;
+    char *resp;
+    int fd;
+
+    fd = VT_connect(5);
+
+    if(write(fd, FRAME_MAGIC, FRAME_MAGIC_LEN) != FRAME_MAGIC_LEN) {
+        perror("write");
+        close(fd);
+        return -1;
+    }
+
+    while(!eof || outstanding > 0) {
+        if(!eof && outstanding < STREAM_WINDOW) {
+            if(!fgets(line, sizeof(line), in)) {
+                eof = 1;
+                continue;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+            if(*line == '\0')
+                continue;
+
+            if(debug)
+                fprintf(stderr, "-> %u %s\n", next_id, line);
+            if(send_frame(fd, next_id++, line) < 0) {
+                fprintf(stderr, "error sending command\n");
+                rc = -1;
+                break;
+            }
+            outstanding++;
+            continue;
+        }
+
+        if(!(resp = recv_frame(fd, &id))) {
+            fprintf(stderr, "error reading response\n");
+            rc = -1;
+            break;
+        }
+        VT_print_tagged(id, resp);
+        free(resp);
+        outstanding--;
+    }
+
+    shutdown(fd, 2);
+    close(fd);
+
+    return rc;
+}
+
+/*
+ * Loads a schedule file (one path or URI per line, optionally followed
+ * by ";IN;OUT", '#' comments and blank lines ignored) and inserts it
+ * with a single COMMAND_INSERT_BULK request over a framed connection.
+ */
+static int VT_add_from_file(const char *path, int pos)
+{
+    char line[PATH_MAX + 2], uri[PATH_MAX];
+    size_t len = 0, cap = 4096;
+    unsigned int lineno = 0, count = 0;
+    char *payload, *resp, *p, *save = NULL, *trim;
+    FILE *in;
+    int fd, rc = 0;
+
+    if(!strcmp(path, "-"))
+        in = stdin;
+    else if(!(in = fopen(path, "r"))) {
+        perror(path);
+        return -1;
+    }
+
+    if(!(payload = malloc(cap))) {
+        perror("malloc");
+        exit(1);
+    }
+    len = snprintf(payload, cap, "%d %d\n", COMMAND_INSERT_BULK, pos > 0 ? pos : 0);
+
+    while(fgets(line, sizeof(line), in)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if(*line == '\0' || *line == '#')
+            continue;
+
+        /* PATH;IN;OUT: only the path is resolved, the server checks the points. */
+        trim = NULL;
+        if(!strstr(line, "://") && access(line, F_OK) != 0 && (p = strrchr(line, ';'))) {
+            *p = '\0';
+            trim = strrchr(line, ';');
+            *p = ';';
+            if(trim)
+                *trim++ = '\0';
+        }
+
+        if(VT_resolve_uri(line, uri, sizeof(uri)) < 0 ||
+                (trim && strlen(uri) + strlen(trim) + 1 >= sizeof(uri))) {
+            fprintf(stderr, "%s:%u: invalid entry, nothing was sent.\n", path, lineno);
+            rc = -1;
+            break;
+        }
+        if(trim) {
+            strcat(uri, ";");
+            strcat(uri, trim);
+        }
+
+        size_t n = strlen(uri);
+        while(len + n + 2 > cap) {
+            cap *= 2;
+            if(!(payload = realloc(payload, cap))) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        memcpy(payload + len, uri, n);
+        len += n;
+        payload[len++] = '\n';
+        payload[len] = '\0';
+        count++;
+    }
+
+    if(in != stdin)
+        fclose(in);
+
+    if(rc == 0 && count == 0) {
+        fprintf(stderr, "%s: no entries to add.\n", path);
+        rc = -1;
+    }
+    if(rc == 0 && len > MAX_FRAME_LEN) {
+        fprintf(stderr, "%s: schedule too large for one request.\n", path);
+        rc = -1;
+    }
+    if(rc < 0) {
+        free(payload);
+        return rc;
+    }
+
+    fd = VT_connect(5);
+    if(write(fd, FRAME_MAGIC, FRAME_MAGIC_LEN) != FRAME_MAGIC_LEN ||
+            send_frame(fd, 1, payload) < 0) {
+        fprintf(stderr, "error sending command\n");
+        rc = -1;
+    } else if(!(resp = recv_frame(fd, NULL))) {
+        fprintf(stderr, "error reading response\n");
+        rc = -1;
+    } else {
+        for(p = strtok_r(resp, "\n", &save); p; p = strtok_r(NULL, "\n", &save)) {
+            if(*p == COMMAND_DELIM)
+                break;
+            printf("%s\n", p);
+        }
+        if(*resp != COMMAND_OK)
+            rc = -1;
+        free(resp);
+    }
+
+    free(payload);
+    shutdown(fd, 2);
+    close(fd);
+
+    return rc;
+}
+
 /* 
  * Moved from nested function in main() to file scope for C99 compliance.
  */
@@ -124,13 +532,49 @@ static void show_help(const char *progname) {
     fprintf(stdout, "use: %s OPTIONS\n"
             "OPTIONS:\n"
             "\t--add,      -a URI       Add URI to server's play queue\n"
+            "\t--add-from, -A FILE      Add every path/URI listed in FILE (- for stdin)\n"
+            "\t                         in one batch request\n"
             "\t--remove,   -r IDX       Remove IDX from server's play queue\n"
             "\t--position, -p IDX       Queue's index to remove or add the URI into\n"
+            "\t--in,       -b TIME      With --add, start playing the URI at TIME\n"
+            "\t--out,      -e TIME      With --add, stop playing the URI at TIME\n"
+            "\t                         (seconds, MM:SS or HH:MM:SS[.FRAC])\n"
+            "\t--remove-id, -D ID       Remove the item with ID from the play queue\n"
+            "\t--move,     -m ID        Move the item with ID (see --after)\n"
+            "\t--after,    -f ID        Add or move right after the item with ID\n"
+            "\t                         (0 for the head of the queue)\n"
             "\t--list,     -l           list URIs on the server's queue\n"
             "\t--status,   -s           Show current playback status and progress\n"
+            "\t--shm,      -M           With --status, read the server's shared-memory\n"
+            "\t                         status page instead of asking over the socket\n"
             "\t--pause,    -P           Pause playback\n"
             "\t--resume,   -R           Resume playback\n"
             "\t--stop,     -S           Stop playback\n"
+            "\t--limits,   -L           Show queue item/memory limits and usage\n"
+            "\t--stats,    -t           Show server counters and latency percentiles\n"
+            "\t--watch[=CLASSES], -w[CLASSES]\n"
+            "\t                         Print server events as they happen; CLASSES is a\n"
+            "\t                         comma-separated subset of state, item, queue,\n"
+            "\t                         error, progress (default all)\n"
+            "\t--interval, -i MS        Progress event interval for --watch (0: none)\n"
+            "\t--log-level[=LEVEL], -V[LEVEL]\n"
+            "\t                         Show or set the server's log level\n"
+            "\t                         (error, warning, info, debug)\n"
+            "\t--graphics[=LAYER;ARGS], -g[LAYER;ARGS]\n"
+            "\t                         Set an on-air graphics layer, or show them all:\n"
+            "\t                         watermark;TEXT  bug;PNG;CORNER  clock;FORMAT;CORNER\n"
+            "\t                         lower;TITLE;SUBTITLE;SECONDS  ticker;TEXT;PX_PER_S\n"
+            "\t                         (CORNER: tl, tr, bl, br; a bare LAYER takes it off)\n"
+            "\t                         standby;TEXT;PNG;START sets the standby card, with\n"
+            "\t                         a countdown to START (unix time, or +SECONDS)\n"
+            "\t--seek,     -k TIME      Seek within the video on air; TIME is seconds,\n"
+            "\t                         MM:SS or HH:MM:SS[.FRAC], +/- for relative\n"
+            "\t--accurate, -c           With --seek, land on the exact frame instead of\n"
+            "\t                         the nearest keyframe\n"
+            "\t--rate,     -z RATE      Set the playback rate of the video on air\n"
+            "\t                         (2 fast, 0.5 slow, -1 reverse; 1 is normal)\n"
+            "\t--stream,   -x           Pipeline raw protocol commands from stdin\n"
+            "\t                         over one persistent framed connection\n"
             "\t--debug,    -d           run de debug mode\n"
             "\t--help,     -h           this help\n", progname);
 
@@ -141,16 +585,33 @@ int main(int argc, char **argv)
 {
     VTCommand cmd;
     int c, optind = 0;
-    const char *opts = "a:r:p:lsPRSdh";
+    const char *opts = "a:A:r:p:b:e:D:m:f:lsMPRSLtV::w::i:g::k:cz:xdh";
     const struct option optl[] = {
         { "add",      1, 0, 'a' },
+        { "add-from", 1, 0, 'A' },
         { "remove",   1, 0, 'r' },
         { "position", 1, 0, 'p' },
+        { "in",       1, 0, 'b' },
+        { "out",      1, 0, 'e' },
+        { "remove-id", 1, 0, 'D' },
+        { "move",     1, 0, 'm' },
+        { "after",    1, 0, 'f' },
         { "list",     0, 0, 'l' },
         { "status",   0, 0, 's' },
+        { "shm",      0, 0, 'M' },
         { "pause",    0, 0, 'P' },
         { "resume",   0, 0, 'R' },
         { "stop",     0, 0, 'S' },
+        { "limits",   0, 0, 'L' },
+        { "stats",    0, 0, 't' },
+        { "log-level", 2, 0, 'V' },
+        { "watch",    2, 0, 'w' },
+        { "interval", 1, 0, 'i' },
+        { "graphics", 2, 0, 'g' },
+        { "seek",     1, 0, 'k' },
+        { "accurate", 0, 0, 'c' },
+        { "rate",     1, 0, 'z' },
+        { "stream",   0, 0, 'x' },
         { "debug",    0, 0, 'd' },
         { "help",     0, 0, 'h' },
         { 0, 0, 0, 0 }
@@ -164,31 +625,14 @@ int main(int argc, char **argv)
                 if(optarg == NULL)
                     show_help(argv[0]);
 
-                /* 
-                 * Robust Path Resolution & Validation:
-                 * 1. Resolve relative paths to absolute to ensure daemon can find file.
-                 * 2. Validate length to prevent silent truncation.
-                 */
-                if (strstr(optarg, "://")) {
-                    /* It's already a URI (e.g. http://), use as is */
-                    if (strlen(optarg) >= sizeof(cmd.uri)) {
-                        fprintf(stderr, "Error: URI too long (max %zu bytes).\n", sizeof(cmd.uri) - 1);
-                        exit(EXIT_FAILURE);
-                    }
-                    snprintf(cmd.uri, sizeof(cmd.uri), "%s", optarg);
-                } else {
-                    /* Local file path - resolve absolute path */
-                    char resolved_path[PATH_MAX];
-                    if (realpath(optarg, resolved_path) == NULL) {
-                        perror("realpath");
-                        exit(EXIT_FAILURE);
-                    }
-                    if (strlen(resolved_path) >= sizeof(cmd.uri)) {
-                        fprintf(stderr, "Error: Resolved path too long (max %zu bytes).\n", sizeof(cmd.uri) - 1);
-                        exit(EXIT_FAILURE);
-                    }
-                    snprintf(cmd.uri, sizeof(cmd.uri), "%s", resolved_path);
-                }
+                if(VT_resolve_uri(optarg, cmd.uri, sizeof(cmd.uri)) < 0)
+                    exit(EXIT_FAILURE);
+                break;
+            case 'A':
+                cmd.cmd = ADD_FROM_CMD;
+                if(optarg == NULL)
+                    show_help(argv[0]);
+                snprintf(cmd.uri, sizeof(cmd.uri), "%s", optarg);
                 break;
             case 'r':
                 cmd.cmd = REM_CMD;
@@ -201,12 +645,33 @@ int main(int argc, char **argv)
                     show_help(argv[0]);
                 cmd.idx = atol(optarg);
                 break;
+            case 'b':
+                snprintf(cmd.in, sizeof(cmd.in), "%s", optarg);
+                break;
+            case 'e':
+                snprintf(cmd.out, sizeof(cmd.out), "%s", optarg);
+                break;
+            case 'D':
+                cmd.cmd = REM_ID_CMD;
+                cmd.id = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                cmd.cmd = MOVE_CMD;
+                cmd.id = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                cmd.after = strtoull(optarg, NULL, 10);
+                cmd.has_after = 1;
+                break;
             case 'l':
                 cmd.cmd = LIST_CMD;
                 break;
             case 's':
                 cmd.cmd = STATUS_CMD;
                 break;
+            case 'M':
+                use_shm = 1;
+                break;
             case 'P':
                 cmd.cmd = PAUSE_CMD;
                 break;
@@ -216,6 +681,44 @@ int main(int argc, char **argv)
             case 'R':
                 cmd.cmd = RESUME_CMD;
                 break;
+            case 'L':
+                cmd.cmd = LIMITS_CMD;
+                break;
+            case 't':
+                cmd.cmd = STATS_CMD;
+                break;
+            case 'V':
+                cmd.cmd = LOG_LEVEL_CMD;
+                if(optarg)
+                    snprintf(cmd.uri, sizeof(cmd.uri), "%s", optarg);
+                break;
+            case 'w':
+                cmd.cmd = WATCH_CMD;
+                if(optarg)
+                    snprintf(cmd.uri, sizeof(cmd.uri), "%s", optarg);
+                break;
+            case 'i':
+                cmd.interval = atoi(optarg);
+                break;
+            case 'g':
+                cmd.cmd = GRAPHICS_CMD;
+                if(optarg && VT_graphics_spec(optarg, cmd.uri, sizeof(cmd.uri)) < 0)
+                    exit(EXIT_FAILURE);
+                break;
+            case 'k':
+                cmd.cmd = SEEK_CMD;
+                snprintf(cmd.uri, sizeof(cmd.uri), "%s", optarg);
+                break;
+            case 'c':
+                cmd.accurate = 1;
+                break;
+            case 'z':
+                cmd.cmd = RATE_CMD;
+                snprintf(cmd.uri, sizeof(cmd.uri), "%s", optarg);
+                break;
+            case 'x':
+                cmd.cmd = STREAM_CMD;
+                break;
             case 'd':
                 debug = 1;
                 break;
@@ -228,11 +731,21 @@ int main(int argc, char **argv)
     }
 
     /* Validation: ADD commands only require a URI (default idx is -1).
-       REM commands require a valid position index. */
+       REM commands require a valid position index, ID commands an ID. */
     if((cmd.cmd == ADD_CMD && strlen(cmd.uri) < 2) || 
-            (cmd.cmd == REM_CMD && cmd.idx <= 0))
+            (cmd.cmd == REM_CMD && cmd.idx <= 0) ||
+            ((cmd.cmd == REM_ID_CMD || cmd.cmd == MOVE_CMD) && cmd.id == 0))
         show_help(argv[0]);
 
+    if(cmd.cmd == ADD_FROM_CMD)
+        return VT_add_from_file(cmd.uri, cmd.idx) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if(cmd.cmd == STREAM_CMD)
+        return VT_stream_commands(stdin) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if(cmd.cmd == WATCH_CMD)
+        return VT_watch(&cmd) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if(cmd.cmd == STATUS_CMD && use_shm)
+        return VT_status_shm() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
     VT_send_command(&cmd);
     return EXIT_SUCCESS;
 }
@@ -13,8 +13,12 @@
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <limits.h>
+#include <errno.h>
+#include <stdint.h>
+#include <arpa/inet.h>
 
 #include "config.h"
+#include "statuspage.h"
 
 typedef enum {
     ADD_CMD = 0,
@@ -23,16 +27,45 @@ typedef enum {
     STATUS_CMD,
     PAUSE_CMD,
     STOP_CMD,
-    RESUME_CMD
+    RESUME_CMD,
+    STREAM_CMD,
+    ADD_FROM_CMD,
+    LIMITS_CMD,
+    REM_ID_CMD,
+    MOVE_CMD,
+    LOG_LEVEL_CMD,
+    WATCH_CMD,
+    STATS_CMD,
+    GRAPHICS_CMD,
+    SEEK_CMD,
+    RATE_CMD
 } VTCommandType;
 
 typedef struct {
     VTCommandType cmd;
-    char          uri[PATH_MAX];
+    char          uri[PATH_MAX];     /* also the level for --log-level, the classes for --watch,
+                                    the layer spec for --graphics, the time for --seek,
+                                    the rate for --rate */
     int           idx;
+    unsigned long long id;      /* item ID for --remove-id/--move */
+    unsigned long long after;   /* anchor item ID (0 = head) */
+    int           has_after;
+    int           interval;     /* --watch progress interval, ms (-1: server default) */
+    int           accurate;     /* --seek to the exact frame, not a keyframe */
+    char          in[32];       /* --add in and out points, as given (empty: none) */
+    char          out[32];
 } VTCommand;
 
 extern int send_cmd(int fd, const char *cmd);
 extern char *get_cmd_result(FILE *fp);
+extern int send_frame(int fd, uint32_t id, const char *payload);
+extern char *recv_frame(int fd, uint32_t *id);
+
+/* status.c: shared-memory status page reader */
+extern int status_page_attach(void);
+extern void status_page_detach(void);
+extern int status_page_read(VTStatusBody *out);
+extern int status_page_pid(void);
+extern const char *status_page_state_name(int64_t state);
 
 #endif
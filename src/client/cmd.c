@@ -11,8 +11,11 @@
 
 static char result_buf[MAX_RESULT_LINE_LEN];
 
+static int write_full(int fd, const void *buf, size_t len);
+
 /*
- * Sends a command to the server.
+ * Sends a command to the server, ended with a NUL byte so the server
+ * knows the request is complete however the socket splits it.
  * Returns:
  *  -1 on system/socket error
  *   1 on success (command sent)
@@ -25,8 +28,7 @@ int send_cmd(int fd, const char *cmd)
    	if (!cmd)
 	   	return -1;
 	
-    /* SECURITY FIX: Use %s to prevent format string attacks */
-	if (dprintf(fd, "%s", cmd) < 0)
+	if (write_full(fd, cmd, strlen(cmd) + 1) < 0)
 	   	return -1;
 	
     /*
@@ -57,3 +59,88 @@ char *get_cmd_result(FILE *fp)
 
     return result_buf;
 }
+
+/*
+ * Framed mode helpers.
+ * A frame is [u32 length][u32 request id][payload], big-endian.
+ */
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+/* Returns 1 on success, -1 on error. */
+int send_frame(int fd, uint32_t id, const char *payload)
+{
+    uint32_t hdr[2];
+    size_t len;
+
+    if (!payload)
+        return -1;
+
+    len = strlen(payload);
+    if (len > MAX_FRAME_LEN)
+        return -1;
+
+    hdr[0] = htonl((uint32_t) len);
+    hdr[1] = htonl(id);
+    if (write_full(fd, hdr, sizeof(hdr)) < 0 || write_full(fd, payload, len) < 0)
+        return -1;
+
+    return 1;
+}
+
+/* return
+ * a malloc'd, NUL-terminated response payload (caller frees)
+ * NULL on error or closed connection
+ */
+char *recv_frame(int fd, uint32_t *id)
+{
+    uint32_t hdr[2];
+    uint32_t len;
+    char *payload;
+
+    if (read_full(fd, hdr, sizeof(hdr)) < 0)
+        return NULL;
+
+    len = ntohl(hdr[0]);
+    if (len > MAX_FRAME_LEN)
+        return NULL;
+    if (id)
+        *id = ntohl(hdr[1]);
+
+    if (!(payload = malloc(len + 1)))
+        return NULL;
+    if (read_full(fd, payload, len) < 0) {
+        free(payload);
+        return NULL;
+    }
+    payload[len] = '\0';
+
+    return payload;
+}
@@ -0,0 +1,129 @@
+/*
+ * Reader side of the server's shared-memory status page (see
+ * statuspage.h). Any local program can use these three calls: reading
+ * the page takes no lock and costs the server nothing.
+ */
+#include "VTqueue.h"
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/* Copies given up on while the server is (or died) mid-update. */
+#define STATUS_READ_RETRIES (1 << 20)
+
+static const VTStatusPage *page = NULL;
+
+/*
+ * Maps the page read-only.
+ * Returns:
+ *   0 on success
+ *  -1 if there is no page (no server running), errno set
+ */
+int status_page_attach(void)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if(page)
+        return 0;
+    if((fd = shm_open(STATUS_PAGE_NAME, O_RDONLY | O_CLOEXEC, 0)) < 0)
+        return -1;
+    /* A page from an older server may be shorter than ours. */
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(VTStatusPage)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    map = mmap(NULL, sizeof(VTStatusPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    page = map;
+    return 0;
+}
+
+void status_page_detach(void)
+{
+    if(page)
+        munmap((void *) page, sizeof(VTStatusPage));
+    page = NULL;
+}
+
+/*
+ * Copies a consistent body into 'out', with the position of a playing
+ * item brought up to now.
+ * Returns:
+ *   0 on success
+ *  -1 if the page is not attached, belongs to no running server
+ *     (ENOENT), has another layout (EPROTO) or stays mid-update (EAGAIN)
+ */
+int status_page_read(VTStatusBody *out)
+{
+    const int64_t *src;
+    int64_t *dst;
+    struct timespec ts;
+    unsigned int i, tries;
+    int32_t seq;
+
+    if(!page) {
+        errno = ENOENT;
+        return -1;
+    }
+    if(__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATUS_PAGE_MAGIC) {
+        errno = ENOENT;
+        return -1;
+    }
+    if(page->version != STATUS_PAGE_VERSION || page->size < sizeof(VTStatusPage)) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    src = (const int64_t *) &page->body;
+    dst = (int64_t *) out;
+    for(tries = 0; ; tries++) {
+        if(tries == STATUS_READ_RETRIES) {
+            errno = EAGAIN;
+            return -1;
+        }
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+            continue;
+        for(i = 0; i < sizeof(VTStatusBody) / sizeof(int64_t); i++)
+            dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+    out->uri[sizeof(out->uri) - 1] = '\0';
+
+    /* The server samples the position every 100 ms; interpolate between samples. */
+    if(out->running && out->position >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        out->position += ((int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - out->sampled) * 1000;
+        if(out->duration > 0 && out->position > out->duration)
+            out->position = out->duration;
+    }
+
+    return 0;
+}
+
+/* PID of the server that owns the attached page, 0 if none. */
+int status_page_pid(void)
+{
+    return page ? page->pid : 0;
+}
+
+/* "Playing", "Paused" or "Standby", as STATUS names them. */
+const char *status_page_state_name(int64_t state)
+{
+    switch(state) {
+        case STATUS_PAGE_PLAYING:
+            return "Playing";
+        case STATUS_PAGE_PAUSED:
+            return "Paused";
+        default:
+            return "Standby";
+    }
+}
@@ -15,8 +15,23 @@
    do servidor */
 #define MAX_RESULT_LINE_LEN 2048
 
-/* Hard limit on queue depth to prevent memory exhaustion DoS */
-#define MAX_QUEUE_LEN 2048
+/* framed protocol mode: a client that opens the connection
+   with FRAME_MAGIC keeps it open and exchanges frames of
+   [u32 length][u32 request id][payload], big-endian */
+#define FRAME_MAGIC      "VTF1"
+#define FRAME_MAGIC_LEN  4
+#define FRAME_HEADER_LEN 8
+
+/* largest payload carried by a single frame: room for a batch
+   insert of a full default queue (100000 paths of ~80 bytes);
+   larger schedules go in several batches */
+#define MAX_FRAME_LEN    (8 * 1024 * 1024)
+
+/* Default limits on queue size, to prevent memory exhaustion DoS.
+   VTserver --max-items/--max-memory override them; COMMAND_LIMITS
+   can lower them at runtime (never above the startup values). */
+#define DEFAULT_QUEUE_MAX_ITEMS 100000
+#define DEFAULT_QUEUE_MAX_BYTES (64 * 1024 * 1024)
 
 /* definições do widget onde deverá passar o mpeg */
 #define VIDEO_WIDTH	640
@@ -30,11 +45,24 @@
   The server responds with a status character (COMMAND_OK/COMMAND_ERROR)
   and an optional payload, terminated by COMMAND_DELIM.
 
+  Text mode carries one command per connection. The client ends it
+  with a NUL byte or by shutting down its sending side; a request with
+  neither is taken once it is a whole command: an ID whose arguments
+  are optional, an ID and its arguments, a line ending in a newline,
+  or a batch with at least one item line.
+
+  In framed mode the client sends FRAME_MAGIC once, then any number of
+  frames whose payload is the same command text; requests may be
+  pipelined and each response frame carries the request ID it answers,
+  in request order.
+
   ID   Command   Arguments              Description
   --------------------------------------------------------------------
   1    LIST                             Lists the current video queue.
   2    INSERT    [filename];[pos]       Inserts a video at a given
-                                        position (0 for end).
+                 [;[in];[out]]          position (0 for end); with in
+                                        and/or out points only that
+                                        part of it plays (see below).
   3    REMOVE    [pos]                  Removes the video at the given
                                         position.
   4    PLAY                             Resumes playback.
@@ -46,6 +74,82 @@
   9    MUTE                             Server-supported audio mute toggle
   10   STATUS                           Gets current playback status
                                         and progress.
+  11   INSERT_BULK                      Inserts all files, in order,
+                 [pos]\n[file]\n...     starting at pos (0 for end).
+                                        All-or-nothing; replies with
+                                        one [n];[S|E];[detail] line
+                                        per item.
+  12   REMOVE_BULK                      Removes all positions (as
+                 \n[pos]\n[pos]\n...    numbered before the batch).
+                                        All-or-nothing, per-item reply.
+  13   LIMITS    [items];[bytes]        Sets the queue item/memory
+                                        limits (0 keeps a value);
+                                        no arguments reports limits
+                                        and current usage.
+
+  14   REMOVE_ID [id]                   Removes the item with the given
+                                        ID.
+  15   MOVE_ID   [id];[after]           Moves an item right after the
+                                        item with ID 'after' (0 moves
+                                        it to the head).
+  16   INSERT_AFTER [filename];[after]  Inserts a video right after the
+                 [;[in];[out]]          item with ID 'after' (0 for
+                                        the head).
+  17   LOG_LEVEL [level]                Sets the log verbosity (error,
+                                        warning, info, debug); no
+                                        argument reports it.
+  18   SUBSCRIBE [classes];[ms]         Keeps a text-mode connection
+                                        open and streams events (see
+                                        below). Not valid in framed
+                                        mode.
+  19   STATS                            Reports counters and latency
+                                        percentiles (commands by type,
+                                        items played, errors, ...).
+  20   GRAPHICS  [layer];[args]         Sets an on-air graphics layer
+                                        (see below); a layer without
+                                        args goes off air, no args
+                                        reports every layer.
+  21   SEEK      [time];[mode]          Seeks within the item on air;
+                                        [time] is seconds, mm:ss or
+                                        hh:mm:ss[.frac], +/- for
+                                        relative. [mode] is key
+                                        (default, nearest keyframe)
+                                        or accurate.
+  22   RATE      [rate]                 Sets the playback rate of the
+                                        item on air (2 fast, 0.5 slow,
+                                        -1 reverse); 1/64 to 64, and
+                                        the next item starts at 1.
+
+  Every queued item has a 64-bit ID, unique for the life of the
+  queue: INSERT replies with it ("ID: [id]"), batch inserts append
+  it to each item line and LIST shows it as [pos];[id];[uri].
+
+  In and out points are times in the file (seconds, mm:ss or
+  hh:mm:ss[.frac], ms precision); an empty one means its start or end.
+  A batch insert line may end in ";[in];[out]" too. LIST appends
+  ";[in]-[out] ([duration])" to trimmed items, and STATUS counts the
+  progress within the segment.
+
+  Batch commands are usually larger than a text-mode request allows
+  and should be sent in framed mode.
+
+  After SUBSCRIBE's reply the server writes one line per event,
+  "[unix time ms] [class] [detail]", until the client hangs up.
+  Classes (comma-separated, default all): state, item, queue, error,
+  progress; [ms] is the progress interval (default 1000, 0 for none).
+  A "lost [n]" line reports events dropped under load. A subscriber
+  that leaves too much unread is disconnected.
+
+  GRAPHICS layers, bottom to top ([corner] is tl, tr, bl or br):
+    watermark;[text]
+    bug;[png path];[corner]             path as the server sees it
+    clock;[strftime format];[corner]    default %H:%M:%S, tl
+    lower;[title];[subtitle];[s]        off after [s] (default 10,
+                                        0 stays up)
+    ticker;[text];[px/s]                default 120
+  and the standby card:
+    standby;[text];[png path];[start]   countdown to [start], a unix
+                                        time or +[s] from now
 */
 #define COMMAND_OK	'S'
 #define COMMAND_ERROR	'E'
@@ -61,5 +165,17 @@
 #define COMMAND_PREV    8
 #define COMMAND_MUTE    9
 #define COMMAND_STATUS  10
+#define COMMAND_INSERT_BULK 11
+#define COMMAND_REMOVE_BULK 12
+#define COMMAND_LIMITS  13
+#define COMMAND_REMOVE_ID    14
+#define COMMAND_MOVE_ID      15
+#define COMMAND_INSERT_AFTER 16
+#define COMMAND_LOG_LEVEL    17
+#define COMMAND_SUBSCRIBE    18
+#define COMMAND_STATS        19
+#define COMMAND_GRAPHICS     20
+#define COMMAND_SEEK         21
+#define COMMAND_RATE         22
 
 #endif /* config.h */
@@ -0,0 +1,58 @@
+#ifndef _STATUSPAGE_H
+#define _STATUSPAGE_H 1
+
+#include <stdint.h>
+
+/*
+  Shared-memory status page
+
+  The server keeps a read-only mirror of STATUS in a POSIX
+  shared-memory object (/dev/shm/VTmpegd.status) that local
+  readers map instead of asking over the socket: a status bar or
+  a tally light can poll it as often as it likes without waking
+  the server.
+
+  The header is written once. The body is protected by a
+  seqlock: 'seq' is odd while the server updates it, so a reader
+  copies the body between two equal, even reads of 'seq' and
+  retries otherwise. Fields are only ever appended to the body;
+  STATUS_PAGE_VERSION changes if the meaning of one changes.
+  A page whose magic is not STATUS_PAGE_MAGIC belongs to no
+  running server (it is cleared on shutdown).
+*/
+#define STATUS_PAGE_NAME     "/VTmpegd.status"
+#define STATUS_PAGE_MAGIC    0x56545350     /* "VTSP" */
+#define STATUS_PAGE_VERSION  1
+#define STATUS_PAGE_URI_MAX  1024
+
+/* VTStatusBody.state */
+#define STATUS_PAGE_STANDBY  0
+#define STATUS_PAGE_PAUSED   1
+#define STATUS_PAGE_PLAYING  2
+
+typedef struct {
+    int64_t  state;         /* STATUS_PAGE_STANDBY/PAUSED/PLAYING */
+    int64_t  running;       /* 1 while the position advances in real time */
+    int64_t  position;      /* ns at 'sampled', -1 if unknown */
+    int64_t  duration;      /* ns, -1 if unknown */
+    int64_t  sampled;       /* CLOCK_MONOTONIC time of the position, us */
+    int64_t  updated;       /* CLOCK_REALTIME time of this update, us */
+    uint64_t item_id;       /* ID of the item on air, 0 if none or unknown */
+    int64_t  queue_length;
+    int64_t  items_played;  /* items started since the server started */
+    int64_t  gapless;       /* ... of which by a gapless handoff */
+    int64_t  errors;        /* playback errors */
+    char     uri[STATUS_PAGE_URI_MAX];  /* the item on air as queued, "" if none */
+} VTStatusBody;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          /* sizeof(VTStatusPage) of the server */
+    int32_t  pid;           /* of the server */
+    int32_t  seq;
+    int32_t  reserved;
+    VTStatusBody body;
+} VTStatusPage;
+
+#endif /* statuspage.h */
@@ -11,7 +11,8 @@
 #include <glib-unix.h>
 
 static void finish  (void);
-static int already_finished = 0;
+static gint already_finished = 0;
+static GMainLoop *headless_loop = NULL;  /* runs instead of gtk_main() when headless */
 
 void show_copyright(void)
 {
@@ -20,93 +21,47 @@ void show_copyright(void)
 }
 
 /*
- * Main-thread callback to start playback safely.
- * Triggered via g_idle_add from the IPC thread.
+ * Public helpers called from commands.c. Each posts to the control
+ * mailbox (mailbox.c), which the main loop drains and coalesces.
  */
-static gboolean idle_start_playback(gpointer data)
-{
-    (void)data;
-
-    /*
-     * Robust Idle Check:
-     * Only start if the pipeline is explicitly in GST_STATE_NULL.
-     */
-    if (md_gst_is_stopped()) {
-        char *filename = command_get_next_video();
-        if (filename) {
-            g_printerr("Starting playback (event-driven): %s\n", filename);
-            md_gst_play(filename);
-            g_free(filename);
-        }
-    }
-
-    return FALSE; /* Run once */
-}
-
-static gboolean idle_pause_playback(gpointer data)
-{
-    (void)data;
-    md_gst_pause();
-    return FALSE;
-}
-
-static gboolean idle_resume_playback(gpointer data)
-{
-    (void)data;
-    md_gst_resume();
-    return FALSE;
-}
-
-static gboolean idle_stop_playback(gpointer data)
-{
-    (void)data;
-    md_gst_stop();
-    return FALSE;
-}
-
-static gboolean idle_skip_playback(gpointer data)
+void start_playback_request(void)
 {
-    (void)data;
-    md_gst_skip();
-    return FALSE;
+    mailbox_post(MAIL_START);
 }
 
-static gboolean idle_mute_playback(gpointer data)
+gboolean pause_playback_request(void)
 {
-    (void)data;
-    md_gst_toggle_mute();
-    return FALSE;
+    return mailbox_post(MAIL_PAUSE);
 }
 
-/* Public helper called from commands.c */
-void start_playback_request(void)
+gboolean resume_playback_request(void)
 {
-    g_idle_add(idle_start_playback, NULL);
+    return mailbox_post(MAIL_RESUME);
 }
 
-void pause_playback_request(void)
+gboolean stop_playback_request(void)
 {
-    g_idle_add(idle_pause_playback, NULL);
+    return mailbox_post(MAIL_STOP);
 }
 
-void resume_playback_request(void)
+gboolean skip_playback_request(void)
 {
-    g_idle_add(idle_resume_playback, NULL);
+    return mailbox_post(MAIL_SKIP);
 }
 
-void stop_playback_request(void)
+gboolean mute_playback_request(void)
 {
-    g_idle_add(idle_stop_playback, NULL);
+    return mailbox_post(MAIL_MUTE);
 }
 
-void skip_playback_request(void)
+gboolean seek_playback_request(gint64 ns, guint flags)
 {
-    g_idle_add(idle_skip_playback, NULL);
+    return mailbox_post_seek(ns, flags);
 }
 
-void mute_playback_request(void)
+gboolean rate_playback_request(gdouble rate)
 {
-    g_idle_add(idle_mute_playback, NULL);
+    return mailbox_post_rate(rate);
 }
 
 /*
@@ -116,49 +71,171 @@ void mute_playback_request(void)
 static gboolean sig_handler(gpointer user_data)
 {
     (void)user_data;
-    g_printerr("VTmpegd: Received termination signal, exiting.\n");
+    log_info("VTmpegd: Received termination signal, exiting.");
     finish();
     return G_SOURCE_REMOVE;
 }
 
+/* Parses a byte count with an optional K/M/G suffix; returns 0 if invalid. */
+static gsize parse_size(const char *arg)
+{
+    char *end = NULL;
+    guint64 v = g_ascii_strtoull(arg, &end, 10);
+
+    if (end == arg) return 0;
+    switch (*end) {
+        case 'k': case 'K': v <<= 10; end++; break;
+        case 'm': case 'M': v <<= 20; end++; break;
+        case 'g': case 'G': v <<= 30; end++; break;
+        default: break;
+    }
+    return (*end == '\0') ? (gsize) v : 0;
+}
+
 int main (int argc, char **argv)
 {
-    GtkWidget *win;
+    GtkWidget *win = NULL;
     gint r;
     int c;
     int loop_enabled = 0;
     int watermark_enabled = 0;
-
-    gtk_init(&argc, &argv);
+    const char *watermark_text = OVERLAY_WATERMARK_TEXT;
+    const char *standby_text = NULL;
+    const char *standby_image = NULL;
+    guint max_items = 0;
+    gsize max_bytes = 0;
+    const char *journal_dir = NULL;
+    guint prefetch_items = 3;
+    gsize prefetch_head = 8 << 20;
+    gsize prefetch_rate = 16 << 20;
+    LogTarget log_target = LOG_TARGET_STDERR;
+    const char *log_file = NULL;
+    int log_level = LOG_LEVEL_INFO;
+    const char *metrics_socket = NULL;
+    int headless = 0;
+    const char *video_sink = NULL;
+    const char *audio_sink = NULL;
 
     struct option long_options[] = {
         {"loop",      no_argument, 0, 'l'},
         {"watermark", no_argument, 0, 'w'},
+        {"watermark-text", required_argument, 0, 'W'},
+        {"standby-text", required_argument, 0, 'T'},
+        {"standby-image", required_argument, 0, 'I'},
+        {"max-items", required_argument, 0, 'n'},
+        {"max-memory", required_argument, 0, 'M'},
+        {"journal",   required_argument, 0, 'j'},
+        {"prefetch",  required_argument, 0, 'p'},
+        {"prefetch-head", required_argument, 0, 'H'},
+        {"prefetch-rate", required_argument, 0, 'R'},
+        {"log-level", required_argument, 0, 'v'},
+        {"log-file",  required_argument, 0, 'L'},
+        {"syslog",    no_argument, 0, 'S'},
+        {"metrics-socket", required_argument, 0, 'm'},
+        {"headless",  no_argument, 0, 'x'},
+        {"sink",      required_argument, 0, 'k'},
+        {"audio-sink", required_argument, 0, 'a'},
         {0, 0, 0, 0}
     };
 
-    while ((c = getopt_long(argc, argv, "lw", long_options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "lwW:T:I:n:M:j:p:H:R:v:L:Sm:xk:a:", long_options, NULL)) != -1) {
         switch (c) {
             case 'l': loop_enabled = 1; break;
             case 'w': watermark_enabled = 1; break;
+            case 'W': watermark_enabled = 1; watermark_text = optarg; break;
+            case 'T': standby_text = optarg; break;
+            case 'I': standby_image = optarg; break;
+            case 'n':
+                max_items = (guint) atoi(optarg);
+                if (max_items == 0) {
+                    g_printerr("Invalid --max-items value: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'M':
+                max_bytes = parse_size(optarg);
+                if (max_bytes == 0) {
+                    g_printerr("Invalid --max-memory value: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'j': journal_dir = optarg; break;
+            case 'p': prefetch_items = (guint) atoi(optarg); break;
+            case 'H':
+                prefetch_head = parse_size(optarg);
+                if (prefetch_head == 0) {
+                    g_printerr("Invalid --prefetch-head value: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                /* 0 lifts the I/O budget */
+                prefetch_rate = parse_size(optarg);
+                if (prefetch_rate == 0 && strcmp(optarg, "0") != 0) {
+                    g_printerr("Invalid --prefetch-rate value: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'v':
+                log_level = logger_parse_level(optarg);
+                if (log_level < 0) {
+                    g_printerr("Invalid --log-level value: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L': log_target = LOG_TARGET_FILE; log_file = optarg; break;
+            case 'S': log_target = LOG_TARGET_SYSLOG; break;
+            case 'm': metrics_socket = optarg; break;
+            case 'x': headless = 1; break;
+            /* A sink implies headless: the GTK paths pick their own. */
+            case 'k': headless = 1; video_sink = optarg; break;
+            case 'a': headless = 1; audio_sink = optarg; break;
             default: break; /* ignore unknowns */
         }
     }
 
-    win = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-    gtk_window_set_title(GTK_WINDOW(win), "Video Daemon");
-    gtk_window_set_decorated(GTK_WINDOW(win), FALSE);
-    g_signal_connect(G_OBJECT(win), "delete_event", G_CALLBACK(finish), NULL);
-    gtk_widget_set_size_request(GTK_WIDGET(win), 720, 480);
-    gtk_window_move(GTK_WINDOW(win), 0, 0);
+    /* Headless never opens a display: GTK is not even initialised. */
+    if (!headless)
+        gtk_init(&argc, &argv);
 
-    /* Show early so XID exists for overlay path */
-    gtk_widget_show_all(win);
+    /* From here on, runtime messages go through the log writer thread. */
+    if (!logger_start(log_target, log_file, (LogLevel) log_level)) {
+        g_printerr("VTmpegd: Cannot start the logger.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Without shared memory only the socket reports status. */
+    status_page_open();
+    metrics_init();
+
+    if (headless) {
+        md_gst_set_headless(video_sink, audio_sink);
+    } else {
+        win = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_window_set_title(GTK_WINDOW(win), "Video Daemon");
+        gtk_window_set_decorated(GTK_WINDOW(win), FALSE);
+        g_signal_connect(G_OBJECT(win), "delete_event", G_CALLBACK(finish), NULL);
+        gtk_widget_set_size_request(GTK_WIDGET(win), 720, 480);
+        gtk_window_move(GTK_WINDOW(win), 0, 0);
+
+        /* Show early so XID exists for overlay path */
+        gtk_widget_show_all(win);
+    }
+
+    if (watermark_enabled)
+        overlay_set_watermark(watermark_text);
+    if ((standby_text || standby_image) && !standby_set_card(standby_text, standby_image, 0)) {
+        log_error("Cannot load the standby slate %s.", standby_image);
+        exit(EXIT_FAILURE);
+    }
 
-    r = md_gst_init(&argc, &argv, win, loop_enabled, watermark_enabled);
+    r = md_gst_init(&argc, &argv, win, loop_enabled);
     if (r < 0) {
-        g_printerr("md_gst_init() failed, aborting.\n");
-        gtk_widget_destroy(GTK_WIDGET(win));
+        log_error("md_gst_init() failed, aborting.");
+        if (win)
+            gtk_widget_destroy(GTK_WIDGET(win));
+        status_page_close();
+        logger_stop();
         exit(EXIT_SUCCESS);
     }
 
@@ -173,40 +250,65 @@ int main (int argc, char **argv)
     show_copyright();
 
     /* Initialize Command Layer state */
+    mailbox_init();
     commands_init(loop_enabled);
+    commands_set_limits(max_items, max_bytes);
+
+    /* Restore the queue (and what was on air) before accepting clients. */
+    if (journal_dir && !commands_open_journal(journal_dir)) {
+        log_error("VTmpegd: Cannot open the queue journal in %s.", journal_dir);
+        md_gst_finish();
+        status_page_close();
+        logger_stop();
+        exit(EXIT_FAILURE);
+    }
+
+    /* Keep the next items in the page cache (0 items disables it). */
+    prefetch_start(command_upcoming_videos, prefetch_items, prefetch_head, prefetch_rate);
+
+    /* Optional: a scrape failure is not worth refusing to play. */
+    if (metrics_socket && !metrics_serve_start(metrics_socket))
+        log_warning("VTmpegd: Cannot create the metrics socket, continuing without it.");
 
     if (!unix_server()) {
-        fprintf(stderr, "VTmpegd: Cannot create the server.\n");
+        log_error("VTmpegd: Cannot create the server.");
+        status_page_close();
+        logger_stop();
         return 0;
     }
 
-    gtk_main();
+    if (headless) {
+        headless_loop = g_main_loop_new(NULL, FALSE);
+        g_main_loop_run(headless_loop);
+    } else {
+        gtk_main();
+    }
     return 1;
 }
 
 void finish (void)
 {
-    thread_lock();
-
-    if (already_finished) {
-        thread_unlock();
+    if (!g_atomic_int_compare_and_exchange(&already_finished, 0, 1))
         return;
-    }
-
-    already_finished = 1;
-    thread_unlock();
 
     unix_finish();
+    metrics_serve_stop();
+    prefetch_stop();
 
     thread_lock();
     unlink(unix_sockname());
     commands_cleanup();
 
-    g_printerr("Goodbye.\n");
+    log_info("Goodbye.");
     thread_unlock();
 
     md_gst_finish();
-    gtk_main_quit();
+    status_page_close();
+    if (headless_loop)
+        g_main_loop_quit(headless_loop);
+    else
+        gtk_main_quit();
+    logger_stop();
 
     exit(EXIT_SUCCESS);
 }
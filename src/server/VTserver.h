@@ -26,6 +26,8 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
 #include <sys/stat.h>
 #include <getopt.h>
 #include <limits.h>
@@ -37,31 +39,83 @@
 /* GStreamer */
 #include <gst/gst.h>
 #include <gst/video/videooverlay.h>
+#include <gst/video/gstvideosink.h>
 
 /* local */
 #include "video.h"
+#include "queue.h"
 #include "config.h"
+#include "statuspage.h"
 
+/*
+ * In and out points of a queue entry, in ms from the start of the file
+ * (out 0: to the end). Milliseconds keep the entry small and fit both
+ * points into one journal word.
+ */
 typedef struct {
-    char filename[PATH_MAX];
-    int  played;
+    guint32 in;
+    guint32 out;
+} ItemTrim;
+
+#define TRIM_IS_SET(t)  ((t).in != 0 || (t).out != 0)
+
+/*
+ * A queue entry. The URI is interned (see intern.c), so entries that
+ * share a path share its storage and the struct itself stays small:
+ * 24 bytes.
+ * The ID is assigned on insert, never reused, and survives moves and
+ * restarts (it is journaled).
+ */
+typedef struct {
+    const char *filename;
+    guint64     id;
+    ItemTrim    trim;
 } VTmpeg;
 
 /* gst-backend.c */
-extern gint md_gst_init(gint *argc, gchar ***argv, GtkWidget *win, int loop_enabled, int watermark_enabled);
+/*
+ * Playback state as last seen by the main loop. All fields are gint64
+ * words so the snapshot can be published under a SeqLock.
+ */
+typedef struct {
+    gint64 state;       /* GstState of the live pipeline */
+    gint64 pending;     /* GstState it is heading to, or VOID_PENDING */
+    gint64 position;    /* ns, -1 if unknown */
+    gint64 duration;    /* ns, -1 if unknown */
+    gint64 sampled;     /* monotonic time of the position sample, us */
+    gint64 in;          /* in point of the item on air, ns; position counts from it */
+    gint64 out;         /* out point, ns, 0 = the end of the file */
+} PlaybackSnapshot;
+
+/* A NULL 'win' runs headless, into the sinks set by md_gst_set_headless(). */
+extern gint md_gst_init(gint *argc, gchar ***argv, GtkWidget *win, int loop_enabled);
+/* gst-launch descriptions; NULL keeps the default fakesink. Before md_gst_init(). */
+extern void md_gst_set_headless(const char *video_sink, const char *audio_sink);
 extern gint md_gst_play(char *uri);
+/* 'trim' (NULL: the whole file) plays only that part of it. */
+extern gint md_gst_play_item(char *filename, guint64 id, const ItemTrim *trim);
 extern gint md_gst_pause(void);
 extern gint md_gst_resume(void);
 extern gint md_gst_stop(void);
 extern gint md_gst_skip(void);
+extern gint md_gst_skip_n(guint n);
 extern gint md_gst_toggle_mute(void);
+extern gint md_gst_seek(gint64 ns, gboolean relative, gboolean accurate);
+extern gint md_gst_set_rate(gdouble rate);
 extern gint md_gst_finish(void);
 extern int  md_gst_is_playing(void);
 extern void md_gst_set_window_handle(guintptr handle);
 extern gboolean md_gst_is_stopped(void);
 extern gint64 md_gst_get_position(void);
 extern gint64 md_gst_get_duration(void);
+/* Lock-free; never touches the pipeline. Safe from any thread. */
+extern void md_gst_get_snapshot(PlaybackSnapshot *out);
+extern const char *md_gst_state_name(const PlaybackSnapshot *s);
 extern char *md_gst_get_current_uri(void);
+/* The next queue item may have changed; safe from any thread. */
+extern void md_gst_queue_changed(void);
+/* Ensures a path has a URI scheme; newly allocated. */
+extern char *ensure_uri_scheme(const char *uri);
 
 /* unix.c */
 extern char   *unix_sockname (void);
@@ -69,23 +123,284 @@ extern int     unix_server   (void);
 extern void    unix_finish   (void);
 
 /* commands.c */
+/* The next item, resolved ahead of time for the gapless handoff. */
+typedef struct {
+    guint64     id;         /* queue item, 0 = replay of the item on air (loop mode) */
+    const char *filename;   /* interned, NULL = nothing would play */
+    char       *uri;        /* for playbin; the streaming thread takes it */
+    char       *replaced;   /* current URI it replaced, retired on commit */
+    ItemTrim    trim;
+} Handoff;
+
 extern void  commands_init(int loop_enabled);
+/* Sets the queue item/byte limits and their runtime ceilings (0 keeps the default). */
+extern void  commands_set_limits(guint max_items, gsize max_bytes);
 extern void  commands_cleanup(void);
-/* Returns a newly allocated string that MUST be freed by the caller. */
-extern char *command_get_next_video(void);
+/* Returns a newly allocated string that MUST be freed by the caller;
+   'id' and 'trim' (may be NULL) receive the item's ID and in/out points. */
+extern char *command_get_next_video(guint64 *id, ItemTrim *trim);
+/* Same, without consuming the item (for pre-roll). */
+extern char *command_peek_next_video(guint64 *id, ItemTrim *trim);
+/* The next n items in play order, for the prefetcher. */
+extern GPtrArray *command_upcoming_videos(guint n);
+/* Gapless handoff: taken wait-free on the streaming thread, committed on the main loop. */
+extern Handoff *command_take_handoff(void);
+extern void  command_commit_handoff(Handoff *h);
 extern char *command_process(const char *payload);
+/* Replays the journal in 'dir' into the queue and starts journaling. */
+extern gboolean commands_open_journal(const char *dir);
+/* Blocks until every mutation so far is durable (no-op without a journal). */
+extern void  commands_commit(void);
+/* Playback ran out or was stopped: nothing is current any more. */
+extern void  command_playback_finished(void);
+/* Drops the next n items without playing them (coalesced skips). */
+extern void  command_skip_videos(guint n);
+
+/* intern.c */
+extern void        intern_init    (void);
+extern void        intern_cleanup (void);
+extern const char *intern_ref     (const char *s);
+extern void        intern_unref   (const char *s);
+extern guint       intern_count   (void);
+extern gsize       intern_bytes   (void);
+
+/* journal.c */
+typedef enum {
+    JOURNAL_INSERT  = 1,    /* pos (0-based, -1 = append), arg = id, uri */
+    JOURNAL_REMOVE  = 2,    /* pos */
+    JOURNAL_CONSUME = 3,    /* FIFO head consumed, uri is now current */
+    JOURNAL_CURSOR  = 4,    /* pos = loop cursor (next item to play) */
+    JOURNAL_CURRENT = 5,    /* uri now playing, NULL = none; arg = its in/out as JOURNAL_TRIM */
+    JOURNAL_MOVE    = 6,    /* item at pos moves to position arg */
+    JOURNAL_NEXT_ID = 7,    /* arg = next item ID (snapshots only) */
+    JOURNAL_TRIM    = 8     /* item at pos (-1 = last) gets arg = in ms << 32 | out ms */
+} JournalOp;
+
+typedef void (*JournalReplayFunc)(JournalOp op, gint32 pos, guint64 arg, const char *uri);
+
+extern gboolean journal_open            (const char *dir, JournalReplayFunc replay);
+extern void     journal_close           (void);
+extern gboolean journal_enabled         (void);
+/* Buffers a record in memory; the caller holds the queue lock. */
+extern void     journal_append          (JournalOp op, gint32 pos, guint64 arg, const char *uri);
+extern void     journal_commit          (void);
+extern gboolean journal_wants_snapshot  (void);
+extern GString *journal_snapshot_begin  (void);
+extern void     journal_snapshot_add    (GString *snap, JournalOp op, gint32 pos, guint64 arg, const char *uri);
+extern void     journal_snapshot_submit (GString *snap);
+
+/* log.c */
+typedef enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} LogLevel;
+
+typedef enum {
+    LOG_TARGET_STDERR = 0,
+    LOG_TARGET_FILE,
+    LOG_TARGET_SYSLOG
+} LogTarget;
+
+extern gboolean    logger_start       (LogTarget target, const char *path, LogLevel level);
+extern void        logger_stop        (void);
+extern void        logger_write       (LogLevel level, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+extern int         logger_parse_level (const char *name);
+extern void        logger_set_level   (LogLevel level);
+extern const char *logger_level_name  (void);
+extern void        logger_report      (GString *out);
+
+/* One message per call, without a trailing newline. */
+#define log_error(...)   logger_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warning(...) logger_write(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define log_info(...)    logger_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...)   logger_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* events.c */
+typedef enum {
+    EVENT_STATE    = 1 << 0,    /* Playing/Paused/Standby */
+    EVENT_ITEM     = 1 << 1,    /* an item started or finished */
+    EVENT_QUEUE    = 1 << 2,    /* queue mutations */
+    EVENT_ERROR    = 1 << 3,    /* pipeline errors */
+    EVENT_PROGRESS = 1 << 4,    /* periodic position, per subscriber (unix.c) */
+    EVENT_ALL      = (1 << 5) - 1
+} EventClass;
+
+/* Receives one formatted event line; 'cls' is 0 for a "lost" notice. */
+typedef void (*EventFunc) (EventClass cls, const char *line, gsize len, gpointer data);
+
+extern int         events_init          (void);
+extern void        events_finish        (void);
+extern void        event_post           (EventClass cls, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+extern void        events_format        (GString *line, gint64 time, EventClass cls, const char *text);
+extern guint       events_mark          (void);
+extern guint       events_drain         (guint upto, EventFunc fn, gpointer data);
+extern void        events_subscribe     (void);
+extern void        events_unsubscribe   (gboolean slow);
+extern const char *event_class_name     (EventClass cls);
+extern gboolean    events_parse_classes (const char *list, guint *mask);
+extern void        events_report        (GString *out);
+
+/* mailbox.c */
+typedef enum {
+    MAIL_START = 0,
+    MAIL_PAUSE,
+    MAIL_RESUME,
+    MAIL_STOP,
+    MAIL_SKIP,
+    MAIL_MUTE,
+    MAIL_SEEK,
+    MAIL_RATE
+} MailOp;
+
+/* MAIL_SEEK flags */
+#define SEEK_RELATIVE   (1 << 0)    /* by the offset, not to the position */
+#define SEEK_ACCURATE   (1 << 1)    /* to the exact frame, not a keyframe */
+
+/* MAIL_RATE limits, either direction */
+#define SEEK_RATE_MIN   (1.0 / 64)
+#define SEEK_RATE_MAX   64.0
+
+extern void     mailbox_init   (void);
+extern gboolean mailbox_post   (MailOp op);
+extern gboolean mailbox_post_seek (gint64 ns, guint flags);
+extern gboolean mailbox_post_rate (gdouble rate);
+extern void     mailbox_post_handoff (Handoff *h);
+extern void     mailbox_report (GString *out);
+
+/* metrics.c */
+/* Slots in the per-command counters: protocol IDs, 0 for unknown ones. */
+#define METRICS_COMMANDS (COMMAND_RATE + 1)
+
+typedef enum {
+    METRIC_ITEMS_PLAYED = 0,
+    METRIC_GAPLESS,             /* ... started by an about-to-finish handoff */
+    METRIC_HARD_STARTS,         /* ... started by building or swapping a pipeline */
+    METRIC_HANDOFF_IDLE,        /* about-to-finish with nothing queued */
+    METRIC_PIPELINE_ERRORS,
+    METRIC_QOS_DROPS,
+    METRIC_FRAMES,              /* video buffers that reached the live sink */
+    METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum {
+    METRIC_HIST_COMMAND = 0,    /* command_process() */
+    METRIC_HIST_ABOUT_TO_FINISH,
+    METRIC_HIST_SKIP_PREROLLED, /* skip to first frame, per path */
+    METRIC_HIST_SKIP_REBUILT,
+    METRIC_HIST_OVERLAY,        /* graphics, per frame and deck */
+    METRIC_HIST_STANDBY,        /* standby card, per expose */
+    METRIC_HIST_SEEK,           /* seek to first frame */
+    METRIC_HISTS
+} MetricHist;
+
+/* Latencies in ns; quantiles are within 6%. */
+typedef struct {
+    guint64 count;
+    gint64  avg;
+    gint64  p50;
+    gint64  p90;
+    gint64  p99;
+    gint64  p999;
+    gint64  max;
+} MetricsSummary;
+
+/* Recording: lock-free, allocation-free, safe from any thread. */
+extern void     metrics_init            (void);
+extern gint64   metrics_now             (void);
+extern void     metrics_count           (MetricCounter c);
+extern void     metrics_command         (int id, gint64 ns);
+extern void     metrics_record          (MetricHist h, gint64 ns);
+extern void     metrics_set_queue_depth (guint depth);
+/* Reading */
+extern guint64  metrics_counter         (MetricCounter c);
+extern void     metrics_summary         (MetricHist h, MetricsSummary *out);
+extern void     metrics_log_histogram   (MetricHist h);
+extern void     metrics_report          (GString *out);
+/* Prometheus text endpoint on a second UNIX socket */
+extern gboolean metrics_serve_start     (const char *path);
+extern void     metrics_serve_stop      (void);
+
+/* overlay.c */
+#define OVERLAY_WATERMARK_TEXT      "VT-TV LIVE"
+#define GRAPHICS_TEXT_MAX           1024    /* bytes of any layer's text */
+#define GRAPHICS_CLOCK_FORMAT       "%H:%M:%S"
+#define GRAPHICS_TICKER_SPEED       120     /* px/s */
+#define GRAPHICS_TICKER_SPEED_MAX   4000
+#define GRAPHICS_LOWER_THIRD_SECS   10
+
+typedef enum {
+    OVERLAY_TOP_LEFT = 0,
+    OVERLAY_TOP_RIGHT,
+    OVERLAY_BOTTOM_LEFT,
+    OVERLAY_BOTTOM_RIGHT
+} OverlayCorner;
+
+/* Layers; any thread. NULL or "" takes a layer off air. */
+extern void        overlay_set_watermark   (const char *text);
+extern gboolean    overlay_set_bug         (const char *png_path, OverlayCorner corner);
+extern void        overlay_set_clock       (const char *strftime_format, OverlayCorner corner);
+extern void        overlay_set_lower_third (const char *title, const char *subtitle, guint seconds);
+extern void        overlay_set_ticker      (const char *text, guint speed);
+extern int         overlay_parse_corner    (const char *s);
+extern void        overlay_report          (GString *out);
+/* "overlaycomposition", or "cairooverlay" before GStreamer 1.20 */
+extern const char *overlay_factory         (void);
+extern void        overlay_connect         (GstElement *element);
+
+/* prefetch.c */
+typedef GPtrArray *(*PrefetchSourceFunc)(guint n);
+
+typedef struct {
+    guint   hits;           /* items that started playing warm */
+    guint   misses;         /* ... and cold (or still warming) */
+    guint   warmed;         /* files completely warmed */
+    guint64 bytes;          /* bytes read ahead */
+    gint64  throttled_us;   /* time spent waiting on the I/O budget */
+} PrefetchStats;
+
+extern void prefetch_start     (PrefetchSourceFunc upcoming, guint n, gsize head, gsize rate);
+extern void prefetch_stop      (void);
+extern void prefetch_kick      (void);
+extern void prefetch_played    (const char *filename);
+extern void prefetch_get_stats (PrefetchStats *out);
+extern void prefetch_report    (GString *out);
+
+/* statuspage.c */
+extern gboolean status_page_open     (void);
+extern void     status_page_close    (void);
+extern void     status_page_playback (const PlaybackSnapshot *s);
+extern void     status_page_item     (guint64 id, const char *uri, gboolean gapless);
+extern void     status_page_queue    (guint length);
+extern void     status_page_error    (void);
 
 /* thread.c */
-extern void thread_lock   (void);
-extern void thread_unlock (void);
-
-/* VTserver.c helpers */
-extern void start_playback_request(void);
-extern void pause_playback_request(void);
-extern void resume_playback_request(void);
-extern void stop_playback_request(void);
-extern void skip_playback_request(void);
-extern void mute_playback_request(void);
+/* Queue lock: thread_lock() for writers, thread_rdlock() for readers. */
+extern void thread_lock     (void);
+extern void thread_rdlock   (void);
+extern void thread_unlock   (void);
+/* RCU-style publication, see thread.c */
+extern int  rcu_read_lock   (void);
+extern void rcu_read_unlock (int phase);
+extern void rcu_retire      (gpointer ptr, GDestroyNotify free_fn);
+extern void rcu_reclaim     (void);
+/* Single-writer sequence lock over gint64 words, see thread.c */
+typedef struct {
+    gint seq;
+} SeqLock;
+extern void seqlock_write   (SeqLock *lock, gint64 *dst, const gint64 *src, guint words);
+extern void seqlock_read    (const SeqLock *lock, gint64 *dst, const gint64 *src, guint words);
+
+/* VTserver.c helpers: post to the control mailbox, FALSE if it is full */
+extern void     start_playback_request(void);
+extern gboolean pause_playback_request(void);
+extern gboolean resume_playback_request(void);
+extern gboolean stop_playback_request(void);
+extern gboolean skip_playback_request(void);
+extern gboolean mute_playback_request(void);
+extern gboolean seek_playback_request(gint64 ns, guint flags);
+extern gboolean rate_playback_request(gdouble rate);
 
 /* copyright.c */
 #define PROGRAM_DESCRIPTION "oO VTmpeg - MPEG video player daemon for Linux Oo"
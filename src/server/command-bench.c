@@ -0,0 +1,458 @@
+/*
+ * Benchmark: the command layer (commands.c, queue, intern pool, RCU,
+ * journal) over a stub backend, with no pipeline and no socket.
+ *
+ *   list      queue of SIZE items cycling through 50 distinct paths:
+ *             its memory as LIMITS reports it, and the time to render
+ *             a full LIST reply (to compare with queue-bench's bare
+ *             walk)
+ *   pick      4 threads send LIST back to back while another picks the
+ *             next video every millisecond, as the streaming thread
+ *             does; the pick's latency is reported, in loop and FIFO
+ *             mode
+ *   handoff   a thread takes the gapless handoff slot every 250 us, as
+ *             about-to-finish does, while another inserts and removes
+ *             items and a third commits each taken slot like the main
+ *             loop; the take's latency is reported, and in FIFO mode
+ *             the items must be handed off in order, each once
+ *   insert    CLIENTS threads insert one item at a time and commit
+ *             before the next, like framed clients with one request in
+ *             flight, without and with the journal (in DIR, default
+ *             ./command-bench.d; it must be on the disk under test)
+ *
+ * Each run forks, so every one starts from a fresh command layer.
+ *
+ *   make -C src/server bench && ./src/server/command-bench [SECONDS] [CLIENTS] [DIR]
+ */
+
+#include "VTserver.h"
+#include <sys/wait.h>
+
+#define BENCH_SECONDS   2
+#define BENCH_CLIENTS   16
+#define BENCH_DIR       "command-bench.d"
+#define BENCH_PATHS     50
+#define BENCH_LISTS     20
+#define BENCH_LISTERS   4
+#define BENCH_PICK_US   1000
+#define BENCH_TAKE_US   250
+
+static const guint list_sizes[] = { 2048, 50000, 100000 };
+#define PICK_SIZE 100000
+
+static gint running;
+
+/* ---- Stub backend ---- */
+
+static gpointer current_uri = NULL;     /* what the handoff swaps, like g_current_uri */
+
+gint md_gst_play_item (char *filename, guint64 id, const ItemTrim *trim)
+{
+    (void)filename; (void)id; (void)trim;
+    return 0;
+}
+
+gint md_gst_pause (void) { return 0; }
+gint md_gst_resume (void) { return 0; }
+gint md_gst_stop (void) { return 0; }
+gint md_gst_skip_n (guint n) { (void)n; return 0; }
+gint md_gst_toggle_mute (void) { return 0; }
+int  md_gst_is_playing (void) { return 0; }
+gboolean md_gst_is_stopped (void) { return TRUE; }
+char *md_gst_get_current_uri (void) { return NULL; }
+void md_gst_queue_changed (void) { }
+
+gint md_gst_seek (gint64 ns, gboolean relative, gboolean accurate)
+{
+    (void)ns; (void)relative; (void)accurate;
+    return 0;
+}
+
+gint md_gst_set_rate (gdouble rate)
+{
+    (void)rate;
+    return 0;
+}
+
+void md_gst_get_snapshot (PlaybackSnapshot *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+}
+
+const char *md_gst_state_name (const PlaybackSnapshot *snap)
+{
+    (void)snap;
+    return "Standby";
+}
+
+char *ensure_uri_scheme (const char *uri)
+{
+    if (!uri) return NULL;
+    return strstr(uri, "://") ? g_strdup(uri) : g_filename_to_uri(uri, NULL, NULL);
+}
+
+void start_playback_request (void) { }
+gboolean pause_playback_request (void) { return TRUE; }
+gboolean resume_playback_request (void) { return TRUE; }
+gboolean stop_playback_request (void) { return TRUE; }
+gboolean skip_playback_request (void) { return TRUE; }
+gboolean mute_playback_request (void) { return TRUE; }
+gboolean seek_playback_request (gint64 ns, guint flags) { (void)ns; (void)flags; return TRUE; }
+gboolean rate_playback_request (gdouble rate) { (void)rate; return TRUE; }
+
+void overlay_set_watermark (const char *text) { (void)text; }
+gboolean overlay_set_bug (const char *png_path, OverlayCorner corner) { (void)png_path; (void)corner; return TRUE; }
+void overlay_set_clock (const char *strftime_format, OverlayCorner corner) { (void)strftime_format; (void)corner; }
+void overlay_set_lower_third (const char *title, const char *subtitle, guint seconds) { (void)title; (void)subtitle; (void)seconds; }
+void overlay_set_ticker (const char *text, guint speed) { (void)text; (void)speed; }
+int  overlay_parse_corner (const char *s) { (void)s; return 0; }
+void overlay_report (GString *out) { (void)out; }
+gboolean standby_set_card (const char *text, const char *image_path, gint64 countdown_to) { (void)text; (void)image_path; (void)countdown_to; return TRUE; }
+void standby_report (GString *out) { (void)out; }
+
+/* ---- Helpers ---- */
+
+static gint compare_i64 (gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* p50/p99/max of ns samples, in us. */
+static void report_ns (const char *what, GArray *ns)
+{
+    g_array_sort(ns, compare_i64);
+    if (ns->len == 0) {
+        printf("%-24s no samples\n", what);
+        return;
+    }
+    printf("%-24s %8u  p50 %9.2f us  p99 %9.2f us  max %9.2f us\n", what, ns->len,
+            g_array_index(ns, gint64, ns->len / 2) / 1000.0,
+            g_array_index(ns, gint64, ns->len * 99 / 100) / 1000.0,
+            g_array_index(ns, gint64, ns->len - 1) / 1000.0);
+}
+
+static void bench_insert (guint i)
+{
+    char req[PATH_MAX + 32];
+
+    g_snprintf(req, sizeof(req), "%d /srv/playout/media/archive/2024/programmes/"
+               "evening-schedule/episode-%04u-final-master-1080p50.mpg;0", COMMAND_INSERT, i % BENCH_PATHS);
+    g_free(command_process(req));
+}
+
+static void bench_fill (guint n)
+{
+    guint i;
+
+    commands_set_limits(G_MAXUINT, G_MAXSIZE);
+    for (i = 0; i < n; i++)
+        bench_insert(i);
+}
+
+static char *bench_request (int id)
+{
+    char req[16];
+
+    g_snprintf(req, sizeof(req), "%d", id);
+    return command_process(req);
+}
+
+static void bench_empty_dir (const char *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    if (dir == NULL)
+        return;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        char *file = g_build_filename(path, name, NULL);
+        unlink(file);
+        g_free(file);
+    }
+    g_dir_close(dir);
+}
+
+/* ---- list ---- */
+
+static void run_list (guint n)
+{
+    GArray *ns = g_array_new(FALSE, FALSE, sizeof(gint64));
+    char *reply, *mem, label[32];
+    gsize bytes = 0;
+    guint i;
+
+    commands_init(TRUE);
+    bench_fill(n);
+
+    reply = bench_request(COMMAND_LIMITS);
+    if ((mem = strstr(reply, "Memory: ")) != NULL)
+        printf("%u items, %.2f MiB\n", n, g_ascii_strtoull(mem + strlen("Memory: "), NULL, 10) / (1024.0 * 1024.0));
+    g_free(reply);
+
+    for (i = 0; i < BENCH_LISTS; i++) {
+        gint64 t = metrics_now(), d;
+
+        reply = bench_request(COMMAND_LIST);
+        d = metrics_now() - t;
+        g_array_append_val(ns, d);
+        bytes = strlen(reply);
+        g_free(reply);
+    }
+    g_snprintf(label, sizeof(label), "LIST (%" G_GSIZE_FORMAT " KiB)", bytes / 1024);
+    report_ns(label, ns);
+    g_array_free(ns, TRUE);
+}
+
+/* ---- pick ---- */
+
+static gpointer lister (gpointer data)
+{
+    guint *lists = (guint *) data;
+
+    while (g_atomic_int_get(&running)) {
+        g_free(bench_request(COMMAND_LIST));
+        (*lists)++;
+    }
+    return NULL;
+}
+
+static void run_pick (gboolean loop, int seconds)
+{
+    GArray *ns = g_array_new(FALSE, FALSE, sizeof(gint64));
+    GThread *th[BENCH_LISTERS];
+    guint lists[BENCH_LISTERS] = { 0 }, total = 0;
+    gint64 until;
+    int i;
+
+    commands_init(loop);
+    bench_fill(PICK_SIZE);
+    g_free(bench_request(COMMAND_LIST));
+
+    g_atomic_int_set(&running, 1);
+    for (i = 0; i < BENCH_LISTERS; i++)
+        th[i] = g_thread_new("list", lister, &lists[i]);
+
+    until = g_get_monotonic_time() + (gint64) seconds * G_USEC_PER_SEC;
+    while (g_get_monotonic_time() < until) {
+        guint64 id;
+        gint64 t = metrics_now(), d;
+        char *next = command_get_next_video(&id, NULL);
+
+        d = metrics_now() - t;
+        g_array_append_val(ns, d);
+        g_free(next);
+        g_usleep(BENCH_PICK_US);
+    }
+
+    g_atomic_int_set(&running, 0);
+    for (i = 0; i < BENCH_LISTERS; i++) {
+        g_thread_join(th[i]);
+        total += lists[i];
+    }
+    printf("%s, %u items, %u LISTs alongside\n", loop ? "loop" : "FIFO", PICK_SIZE, total);
+    report_ns("next-video pick", ns);
+    g_array_free(ns, TRUE);
+}
+
+/* ---- handoff ---- */
+
+static gpointer mutator (gpointer data)
+{
+    guint i = 0;
+    char req[32];
+
+    (void)data;
+    while (g_atomic_int_get(&running)) {
+        bench_insert(i);
+        /* Remove from the tail, never the item about to be handed off. */
+        if (++i % 2 == 0) {
+            g_snprintf(req, sizeof(req), "%d %d", COMMAND_REMOVE, 1000);
+            g_free(command_process(req));
+        }
+        g_usleep(50);
+    }
+    return NULL;
+}
+
+static gpointer committer (gpointer data)
+{
+    GAsyncQueue *posted = (GAsyncQueue *) data;
+    Handoff *h;
+
+    while ((h = g_async_queue_pop(posted)) != (Handoff *) posted)
+        command_commit_handoff(h);
+    return NULL;
+}
+
+static void run_handoff (gboolean loop, int seconds)
+{
+    GArray *ns = g_array_new(FALSE, FALSE, sizeof(gint64));
+    GAsyncQueue *posted = g_async_queue_new();
+    GThread *mut, *com;
+    guint64 last = 0;
+    guint handoffs = 0, idle = 0, out_of_order = 0;
+    gint64 until;
+
+    commands_init(loop);
+    bench_fill(2000);
+    /* Start the first item, so the slot holds the one after it. */
+    g_free(command_get_next_video(NULL, NULL));
+
+    g_atomic_int_set(&running, 1);
+    mut = g_thread_new("mutator", mutator, NULL);
+    com = g_thread_new("main", committer, posted);
+
+    until = g_get_monotonic_time() + (gint64) seconds * G_USEC_PER_SEC;
+    while (g_get_monotonic_time() < until) {
+        gint64 t = metrics_now(), d;
+        Handoff *h = command_take_handoff();
+
+        /* What on_about_to_finish() does with the slot, minus playbin. */
+        if (h && h->uri) {
+            h->replaced = g_atomic_pointer_exchange(&current_uri, h->uri);
+            h->uri = NULL;
+        }
+        d = metrics_now() - t;
+        if (h) {
+            g_array_append_val(ns, d);
+            if (h->filename == NULL) {
+                idle++;
+            } else {
+                if (!loop && h->id <= last)
+                    out_of_order++;
+                last = h->id;
+                handoffs++;
+            }
+            g_async_queue_push(posted, h);
+        }
+        g_usleep(BENCH_TAKE_US);
+    }
+
+    g_atomic_int_set(&running, 0);
+    g_thread_join(mut);
+    g_async_queue_push(posted, posted);
+    g_thread_join(com);
+
+    printf("%s, %u handed off, %u with nothing queued", loop ? "loop" : "FIFO", handoffs, idle);
+    if (!loop)
+        printf(", %u out of order or repeated", out_of_order);
+    printf("\n");
+    report_ns("handoff take", ns);
+    g_array_free(ns, TRUE);
+    g_async_queue_unref(posted);
+}
+
+/* ---- insert ---- */
+
+typedef struct {
+    gint64  until;
+    guint   base;
+    guint64 inserts;
+} InsertClient;
+
+static gpointer insert_client (gpointer data)
+{
+    InsertClient *c = (InsertClient *) data;
+
+    while (g_get_monotonic_time() < c->until) {
+        bench_insert(c->base + (guint) c->inserts);
+        commands_commit();
+        c->inserts++;
+    }
+    return NULL;
+}
+
+static void run_insert (const char *dir, int seconds, int clients)
+{
+    InsertClient *c = g_new0(InsertClient, clients);
+    GThread **th = g_new0(GThread *, clients);
+    guint64 inserts = 0;
+    gint64 until;
+    int i;
+
+    commands_init(FALSE);
+    commands_set_limits(G_MAXUINT, G_MAXSIZE);
+    if (dir) {
+        bench_empty_dir(dir);
+        if (!commands_open_journal(dir)) {
+            fprintf(stderr, "command-bench: cannot open a journal in %s\n", dir);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    until = g_get_monotonic_time() + (gint64) seconds * G_USEC_PER_SEC;
+    for (i = 0; i < clients; i++) {
+        c[i].until = until;
+        c[i].base = i * 7;
+        th[i] = g_thread_new("client", insert_client, &c[i]);
+    }
+    for (i = 0; i < clients; i++) {
+        g_thread_join(th[i]);
+        inserts += c[i].inserts;
+    }
+    if (dir)
+        commands_cleanup();
+
+    printf("%-8s %d clients %10.0f inserts/s\n", dir ? "journal" : "none", clients, inserts / (double) seconds);
+    g_free(th);
+    g_free(c);
+}
+
+/* ---- Runs ---- */
+
+typedef enum { RUN_LIST, RUN_PICK, RUN_HANDOFF, RUN_INSERT } BenchKind;
+
+static void bench_fork (BenchKind kind, guint n, gboolean flag, const char *dir, int seconds, int clients)
+{
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        perror("command-bench");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        metrics_init();
+        switch (kind) {
+            case RUN_LIST:    run_list(n); break;
+            case RUN_PICK:    run_pick(flag, seconds); break;
+            case RUN_HANDOFF: run_handoff(flag, seconds); break;
+            case RUN_INSERT:  run_insert(dir, seconds, clients); break;
+        }
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main (int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_SECONDS;
+    int clients = argc > 2 ? atoi(argv[2]) : BENCH_CLIENTS;
+    const char *dir = argc > 3 ? argv[3] : BENCH_DIR;
+    guint i;
+
+    if (seconds <= 0 || clients <= 0) {
+        fprintf(stderr, "usage: %s [SECONDS] [CLIENTS] [DIR]\n", argv[0]);
+        return 1;
+    }
+    logger_set_level(LOG_LEVEL_ERROR);
+
+    printf("-- list\n");
+    for (i = 0; i < G_N_ELEMENTS(list_sizes); i++)
+        bench_fork(RUN_LIST, list_sizes[i], FALSE, NULL, seconds, clients);
+    printf("-- pick\n");
+    bench_fork(RUN_PICK, 0, TRUE, NULL, seconds, clients);
+    bench_fork(RUN_PICK, 0, FALSE, NULL, seconds, clients);
+    printf("-- handoff\n");
+    bench_fork(RUN_HANDOFF, 0, TRUE, NULL, seconds, clients);
+    bench_fork(RUN_HANDOFF, 0, FALSE, NULL, seconds, clients);
+    printf("-- insert, journal in %s\n", dir);
+    bench_fork(RUN_INSERT, 0, FALSE, NULL, seconds, clients);
+    bench_fork(RUN_INSERT, 0, FALSE, dir, seconds, clients);
+
+    bench_empty_dir(dir);
+    rmdir(dir);
+    return 0;
+}
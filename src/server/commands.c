@@ -10,40 +10,526 @@
 #include "VTserver.h"
 
 /* State moved from unix.c to enforce Logic Layering (Invariant 3.4) */
-static GList *queue = NULL;
-static int playing_mpeg = -1;
+static VTQueue queue;
+/* Loop cursor. Written under the queue write lock; LIST reads it lock-free. */
+static gint playing_mpeg = -1;
 static int g_loop_enabled = 0;
 
+/*
+ * Queue limits. The ceilings are fixed at startup; COMMAND_LIMITS may
+ * move the active limits anywhere up to them, so a local client can
+ * never lift the DoS protection the operator configured.
+ */
+static guint max_items = DEFAULT_QUEUE_MAX_ITEMS;
+static guint max_items_ceiling = DEFAULT_QUEUE_MAX_ITEMS;
+static gsize max_bytes = DEFAULT_QUEUE_MAX_BYTES;
+static gsize max_bytes_ceiling = DEFAULT_QUEUE_MAX_BYTES;
+
+/*
+ * Memory charged per entry, on top of its share of the intern pool and
+ * of the node slabs: its VTmpeg and its hash, key and value slots in the
+ * ID index. A new entry is checked against the budget with a node of
+ * its own (QUEUE_ENTRY_BYTES), although it may reuse a free one.
+ */
+#define QUEUE_INDEX_BYTES (sizeof(guint) + 2 * sizeof(gpointer))
+#define QUEUE_ITEM_BYTES  (sizeof(VTmpeg) + QUEUE_INDEX_BYTES)
+#define QUEUE_ENTRY_BYTES (sizeof(VTQueueNode) + QUEUE_ITEM_BYTES)
+
+/*
+ * Item IDs. next_id only grows (it is journaled, so IDs are never
+ * reused across restarts either); id_index maps every queued ID to its
+ * tree node, whose address is stable while the item stays queued.
+ * Both are guarded by the queue write lock.
+ */
+static guint64 next_id = 1;
+static GHashTable *id_index = NULL;
+
+/*
+ * Journal state: the URI handed to the backend (interned, NULL when
+ * nothing plays) and the last loop cursor written to the journal.
+ */
+static const char *current_uri = NULL;
+static ItemTrim current_trim = { 0, 0 };
+static int journaled_cursor = -1;
+/* ID of what is on air, for item events (0: unknown or not queued). */
+static guint64 current_id = 0;
+
+/* In/out points as one journal word (JOURNAL_TRIM, JOURNAL_CURRENT). */
+#define TRIM_PACK(t)    (((guint64) (t).in << 32) | (t).out)
+#define TRIM_UNPACK(t, w) ((t).in = (guint32) ((w) >> 32), (t).out = (guint32) (w))
+
+/*
+ * Gapless handoff slot: the next item, resolved (URI built, ID known)
+ * whenever the queue or the cursor changes, so the streaming thread
+ * only has to exchange a pointer. Rebuilt under the queue write lock;
+ * NULL while the streaming thread holds a taken slot that the main
+ * loop has not committed yet. handoff_none means nothing would play.
+ */
+static Handoff handoff_none = { 0, NULL, NULL, NULL, { 0, 0 } };
+static Handoff *handoff = &handoff_none;
+
+/*
+ * Immutable view of the queue for LIST, RCU-published. It is built by
+ * the first reader after a change, under the read lock only long
+ * enough to copy the entry pointers; rendering happens outside any
+ * lock. Writers unpublish it on every change, before the URIs it points
+ * to can be retired, so a reader that can still see a view can still
+ * read every string in it. Moving the loop cursor alone does not touch
+ * the view; LIST reads the cursor when it renders.
+ */
+typedef struct {
+    const char *uri;
+    guint64     id;
+    ItemTrim    trim;
+} QueueViewEntry;
+
+typedef struct {
+    guint          len;
+    QueueViewEntry items[];
+} QueueView;
+
+static QueueView *queue_view = NULL;
+
+static void command_free_mpeg (void *data);
+static VTmpeg *command_new_mpeg (const char *filename);
+static void command_format_ms (char *buf, gsize size, guint32 ms);
+
+/* Drops the published view. Queue write lock held. */
+static void command_view_invalidate (void)
+{
+    rcu_retire(g_atomic_pointer_exchange(&queue_view, NULL), g_free);
+    status_page_queue(vtq_length(&queue));
+    metrics_set_queue_depth(vtq_length(&queue));
+}
+
+/*
+ * Returns the current view, building and publishing it if needed. The
+ * caller is inside an RCU read section and must release 'owned' (a view
+ * that lost the publication race) when done.
+ */
+static QueueView *command_view_get (QueueView **owned)
+{
+    QueueView *view;
+    VTQueueNode *iter;
+    guint i = 0;
+
+    *owned = NULL;
+    if ((view = g_atomic_pointer_get(&queue_view)) != NULL)
+        return view;
+
+    thread_rdlock();
+    view = g_malloc(sizeof(QueueView) + vtq_length(&queue) * sizeof(QueueViewEntry));
+    view->len = vtq_length(&queue);
+    for (iter = vtq_first(&queue); iter; iter = vtq_next(iter), i++) {
+        view->items[i].uri = ((VTmpeg *) iter->data)->filename;
+        view->items[i].id = ((VTmpeg *) iter->data)->id;
+        view->items[i].trim = ((VTmpeg *) iter->data)->trim;
+    }
+
+    /* Writers are excluded, so any view already published is as fresh. */
+    if (!g_atomic_pointer_compare_and_exchange(&queue_view, NULL, view))
+        *owned = view;
+    thread_unlock();
+
+    return view;
+}
+
 void commands_init(int loop_enabled)
 {
     g_loop_enabled = loop_enabled;
-    queue = NULL;
+    vtq_init(&queue);
+    intern_init();
+    id_index = g_hash_table_new(g_int64_hash, g_int64_equal);
     playing_mpeg = -1;
 }
 
-void commands_cleanup(void)
+void commands_set_limits(guint items, gsize bytes)
+{
+    thread_lock();
+    if (items > 0) max_items = max_items_ceiling = items;
+    if (bytes > 0) max_bytes = max_bytes_ceiling = bytes;
+    thread_unlock();
+}
+
+/*
+ * Bytes actually held by the queue: node slabs (all of them, since
+ * freed nodes are only reused, never returned), VTmpeg structs, index
+ * slots and pooled URIs.
+ */
+static gsize command_queue_bytes(void)
+{
+    return vtq_bytes(&queue) + vtq_length(&queue) * QUEUE_ITEM_BYTES + intern_bytes();
+}
+
+/*
+ * Indexes a freshly inserted node, giving its entry the next ID unless
+ * it already has one (replay, moves). Lock held.
+ */
+static void command_index (VTQueueNode *node)
+{
+    VTmpeg *mpeg = (VTmpeg *) node->data;
+
+    if (mpeg->id == 0)
+        mpeg->id = next_id++;
+    else if (mpeg->id >= next_id)
+        next_id = mpeg->id + 1;
+    g_hash_table_insert(id_index, &mpeg->id, node);
+}
+
+/* O(1) resolution of an ID to its node, NULL if it is not queued. */
+static VTQueueNode *command_lookup (guint64 id)
+{
+    return id ? g_hash_table_lookup(id_index, &id) : NULL;
+}
+
+static void command_set_current (const char *uri)
+{
+    const char *old = current_uri;
+
+    current_uri = uri ? intern_ref(uri) : NULL;
+    intern_unref(old);
+}
+
+/*
+ * Item events: what was on air finished, 'uri' (NULL: nothing) started,
+ * by a gapless handoff or not. Lock held.
+ */
+static void command_announce (guint64 id, const char *uri, gboolean gapless)
+{
+    if (current_uri)
+        event_post(EVENT_ITEM, "finished id=%" G_GUINT64_FORMAT " uri=%s", current_id, current_uri);
+    if (uri)
+        event_post(EVENT_ITEM, "started id=%" G_GUINT64_FORMAT " uri=%s", id, uri);
+    current_id = id;
+    status_page_item(id, uri, gapless);
+    if (uri) {
+        metrics_count(METRIC_ITEMS_PLAYED);
+        metrics_count(gapless ? METRIC_GAPLESS : METRIC_HARD_STARTS);
+    }
+}
+
+/* Logs the loop cursor if a mutation moved it. */
+static void command_journal_cursor (void)
+{
+    if (playing_mpeg != journaled_cursor) {
+        journal_append(JOURNAL_CURSOR, playing_mpeg, 0, NULL);
+        journaled_cursor = playing_mpeg;
+    }
+}
+
+/* The item command_get_next_video() would pick, NULL if none. Lock held. */
+static VTQueueNode *command_next_node (void)
+{
+    guint len = vtq_length(&queue);
+
+    if (len == 0)
+        return NULL;
+    /* Loop mode follows the cursor (wrapping), FIFO mode takes the head. */
+    if (g_loop_enabled && playing_mpeg > 0 && (guint) playing_mpeg < len)
+        return vtq_nth_node(&queue, playing_mpeg);
+    return vtq_first(&queue);
+}
+
+/*
+ * Puts 'node' on air: loop mode moves the cursor past it, FIFO mode
+ * consumes (frees) it. Lock held.
+ */
+static void command_advance (VTQueueNode *node, gboolean gapless)
+{
+    VTmpeg *mpeg = node->data;
+    guint idx = vtq_node_index(node);
+
+    command_announce(mpeg->id, mpeg->filename, gapless);
+    command_set_current(mpeg->filename);
+    current_trim = mpeg->trim;
+
+    if (g_loop_enabled) {
+        playing_mpeg = idx + 1;
+        command_journal_cursor();
+        journal_append(JOURNAL_CURRENT, 0, TRIM_PACK(current_trim), current_uri);
+    } else {
+        vtq_remove_node(&queue, node);
+        if (idx == 0) {
+            journal_append(JOURNAL_CONSUME, 0, 0, current_uri);
+        } else {
+            /* The handoff took an item the head no longer points to. */
+            journal_append(JOURNAL_REMOVE, idx, 0, NULL);
+            journal_append(JOURNAL_CURRENT, 0, TRIM_PACK(current_trim), current_uri);
+        }
+        event_post(EVENT_QUEUE, "consume id=%" G_GUINT64_FORMAT " len=%u", mpeg->id, vtq_length(&queue));
+        command_free_mpeg(mpeg);
+        playing_mpeg = 0;
+        journaled_cursor = 0;
+        command_view_invalidate();
+    }
+}
+
+static void command_handoff_free (Handoff *h)
+{
+    if (h == NULL || h == &handoff_none)
+        return;
+    intern_unref(h->filename);
+    g_free(h->uri);
+    g_free(h);
+}
+
+/*
+ * Re-resolves the handoff slot. Lock held. While a taken slot is in
+ * flight nothing is published; its commit refreshes with 'committed'.
+ */
+static void command_handoff_refresh (gboolean committed)
+{
+    Handoff *old = g_atomic_pointer_get(&handoff), *h = &handoff_none;
+    VTQueueNode *node = command_next_node();
+    const char *filename = NULL;
+    ItemTrim trim = { 0, 0 };
+    guint64 id = 0;
+
+    if (old == NULL && !committed)
+        return;
+
+    if (node) {
+        id = ((VTmpeg *) node->data)->id;
+        filename = ((VTmpeg *) node->data)->filename;
+        trim = ((VTmpeg *) node->data)->trim;
+    } else if (g_loop_enabled) {
+        /* Queue emptied under a loop: replay what is on air. */
+        filename = current_uri;
+        trim = current_trim;
+    }
+
+    /* Unchanged: same item, or still nothing. */
+    if (old && ((id != 0 && old->id == id) || (filename == NULL && old == &handoff_none)))
+        return;
+
+    if (filename) {
+        h = g_new0(Handoff, 1);
+        h->id = id;
+        h->filename = intern_ref(filename);
+        h->trim = trim;
+        if ((h->uri = ensure_uri_scheme(filename)) == NULL) {
+            command_handoff_free(h);
+            h = &handoff_none;
+        }
+    }
+
+    if (committed) {
+        old = g_atomic_pointer_exchange(&handoff, h);
+    } else if (!g_atomic_pointer_compare_and_exchange(&handoff, old, h)) {
+        /* Taken meanwhile; its commit refreshes again. */
+        command_handoff_free(h);
+        return;
+    }
+    command_handoff_free(old);
+}
+
+/* Streaming thread: wait-free. NULL while the previous one is in flight. */
+Handoff *command_take_handoff(void)
+{
+    return g_atomic_pointer_exchange(&handoff, NULL);
+}
+
+/*
+ * Main loop: books the handoff the streaming thread just made (the
+ * backend took h->uri and left the URI it replaced in h->replaced) and
+ * publishes the next slot.
+ */
+void command_commit_handoff(Handoff *h)
 {
-    if (queue) {
-        /*
-         * Correctly deallocates the list and its data.
-         * The `free` function is passed as it matches the `malloc` in command_insert.
-         */
-        g_list_free_full(queue, free);
-        queue = NULL;
+    VTQueueNode *node;
+    char *filename = NULL;
+
+    thread_lock();
+    if (h->filename) {
+        filename = g_strdup(h->filename);
+        if ((node = command_lookup(h->id)) != NULL) {
+            command_advance(node, TRUE);
+        } else {
+            /* Removed while in flight, or a loop replaying what is on air: it plays all the same. */
+            command_announce(h->id, h->filename, TRUE);
+            if (h->filename != current_uri) {
+                command_set_current(h->filename);
+                current_trim = h->trim;
+                journal_append(JOURNAL_CURRENT, 0, TRIM_PACK(current_trim), current_uri);
+            }
+        }
     }
+    command_handoff_refresh(TRUE);
+    rcu_retire(h->replaced, g_free);
+    command_handoff_free(h);
+    thread_unlock();
+
+    if (filename) {
+        log_info("Gapless transition to: %s", filename);
+        prefetch_played(filename);
+        prefetch_kick();
+        g_free(filename);
+    }
+    /* The standby deck held the item just taken; re-aim it. */
+    md_gst_queue_changed();
+}
+
+/* Hands the writer a compacted image of the queue. Lock held. */
+static void command_snapshot (void)
+{
+    GString *snap = journal_snapshot_begin();
+    VTQueueNode *iter;
+
+    for (iter = vtq_first(&queue); iter; iter = vtq_next(iter)) {
+        VTmpeg *mpeg = (VTmpeg *) iter->data;
+        journal_snapshot_add(snap, JOURNAL_INSERT, -1, mpeg->id, mpeg->filename);
+        if (TRIM_IS_SET(mpeg->trim))
+            journal_snapshot_add(snap, JOURNAL_TRIM, -1, TRIM_PACK(mpeg->trim), NULL);
+    }
+    journal_snapshot_add(snap, JOURNAL_NEXT_ID, 0, next_id, NULL);
+    journal_snapshot_add(snap, JOURNAL_CURSOR, playing_mpeg, 0, NULL);
+    journal_snapshot_add(snap, JOURNAL_CURRENT, 0, TRIM_PACK(current_trim), current_uri);
+    journal_snapshot_submit(snap);
+}
+
+/* Applies one journal record during startup replay. Limits do not apply. */
+static void command_replay (JournalOp op, gint32 pos, guint64 arg, const char *uri)
+{
+    VTQueueNode *node;
+    VTmpeg *mpeg;
+
+    switch (op) {
+        case JOURNAL_INSERT:
+            if (uri) {
+                mpeg = command_new_mpeg(uri);
+                mpeg->id = arg;
+                command_index(vtq_insert(&queue, pos < 0 ? vtq_length(&queue) : (guint) pos, mpeg));
+            }
+            break;
+        case JOURNAL_MOVE:
+            if (pos >= 0 && (node = vtq_nth_node(&queue, pos)) != NULL) {
+                mpeg = vtq_remove_node(&queue, node);
+                command_index(vtq_insert(&queue, (guint) arg, mpeg));
+            }
+            break;
+        case JOURNAL_NEXT_ID:
+            if (arg > next_id) next_id = arg;
+            break;
+        case JOURNAL_REMOVE:
+            if (pos >= 0 && (mpeg = vtq_remove(&queue, pos)) != NULL)
+                command_free_mpeg(mpeg);
+            break;
+        case JOURNAL_CONSUME:
+            current_trim.in = current_trim.out = 0;
+            if ((mpeg = vtq_remove(&queue, 0)) != NULL) {
+                current_trim = mpeg->trim;
+                command_free_mpeg(mpeg);
+            }
+            command_set_current(uri);
+            playing_mpeg = 0;
+            break;
+        case JOURNAL_CURSOR:
+            playing_mpeg = pos;
+            break;
+        case JOURNAL_CURRENT:
+            command_set_current(uri);
+            TRIM_UNPACK(current_trim, arg);
+            break;
+        case JOURNAL_TRIM:
+            if ((node = vtq_nth_node(&queue, pos < 0 ? vtq_length(&queue) - 1 : (guint) pos)) != NULL)
+                TRIM_UNPACK(((VTmpeg *) node->data)->trim, arg);
+            break;
+    }
+}
+
+gboolean commands_open_journal(const char *dir)
+{
+    guint len;
+    gboolean resumed = FALSE;
+
+    thread_lock();
+    if (!journal_open(dir, command_replay)) {
+        thread_unlock();
+        return FALSE;
+    }
+    journaled_cursor = playing_mpeg;
+
+    /*
+     * RESILIENCE: resume the item that was on air when we went down.
+     * FIFO mode already consumed it, so it goes back to the head; loop
+     * mode just steps the cursor back onto it.
+     */
+    if (current_uri) {
+        if (g_loop_enabled) {
+            if (playing_mpeg > 0) playing_mpeg--;
+        } else {
+            VTmpeg *mpeg = command_new_mpeg(current_uri);
+            mpeg->trim = current_trim;
+            command_index(vtq_insert(&queue, 0, mpeg));
+            journal_append(JOURNAL_INSERT, 0, mpeg->id, current_uri);
+            if (TRIM_IS_SET(mpeg->trim))
+                journal_append(JOURNAL_TRIM, 0, TRIM_PACK(mpeg->trim), NULL);
+            playing_mpeg = -1;
+        }
+        command_journal_cursor();
+        resumed = TRUE;
+    }
+
+    if (journal_wants_snapshot())
+        command_snapshot();
+
+    command_view_invalidate();
+    command_handoff_refresh(FALSE);
+    len = vtq_length(&queue);
+    thread_unlock();
+
+    log_info("Journal: restored %u queued items%s.", len, resumed ? ", resuming playback" : "");
+    if (len > 0)
+        start_playback_request();
+    return TRUE;
+}
+
+void commands_commit(void)
+{
+    journal_commit();
+}
+
+void command_playback_finished(void)
+{
+    thread_lock();
+    if (current_uri) {
+        command_announce(0, NULL, FALSE);
+        command_set_current(NULL);
+        current_trim.in = current_trim.out = 0;
+        journal_append(JOURNAL_CURRENT, 0, 0, NULL);
+        command_handoff_refresh(FALSE);
+    }
+    thread_unlock();
+}
+
+void commands_cleanup(void)
+{
+    /* Flush whatever is still buffered before the queue goes away. */
+    journal_close();
+    command_set_current(NULL);
+    command_view_invalidate();
+    command_handoff_free(g_atomic_pointer_exchange(&handoff, &handoff_none));
+    g_hash_table_destroy(id_index);
+    id_index = NULL;
+
+    /*
+     * Correctly deallocates the queue and its data, dropping each
+     * entry's reference on its interned URI.
+     */
+    vtq_clear(&queue, command_free_mpeg);
+    intern_cleanup();
 }
 
 static char *command_status(void)
 {
     char *uri = md_gst_get_current_uri();
-    gint64 pos = md_gst_get_position();
-    gint64 dur = md_gst_get_duration();
-    const char *state_str = "Standby";
+    PlaybackSnapshot snap;
 
-    if (!md_gst_is_stopped()) {
-        if (md_gst_is_playing()) state_str = "Playing";
-        else state_str = "Paused";
-    }
+    /* One coherent copy of what the main loop last saw; the pipeline is not queried. */
+    md_gst_get_snapshot(&snap);
+    gint64 pos = MAX(snap.position, 0);
+    gint64 dur = MAX(snap.duration, 0);
+    const char *state_str = md_gst_state_name(&snap);
 
     long long p_m = (pos / GST_SECOND) / 60;
     long long p_s = (pos / GST_SECOND) % 60;
@@ -66,62 +552,205 @@ static char *command_status(void)
     return g_string_free(response, FALSE);
 }
 
+/* The metrics, then each subsystem's own counters. */
+static char *command_stats (void)
+{
+    GString *out = g_string_new(NULL);
+
+    g_string_append_printf(out, "%c\n", COMMAND_OK);
+    metrics_report(out);
+    mailbox_report(out);
+    events_report(out);
+    prefetch_report(out);
+    logger_report(out);
+    g_string_append_printf(out, "%c\n", COMMAND_DELIM);
+    return g_string_free(out, FALSE);
+}
+
+/* Renders from the published view; the queue lock is not held here. */
 static char *command_list (void)
 {
-    int i = 0;
-    VTmpeg *mpeg;
-    char temp[128];
-    GList *iter = g_list_first(queue);
+    guint i;
+    QueueView *owned;
+    int rcu = rcu_read_lock();
+    QueueView *view = command_view_get(&owned);
+    int playing = g_atomic_int_get(&playing_mpeg);
     GString *response = g_string_new(NULL);
 
-    if (iter == NULL) {
+    if (view->len == 0) {
         g_string_printf(response, "%c\nEmpty list.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
-        return g_string_free(response, FALSE);
-    }
-
-    memset(temp, 0, sizeof(temp));
+    } else {
+        g_string_append_printf(response, "%c\n", COMMAND_OK);
+        g_string_append_printf(response, "VTmpeg queue list\n");
 
-    g_string_append_printf(response, "%c\n", COMMAND_OK);
-    g_string_append_printf(response, "VTmpeg queue list\n");
+        for (i = 0; i < view->len; i++) {
+            const ItemTrim *t = &view->items[i].trim;
+            char range[96] = "";
 
-    while (iter != NULL) {
-        mpeg = (VTmpeg *) iter->data;
-        if (mpeg != NULL) {
-            snprintf(temp, sizeof(temp), "- playing");
+            /* Trimmed items add [in]-[out] ([duration]); without an out point it runs to the end. */
+            if (TRIM_IS_SET(*t)) {
+                char in[32], out[32], dur[32];
 
-            g_string_append_printf(response, "%d%c%s%s\n",
-                    (i + 1), COMMAND_DELIM, mpeg->filename,
-                    (playing_mpeg - 1)==i ? temp : " ");
+                command_format_ms(in, sizeof(in), t->in);
+                command_format_ms(out, sizeof(out), t->out);
+                command_format_ms(dur, sizeof(dur), t->out - t->in);
+                if (t->out)
+                    snprintf(range, sizeof(range), "%c%s-%s (%s)", COMMAND_DELIM, in, out, dur);
+                else
+                    snprintf(range, sizeof(range), "%c%s-end", COMMAND_DELIM, in);
+            }
+            g_string_append_printf(response, "%u%c%" G_GUINT64_FORMAT "%c%s%s%s\n",
+                    i + 1, COMMAND_DELIM, view->items[i].id, COMMAND_DELIM, view->items[i].uri, range,
+                    (playing - 1) == (int) i ? "- playing" : " ");
         }
 
-        iter = g_list_next(iter);
-        i++;
+        g_string_append_printf(response, "%c\n", COMMAND_DELIM);
     }
 
-    g_string_append_printf(response, "%c\n", COMMAND_DELIM);
+    rcu_read_unlock(rcu);
+    g_free(owned);
     return g_string_free(response, FALSE);
 }
 
-static char *command_insert (const char *filename, int pos)
+/* Returns NULL if the URI is acceptable, or a static reason otherwise. */
+static const char *command_check_uri (const char *filename)
 {
-    VTmpeg *mpeg;
-    int max_pos = g_list_length(queue) + 1;
+    if (*filename == '\0')
+        return "Empty path.";
+    if (strlen(filename) >= PATH_MAX)
+        return "Path too long.";
+    if (!g_path_is_absolute(filename) && strstr(filename, "://") == NULL)
+        return "Path must be absolute or a valid URI.";
+    return NULL;
+}
 
-    if (g_list_length(queue) >= MAX_QUEUE_LEN) {
-        return g_strdup_printf("%c\nQueue is full (max %d items).\n%c\n", COMMAND_ERROR, MAX_QUEUE_LEN, COMMAND_DELIM);
+/*
+ * Parses a time into nanoseconds. Only three forms are accepted:
+ * seconds with an optional fraction ("90", "90.5"), mm:ss ("1:30") and
+ * hh:mm:ss with an optional fraction ("0:01:30.5"), where mm and ss are
+ * two digits below 60 and a fraction has at most 9 digits. Signs, hex,
+ * exponents, "inf" and "nan" are not times. A leading '+' or '-' is
+ * left to the caller. Returns FALSE if it is not a time.
+ */
+static gboolean command_parse_time (const char *text, gint64 *ns)
+{
+    const gint64 max_secs = G_MAXINT64 / GST_SECOND - 1;
+    gint64 secs = 0, frac = 0;
+    int fields = 0, digits;
+
+    for (;;) {
+        gint64 part = 0;
+
+        for (digits = 0; g_ascii_isdigit(text[digits]); digits++) {
+            if (part > (max_secs - 9) / 10)
+                return FALSE;
+            part = part * 10 + (text[digits] - '0');
+        }
+        if (digits == 0 || (fields > 0 && (digits != 2 || part >= 60)))
+            return FALSE;
+        if (secs > (max_secs - part) / 60)
+            return FALSE;
+        secs = secs * 60 + part;
+        text += digits;
+        fields++;
+        if (*text != ':' || fields == 3)
+            break;
+        text++;
     }
 
-    if (!g_path_is_absolute(filename) && strstr(filename, "://") == NULL) {
-        return g_strdup_printf("%c\nError: Path must be absolute or a valid URI.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+    /* Fractions on plain seconds and hh:mm:ss only. */
+    if (*text == '.' && fields != 2) {
+        gint64 scale = GST_SECOND;
+
+        text++;
+        for (digits = 0; g_ascii_isdigit(text[digits]); digits++) {
+            if (digits == 9)
+                return FALSE;
+            scale /= 10;
+            frac += (text[digits] - '0') * scale;
+        }
+        if (digits == 0)
+            return FALSE;
+        text += digits;
     }
 
-    if (pos <= 0 || pos > max_pos) pos = 0;
+    if (*text != '\0')
+        return FALSE;
+    *ns = secs * GST_SECOND + frac;
+    return TRUE;
+}
 
-    if (pos > 0 && playing_mpeg == pos) {
-        return g_strdup_printf("%c\nPosition busy.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+/*
+ * Parses "[in];[out]" (either may be empty) into 'trim'. Returns NULL
+ * if it is valid, or a static reason otherwise.
+ */
+static const char *command_parse_trim (const char *spec, ItemTrim *trim)
+{
+    char **f = g_strsplit(spec, ";", 2);
+    gint64 ns[2] = { 0, 0 };
+    const char *why = NULL;
+    int i;
+
+    for (i = 0; i < 2 && f[i] && !why; i++) {
+        if (*g_strstrip(f[i]) == '\0')
+            continue;
+        if (!command_parse_time(f[i], &ns[i]))
+            why = "Invalid in/out point (seconds, mm:ss or hh:mm:ss[.frac]).";
+        else if (ns[i] / GST_MSECOND > G_MAXUINT32)
+            why = "In/out point out of range.";
     }
-    
-    mpeg = (VTmpeg *) malloc(sizeof(VTmpeg));
+    g_strfreev(f);
+
+    if (!why && ns[1] != 0 && ns[1] <= ns[0])
+        why = "Out point must come after the in point.";
+    if (!why) {
+        trim->in = (guint32) (ns[0] / GST_MSECOND);
+        trim->out = (guint32) (ns[1] / GST_MSECOND);
+    }
+    return why;
+}
+
+/*
+ * A batch line is a path, or a path followed by ";[in];[out]". Only a
+ * line whose last two fields are times (or empty) is split, so a path
+ * may still contain ';'. Cuts the line at the in point; returns NULL or
+ * a static reason, as command_parse_trim().
+ */
+static const char *command_split_trim (char *line, ItemTrim *trim)
+{
+    char *p1 = NULL, *p2 = strrchr(line, ';'), *p;
+    const char *why;
+    gboolean times;
+    gint64 ns;
+
+    if (p2 == NULL)
+        return NULL;
+    for (p = line; p < p2; p++)
+        if (*p == ';')
+            p1 = p;
+    if (p1 == NULL)
+        return NULL;
+
+    *p2 = '\0';
+    times = (!p1[1] || command_parse_time(p1 + 1, &ns)) && (!p2[1] || command_parse_time(p2 + 1, &ns));
+    *p2 = ';';
+    if (!times)
+        return NULL;    /* part of the path */
+
+    if ((why = command_parse_trim(p1 + 1, trim)) == NULL)
+        *p1 = '\0';
+    return why;
+}
+
+/* "hh:mm:ss.mmm" */
+static void command_format_ms (char *buf, gsize size, guint32 ms)
+{
+    snprintf(buf, size, "%02u:%02u:%02u.%03u", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000);
+}
+
+static VTmpeg *command_new_mpeg (const char *filename)
+{
+    VTmpeg *mpeg = (VTmpeg *) malloc(sizeof(VTmpeg));
     if (mpeg == NULL) {
         /* This is a fatal error for the server */
         g_printerr("Not enough memory, server shutting down.\n");
@@ -129,22 +758,164 @@ static char *command_insert (const char *filename, int pos)
     }
 
     memset(mpeg, 0, sizeof(VTmpeg));
-    snprintf(mpeg->filename, sizeof(mpeg->filename), "%s", filename);
+    mpeg->filename = intern_ref(filename);
+    return mpeg;
+}
+
+static void command_free_mpeg (void *data)
+{
+    VTmpeg *mpeg = (VTmpeg *) data;
+
+    if (id_index)
+        g_hash_table_remove(id_index, &mpeg->id);
+    intern_unref(mpeg->filename);
+    free(mpeg);
+}
+
+static char *command_insert (const char *filename, int pos, const ItemTrim *trim)
+{
+    VTmpeg *mpeg;
+    const char *why;
+    guint len = vtq_length(&queue);
+    int max_pos = len + 1;
+
+    if (len >= max_items) {
+        return g_strdup_printf("%c\nQueue is full (max %u items).\n%c\n", COMMAND_ERROR, max_items, COMMAND_DELIM);
+    }
+
+    if ((why = command_check_uri(filename)) != NULL) {
+        return g_strdup_printf("%c\nError: %s\n%c\n", COMMAND_ERROR, why, COMMAND_DELIM);
+    }
+
+    if (pos <= 0 || pos > max_pos) pos = 0;
+
+    if (pos > 0 && playing_mpeg == pos) {
+        return g_strdup_printf("%c\nPosition busy.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+    }
+    
+    /* The URI is interned first so its real cost is known. */
+    mpeg = command_new_mpeg(filename);
+    mpeg->trim = *trim;
+    if (command_queue_bytes() + QUEUE_ENTRY_BYTES > max_bytes) {
+        command_free_mpeg(mpeg);
+        return g_strdup_printf("%c\nQueue memory limit reached (max %zu bytes).\n%c\n",
+                COMMAND_ERROR, max_bytes, COMMAND_DELIM);
+    }
 
     if (!pos)
-        queue = g_list_append(queue, mpeg);
+        command_index(vtq_insert(&queue, len, mpeg));
     else {
         if (playing_mpeg >= pos) playing_mpeg += 1;
-        queue = g_list_insert(queue, mpeg, (pos - 1));
+        command_index(vtq_insert(&queue, pos - 1, mpeg));
+    }
+    journal_append(JOURNAL_INSERT, pos ? pos - 1 : (gint32) len, mpeg->id, mpeg->filename);
+    if (TRIM_IS_SET(mpeg->trim))
+        journal_append(JOURNAL_TRIM, pos ? pos - 1 : (gint32) len, TRIM_PACK(mpeg->trim), NULL);
+    command_journal_cursor();
+    command_view_invalidate();
+    event_post(EVENT_QUEUE, "insert id=%" G_GUINT64_FORMAT " pos=%d len=%u uri=%s",
+            mpeg->id, pos ? pos : (int) len + 1, len + 1, mpeg->filename);
+
+    return g_strdup_printf("%c\nFilename %s OK\nID: %" G_GUINT64_FORMAT "\n%c\n",
+            COMMAND_OK, filename, mpeg->id, COMMAND_DELIM);
+}
+
+/*
+ * Batch insert: every URI is validated first and the batch is applied
+ * all-or-nothing, spliced into the list in a single pass. The caller
+ * holds the lock once for the whole batch.
+ */
+static char *command_insert_bulk (GPtrArray *files, int pos)
+{
+    guint i, n = files->len, bad = 0;
+    guint len = vtq_length(&queue);
+    GString *response = g_string_new(NULL);
+    GString *items = g_string_new(NULL);
+    ItemTrim *trims;
+
+    if (n == 0) {
+        g_string_free(items, TRUE);
+        g_string_printf(response, "%c\nEmpty batch.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+        return g_string_free(response, FALSE);
+    }
+    if (len + n > max_items) {
+        g_string_free(items, TRUE);
+        g_string_printf(response, "%c\nQueue is full (%u + %u exceeds max %u items).\n%c\n",
+                COMMAND_ERROR, len, n, max_items, COMMAND_DELIM);
+        return g_string_free(response, FALSE);
+    }
+
+    if (pos <= 0 || (guint)pos > len + 1) pos = 0;
+    if (pos > 0 && playing_mpeg == pos) {
+        g_string_free(items, TRUE);
+        g_string_printf(response, "%c\nPosition busy.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+        return g_string_free(response, FALSE);
+    }
+
+    trims = g_new0(ItemTrim, n);
+    for (i = 0; i < n; i++) {
+        const char *why = command_split_trim(g_ptr_array_index(files, i), &trims[i]);
+        if (!why) why = command_check_uri(g_ptr_array_index(files, i));
+        if (why) bad++;
+        g_string_append_printf(items, "%u%c%c%c%s\n", i + 1, COMMAND_DELIM,
+                why ? COMMAND_ERROR : COMMAND_OK, COMMAND_DELIM,
+                why ? why : "valid");
+    }
+
+    if (bad > 0) {
+        g_string_printf(response, "%c\nBatch rejected: %u of %u items invalid.\n%s%c\n",
+                COMMAND_ERROR, bad, n, items->str, COMMAND_DELIM);
+        g_string_free(items, TRUE);
+        g_free(trims);
+        return g_string_free(response, FALSE);
+    }
+
+    /* Build the new run of items, then splice it in as one subtree. */
+    VTmpeg **batch = g_new(VTmpeg *, n);
+    for (i = 0; i < n; i++) {
+        batch[i] = command_new_mpeg(g_ptr_array_index(files, i));
+        batch[i]->trim = trims[i];
+    }
+    g_free(trims);
+
+    if (command_queue_bytes() + n * QUEUE_ENTRY_BYTES > max_bytes) {
+        for (i = 0; i < n; i++)
+            command_free_mpeg(batch[i]);
+        g_free(batch);
+        g_string_free(items, TRUE);
+        g_string_printf(response, "%c\nQueue memory limit reached (max %zu bytes).\n%c\n",
+                COMMAND_ERROR, max_bytes, COMMAND_DELIM);
+        return g_string_free(response, FALSE);
     }
 
-    if (queue == NULL) {
-        free(mpeg);
-        return g_strdup_printf("%c\nCannot %s on the list.\n%c\n",
-                COMMAND_ERROR, !pos ? "append" : "insert", COMMAND_DELIM);
+    if (!pos) {
+        pos = len + 1;
+    } else if (playing_mpeg >= pos) {
+        playing_mpeg += n;
     }
+    vtq_insert_many(&queue, pos - 1, (void **) batch, n);
+    VTQueueNode *node = vtq_nth_node(&queue, pos - 1);
+    for (i = 0; i < n; i++, node = vtq_next(node)) {
+        command_index(node);
+        journal_append(JOURNAL_INSERT, pos - 1 + i, batch[i]->id, batch[i]->filename);
+        if (TRIM_IS_SET(batch[i]->trim))
+            journal_append(JOURNAL_TRIM, pos - 1 + i, TRIM_PACK(batch[i]->trim), NULL);
+    }
+    command_journal_cursor();
+    command_view_invalidate();
+    event_post(EVENT_QUEUE, "insert_bulk n=%u pos=%d len=%u first_id=%" G_GUINT64_FORMAT "",
+            n, pos, len + n, batch[0]->id);
+
+    g_string_truncate(items, 0);
+    for (i = 0; i < n; i++)
+        g_string_append_printf(items, "%u%c%c%c%u%c%" G_GUINT64_FORMAT "\n", i + 1, COMMAND_DELIM,
+                COMMAND_OK, COMMAND_DELIM, pos + i, COMMAND_DELIM, batch[i]->id);
+    g_free(batch);
 
-    return g_strdup_printf("%c\nFilename %s OK\n%c\n", COMMAND_OK, filename, COMMAND_DELIM);
+    g_string_printf(response, "%c\nInserted %u items at position %d.\n%s%c\n",
+            COMMAND_OK, n, pos, items->str, COMMAND_DELIM);
+    g_string_free(items, TRUE);
+    return g_string_free(response, FALSE);
 }
 
 static char *command_remove (int pos)
@@ -153,70 +924,516 @@ static char *command_remove (int pos)
 
     if (playing_mpeg == pos) {
         return g_strdup_printf("%c\nPosition busy.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
-    } else if (pos <= 0 || (guint)pos > g_list_length(queue)) {
+    } else if (pos <= 0 || (guint)pos > vtq_length(&queue)) {
         return g_strdup_printf("%c\nInvalid position.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
     }
 
-    mpeg = g_list_nth_data(queue, (pos - 1));
+    mpeg = vtq_remove(&queue, pos - 1);
     if (mpeg) {
-        queue = g_list_remove(queue, mpeg);
-        free(mpeg);
+        event_post(EVENT_QUEUE, "remove id=%" G_GUINT64_FORMAT " pos=%d len=%u", mpeg->id, pos, vtq_length(&queue));
+        command_free_mpeg(mpeg);
     } else {
         return g_strdup_printf("%c\nInvalid position.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
     }
 
     if (playing_mpeg > pos) playing_mpeg -= 1;
+    journal_append(JOURNAL_REMOVE, pos - 1, 0, NULL);
+    command_journal_cursor();
+    command_view_invalidate();
 
     return g_strdup_printf("%c\nRemove position %d OK\n%c\n", COMMAND_OK, pos, COMMAND_DELIM);
 }
 
-char *command_get_next_video(void)
+static char *command_remove_id (guint64 id)
 {
+    VTQueueNode *node = command_lookup(id);
+    int pos;
+
+    if (node == NULL)
+        return g_strdup_printf("%c\nNo such ID.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+
+    pos = vtq_node_index(node) + 1;
+    if (playing_mpeg == pos)
+        return g_strdup_printf("%c\nPosition busy.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+
+    command_free_mpeg(vtq_remove_node(&queue, node));
+    event_post(EVENT_QUEUE, "remove id=%" G_GUINT64_FORMAT " pos=%d len=%u", id, pos, vtq_length(&queue));
+    if (playing_mpeg > pos) playing_mpeg -= 1;
+    journal_append(JOURNAL_REMOVE, pos - 1, 0, NULL);
+    command_journal_cursor();
+    command_view_invalidate();
+
+    return g_strdup_printf("%c\nRemove ID %" G_GUINT64_FORMAT " OK\n%c\n", COMMAND_OK, id, COMMAND_DELIM);
+}
+
+/* Moves item 'id' right after item 'after' (0: to the head). */
+static char *command_move_id (guint64 id, guint64 after)
+{
+    VTQueueNode *node = command_lookup(id), *anchor = NULL;
     VTmpeg *mpeg;
-    char *filename_copy = NULL;
+    int from, to;
 
-    thread_lock();
+    if (node == NULL || (after && (anchor = command_lookup(after)) == NULL))
+        return g_strdup_printf("%c\nNo such ID.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+    if (after == id)
+        return g_strdup_printf("%c\nCannot move an item after itself.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
 
-    if (queue == NULL) {
-        playing_mpeg = -1;
-        thread_unlock();
-        return NULL;
+    from = vtq_node_index(node) + 1;
+    if (playing_mpeg == from)
+        return g_strdup_printf("%c\nPosition busy.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+
+    /* The target is counted once the item is unlinked. */
+    mpeg = vtq_remove_node(&queue, node);
+    to = anchor ? (int) vtq_node_index(anchor) + 1 : 0;
+    command_index(vtq_insert(&queue, to, mpeg));
+
+    /* The loop cursor follows the item it points at. */
+    if (playing_mpeg > from) playing_mpeg -= 1;
+    if (playing_mpeg > to) playing_mpeg += 1;
+    journal_append(JOURNAL_MOVE, from - 1, to, NULL);
+    command_journal_cursor();
+    command_view_invalidate();
+    event_post(EVENT_QUEUE, "move id=%" G_GUINT64_FORMAT " pos=%d len=%u", id, to + 1, vtq_length(&queue));
+
+    return g_strdup_printf("%c\nMove ID %" G_GUINT64_FORMAT " to position %d OK\n%c\n",
+            COMMAND_OK, id, to + 1, COMMAND_DELIM);
+}
+
+/* Inserts right after item 'after' (0: at the head). */
+static char *command_insert_after (const char *filename, guint64 after, const ItemTrim *trim)
+{
+    VTQueueNode *anchor = NULL;
+
+    if (after && (anchor = command_lookup(after)) == NULL)
+        return g_strdup_printf("%c\nNo such ID.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+
+    return command_insert(filename, anchor ? (int) vtq_node_index(anchor) + 2 : 1, trim);
+}
+
+static gint command_cmp_desc (gconstpointer a, gconstpointer b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x < y) - (x > y);
+}
+
+/*
+ * Batch remove: positions refer to the queue as it was before the batch.
+ * All of them are validated first; nothing is removed unless every
+ * position is valid, distinct and not currently playing.
+ */
+static char *command_remove_bulk (GArray *positions)
+{
+    guint i, n = positions->len, bad = 0;
+    guint len = vtq_length(&queue);
+    GString *response = g_string_new(NULL);
+    GString *items = g_string_new(NULL);
+    guint8 *seen;
+
+    if (n == 0) {
+        g_string_free(items, TRUE);
+        g_string_printf(response, "%c\nEmpty batch.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+        return g_string_free(response, FALSE);
     }
 
-    if (g_loop_enabled) {
-        /* LOOPING MODE: Cycle through the list using an index. */
-        if (playing_mpeg < 0) playing_mpeg = 0;
+    seen = g_malloc0(len + 1);
+    for (i = 0; i < n; i++) {
+        int pos = g_array_index(positions, int, i);
+        const char *why = NULL;
 
-        int len = (int)g_list_length(queue);
-        if (playing_mpeg >= len) {
-            /* Wrap around */
-            playing_mpeg = 0;
+        if (pos <= 0 || (guint)pos > len) why = "Invalid position.";
+        else if (playing_mpeg == pos) why = "Position busy.";
+        else if (seen[pos]) why = "Duplicate position.";
+        else seen[pos] = 1;
+
+        if (why) bad++;
+        g_string_append_printf(items, "%u%c%c%c%s\n", i + 1, COMMAND_DELIM,
+                why ? COMMAND_ERROR : COMMAND_OK, COMMAND_DELIM,
+                why ? why : "valid");
+    }
+    g_free(seen);
+
+    if (bad > 0) {
+        g_string_printf(response, "%c\nBatch rejected: %u of %u items invalid.\n%s%c\n",
+                COMMAND_ERROR, bad, n, items->str, COMMAND_DELIM);
+        g_string_free(items, TRUE);
+        return g_string_free(response, FALSE);
+    }
+
+    g_string_truncate(items, 0);
+    for (i = 0; i < n; i++)
+        g_string_append_printf(items, "%u%c%c%cremoved %d\n", i + 1, COMMAND_DELIM,
+                COMMAND_OK, COMMAND_DELIM, g_array_index(positions, int, i));
+
+    /* Remove in descending order so earlier positions stay valid. */
+    GArray *sorted = g_array_sized_new(FALSE, FALSE, sizeof(int), n);
+    g_array_append_vals(sorted, positions->data, n);
+    g_array_sort(sorted, command_cmp_desc);
+
+    int shift = 0;
+    for (i = 0; i < n; i++) {
+        int pos = g_array_index(sorted, int, i);
+
+        command_free_mpeg(vtq_remove(&queue, pos - 1));
+        journal_append(JOURNAL_REMOVE, pos - 1, 0, NULL);
+        if (playing_mpeg > pos) shift++;
+    }
+    playing_mpeg -= shift;
+    command_journal_cursor();
+    command_view_invalidate();
+    g_array_free(sorted, TRUE);
+    event_post(EVENT_QUEUE, "remove_bulk n=%u len=%u", n, vtq_length(&queue));
+
+    g_string_printf(response, "%c\nRemoved %u items.\n%s%c\n",
+            COMMAND_OK, n, items->str, COMMAND_DELIM);
+    g_string_free(items, TRUE);
+    return g_string_free(response, FALSE);
+}
+
+/*
+ * Parses a batch payload: "<cmd> <arg>\n<item>\n<item>\n...".
+ * Returns the first-line argument; items are appended to 'lines'.
+ */
+static int command_parse_batch (const char *payload, GPtrArray *lines)
+{
+    const char *p = payload;
+    int arg;
+
+    while (*p && *p != ' ' && *p != '\n') p++;
+    arg = atoi(p);
+    p = strchr(p, '\n');
+
+    while (p && *p) {
+        const char *start = ++p;
+        const char *end = strchr(start, '\n');
+        gsize n = end ? (gsize)(end - start) : strlen(start);
+
+        if (n > 0 && start[n - 1] == '\r') n--;
+        if (n > 0) g_ptr_array_add(lines, g_strndup(start, n));
+        p = end;
+    }
+
+    return arg;
+}
+
+/* Arguments of a command, i.e. what follows "<id> ", or NULL. */
+static const char *command_args (const char *payload)
+{
+    const char *p = strchr(payload, ' ');
+    return p ? p + 1 : NULL;
+}
+
+static char *command_limits (const char *args)
+{
+    guint64 items = 0, bytes = 0;
+
+    if (args && sscanf(args, "%" G_GUINT64_FORMAT ";%" G_GUINT64_FORMAT, &items, &bytes) >= 1) {
+        if (items > max_items_ceiling || bytes > max_bytes_ceiling) {
+            return g_strdup_printf("%c\nLimits may not exceed the startup values (%u items, %zu bytes).\n%c\n",
+                    COMMAND_ERROR, max_items_ceiling, max_bytes_ceiling, COMMAND_DELIM);
         }
+        if (items > 0) max_items = (guint) items;
+        if (bytes > 0) max_bytes = (gsize) bytes;
+    }
+
+    return g_strdup_printf("%c\nItems: %u / %u\nMemory: %zu / %zu bytes\nDistinct URIs: %u\n%c\n",
+            COMMAND_OK, vtq_length(&queue), max_items, command_queue_bytes(), max_bytes,
+            intern_count(), COMMAND_DELIM);
+}
 
-        mpeg = g_list_nth_data(queue, playing_mpeg);
-        if (mpeg) {
-            filename_copy = g_strdup(mpeg->filename);
-            playing_mpeg++;
+/* Sets the log verbosity if a level is given; reports it either way. */
+static char *command_log_level (const char *args)
+{
+    if (args && *args) {
+        int level = logger_parse_level(args);
+
+        if (level < 0) {
+            return g_strdup_printf("%c\nUnknown log level: %s (error, warning, info, debug).\n%c\n",
+                    COMMAND_ERROR, args, COMMAND_DELIM);
         }
-    } else {
-        /* FIFO MODE: Consume from the head of the list. */
-        GList *head_link = g_list_first(queue);
-        if (head_link) {
-            mpeg = (VTmpeg *)head_link->data;
-            filename_copy = g_strdup(mpeg->filename);
-
-            /* Consume the item: remove from list and free memory */
-            queue = g_list_remove(queue, mpeg);
-            free(mpeg);
-            playing_mpeg = 0;
+        logger_set_level((LogLevel) level);
+        log_info("Log level set to %s.", logger_level_name());
+    }
+    return g_strdup_printf("%c\nLog level: %s\n%c\n", COMMAND_OK, logger_level_name(), COMMAND_DELIM);
+}
+
+typedef enum {
+    GRAPHICS_WATERMARK = 0,
+    GRAPHICS_BUG,
+    GRAPHICS_CLOCK,
+    GRAPHICS_LOWER_THIRD,
+    GRAPHICS_TICKER,
+    GRAPHICS_STANDBY
+} GraphicsLayer;
+
+typedef struct {
+    const char   *name;
+    GraphicsLayer layer;
+    int           fields;   /* split limit; the last field takes any further ';' */
+    int           corner;   /* default corner, or -1 if the layer has no corner field */
+} GraphicsLayerSpec;
+
+static const GraphicsLayerSpec graphics_layers[] = {
+    { "watermark", GRAPHICS_WATERMARK,   2, -1 },
+    { "bug",       GRAPHICS_BUG,         3, OVERLAY_TOP_RIGHT },
+    { "clock",     GRAPHICS_CLOCK,       3, OVERLAY_TOP_LEFT },
+    { "lower",     GRAPHICS_LOWER_THIRD, 4, -1 },
+    { "ticker",    GRAPHICS_TICKER,      3, -1 },
+    { "standby",   GRAPHICS_STANDBY,     4, -1 }
+};
+
+static const GraphicsLayerSpec *command_graphics_layer (const char *args)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(graphics_layers); i++) {
+        gsize len = strlen(graphics_layers[i].name);
+        if (strncmp(args, graphics_layers[i].name, len) == 0 && (args[len] == '\0' || args[len] == ';'))
+            return &graphics_layers[i];
+    }
+    return NULL;
+}
+
+/* Standby countdown target: unix time, "+seconds" from now, or 0 for none. */
+static gint64 command_countdown_target (const char *s)
+{
+    if (s == NULL || *s == '\0')
+        return 0;
+    if (*s == '+')
+        return g_get_real_time() / G_USEC_PER_SEC + g_ascii_strtoll(s + 1, NULL, 10);
+    return g_ascii_strtoll(s, NULL, 10);
+}
+
+/*
+ * GRAPHICS [layer];[args]: sets one on-air graphics layer, or takes it
+ * off air when it comes without args, or sets the standby card. Without
+ * a layer it reports them all. Never touches the queue.
+ */
+static char *command_graphics (const char *args)
+{
+    const GraphicsLayerSpec *spec;
+    const char *format;
+    char **f = NULL;
+    char *error = NULL;
+    GString *out;
+    guint n;
+    int corner;
+
+    if (args && *args) {
+        if ((spec = command_graphics_layer(args)) == NULL) {
+            return g_strdup_printf("%c\nUnknown layer (watermark, bug, clock, lower, ticker, standby).\n%c\n",
+                    COMMAND_ERROR, COMMAND_DELIM);
+        }
+
+        f = g_strsplit(args, ";", spec->fields);
+        n = g_strv_length(f);
+        corner = spec->corner;
+        if (spec->corner >= 0 && n > 2 && (corner = overlay_parse_corner(f[2])) < 0)
+            error = g_strdup_printf("Unknown corner: %s (tl, tr, bl, br).", f[2]);
+
+        if (!error) {
+            switch (spec->layer) {
+                case GRAPHICS_WATERMARK:
+                    overlay_set_watermark(n > 1 ? f[1] : NULL);
+                    break;
+                case GRAPHICS_BUG:
+                    if (!overlay_set_bug(n > 1 ? f[1] : NULL, (OverlayCorner) corner))
+                        error = g_strdup_printf("Cannot load PNG image: %s", f[1]);
+                    break;
+                case GRAPHICS_CLOCK:
+                    /* No args: off air; an empty format: the default one. */
+                    if (n < 2)
+                        format = NULL;
+                    else if (*f[1] == '\0')
+                        format = GRAPHICS_CLOCK_FORMAT;
+                    else
+                        format = f[1];
+                    overlay_set_clock(format, (OverlayCorner) corner);
+                    break;
+                case GRAPHICS_LOWER_THIRD:
+                    overlay_set_lower_third(n > 1 ? f[1] : NULL, n > 2 ? f[2] : NULL,
+                            n > 3 ? (guint) atoi(f[3]) : GRAPHICS_LOWER_THIRD_SECS);
+                    break;
+                case GRAPHICS_TICKER:
+                    overlay_set_ticker(n > 1 ? f[1] : NULL, n > 2 ? (guint) atoi(f[2]) : 0);
+                    break;
+                case GRAPHICS_STANDBY:
+                    if (!standby_set_card(n > 1 ? f[1] : NULL, n > 2 ? f[2] : NULL,
+                            command_countdown_target(n > 3 ? f[3] : NULL)))
+                        error = g_strdup_printf("Cannot load PNG image: %s", f[2]);
+                    break;
+            }
+        }
+        g_strfreev(f);
+        if (error) {
+            char *reply = g_strdup_printf("%c\n%s\n%c\n", COMMAND_ERROR, error, COMMAND_DELIM);
+            g_free(error);
+            return reply;
+        }
+    }
+
+    out = g_string_new(NULL);
+    g_string_append_printf(out, "%c\n", COMMAND_OK);
+    overlay_report(out);
+    standby_report(out);
+    g_string_append_printf(out, "%c\n", COMMAND_DELIM);
+    return g_string_free(out, FALSE);
+}
+
+/* Reply for a playback command handed to the control mailbox. */
+static char *command_control (gboolean posted, const char *msg)
+{
+    if (!posted)
+        return g_strdup_printf("%c\nControl mailbox full, command dropped.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+    return g_strdup_printf("%c\n%s\n%c\n", COMMAND_OK, msg, COMMAND_DELIM);
+}
+
+/* SEEK [[+|-]time];[key|accurate]: seeks within the item on air. */
+static char *command_seek (const char *args)
+{
+    char **f;
+    const char *t;
+    guint flags = 0;
+    gint64 ns;
+    gboolean ok;
+
+    f = g_strsplit(args ? args : "", ";", 2);
+    t = f[0] ? f[0] : "";
+    if (*t == '+' || *t == '-')
+        flags |= SEEK_RELATIVE;
+    ok = command_parse_time(t + (flags & SEEK_RELATIVE ? 1 : 0), &ns);
+    if (ok && *t == '-')
+        ns = -ns;
+    if (ok && f[0] && f[1] && *f[1]) {
+        if (g_ascii_strcasecmp(f[1], "accurate") == 0)
+            flags |= SEEK_ACCURATE;
+        else if (g_ascii_strcasecmp(f[1], "key") != 0)
+            ok = FALSE;
+    }
+    g_strfreev(f);
+
+    if (!ok) {
+        return g_strdup_printf("%c\nUsage: SEEK [+|-]seconds|mm:ss|hh:mm:ss[.frac];[key|accurate]\n%c\n",
+                COMMAND_ERROR, COMMAND_DELIM);
+    }
+    return command_control(seek_playback_request(ns, flags), "Seek requested.");
+}
+
+/* RATE [rate]: sets the playback rate of the item on air. */
+static char *command_rate (const char *args)
+{
+    gdouble rate = 0.0;
+    char *end = NULL;
+
+    if (args && *args)
+        rate = g_ascii_strtod(args, &end);
+    if (!end || *end != '\0' || ABS(rate) < SEEK_RATE_MIN || ABS(rate) > SEEK_RATE_MAX) {
+        return g_strdup_printf("%c\nUsage: RATE [rate], nonzero, 1/64 to 64 either way (-1 plays in reverse).\n%c\n",
+                COMMAND_ERROR, COMMAND_DELIM);
+    }
+    return command_control(rate_playback_request(rate), "Rate change requested.");
+}
+
+void command_skip_videos(guint n)
+{
+    guint len;
+
+    thread_lock();
+    len = vtq_length(&queue);
+
+    if (len > 0 && n > 0) {
+        if (g_loop_enabled) {
+            /* Same wrap rule as command_get_next_video(). */
+            if (playing_mpeg < 0 || (guint) playing_mpeg >= len) playing_mpeg = 0;
+            playing_mpeg = (playing_mpeg + n) % len;
+            command_journal_cursor();
+        } else {
+            guint dropped = 0;
+
+            while (n-- > 0 && vtq_length(&queue) > 0) {
+                command_free_mpeg(vtq_remove(&queue, 0));
+                journal_append(JOURNAL_REMOVE, 0, 0, NULL);
+                dropped++;
+            }
+            command_view_invalidate();
+            event_post(EVENT_QUEUE, "skip n=%u len=%u", dropped, vtq_length(&queue));
         }
     }
+    command_handoff_refresh(FALSE);
 
     thread_unlock();
+}
+
+/*
+ * What command_get_next_video() would return now, without consuming
+ * it; the backend pre-rolls it. Takes the read lock only.
+ */
+char *command_peek_next_video(guint64 *id, ItemTrim *trim)
+{
+    VTQueueNode *node;
+    char *filename_copy = NULL;
+
+    thread_rdlock();
+    if ((node = command_next_node()) != NULL) {
+        filename_copy = g_strdup(((VTmpeg *) node->data)->filename);
+        if (id) *id = ((VTmpeg *) node->data)->id;
+        if (trim) *trim = ((VTmpeg *) node->data)->trim;
+    }
+    thread_unlock();
+
     return filename_copy;
 }
 
-char *command_process(const char *payload)
+/*
+ * The next n items in play order (the item command_get_next_video()
+ * returns first), as newly allocated strings; for the prefetcher.
+ */
+GPtrArray *command_upcoming_videos(guint n)
+{
+    GPtrArray *out = g_ptr_array_new_with_free_func(g_free);
+    guint len, start = 0, i;
+
+    thread_rdlock();
+    len = vtq_length(&queue);
+    if (g_loop_enabled && playing_mpeg > 0 && (guint) playing_mpeg < len)
+        start = playing_mpeg;
+    /* Wraps in loop mode, but never yields an item twice. */
+    for (i = 0; i < n && i < len; i++) {
+        VTmpeg *mpeg = vtq_nth(&queue, (start + i) % len);
+        g_ptr_array_add(out, g_strdup(mpeg->filename));
+    }
+    thread_unlock();
+
+    return out;
+}
+
+char *command_get_next_video(guint64 *id, ItemTrim *trim)
+{
+    VTQueueNode *node;
+    char *filename_copy = NULL;
+
+    thread_lock();
+
+    if ((node = command_next_node()) == NULL) {
+        playing_mpeg = -1;
+        command_journal_cursor();
+    } else {
+        filename_copy = g_strdup(((VTmpeg *) node->data)->filename);
+        if (id) *id = ((VTmpeg *) node->data)->id;
+        if (trim) *trim = ((VTmpeg *) node->data)->trim;
+        command_advance(node, FALSE);
+    }
+    command_handoff_refresh(FALSE);
+
+    thread_unlock();
+
+    if (filename_copy) {
+        prefetch_played(filename_copy);
+        prefetch_kick();
+    }
+    return filename_copy;
+}
+
+static char *command_dispatch(const char *payload)
 {
     int command_id = atoi(payload);
     char *response = NULL;
@@ -224,40 +1441,74 @@ char *command_process(const char *payload)
     size_t payload_len = strlen(payload);
 
     /*
-     * DEADLOCK FIX: COMMAND_STATUS accesses the backend state via md_gst_get_current_uri(),
-     * which acquires the lock itself. We must NOT hold the lock here for STATUS, or we 
-     * will deadlock because PTHREAD_MUTEX_INITIALIZER is non-recursive.
+     * Read-only commands never take the queue write lock: STATUS reads
+     * the backend's RCU-published state and LIST renders a queue view.
+     * LOG_LEVEL, STATS and GRAPHICS do not touch the queue at all, nor
+     * do SEEK and RATE, which only post to the control mailbox.
+     */
+    switch (command_id) {
+        case COMMAND_STATUS:
+            return command_status();
+        case COMMAND_LIST:
+            return command_list();
+        case COMMAND_LOG_LEVEL:
+            return command_log_level(command_args(payload));
+        case COMMAND_STATS:
+            return command_stats();
+        case COMMAND_GRAPHICS:
+            return command_graphics(command_args(payload));
+        case COMMAND_SEEK:
+            return command_seek(command_args(payload));
+        case COMMAND_RATE:
+            return command_rate(command_args(payload));
+        case COMMAND_SUBSCRIBE:
+            /* unix.c takes it before it gets here on a text connection. */
+            return g_strdup_printf("%c\nSUBSCRIBE needs its own text-mode connection.\n%c\n",
+                    COMMAND_ERROR, COMMAND_DELIM);
+        default:
+            break;
+    }
+
+    /*
+     * Batch payloads are parsed before taking the lock so the whole batch
+     * is applied under a single, short lock acquisition.
      */
-    if (command_id == COMMAND_STATUS) {
-        return command_status();
+    GPtrArray *batch = NULL;
+    int batch_arg = 0;
+    if (command_id == COMMAND_INSERT_BULK || command_id == COMMAND_REMOVE_BULK) {
+        batch = g_ptr_array_new_with_free_func(g_free);
+        batch_arg = command_parse_batch(payload, batch);
     }
 
     /* Locking must be handled here to protect queue mutations */
     thread_lock();
-    was_empty = (queue == NULL);
+    was_empty = (vtq_length(&queue) == 0);
 
     switch (command_id) {
-        case COMMAND_LIST:
-            response = command_list();
-            break;
-
-        /* COMMAND_STATUS handled above to prevent deadlock */
+        /* COMMAND_LIST and COMMAND_STATUS are handled above, lock-free */
 
         case COMMAND_INSERT: {
             if (payload_len > 2) {
-                int pos = 0;
+                int pos = 0, used = 0;
                 int items_matched;
                 char filename[PATH_MAX];
                 char fmt[64];
+                ItemTrim trim = { 0, 0 };
+                const char *why = NULL;
 
                 memset(filename, 0, sizeof(filename));
-                snprintf(fmt, sizeof(fmt), "%%%zu[^;];%%d\n", sizeof(filename) - 1);
-                items_matched = sscanf(payload + 2, fmt, filename, &pos);
+                snprintf(fmt, sizeof(fmt), "%%%zu[^;];%%d%%n", sizeof(filename) - 1);
+                items_matched = sscanf(payload + 2, fmt, filename, &pos, &used);
+                /* Optional in and out points: [filename];[pos];[in];[out] */
+                if (items_matched == 2 && payload[2 + used] == ';')
+                    why = command_parse_trim(payload + 2 + used + 1, &trim);
 
                 if (items_matched != 2) {
                     response = g_strdup_printf("%c\nInvalid IPC payload for INSERT.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+                } else if (why) {
+                    response = g_strdup_printf("%c\nError: %s\n%c\n", COMMAND_ERROR, why, COMMAND_DELIM);
                 } else {
-                    response = command_insert(filename, pos);
+                    response = command_insert(filename, pos, &trim);
                 }
             } else {
                 response = g_strdup_printf("%c\nInvalid IPC payload length.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
@@ -279,27 +1530,91 @@ char *command_process(const char *payload)
             break;
         }
 
+        case COMMAND_REMOVE_ID: {
+            const char *args = command_args(payload);
+            guint64 id;
+
+            if (args && sscanf(args, "%" G_GUINT64_FORMAT, &id) == 1) {
+                response = command_remove_id(id);
+            } else {
+                response = g_strdup_printf("%c\nInvalid IPC payload format.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+            }
+            break;
+        }
+
+        case COMMAND_MOVE_ID: {
+            const char *args = command_args(payload);
+            guint64 id, after;
+
+            if (args && sscanf(args, "%" G_GUINT64_FORMAT ";%" G_GUINT64_FORMAT, &id, &after) == 2) {
+                response = command_move_id(id, after);
+            } else {
+                response = g_strdup_printf("%c\nInvalid IPC payload format.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+            }
+            break;
+        }
+
+        case COMMAND_INSERT_AFTER: {
+            const char *args = command_args(payload);
+            char filename[PATH_MAX];
+            char fmt[64];
+            guint64 after = 0;
+            ItemTrim trim = { 0, 0 };
+            const char *why = NULL;
+            int used = 0;
+
+            memset(filename, 0, sizeof(filename));
+            snprintf(fmt, sizeof(fmt), "%%%zu[^;];%%" G_GUINT64_FORMAT "%%n", sizeof(filename) - 1);
+            if (args && sscanf(args, fmt, filename, &after, &used) == 2 && args[used] == ';')
+                why = command_parse_trim(args + used + 1, &trim);
+
+            if (used > 0 && why) {
+                response = g_strdup_printf("%c\nError: %s\n%c\n", COMMAND_ERROR, why, COMMAND_DELIM);
+            } else if (used > 0) {
+                response = command_insert_after(filename, after, &trim);
+            } else {
+                response = g_strdup_printf("%c\nInvalid IPC payload for INSERT_AFTER.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+            }
+            break;
+        }
+
+        case COMMAND_INSERT_BULK:
+            response = command_insert_bulk(batch, batch_arg);
+            break;
+
+        case COMMAND_REMOVE_BULK: {
+            guint i;
+            GArray *positions = g_array_sized_new(FALSE, FALSE, sizeof(int), batch->len);
+            for (i = 0; i < batch->len; i++) {
+                int pos = atoi(g_ptr_array_index(batch, i));
+                g_array_append_val(positions, pos);
+            }
+            response = command_remove_bulk(positions);
+            g_array_free(positions, TRUE);
+            break;
+        }
+
+        case COMMAND_LIMITS:
+            response = command_limits(payload_len > 2 ? payload + 2 : NULL);
+            break;
+
         case COMMAND_PLAY:
             /* Start or Resume playback */
-            resume_playback_request();
             /* If it was empty, start_playback_request below will handle it too. */
-            response = g_strdup_printf("%c\nPlayback resume requested.\n%c\n", COMMAND_OK, COMMAND_DELIM);
+            response = command_control(resume_playback_request(), "Playback resume requested.");
             break;
             
         case COMMAND_NEXT:
             /* Skip forward in the queue */
-            skip_playback_request();
-            response = g_strdup_printf("%c\nSkip requested.\n%c\n", COMMAND_OK, COMMAND_DELIM);
+            response = command_control(skip_playback_request(), "Skip requested.");
             break;
 
         case COMMAND_PAUSE:
-            pause_playback_request();
-            response = g_strdup_printf("%c\nPlayback pause requested.\n%c\n", COMMAND_OK, COMMAND_DELIM);
+            response = command_control(pause_playback_request(), "Playback pause requested.");
             break;
 
         case COMMAND_STOP:
-            stop_playback_request();
-            response = g_strdup_printf("%c\nPlayback stop requested.\n%c\n", COMMAND_OK, COMMAND_DELIM);
+            response = command_control(stop_playback_request(), "Playback stop requested.");
             break;
 
         case COMMAND_PREV: {
@@ -309,19 +1624,22 @@ char *command_process(const char *payload)
                 int t;
                 /* playing_mpeg points to the NEXT item to play.
                    So, current = -1, prev = -2. */
-                if ((t = playing_mpeg - 2) < 0) t = g_list_length(queue) - 1;
-                
-                playing_mpeg = t;
-                skip_playback_request(); /* Must use skip to force pipeline transition, resume is passive */
+                if ((t = playing_mpeg - 2) < 0) t = vtq_length(&queue) - 1;
                 
-                response = g_strdup_printf("%c\nSkipping to previous video.\n%c\n", COMMAND_OK, COMMAND_DELIM);
+                /* Must use skip to force pipeline transition, resume is passive.
+                   The main loop cannot pick the next item before we unlock. */
+                gboolean posted = skip_playback_request();
+                if (posted) {
+                    playing_mpeg = t;
+                    command_journal_cursor();
+                }
+                response = command_control(posted, "Skipping to previous video.");
             }
             break;
         }
 
         case COMMAND_MUTE:
-            mute_playback_request();
-            response = g_strdup_printf("%c\nMute toggle requested.\n%c\n", COMMAND_OK, COMMAND_DELIM);
+            response = command_control(mute_playback_request(), "Mute toggle requested.");
             break;
 
         default:
@@ -329,11 +1647,33 @@ char *command_process(const char *payload)
             break;
     }
 
-    if (was_empty && queue != NULL) {
+    if (was_empty && vtq_length(&queue) > 0) {
         start_playback_request();
     }
 
+    if (journal_wants_snapshot())
+        command_snapshot();
+
+    /* Queue or cursor may have changed: re-resolve the gapless handoff. */
+    command_handoff_refresh(FALSE);
     thread_unlock();
+
+    /* The next item may have changed: let the backend re-check its pre-roll. */
+    md_gst_queue_changed();
+    prefetch_kick();
+
+    if (batch)
+        g_ptr_array_unref(batch);
     
     return response;
 }
+
+/* Every protocol command goes through here; counted and timed by type. */
+char *command_process(const char *payload)
+{
+    gint64 started = metrics_now();
+    char *response = command_dispatch(payload);
+
+    metrics_command(atoi(payload), metrics_now() - started);
+    return response;
+}
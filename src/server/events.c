@@ -0,0 +1,238 @@
+/*
+ * Event broadcaster for SUBSCRIBE connections.
+ *
+ * Producers (the main loop, the IPC workers) post one-line events into a
+ * bounded multi-producer/single-consumer ring, the same slot-sequence
+ * design as the control mailbox: posting never blocks and takes no
+ * lock, and with nobody subscribed it returns before formatting
+ * anything. The IPC thread is the only consumer. It drains the ring
+ * only up to a mark taken before a journal commit (so a queue event
+ * never reaches a subscriber before the mutation is durable) and fans
+ * every event out to the subscribers that asked for its class. Fan-out
+ * and the per-subscriber backlog limit live in unix.c.
+ *
+ * A full ring drops the event and counts it; the next drain tells every
+ * subscriber how many were lost.
+ */
+
+#include "VTserver.h"
+#include <sys/eventfd.h>
+
+/* Slots in the ring; a power of two. */
+#define EVENTS_SIZE      512
+#define EVENTS_MASK      (EVENTS_SIZE - 1)
+/* Longer event texts are truncated. */
+#define EVENTS_TEXT_MAX  1024
+
+typedef struct {
+    gint    seq;
+    gint    cls;
+    gint64  time;       /* real time, ms */
+    char    text[EVENTS_TEXT_MAX];
+} EventSlot;
+
+static EventSlot slots[EVENTS_SIZE];
+static gint      head = 0;          /* next slot to claim (producers) */
+static guint     tail = 0;          /* next slot to drain (IPC thread only) */
+static gint      wake_armed = 0;
+static int       wake_fd = -1;
+static gint      subscribers = 0;
+
+static gint      stat_posted = 0;
+static gint      stat_lost = 0;
+static gint      lost_reported = 0;    /* IPC thread only */
+static gint      stat_slow = 0;
+
+static const char *class_names[] = { "state", "item", "queue", "error", "progress" };
+
+/* Returns the eventfd the consumer waits on; -1 if it cannot be created. */
+int events_init (void)
+{
+    guint i;
+
+    for (i = 0; i < EVENTS_SIZE; i++)
+        slots[i].seq = (gint) i;
+
+    if (wake_fd < 0 && (wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        log_error("eventfd: %s", g_strerror(errno));
+    return wake_fd;
+}
+
+void events_finish (void)
+{
+    if (wake_fd >= 0)
+        close(wake_fd);
+    wake_fd = -1;
+}
+
+static void events_wake (void)
+{
+    guint64 one = 1;
+
+    if (g_atomic_int_compare_and_exchange(&wake_armed, 0, 1)) {
+        ssize_t r = write(wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+/* Posts an event of class 'cls'; safe from any thread, never blocks. */
+void event_post (EventClass cls, const char *fmt, ...)
+{
+    guint pos;
+    EventSlot *slot;
+    va_list ap;
+
+    if (g_atomic_int_get(&subscribers) == 0 || wake_fd < 0)
+        return;
+
+    pos = (guint) g_atomic_int_get(&head);
+    for (;;) {
+        slot = &slots[pos & EVENTS_MASK];
+        gint diff = (gint) ((guint) g_atomic_int_get(&slot->seq) - pos);
+
+        if (diff == 0) {
+            if (g_atomic_int_compare_and_exchange(&head, (gint) pos, (gint) (pos + 1)))
+                break;
+            pos = (guint) g_atomic_int_get(&head);
+        } else if (diff < 0) {
+            /* Full: the IPC thread has not drained this slot yet. */
+            g_atomic_int_inc(&stat_lost);
+            events_wake();
+            return;
+        } else {
+            pos = (guint) g_atomic_int_get(&head);
+        }
+    }
+
+    slot->cls = cls;
+    slot->time = g_get_real_time() / 1000;
+    va_start(ap, fmt);
+    vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+    va_end(ap);
+    g_atomic_int_set(&slot->seq, (gint) (pos + 1));
+    g_atomic_int_inc(&stat_posted);
+
+    events_wake();
+}
+
+/*
+ * Formats one event line: "<time ms> <class> <text>\n". 'cls' 0 is the
+ * "lost" notice, which every subscriber gets.
+ */
+void events_format (GString *line, gint64 time, EventClass cls, const char *text)
+{
+    g_string_printf(line, "%" G_GINT64_FORMAT " %s %s\n", time, cls ? event_class_name(cls) : "lost", text);
+}
+
+/* Position of the next event to be posted: a mark for events_drain(). Any thread. */
+guint events_mark (void)
+{
+    return (guint) g_atomic_int_get(&head);
+}
+
+/*
+ * IPC thread: passes every queued event posted before 'upto' (a mark),
+ * formatted, to 'fn'. Returns the number of events drained.
+ */
+guint events_drain (guint upto, EventFunc fn, gpointer data)
+{
+    GString *line = g_string_sized_new(256);
+    guint64 count;
+    gint lost;
+    guint n = 0;
+
+    /* Re-arm first: anything posted from here on signals again. */
+    g_atomic_int_set(&wake_armed, 0);
+    if (read(wake_fd, &count, sizeof(count)) < 0)
+        count = 0;
+
+    while (tail != upto) {
+        EventSlot *slot = &slots[tail & EVENTS_MASK];
+
+        if ((gint) ((guint) g_atomic_int_get(&slot->seq) - (tail + 1)) < 0)
+            break;
+
+        events_format(line, slot->time, (EventClass) slot->cls, slot->text);
+        fn((EventClass) slot->cls, line->str, line->len, data);
+        g_atomic_int_set(&slot->seq, (gint) (tail + EVENTS_SIZE));
+        tail++;
+        n++;
+    }
+
+    if ((lost = g_atomic_int_get(&stat_lost)) != lost_reported) {
+        char text[32];
+
+        g_snprintf(text, sizeof(text), "%d", lost - lost_reported);
+        events_format(line, g_get_real_time() / 1000, 0, text);
+        fn(0, line->str, line->len, data);
+        lost_reported = lost;
+    }
+
+    g_string_free(line, TRUE);
+    return n;
+}
+
+void events_subscribe (void)
+{
+    g_atomic_int_inc(&subscribers);
+}
+
+/* 'slow': the subscriber was dropped for not reading its events. */
+void events_unsubscribe (gboolean slow)
+{
+    g_atomic_int_add(&subscribers, -1);
+    if (slow)
+        g_atomic_int_inc(&stat_slow);
+}
+
+const char *event_class_name (EventClass cls)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(class_names); i++) {
+        if (cls == (EventClass) (1 << i))
+            return class_names[i];
+    }
+    return "?";
+}
+
+/*
+ * Parses a comma-separated class list ("item,queue", "all"). Returns
+ * FALSE on an unknown name.
+ */
+gboolean events_parse_classes (const char *list, guint *mask)
+{
+    char **names = g_strsplit(list, ",", -1);
+    gboolean ok = TRUE;
+    guint i, j;
+
+    *mask = 0;
+    for (i = 0; names[i] && ok; i++) {
+        char *name = g_strstrip(names[i]);
+
+        if (*name == '\0')
+            continue;
+        if (g_ascii_strcasecmp(name, "all") == 0) {
+            *mask |= EVENT_ALL;
+            continue;
+        }
+        for (j = 0; j < G_N_ELEMENTS(class_names); j++) {
+            if (g_ascii_strcasecmp(name, class_names[j]) == 0)
+                break;
+        }
+        if (j == G_N_ELEMENTS(class_names))
+            ok = FALSE;
+        else
+            *mask |= 1 << j;
+    }
+    g_strfreev(names);
+    return ok;
+}
+
+/* Appends the broadcaster counters to a STATS response. */
+void events_report (GString *out)
+{
+    g_string_append_printf(out, "Events: %d subscribers, %d posted, %d lost, %d slow subscribers dropped\n",
+            g_atomic_int_get(&subscribers), g_atomic_int_get(&stat_posted),
+            g_atomic_int_get(&stat_lost), g_atomic_int_get(&stat_slow));
+}
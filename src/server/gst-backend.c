@@ -1,18 +1,126 @@
 #include "VTserver.h"
-#include <cairo.h>
 
+/*
+ * A/B pre-roll. Two identically built pipelines ("decks"): the live one
+ * is on air and 'playbin' points at it; the standby one pre-rolls the
+ * next queue item to PAUSED in the background, its first frame decoded
+ * but not shown. A skip (or start) that lands on exactly that item, by
+ * queue ID, swaps the decks: the standby goes to PLAYING, which puts
+ * the pre-rolled frame on air at once, and the old deck stops and is
+ * torn down off the main loop before it pre-rolls the item after. If
+ * the queue changed and the next item is not the pre-rolled one, the
+ * live pipeline is rebuilt as before.
+ *
+ * Items with in/out points play as a segment: a flushing seek to the in
+ * point with the out point as its stop, so the demuxer ends the stream
+ * there and nothing is re-encoded. The standby deck seeks before it
+ * reports ready, a rebuilt live deck before it leaves PAUSED. A trimmed
+ * item handed to playbin on about-to-finish cannot be seeked before its
+ * stream starts, so the live deck's sinks drop its buffers from its
+ * STREAM_START until the seek to the in point flushes them; the last
+ * frame of the item before stays on screen meanwhile.
+ */
+typedef enum {
+    STANDBY_IDLE = 0,       /* NULL state, free to pre-roll */
+    STANDBY_PREROLLING,     /* going to PAUSED */
+    STANDBY_SEEKING,        /* PAUSED, seeking to the item's in point */
+    STANDBY_READY,          /* PAUSED, first frame decoded */
+    STANDBY_TEARDOWN        /* going to NULL off the main loop */
+} StandbyState;
+
+typedef struct {
+    GstElement *pipeline;
+    GtkWidget  *widget;     /* its gtksink widget; NULL when embedding */
+    GstElement *vsink;      /* the video sink playbin picked (ref held) */
+    guint       watch;
+    StandbyState state;     /* main loop only, meaningful for the standby */
+    guint64     id;         /* queue item pre-rolled */
+    ItemTrim    trim;       /* in/out points of the item it holds; main loop only */
+} Deck;
+
+static Deck        decks[2];
+static Deck       *live = &decks[0];
+static Deck       *standby = NULL;      /* NULL: pre-roll unavailable */
+static GtkWidget  *deck_stack = NULL;   /* shows the live deck's widget */
+static GMutex      deck_lock;           /* guards Deck.vsink */
+static gint        preroll_enabled = 0;
+static gint        standby_armed = 0;   /* a refresh is already scheduled */
+static guint64     standby_failed_id = 0;   /* do not pre-roll it again */
+/*
+ * A rebuilt live deck with an in point: pre-rolling (1), then seeking
+ * (2). Written by the main loop, read by deck_element_added().
+ */
+static gint        live_arming = 0;
+
+/* The live pipeline; swapped by the main loop, read from any thread. */
 static GstElement *playbin;
-static GstBus     *bus;
-static guint       bus_watch_id;
 static GtkWidget  *video_widget;
 
+/*
+ * Skip-to-first-frame latency, split by path so the gain is visible on
+ * a running server: "pre-rolled" skips swap decks, "rebuilt" ones tear
+ * the live pipeline down. Armed by a skip; stopped by the first buffer
+ * reaching the live video sink, or by the live pipeline reaching
+ * PLAYING (a pre-rolled frame is shown on that transition, it does not
+ * cross the sink pad again). Recorded in metrics.c, as is the
+ * about-to-finish duration.
+ */
+static GMutex    skip_lock;
+static gint      skip_pending = 0;
+static gint64    skip_started = 0;
+static gboolean  skip_swapped = FALSE;
+
+/* Seek to first frame, timed the same way (METRIC_HIST_SEEK). */
+static gint      seek_pending = 0;
+static gint64    seek_started = 0;     /* written before seek_pending is set */
+
+/* Playback rate of the item on air; main loop only. Each item starts at 1. */
+static gdouble   g_rate = 1.0;
+
+/*
+ * Playback snapshot. The main loop is its only writer: it republishes
+ * on state changes, new streams and duration changes of the live
+ * pipeline, after every state change it requests itself and on a
+ * position tick. Readers (STATUS on an IPC worker, the mailbox) copy
+ * it under a seqlock, and the standby card is told when it starts or
+ * stops playing, so none of them ever query the pipeline or contend
+ * with its streaming threads for GStreamer object locks.
+ */
+#define SNAPSHOT_TICK_MS    100
+#define SNAPSHOT_WORDS      (sizeof(PlaybackSnapshot) / sizeof(gint64))
+
+enum {
+    SNAP_STATE    = 1 << 0,   /* query the live pipeline's state */
+    SNAP_POSITION = 1 << 1,
+    SNAP_DURATION = 1 << 2,
+    SNAP_RESET    = 1 << 3    /* a new item: forget position and duration */
+};
+
+static SeqLock          snapshot_lock;
+static PlaybackSnapshot snapshot = { GST_STATE_NULL, GST_STATE_VOID_PENDING, -1, -1, 0, 0, 0 };
+static PlaybackSnapshot shadow = { GST_STATE_NULL, GST_STATE_VOID_PENDING, -1, -1, 0, 0, 0 };  /* main loop's copy */
+static guint            snapshot_tick = 0;
+static const char      *snapshot_announced = NULL;   /* last state event posted */
+
 /* State for features */
 static int g_loop_enabled = 0;
-static int g_watermark_enabled = 0;
+/*
+ * Current URI, RCU-published: writers swap in a new string and retire
+ * the old one, readers copy it inside an RCU read section. Neither side
+ * takes the queue lock.
+ */
 static char *g_current_uri = NULL;
 static gpointer g_window_handle = NULL;
 static gboolean g_using_gtksink = FALSE;
 
+/* Headless output (no GTK at all): gst-launch descriptions of the sinks. */
+#define HEADLESS_VIDEO_SINK "fakesink sync=true"
+#define HEADLESS_AUDIO_SINK "fakesink sync=true"
+
+static gboolean    g_headless = FALSE;
+static const char *g_headless_video = HEADLESS_VIDEO_SINK;
+static const char *g_headless_audio = HEADLESS_AUDIO_SINK;
+
 /*
  * Transition flag to prevent EOS/Signal races.
  * Accessed from:
@@ -25,8 +133,22 @@ static gboolean g_using_gtksink = FALSE;
  */
 static gint g_next_uri_scheduled = 0;
 
-/* Internal helper to ensure a path has a URI scheme */
-static char *ensure_uri_scheme(const char *uri)
+/*
+ * A trimmed item handed off on about-to-finish, on its way to its in
+ * point. Same threads as above, plus the live deck's sink pads.
+ */
+typedef enum {
+    SEGMENT_IDLE = 0,
+    SEGMENT_ARMED,          /* handed off, its stream has not started */
+    SEGMENT_HIDING,         /* started, its buffers are dropped */
+    SEGMENT_SEEKING         /* seek sent, dropped until its flush */
+} SegmentState;
+
+static gint     g_segment_state = SEGMENT_IDLE;
+static ItemTrim g_segment_trim;         /* written before SEGMENT_ARMED is set */
+
+/* Ensures a path has a URI scheme; newly allocated. */
+char *ensure_uri_scheme(const char *uri)
 {
     if (!uri) return NULL;
 
@@ -42,73 +164,168 @@ static char *ensure_uri_scheme(const char *uri)
     }
 }
 
+/* Main loop only. Re-reads what 'what' asks for into the snapshot and publishes it. */
+static void snapshot_refresh(guint what)
+{
+    GstElement *p = playbin;
+    gint64 v, in = (gint64) live->trim.in * GST_MSECOND, out = (gint64) live->trim.out * GST_MSECOND;
+
+    /* A trimmed item's position and duration count within its segment. */
+    shadow.in = in;
+    shadow.out = out;
+    if (what & SNAP_RESET) {
+        shadow.position = -1;
+        shadow.duration = -1;
+        shadow.sampled = g_get_monotonic_time();
+    }
+
+    if (!p) {
+        shadow.state = GST_STATE_NULL;
+        shadow.pending = GST_STATE_VOID_PENDING;
+    } else {
+        if (what & SNAP_STATE) {
+            GstState current = GST_STATE_NULL, pending = GST_STATE_VOID_PENDING;
+
+            /* Only ever asked on the main loop; timeout 0 never blocks. */
+            gst_element_get_state(p, &current, &pending, 0);
+            shadow.state = current;
+            shadow.pending = pending;
+        }
+        if ((what & SNAP_POSITION) && gst_element_query_position(p, GST_FORMAT_TIME, &v)) {
+            shadow.position = MAX(v - in, 0);
+            shadow.sampled = g_get_monotonic_time();
+        }
+        if ((what & SNAP_DURATION) && gst_element_query_duration(p, GST_FORMAT_TIME, &v))
+            shadow.duration = MAX((out && out < v ? out : v) - in, 0);
+    }
+
+    seqlock_write(&snapshot_lock, (gint64 *) &snapshot, (const gint64 *) &shadow, SNAPSHOT_WORDS);
+    status_page_playback(&shadow);
+    gst_player_video_set_playing(shadow.state == GST_STATE_PLAYING || shadow.pending == GST_STATE_PLAYING);
+
+    if (md_gst_state_name(&shadow) != snapshot_announced) {
+        snapshot_announced = md_gst_state_name(&shadow);
+        event_post(EVENT_STATE, "%s", snapshot_announced);
+    }
+}
+
+/* Keeps the position fresh; the duration is retried until it is known. */
+static gboolean snapshot_tick_cb(gpointer data)
+{
+    (void)data;
+
+    if (shadow.state >= GST_STATE_PAUSED || shadow.pending >= GST_STATE_PAUSED)
+        snapshot_refresh(SNAP_POSITION | (shadow.duration < 0 ? SNAP_DURATION : 0));
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Between ticks a playing item's position is extrapolated from the
+ * last sample, so readers see it move smoothly.
+ */
+void md_gst_get_snapshot(PlaybackSnapshot *out)
+{
+    seqlock_read(&snapshot_lock, (gint64 *) out, (const gint64 *) &snapshot, SNAPSHOT_WORDS);
+
+    if (out->state == GST_STATE_PLAYING && out->pending == GST_STATE_VOID_PENDING && out->position >= 0) {
+        out->position += (g_get_monotonic_time() - out->sampled) * GST_USECOND;
+        if (out->duration > 0 && out->position > out->duration)
+            out->position = out->duration;
+    }
+}
+
+/* "Playing", "Paused" or "Standby", as STATUS and the state events name it. */
+const char *md_gst_state_name(const PlaybackSnapshot *s)
+{
+    if (s->state == GST_STATE_NULL || s->state == GST_STATE_READY)
+        return "Standby";
+    if (s->state == GST_STATE_PLAYING || s->pending == GST_STATE_PLAYING)
+        return "Playing";
+    return "Paused";
+}
+
 int md_gst_is_playing(void)
 {
-    GstState current, pending;
-    if (!playbin) return 0;
+    PlaybackSnapshot s;
 
-    gst_element_get_state(playbin, &current, &pending, 0);
-    return (current == GST_STATE_PLAYING || pending == GST_STATE_PLAYING) ? 1 : 0;
+    md_gst_get_snapshot(&s);
+    return (s.state == GST_STATE_PLAYING || s.pending == GST_STATE_PLAYING) ? 1 : 0;
 }
 
-gboolean md_gst_is_stopped(void)
+static gboolean pipeline_is_stopped(GstElement *p)
 {
     GstState current = GST_STATE_NULL, pending = GST_STATE_NULL;
 
-    if (!playbin) return TRUE;
-
     /* IMPORTANT:
      * With timeout=0, gst_element_get_state() can return ASYNC even when current
      * is already READY/NULL. For startup gating we only care about current state,
      * not the return code.
      */
-    gst_element_get_state(playbin, &current, &pending, 0);
+    gst_element_get_state(p, &current, &pending, 0);
 
     /* Consider READY as "stopped enough" for safe start. */
     return (current == GST_STATE_NULL || current == GST_STATE_READY) ? TRUE : FALSE;
 }
 
+gboolean md_gst_is_stopped(void)
+{
+    PlaybackSnapshot s;
+
+    /* Same rule as pipeline_is_stopped(), on the snapshot. */
+    md_gst_get_snapshot(&s);
+    return (s.state == GST_STATE_NULL || s.state == GST_STATE_READY) ? TRUE : FALSE;
+}
+
 gint64 md_gst_get_position(void)
 {
-    gint64 pos = 0;
-    if (playbin && gst_element_query_position(playbin, GST_FORMAT_TIME, &pos)) {
-        return pos;
-    }
-    return 0;
+    PlaybackSnapshot s;
+
+    md_gst_get_snapshot(&s);
+    return MAX(s.position, 0);
 }
 
 gint64 md_gst_get_duration(void)
 {
-    gint64 dur = 0;
-    if (playbin && gst_element_query_duration(playbin, GST_FORMAT_TIME, &dur)) {
-        return dur;
-    }
-    return 0;
+    PlaybackSnapshot s;
+
+    md_gst_get_snapshot(&s);
+    return MAX(s.duration, 0);
+}
+
+/* Takes ownership of 'uri' (may be NULL). */
+static void set_current_uri(char *uri)
+{
+    rcu_retire(g_atomic_pointer_exchange(&g_current_uri, uri), g_free);
 }
 
 char *md_gst_get_current_uri(void)
 {
-    char *uri = NULL;
-    thread_lock();
-    if (g_current_uri) {
-        uri = g_strdup(g_current_uri);
-    }
-    thread_unlock();
+    int rcu = rcu_read_lock();
+    char *uri = g_strdup(g_atomic_pointer_get(&g_current_uri));
+    rcu_read_unlock(rcu);
     return uri;
 }
 
 void md_gst_set_window_handle(guintptr handle)
 {
+    int i;
+
     g_atomic_pointer_set(&g_window_handle, (gpointer)handle);
     guintptr loaded_handle = (guintptr)g_atomic_pointer_get(&g_window_handle);
-    if (playbin && GST_IS_VIDEO_OVERLAY(playbin) && !g_using_gtksink) {
-        gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(playbin), loaded_handle);
+    /* Both decks render into the same window; only the live one draws. */
+    for (i = 0; i < 2; i++) {
+        GstElement *p = decks[i].pipeline;
+        if (p && GST_IS_VIDEO_OVERLAY(p) && !g_using_gtksink) {
+            gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(p), loaded_handle);
+        }
     }
 }
 
 static GstBusSyncReply bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer data)
 {
-    (void)bus; (void)data;
+    Deck *deck = (Deck *) data;
+
+    (void)bus;
 
     /* Only handle sync XID embedding if we are NOT using a native GTK sink */
     if (g_using_gtksink)
@@ -123,9 +340,9 @@ static GstBusSyncReply bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer d
             if (GST_IS_VIDEO_OVERLAY(src)) {
                 gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(src), window_handle);
             } else {
-                /* Fallback: try the current playbin video-sink (some graphs emit from a bin/child). */
+                /* Fallback: try this deck's video-sink (some graphs emit from a bin/child). */
                 GstElement *vsink = NULL;
-                g_object_get(G_OBJECT(playbin), "video-sink", &vsink, NULL);
+                g_object_get(G_OBJECT(deck->pipeline), "video-sink", &vsink, NULL);
                 if (vsink) {
                     if (GST_IS_VIDEO_OVERLAY(vsink)) {
                         gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY(vsink), window_handle);
@@ -139,85 +356,388 @@ static GstBusSyncReply bus_sync_handler(GstBus *bus, GstMessage *msg, gpointer d
     return GST_BUS_PASS;
 }
 
-static void draw_overlay(GstElement *overlay, cairo_t *cr, guint64 timestamp, guint64 duration, gpointer data)
+/* Skip latency: start measuring (main loop, once the new deck is live). */
+static void skip_latency_arm(gint64 started, gboolean swapped)
+{
+    g_mutex_lock(&skip_lock);
+    skip_started = started;
+    skip_swapped = swapped;
+    g_mutex_unlock(&skip_lock);
+    g_atomic_int_set(&skip_pending, 1);
+}
+
+/* The skipped-to item's first frame is on air. Any thread. */
+static void skip_latency_done(void)
 {
-    (void)overlay; (void)timestamp; (void)duration; (void)data;
+    gint64 elapsed;
+    gboolean swapped;
+
+    if (!g_atomic_int_compare_and_exchange(&skip_pending, 1, 0))
+        return;
 
-    if (!g_watermark_enabled) return;
+    g_mutex_lock(&skip_lock);
+    elapsed = g_get_monotonic_time() - skip_started;
+    swapped = skip_swapped;
+    g_mutex_unlock(&skip_lock);
 
-    double x1, y1, x2, y2;
-    cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    metrics_record(swapped ? METRIC_HIST_SKIP_PREROLLED : METRIC_HIST_SKIP_REBUILT, elapsed * 1000);
+}
 
-    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size(cr, 24.0);
+/* The first frame after a seek is on air. Any thread. */
+static void seek_latency_done(void)
+{
+    if (g_atomic_int_compare_and_exchange(&seek_pending, 1, 0))
+        metrics_record(METRIC_HIST_SEEK, (g_get_monotonic_time() - seek_started) * 1000);
+}
+
+static gint64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    const char *text = "VT-TV LIVE";
-    cairo_text_extents_t extents;
-    cairo_text_extents(cr, text, &extents);
+/* Runs on every buffer reaching a deck's video sink: keep it cheap. */
+static GstPadProbeReturn deck_frame_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data)
+{
+    Deck *deck = (Deck *) data;
 
-    /* Position Top-Right with 20px padding */
-    double x = x2 - extents.width - 20;
-    double y = y1 + extents.height + 20;
+    (void)pad; (void)info;
 
-    /* Drop Shadow (Black, 50% opacity) */
-    cairo_set_source_rgba(cr, 0, 0, 0, 0.5);
-    cairo_move_to(cr, x + 2, y + 2);
-    cairo_show_text(cr, text);
+    if (deck->pipeline != g_atomic_pointer_get(&playbin))
+        return GST_PAD_PROBE_OK;    /* a standby deck's pre-roll frame */
 
-    /* Text (White, 50% opacity) */
-    cairo_set_source_rgba(cr, 1, 1, 1, 0.5);
-    cairo_move_to(cr, x, y);
-    cairo_show_text(cr, text);
+    metrics_count(METRIC_FRAMES);
+    if (g_atomic_int_get(&skip_pending))
+        skip_latency_done();
+    if (g_atomic_int_get(&seek_pending))
+        seek_latency_done();
+    return GST_PAD_PROBE_OK;
 }
 
-static void on_about_to_finish(GstElement *playbin_local, gpointer data)
+/*
+ * Runs on every buffer and event reaching a live deck's sinks, so a
+ * trimmed item handed off gaplessly shows nothing before its in point.
+ */
+static GstPadProbeReturn deck_segment_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data)
 {
-    (void)playbin_local; (void)data;
+    Deck *deck = (Deck *) data;
+    gint state;
+
+    (void)pad;
+
+    if (deck->pipeline != g_atomic_pointer_get(&playbin))
+        return GST_PAD_PROBE_OK;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        switch (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info))) {
+            case GST_EVENT_STREAM_START:
+                g_atomic_int_compare_and_exchange(&g_segment_state, SEGMENT_ARMED, SEGMENT_HIDING);
+                break;
+            case GST_EVENT_FLUSH_STOP:
+                g_atomic_int_compare_and_exchange(&g_segment_state, SEGMENT_SEEKING, SEGMENT_IDLE);
+                break;
+            default:
+                break;
+        }
+        return GST_PAD_PROBE_OK;
+    }
 
-    char *next_filename = NULL;
-    char *new_uri = NULL;
+    state = g_atomic_int_get(&g_segment_state);
+    return state == SEGMENT_HIDING || state == SEGMENT_SEEKING ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
 
-    /*
-     * SINGLE AUTHORITY for queue advancement.
-     * This runs in the streaming thread. No GTK calls allowed.
-     */
-    next_filename = command_get_next_video();
-    if (next_filename) {
-        g_printerr("Gapless transition to: %s\n", next_filename);
-        new_uri = ensure_uri_scheme(next_filename);
-        g_free(next_filename);
-    } else if (g_loop_enabled) {
-        /* FIX: Thread Safety
-           We must acquire the lock BEFORE checking g_current_uri to avoid a race
-           condition with the main thread (md_gst_play) freeing it.
-        */
-        thread_lock();
-        if (g_current_uri) {
-            g_printerr("Queue empty, looping: %s\n", g_current_uri);
-            new_uri = g_strdup(g_current_uri);
+/* A standby deck decodes its first frame but must not show it. */
+static void deck_show_preroll(Deck *deck, gboolean show)
+{
+    g_mutex_lock(&deck_lock);
+    if (deck->vsink)
+        g_object_set(G_OBJECT(deck->vsink), "show-preroll-frame", show, NULL);
+    g_mutex_unlock(&deck_lock);
+}
+
+/*
+ * Finds the video sink playbin (or its auto sink) puts in a deck, so
+ * its pre-roll frame can be hidden while the deck is on standby and its
+ * first frame timed; every sink also gets deck_segment_probe(). Any
+ * thread: playbin may build its sinks from a streaming thread.
+ */
+static void deck_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer data)
+{
+    Deck *deck = (Deck *) data;
+    GstPad *pad;
+
+    (void)bin; (void)sub_bin;
+
+    if (GST_IS_BASE_SINK(element) && !g_object_get_data(G_OBJECT(element), "segment-probe") &&
+        (pad = gst_element_get_static_pad(element, "sink")) != NULL) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                          deck_segment_probe, deck, NULL);
+        g_object_set_data(G_OBJECT(element), "segment-probe", deck);
+        gst_object_unref(GST_OBJECT(pad));
+    }
+
+    if (!GST_IS_VIDEO_SINK(element))
+        return;
+
+    g_mutex_lock(&deck_lock);
+    if (element == deck->vsink) {
+        g_mutex_unlock(&deck_lock);
+        return;
+    }
+    if (deck->vsink)
+        gst_object_unref(GST_OBJECT(deck->vsink));
+    deck->vsink = GST_ELEMENT(gst_object_ref(element));
+    g_object_set(G_OBJECT(element), "show-preroll-frame",
+            deck->pipeline == g_atomic_pointer_get(&playbin) && !g_atomic_int_get(&live_arming), NULL);
+    g_mutex_unlock(&deck_lock);
+
+    /* Headless decks time frames at their sink bin, whatever the sink is. */
+    if (!g_headless && (pad = gst_element_get_static_pad(element, "sink")) != NULL) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, deck_frame_probe, deck, NULL);
+        gst_object_unref(GST_OBJECT(pad));
+    }
+}
+
+static gboolean standby_refresh(gpointer data);
+
+void md_gst_queue_changed(void)
+{
+    if (g_atomic_int_get(&preroll_enabled) &&
+        g_atomic_int_compare_and_exchange(&standby_armed, 0, 1))
+        g_idle_add(standby_refresh, NULL);
+}
+
+static gboolean deck_torn_down(gpointer data)
+{
+    Deck *deck = (Deck *) data;
+
+    if (deck->state == STANDBY_TEARDOWN)
+        deck->state = STANDBY_IDLE;
+    md_gst_queue_changed();
+    return FALSE; /* Run once */
+}
+
+/* Runs in a GStreamer thread: NULL can take a while for a big decoder graph. */
+static void deck_teardown(GstElement *element, gpointer data)
+{
+    gst_element_set_state(element, GST_STATE_NULL);
+    g_idle_add(deck_torn_down, data);
+}
+
+/* Drops whatever a deck holds without blocking the main loop. */
+static void standby_release(Deck *deck)
+{
+    deck->state = STANDBY_TEARDOWN;
+    deck->id = 0;
+    deck->trim.in = deck->trim.out = 0;
+    gst_element_call_async(deck->pipeline, deck_teardown, deck, NULL);
+}
+
+/*
+ * Seeks a deck to the in point of the item it holds, stopping at its
+ * out point. Accurate, so the first frame is the in point's.
+ */
+static gboolean deck_seek_segment(Deck *deck)
+{
+    gint64 out = deck->trim.out ? (gint64) deck->trim.out * GST_MSECOND : (gint64) GST_CLOCK_TIME_NONE;
+
+    return gst_element_seek(deck->pipeline, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                            GST_SEEK_TYPE_SET, (gint64) deck->trim.in * GST_MSECOND, GST_SEEK_TYPE_SET, out);
+}
+
+/* The standby deck reached PAUSED; a trimmed item seeks to its in point first. */
+static void standby_prerolled(Deck *deck)
+{
+    if (!TRIM_IS_SET(deck->trim)) {
+        deck->state = STANDBY_READY;
+    } else if (deck_seek_segment(deck)) {
+        deck->state = STANDBY_SEEKING;
+    } else {
+        /* The skip will rebuild, and try again on the live deck. */
+        log_warning("Pre-roll: cannot seek to the in point.");
+        standby_failed_id = deck->id;
+        standby_release(deck);
+    }
+}
+
+/*
+ * Keeps the standby deck pre-rolled on the next queue item. Scheduled
+ * (coalesced) whenever the next item may have changed; a stale deck is
+ * released first and pre-rolls again once it is back in NULL.
+ */
+static gboolean standby_refresh(gpointer data)
+{
+    GstStateChangeReturn ret;
+    guint64 id = 0;
+    ItemTrim trim = { 0, 0 };
+    char *next, *uri;
+
+    (void)data;
+    g_atomic_int_set(&standby_armed, 0);
+
+    if (!standby || standby->state == STANDBY_TEARDOWN)
+        return FALSE;
+
+    next = command_peek_next_video(&id, &trim);
+    if (standby->state != STANDBY_IDLE) {
+        if (!next || id != standby->id)
+            standby_release(standby);
+        g_free(next);
+        return FALSE;
+    }
+    if (!next || id == standby_failed_id) {
+        g_free(next);
+        return FALSE;
+    }
+
+    uri = ensure_uri_scheme(next);
+    g_object_set(G_OBJECT(standby->pipeline), "uri", uri, NULL);
+    standby->id = id;
+    standby->trim = trim;
+    standby->state = STANDBY_PREROLLING;
+
+    ret = gst_element_set_state(standby->pipeline, GST_STATE_PAUSED);
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        standby_failed_id = id;
+        standby_release(standby);
+    } else if (ret == GST_STATE_CHANGE_SUCCESS) {
+        standby_prerolled(standby);
+    }
+
+    g_free(uri);
+    g_free(next);
+    return FALSE;
+}
+
+/*
+ * Puts the standby deck on air if it holds item 'id'. Returns FALSE
+ * (nothing touched) when it does not, e.g. the queue changed since it
+ * was pre-rolled or pre-roll is still running.
+ */
+static gboolean deck_swap(guint64 id)
+{
+    Deck *old = live;
+
+    if (!standby || standby->state != STANDBY_READY || standby->id != id)
+        return FALSE;
+
+    live = standby;
+    standby = old;
+    live->state = STANDBY_IDLE;
+    g_atomic_pointer_set(&playbin, live->pipeline);
+
+    /* The pre-rolled frame is shown as soon as the sink goes to PLAYING. */
+    deck_show_preroll(live, TRUE);
+    if (deck_stack && live->widget)
+        gtk_stack_set_visible_child(GTK_STACK(deck_stack), live->widget);
+    gst_element_set_state(live->pipeline, GST_STATE_PLAYING);
+    snapshot_refresh(SNAP_RESET | SNAP_STATE | SNAP_POSITION | SNAP_DURATION);
+
+    /* Off air right away; the rest of the teardown leaves the main loop. */
+    deck_show_preroll(old, FALSE);
+    if (!pipeline_is_stopped(old->pipeline))
+        gst_element_set_state(old->pipeline, GST_STATE_PAUSED);
+    standby_release(old);
+    return TRUE;
+}
+
+/* Standby decks only report pre-roll progress and failures. */
+static void standby_message(Deck *deck, GstMessage *msg)
+{
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ASYNC_DONE:
+            if (GST_MESSAGE_SRC(msg) != GST_OBJECT(deck->pipeline))
+                break;
+            if (deck->state == STANDBY_PREROLLING)
+                standby_prerolled(deck);
+            else if (deck->state == STANDBY_SEEKING)
+                deck->state = STANDBY_READY;   /* pre-rolled on the in point */
+            break;
+
+        case GST_MESSAGE_ERROR: {
+            GError *error = NULL;
+
+            if (deck->state != STANDBY_PREROLLING && deck->state != STANDBY_SEEKING &&
+                    deck->state != STANDBY_READY)
+                break;  /* a torn-down deck's leftovers */
+
+            gst_message_parse_error(msg, &error, NULL);
+            log_warning("Pre-roll failed: %s", error ? error->message : "(unknown)");
+            event_post(EVENT_ERROR, "preroll %s", error ? error->message : "(unknown)");
+            if (error) g_error_free(error);
+
+            /* Do not retry the same item; the skip will rebuild instead. */
+            standby_failed_id = deck->id;
+            standby_release(deck);
+            break;
         }
-        thread_unlock();
+
+        default:
+            break;
     }
+}
+
+/*
+ * Runs on the streaming thread with a tight deadline. The next item was
+ * resolved ahead of time (commands.c), so this is a pointer exchange and
+ * the URI handoff to playbin: no queue lock, no allocation, no logging.
+ * Queue bookkeeping happens when the main loop commits the handoff.
+ */
+static void on_about_to_finish(GstElement *playbin_local, gpointer data)
+{
+    Deck *deck = (Deck *) data;
+    gint64 started;
+    Handoff *h;
+
+    /* A standby deck can drain a short clip while pre-rolling; only the live one advances. */
+    if (deck->pipeline != g_atomic_pointer_get(&playbin))
+        return;
+
+    started = now_ns();
+
+    /* NULL: the last handoff is not committed yet, this clip is shorter than a main loop wakeup. */
+    if ((h = command_take_handoff()) == NULL)
+        return;
 
-    if (new_uri) {
-        thread_lock();
-        if (g_current_uri) g_free(g_current_uri);
-        g_current_uri = g_strdup(new_uri);
-        thread_unlock();
+    if (h->uri) {
+        /* A trimmed item seeks to its in point once it starts (see STREAM_START). */
+        if (TRIM_IS_SET(h->trim)) {
+            g_segment_trim = h->trim;
+            g_atomic_int_set(&g_segment_state, SEGMENT_ARMED);
+        } else {
+            g_atomic_int_set(&g_segment_state, SEGMENT_IDLE);
+        }
+        g_object_set(G_OBJECT(playbin_local), "uri", h->uri, NULL);
 
-        g_object_set(G_OBJECT(playbin), "uri", new_uri, NULL);
-        g_free(new_uri);
+        /* The slot's URI becomes the current one; the commit retires the old one. */
+        h->replaced = g_atomic_pointer_exchange(&g_current_uri, h->uri);
+        h->uri = NULL;
 
         /* Mark transition as active so EOS doesn't stop pipeline */
         g_atomic_int_set(&g_next_uri_scheduled, 1);
     } else {
+        metrics_count(METRIC_HANDOFF_IDLE);
         g_atomic_int_set(&g_next_uri_scheduled, 0);
     }
+
+    /* Last use of h: from here on it belongs to the main loop. */
+    mailbox_post_handoff(h);
+    metrics_record(METRIC_HIST_ABOUT_TO_FINISH, now_ns() - started);
 }
 
+static gint play_item(char *filename, guint64 id, const ItemTrim *trim, gint64 skip_started);
+
 static gboolean bus_call(GstBus *bus_local, GstMessage *msg, gpointer data)
 {
-    (void)bus_local; (void)data;
+    Deck *deck = (Deck *) data;
+
+    (void)bus_local;
+
+    if (deck != live) {
+        standby_message(deck, msg);
+        return TRUE;
+    }
 
     switch (GST_MESSAGE_TYPE(msg)) {
 
@@ -229,27 +749,86 @@ static gboolean bus_call(GstBus *bus_local, GstMessage *msg, gpointer data)
                 GstState old_s, new_s, pending_s;
                 gst_message_parse_state_changed(msg, &old_s, &new_s, &pending_s);
 
+                shadow.state = new_s;
+                shadow.pending = pending_s;
+                snapshot_refresh(SNAP_POSITION);
+
+                /* A swapped-in deck shows its pre-rolled frame on this transition. */
+                if (new_s == GST_STATE_PLAYING)
+                    skip_latency_done();
+
                 if (new_s == GST_STATE_PLAYING && g_atomic_int_get(&g_next_uri_scheduled) == 1) {
-                    g_printerr("Transition committed (PLAYING). Clearing transition flag.\n");
+                    log_debug("Transition committed (PLAYING). Clearing transition flag.");
                     g_atomic_int_set(&g_next_uri_scheduled, 0);
                 }
             }
             break;
         }
 
+        case GST_MESSAGE_STREAM_START:
+            /* A gapless transition: the next item is now on air, at its own rate. */
+            g_rate = 1.0;
+            if (g_atomic_int_compare_and_exchange(&g_segment_state, SEGMENT_HIDING, SEGMENT_SEEKING) ||
+                g_atomic_int_compare_and_exchange(&g_segment_state, SEGMENT_ARMED, SEGMENT_SEEKING)) {
+                /* Its sinks drop what it plays until this seek flushes them. */
+                live->trim = g_segment_trim;
+                if (!deck_seek_segment(live)) {
+                    log_warning("Cannot seek to the in point, playing the whole item.");
+                    live->trim.in = live->trim.out = 0;
+                    g_atomic_int_set(&g_segment_state, SEGMENT_IDLE);
+                }
+            } else if (g_atomic_int_get(&g_next_uri_scheduled) == 1) {
+                live->trim.in = live->trim.out = 0;     /* handed off untrimmed */
+            }
+            snapshot_refresh(SNAP_RESET | SNAP_POSITION | SNAP_DURATION);
+            break;
+
+        case GST_MESSAGE_DURATION_CHANGED:
+            snapshot_refresh(SNAP_DURATION);
+            break;
+
+        case GST_MESSAGE_ASYNC_DONE:
+            if (GST_MESSAGE_SRC(msg) != GST_OBJECT(playbin))
+                break;
+            /* A rebuilt deck with an in point: pre-rolled at the start, then on the in point. */
+            if (g_atomic_int_get(&live_arming) == 1 && deck_seek_segment(live)) {
+                g_atomic_int_set(&live_arming, 2);
+            } else if (g_atomic_int_get(&live_arming)) {
+                if (g_atomic_int_get(&live_arming) == 1) {
+                    log_warning("Cannot seek to the in point, playing the whole item.");
+                    live->trim.in = live->trim.out = 0;
+                }
+                g_atomic_int_set(&live_arming, 0);
+                deck_show_preroll(live, TRUE);
+                gst_element_set_state(playbin, GST_STATE_PLAYING);
+            }
+            snapshot_refresh(SNAP_POSITION | SNAP_DURATION);
+            break;
+
         case GST_MESSAGE_EOS: {
-            g_printerr("End of stream\n");
+            guint64 id = 0;
+            ItemTrim trim;
+            char *next = NULL;
+
+            log_debug("End of stream");
 
             /* Deterministic EOS logic:
                - If transition flag is set, ignore EOS for pipeline-stop purposes.
                - If not set, we are at end of playlist: stop pipeline. */
             if (g_atomic_int_get(&g_next_uri_scheduled) == 1) {
-                g_printerr("Ignoring EOS (transition active)\n");
+                log_debug("Ignoring EOS (transition active)");
                 /* Clear just in case this EOS was actually emitted (non-gapless path) */
                 g_atomic_int_set(&g_next_uri_scheduled, 0);
+            } else if (live->trim.out && (next = command_get_next_video(&id, &trim)) != NULL) {
+                /* Ended at its out point without a handoff: play what is next. */
+                log_info("Segment transition to: %s", next);
+                play_item(next, id, &trim, 0);
+                g_free(next);
             } else {
-                g_printerr("Playlist finished. Stopping.\n");
+                log_info("Playlist finished. Stopping.");
                 gst_element_set_state(playbin, GST_STATE_NULL);
+                snapshot_refresh(SNAP_RESET | SNAP_STATE);
+                command_playback_finished();
             }
             break;
         }
@@ -261,14 +840,25 @@ static gboolean bus_call(GstBus *bus_local, GstMessage *msg, gpointer data)
             gst_message_parse_error(msg, &error, &debug);
             g_free(debug);
 
-            g_printerr("Error: %s\n", error ? error->message : "(unknown)");
+            log_error("Error: %s", error ? error->message : "(unknown)");
+            event_post(EVENT_ERROR, "playback %s", error ? error->message : "(unknown)");
+            status_page_error();
+            metrics_count(METRIC_PIPELINE_ERRORS);
             if (error) g_error_free(error);
 
             gst_element_set_state(playbin, GST_STATE_NULL);
+            snapshot_refresh(SNAP_RESET | SNAP_STATE);
             g_atomic_int_set(&g_next_uri_scheduled, 0);
+            g_atomic_int_set(&g_segment_state, SEGMENT_IDLE);
+            command_playback_finished();
             break;
         }
 
+        case GST_MESSAGE_QOS:
+            /* Sinks post one per buffer they drop for being late. */
+            metrics_count(METRIC_QOS_DROPS);
+            break;
+
         default:
             break;
     }
@@ -276,33 +866,84 @@ static gboolean bus_call(GstBus *bus_local, GstMessage *msg, gpointer data)
     return TRUE;
 }
 
-gint md_gst_play(char *uri)
+/* Loads 'uri' into the live pipeline and takes it to 'state'. */
+static gint play_uri(char *uri, GstState state)
 {
     gchar *real_uri;
     g_return_val_if_fail(uri, -1);
 
     real_uri = ensure_uri_scheme(uri);
 
-    /* Update current URI cache (protected) */
-    thread_lock();
-    if (g_current_uri) g_free(g_current_uri);
-    g_current_uri = g_strdup(real_uri);
-    thread_unlock();
+    /* Update current URI cache (RCU-published) */
+    set_current_uri(g_strdup(real_uri));
 
     g_object_set(G_OBJECT(playbin), "uri", real_uri, NULL);
     g_free(real_uri);
 
     if (GST_IS_ELEMENT(playbin))
-        gst_element_set_state(playbin, GST_STATE_PLAYING);
+        gst_element_set_state(playbin, state);
+    snapshot_refresh(SNAP_RESET | SNAP_STATE);
+
+    return 0;
+}
+
+gint md_gst_play(char *uri)
+{
+    return play_uri(uri, GST_STATE_PLAYING);
+}
+
+/*
+ * Plays queue item 'id' (only its 'trim' segment; NULL: all of it):
+ * swaps in the standby deck if it pre-rolled exactly this item,
+ * otherwise rebuilds the live pipeline. A non-zero 'skip_started' times
+ * the skip to its first frame.
+ */
+static gint play_item(char *filename, guint64 id, const ItemTrim *trim, gint64 skip_started)
+{
+    g_return_val_if_fail(filename, -1);
 
+    g_rate = 1.0;
+    g_atomic_int_set(&g_segment_state, SEGMENT_IDLE);
+    if (g_atomic_int_get(&live_arming)) {
+        g_atomic_int_set(&live_arming, 0);
+        deck_show_preroll(live, TRUE);
+    }
+    if (deck_swap(id)) {
+        /* Pre-rolled on its in point already. */
+        set_current_uri(ensure_uri_scheme(filename));
+        if (skip_started) skip_latency_arm(skip_started, TRUE);
+    } else {
+        /* Force pipeline reset to purge current buffers and accept new URI cleanly */
+        gst_element_set_state(playbin, GST_STATE_NULL);
+        if (skip_started) skip_latency_arm(skip_started, FALSE);
+        live->trim.in = trim ? trim->in : 0;
+        live->trim.out = trim ? trim->out : 0;
+        if (TRIM_IS_SET(live->trim)) {
+            /* Pre-roll hidden, seek to the in point, then play (see ASYNC_DONE). */
+            g_atomic_int_set(&live_arming, 1);
+            deck_show_preroll(live, FALSE);
+            play_uri(filename, GST_STATE_PAUSED);
+        } else {
+            md_gst_play(filename);
+        }
+    }
+
+    /* Pre-roll whatever comes after it. */
+    md_gst_queue_changed();
     return 0;
 }
 
+gint md_gst_play_item(char *filename, guint64 id, const ItemTrim *trim)
+{
+    return play_item(filename, id, trim, 0);
+}
+
 gint md_gst_pause(void)
 {
     if (playbin) {
         gst_element_set_state(playbin, GST_STATE_PAUSED);
-        g_printerr("Pipeline paused.\n");
+        snapshot_refresh(SNAP_STATE | SNAP_POSITION);
+        log_info("Pipeline paused.");
     }
     return 0;
 }
@@ -311,7 +952,8 @@ gint md_gst_resume(void)
 {
     if (playbin) {
         gst_element_set_state(playbin, GST_STATE_PLAYING);
-        g_printerr("Pipeline resumed.\n");
+        snapshot_refresh(SNAP_STATE | SNAP_POSITION);
+        log_info("Pipeline resumed.");
     }
     return 0;
 }
@@ -320,32 +962,50 @@ gint md_gst_stop(void)
 {
     if (playbin) {
         gst_element_set_state(playbin, GST_STATE_NULL);
+        snapshot_refresh(SNAP_RESET | SNAP_STATE);
         g_atomic_int_set(&g_next_uri_scheduled, 0);
-        
+        g_atomic_int_set(&g_segment_state, SEGMENT_IDLE);
+        g_atomic_int_set(&skip_pending, 0);
+        if (g_atomic_int_get(&live_arming)) {
+            g_atomic_int_set(&live_arming, 0);
+            deck_show_preroll(live, TRUE);
+        }
+        command_playback_finished();
+
         /* Force widget redraw to show standby screen immediately */
         if (video_widget) {
             gtk_widget_queue_draw(video_widget);
         }
-        g_printerr("Pipeline stopped (Standby).\n");
+        log_info("Pipeline stopped (Standby).");
     }
     return 0;
 }
 
 gint md_gst_skip(void)
 {
-    if (playbin) {
-        char *next_filename = command_get_next_video();
-        
-        /* Force pipeline reset to purge current buffers and accept new URI cleanly */
-        gst_element_set_state(playbin, GST_STATE_NULL);
+    return md_gst_skip_n(1);
+}
+
+/* Skips n items at once: n - 1 are dropped unplayed, the n-th plays. */
+gint md_gst_skip_n(guint n)
+{
+    if (playbin && n > 0) {
+        gint64 started = g_get_monotonic_time();
+        guint64 id = 0;
+        ItemTrim trim;
+        char *next_filename;
+
+        if (n > 1)
+            command_skip_videos(n - 1);
+        next_filename = command_get_next_video(&id, &trim);
         g_atomic_int_set(&g_next_uri_scheduled, 0);
-        
+
         if (next_filename) {
-            g_printerr("Skipping forward to: %s\n", next_filename);
-            md_gst_play(next_filename);
+            log_info("Skipping forward to: %s", next_filename);
+            play_item(next_filename, id, &trim, started);
             g_free(next_filename);
         } else {
-            g_printerr("Skip requested, but queue is empty.\n");
+            log_info("Skip requested, but queue is empty.");
             md_gst_stop();
         }
     }
@@ -356,66 +1016,201 @@ gint md_gst_toggle_mute(void)
 {
     if (playbin) {
         gboolean current_mute = FALSE;
+        int i;
+
         g_object_get(G_OBJECT(playbin), "mute", &current_mute, NULL);
-        g_object_set(G_OBJECT(playbin), "mute", !current_mute, NULL);
-        g_printerr("Pipeline audio %s.\n", !current_mute ? "muted" : "unmuted");
+        /* Both decks, so a swap keeps the mute state. */
+        for (i = 0; i < 2; i++) {
+            if (decks[i].pipeline)
+                g_object_set(G_OBJECT(decks[i].pipeline), "mute", !current_mute, NULL);
+        }
+        log_info("Pipeline audio %s.", !current_mute ? "muted" : "unmuted");
     }
     return 0;
 }
 
-gint md_gst_finish(void)
+/* Fast and reverse playback let decoders skip what they cannot show. */
+static gboolean rate_is_trickmode(gdouble rate)
 {
-    if (bus_watch_id > 0)
-        g_source_remove(bus_watch_id);
+    return rate > 2.0 || rate < 0.0;
+}
 
-    if (playbin) {
-        gst_element_set_state(playbin, GST_STATE_NULL);
-        gst_object_unref(GST_OBJECT(playbin));
-        playbin = NULL;
+/*
+ * Seeks the live pipeline to 'position' at rate 'rate'. Forward
+ * playback runs from the position to the end of the item (its out
+ * point, if it has one), reverse from the position back to its start.
+ */
+static gboolean pipeline_seek(gint64 position, gdouble rate, GstSeekFlags flags)
+{
+    gint64 in = (gint64) live->trim.in * GST_MSECOND;
+    gint64 out = live->trim.out ? (gint64) live->trim.out * GST_MSECOND : (gint64) GST_CLOCK_TIME_NONE;
+
+    if (rate_is_trickmode(rate))
+        flags |= GST_SEEK_FLAG_TRICKMODE;
+
+    if (rate > 0.0)
+        return gst_element_seek(playbin, rate, GST_FORMAT_TIME, flags,
+                                GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_SET, out);
+    return gst_element_seek(playbin, rate, GST_FORMAT_TIME, flags,
+                            GST_SEEK_TYPE_SET, in, GST_SEEK_TYPE_SET, position);
+}
+
+/*
+ * Seeks within the item on air, to 'ns' (from its in point) or, if
+ * 'relative', by 'ns' from where it is, clamped to the item. Keyframe mode lands on the
+ * nearest keyframe, so the first frame needs no decoding up to the
+ * target; accurate mode decodes up to the exact frame.
+ */
+gint md_gst_seek(gint64 ns, gboolean relative, gboolean accurate)
+{
+    GstSeekFlags flags = GST_SEEK_FLAG_FLUSH |
+        (accurate ? GST_SEEK_FLAG_ACCURATE : GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST);
+    gint64 in = (gint64) live->trim.in * GST_MSECOND, target = in + ns, position = 0, duration = -1;
+
+    if (!playbin || md_gst_is_stopped()) {
+        log_info("Seek requested, but nothing is playing.");
+        return -1;
+    }
+
+    if (relative) {
+        if (!gst_element_query_position(playbin, GST_FORMAT_TIME, &position)) {
+            log_warning("Seek: position unknown, cannot seek relative to it.");
+            return -1;
+        }
+        target = position + ns;
+    }
+    if (live->trim.out)
+        target = MIN(target, (gint64) live->trim.out * GST_MSECOND);
+    else if (gst_element_query_duration(playbin, GST_FORMAT_TIME, &duration) && duration > 0)
+        target = MIN(target, duration);
+    target = MAX(target, in);
+
+    seek_started = g_get_monotonic_time();
+    g_atomic_int_set(&seek_pending, 1);
+    if (!pipeline_seek(target, g_rate, flags)) {
+        g_atomic_int_set(&seek_pending, 0);
+        log_warning("Seek to %" GST_TIME_FORMAT " failed.", GST_TIME_ARGS(target));
+        return -1;
+    }
+    snapshot_refresh(SNAP_POSITION);
+    log_info("Seeking to %" GST_TIME_FORMAT " (%s).", GST_TIME_ARGS(target), accurate ? "accurate" : "keyframe");
+    return 0;
+}
+
+/*
+ * Changes the playback rate of the item on air: above 1 fast-forward,
+ * between 0 and 1 slow motion, below 0 reverse (if the demuxer can).
+ * The next item starts at 1 again.
+ */
+gint md_gst_set_rate(gdouble rate)
+{
+    gint64 position;
+
+    if (!playbin || md_gst_is_stopped()) {
+        log_info("Rate change requested, but nothing is playing.");
+        return -1;
+    }
+    if (rate == g_rate)
+        return 0;
+
+#if GST_CHECK_VERSION(1, 18, 0)
+    /*
+     * An instant rate change keeps the segment's flags, so it may only
+     * stay in the same direction and on the same side of trick mode.
+     */
+    if ((rate > 0.0) == (g_rate > 0.0) && rate_is_trickmode(rate) == rate_is_trickmode(g_rate) &&
+            gst_element_seek(playbin, rate, GST_FORMAT_TIME, GST_SEEK_FLAG_INSTANT_RATE_CHANGE,
+                             GST_SEEK_TYPE_NONE, 0, GST_SEEK_TYPE_NONE, 0)) {
+        g_rate = rate;
+        log_info("Playback rate %.3g.", rate);
+        return 0;
+    }
+#endif
+
+    /* Otherwise play on from the current frame at the new rate. */
+    if (!gst_element_query_position(playbin, GST_FORMAT_TIME, &position) ||
+            !pipeline_seek(position, rate, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE)) {
+        log_warning("Playback rate %.3g not supported by this item.", rate);
+        return -1;
     }
+    g_rate = rate;
+    snapshot_refresh(SNAP_POSITION);
+    log_info("Playback rate %.3g.", rate);
+    return 0;
+}
+
+gint md_gst_finish(void)
+{
+    int i;
 
-    thread_lock();
-    if (g_current_uri) {
-        g_free(g_current_uri);
-        g_current_uri = NULL;
+    g_atomic_int_set(&preroll_enabled, 0);
+
+    if (snapshot_tick > 0)
+        g_source_remove(snapshot_tick);
+    snapshot_tick = 0;
+
+    for (i = 0; i < 2; i++) {
+        Deck *deck = &decks[i];
+
+        if (deck->watch > 0)
+            g_source_remove(deck->watch);
+        deck->watch = 0;
+
+        if (deck->pipeline) {
+            gst_element_set_state(deck->pipeline, GST_STATE_NULL);
+            g_mutex_lock(&deck_lock);
+            if (deck->vsink) gst_object_unref(GST_OBJECT(deck->vsink));
+            deck->vsink = NULL;
+            g_mutex_unlock(&deck_lock);
+            gst_object_unref(GST_OBJECT(deck->pipeline));
+            deck->pipeline = NULL;
+        }
     }
-    thread_unlock();
+    playbin = NULL;
+    standby = NULL;
+    snapshot_refresh(SNAP_RESET);
+
+    set_current_uri(NULL);
 
     g_atomic_int_set(&g_next_uri_scheduled, 0);
+
+    /* For soak tests: the whole about-to-finish distribution. */
+    metrics_log_histogram(METRIC_HIST_ABOUT_TO_FINISH);
     return 0;
 }
 
 /*
- * Helper to set up the modern GTK sink pipeline.
+ * Helper to build a deck's modern GTK sink.
  * Tries gtkglsink, then gtksink, and builds a bin with overlay support.
- * Returns TRUE on success, FALSE on failure.
+ * On success the deck's widget is set (one reference, owned by the
+ * caller). Returns TRUE on success, FALSE on failure.
  */
-static gboolean setup_modern_sink(GtkWidget *win)
+static gboolean build_modern_sink(Deck *deck)
 {
     GstElement *sink = NULL, *sink_bin = NULL, *convert = NULL, *scale = NULL, *overlay = NULL;
     gboolean success = FALSE;
     gboolean elements_added = FALSE;
 
-    if (!(sink = gst_element_factory_make("gtkglsink", "gtkglsink_elt")) &&
-        !(sink = gst_element_factory_make("gtksink", "gtksink_elt"))) {
+    if (!(sink = gst_element_factory_make("gtkglsink", NULL)) &&
+        !(sink = gst_element_factory_make("gtksink", NULL))) {
         return FALSE; /* No modern sinks available */
     }
 
-    sink_bin = gst_bin_new("sink_bin");
+    sink_bin = gst_bin_new(NULL);
     convert  = gst_element_factory_make("videoconvert", NULL);
     scale    = gst_element_factory_make("videoscale", NULL);
-    overlay  = gst_element_factory_make("cairooverlay", "overlay");
+    overlay  = gst_element_factory_make(overlay_factory(), "overlay");
 
     if (!sink_bin || !convert || !scale || !overlay) {
-        g_printerr("Failed to create bin elements, falling back.\n");
+        log_warning("Failed to create bin elements, falling back.");
         goto cleanup;
     }
-    
+
     gst_bin_add_many(GST_BIN(sink_bin), convert, scale, overlay, sink, NULL);
     elements_added = TRUE;
-    
+
     if (!gst_element_link_many(convert, scale, overlay, sink, NULL)) {
-        g_printerr("Failed to link sink bin elements, falling back.\n");
+        log_warning("Failed to link sink bin elements, falling back.");
         goto cleanup;
     }
 
@@ -426,26 +1221,21 @@ static gboolean setup_modern_sink(GtkWidget *win)
         if (ghost_pad && gst_element_add_pad(sink_bin, ghost_pad)) {
             success = TRUE;
         } else {
-            g_printerr("Failed to add ghost pad to sink bin, falling back.\n");
+            log_warning("Failed to add ghost pad to sink bin, falling back.");
             if (ghost_pad) gst_object_unref(ghost_pad);
         }
     } else {
-        g_printerr("Failed to get convert sink pad, falling back.\n");
+        log_warning("Failed to get convert sink pad, falling back.");
     }
 
     if (!success) goto cleanup;
 
-    g_object_get(sink, "widget", &video_widget, NULL);
-    if (video_widget) {
-        g_using_gtksink = TRUE;
-        gtk_container_add(GTK_CONTAINER(win), video_widget);
-        gtk_widget_show(video_widget);
-        g_object_unref(video_widget); /* Container holds ref now */
-        if (g_watermark_enabled)
-            g_signal_connect(overlay, "draw", G_CALLBACK(draw_overlay), NULL);
-        g_object_set(G_OBJECT(playbin), "video-sink", sink_bin, NULL);
+    g_object_get(sink, "widget", &deck->widget, NULL);
+    if (deck->widget) {
+        overlay_connect(overlay);
+        g_object_set(G_OBJECT(deck->pipeline), "video-sink", sink_bin, NULL);
     } else {
-        g_printerr("Failed to get gtksink widget, falling back.\n");
+        log_warning("Failed to get gtksink widget, falling back.");
         success = FALSE;
     }
 
@@ -467,84 +1257,267 @@ cleanup:
     return success;
 }
 
+/*
+ * Sets up the modern GTK sink path: one gtksink per deck, stacked so a
+ * swap only changes which one is visible.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static gboolean setup_modern_sink(GtkWidget *win)
+{
+    int i;
+
+    if (!build_modern_sink(&decks[0]))
+        return FALSE;
+
+    if (decks[1].pipeline && !build_modern_sink(&decks[1])) {
+        log_warning("No second GTK sink, pre-roll disabled.");
+        gst_object_unref(GST_OBJECT(decks[1].pipeline));
+        decks[1].pipeline = NULL;
+    }
+
+    g_using_gtksink = TRUE;
+    deck_stack = gtk_stack_new();
+    for (i = 0; i < 2; i++) {
+        if (!decks[i].widget) continue;
+        gtk_container_add(GTK_CONTAINER(deck_stack), decks[i].widget);
+        gtk_widget_show(decks[i].widget);
+        g_object_unref(decks[i].widget); /* Container holds ref now */
+    }
+    gtk_stack_set_visible_child(GTK_STACK(deck_stack), decks[0].widget);
+
+    video_widget = deck_stack;
+    gtk_container_add(GTK_CONTAINER(win), video_widget);
+    gtk_widget_show(video_widget);
+    return TRUE;
+}
+
 /*
  * Helper for legacy GstVideoOverlay embedding.
- * Creates a drawing area and configures a video sink with cairooverlay if needed.
+ * Creates a drawing area and configures a video sink with the graphics
+ * overlay. Both decks render into the same window.
  */
 static void setup_fallback_sink(GtkWidget *win)
 {
-    g_printerr("Modern sinks not available or failed, using fallback embedding.\n");
+    char *description;
+    int i;
+
+    log_warning("Modern sinks not available or failed, using fallback embedding.");
     video_widget = gst_player_video_new(playbin);
     if (!video_widget) return;
-    
+
     gtk_container_add(GTK_CONTAINER(win), video_widget);
     gtk_widget_show(video_widget);
 
-    if (g_watermark_enabled) {
+    description = g_strdup_printf("videoconvert ! videoscale method=0 ! %s name=overlay ! autovideosink",
+            overlay_factory());
+
+    for (i = 0; i < 2; i++) {
         GError *error = NULL;
-        GstElement *video_sink_bin = gst_parse_bin_from_description(
-            "videoconvert ! videoscale method=0 ! cairooverlay name=overlay ! autovideosink",
-            TRUE, &error);
+        GstElement *video_sink_bin;
+
+        if (!decks[i].pipeline) continue;
+
+        video_sink_bin = gst_parse_bin_from_description(description, TRUE, &error);
 
         if (video_sink_bin) {
             GstElement *ov = gst_bin_get_by_name(GST_BIN(video_sink_bin), "overlay");
             if (ov) {
-                g_signal_connect(ov, "draw", G_CALLBACK(draw_overlay), NULL);
+                overlay_connect(ov);
                 gst_object_unref(GST_OBJECT(ov));
-                g_object_set(G_OBJECT(playbin), "video-sink", video_sink_bin, NULL);
+                g_object_set(G_OBJECT(decks[i].pipeline), "video-sink", video_sink_bin, NULL);
             } else {
                 gst_object_unref(GST_OBJECT(video_sink_bin));
             }
         } else if (error) {
-            g_printerr("Failed to parse fallback sink bin: %s\n", error->message);
+            log_warning("Failed to parse fallback sink bin: %s", error->message);
             g_error_free(error);
         }
     }
+    g_free(description);
+}
+
+/* appsink: pulls each frame so it never queues up. In-process consumers go here. */
+static GstFlowReturn headless_new_sample(GstElement *appsink, gpointer data)
+{
+    GstSample *sample = NULL;
+
+    (void)data;
+
+    g_signal_emit_by_name(appsink, "pull-sample", &sample);
+    if (!sample)
+        return GST_FLOW_EOS;
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+/* Iterator callback: clears *data if a sink of the description keeps its output. */
+static void headless_sink_check(const GValue *item, gpointer data)
+{
+    GstElement *sink = GST_ELEMENT(g_value_get_object(item));
+    GstElementFactory *factory = gst_element_get_factory(sink);
+    const char *name = factory ? GST_OBJECT_NAME(factory) : "";
+    gboolean *discards = (gboolean *) data;
+
+    if (strcmp(name, "appsink") == 0) {
+        g_object_set(G_OBJECT(sink), "emit-signals", TRUE, NULL);
+        g_signal_connect(sink, "new-sample", G_CALLBACK(headless_new_sample), NULL);
+    } else if (strcmp(name, "fakesink") != 0 && strcmp(name, "fakevideosink") != 0) {
+        *discards = FALSE;
+    }
+}
+
+/* One instance of a sink description, NULL (logged) if it does not parse. */
+static GstElement *headless_sink_bin(const char *description, gboolean *discards)
+{
+    GError *error = NULL;
+    GstElement *bin = gst_parse_bin_from_description(description, TRUE, &error);
+    GstIterator *it;
+
+    if (!bin) {
+        log_error("Invalid sink \"%s\": %s", description, error ? error->message : "(unknown)");
+        if (error) g_error_free(error);
+        return NULL;
+    }
+    if (error) {
+        /* Parsed, with a recoverable problem (e.g. an unknown property). */
+        log_warning("Sink \"%s\": %s", description, error->message);
+        g_error_free(error);
+    }
+
+    it = gst_bin_iterate_sinks(GST_BIN(bin));
+    gst_iterator_foreach(it, headless_sink_check, discards);
+    gst_iterator_free(it);
+    return bin;
+}
+
+/*
+ * Headless output: no window and no GTK. Each deck gets its own
+ * instance of the video and audio sink descriptions, behind the
+ * graphics overlay, and times frames at the video bin's
+ * sink pad. Two decks must not write the same output, so pre-roll is
+ * kept only if every sink discards what it gets (fakesink,
+ * fakevideosink, appsink). Gapless handoffs happen inside one pipeline
+ * and are unaffected. Returns FALSE if a description does not parse.
+ */
+static gboolean setup_headless_sink(void)
+{
+    gboolean discards = TRUE;
+    char *video;
+    int i;
+
+    video = g_strdup_printf("videoconvert ! %s name=overlay ! %s", overlay_factory(), g_headless_video);
+
+    for (i = 0; i < 2; i++) {
+        GstElement *vbin, *abin, *ov;
+        GstPad *pad;
+
+        if (!decks[i].pipeline) continue;
+
+        if (!(vbin = headless_sink_bin(video, &discards))) {
+            g_free(video);
+            return FALSE;
+        }
+        if (!(abin = headless_sink_bin(g_headless_audio, &discards))) {
+            gst_object_unref(GST_OBJECT(vbin));
+            g_free(video);
+            return FALSE;
+        }
+
+        if ((ov = gst_bin_get_by_name(GST_BIN(vbin), "overlay")) != NULL) {
+            overlay_connect(ov);
+            gst_object_unref(GST_OBJECT(ov));
+        }
+        if ((pad = gst_element_get_static_pad(vbin, "sink")) != NULL) {
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, deck_frame_probe, &decks[i], NULL);
+            gst_object_unref(GST_OBJECT(pad));
+        }
+        g_object_set(G_OBJECT(decks[i].pipeline), "video-sink", vbin, "audio-sink", abin, NULL);
+    }
+    g_free(video);
+
+    if (decks[1].pipeline && !discards) {
+        log_info("Pre-roll disabled: the sink keeps its output, one pipeline must own it.");
+        gst_object_unref(GST_OBJECT(decks[1].pipeline));
+        decks[1].pipeline = NULL;
+    }
+
+    log_info("Headless output: %s (audio: %s).", g_headless_video, g_headless_audio);
+    return TRUE;
 }
 
+void md_gst_set_headless(const char *video_sink, const char *audio_sink)
+{
+    if (video_sink) g_headless_video = video_sink;
+    if (audio_sink) g_headless_audio = audio_sink;
+}
+
+/* Hooks a deck's bus and signals up; 'deck' is their user data. */
+static void deck_connect(Deck *deck)
+{
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(deck->pipeline));
+
+    /* Synchronous handler (only active if !g_using_gtksink) */
+    gst_bus_set_sync_handler(bus, bus_sync_handler, deck, NULL);
+
+    /* Async watch for state changes/EOS/errors */
+    deck->watch = gst_bus_add_watch(bus, bus_call, deck);
+    gst_object_unref(GST_OBJECT(bus));
+
+    g_signal_connect(deck->pipeline, "about-to-finish", G_CALLBACK(on_about_to_finish), deck);
+    g_signal_connect(deck->pipeline, "deep-element-added", G_CALLBACK(deck_element_added), deck);
+}
 
-gint md_gst_init(gint *argc, gchar ***argv, GtkWidget *win, int loop_enabled, int watermark_enabled)
+gint md_gst_init(gint *argc, gchar ***argv, GtkWidget *win, int loop_enabled)
 {
+    const char *factory;
+    int i;
+
     /* Store feature flags */
     g_loop_enabled = loop_enabled;
-    g_watermark_enabled = watermark_enabled;
 
     gst_init(argc, argv);
 
     /* Modern Playback: try playbin3 first */
-    if (gst_element_factory_find("playbin3")) {
-        playbin = gst_element_factory_make("playbin3", "play");
-    } else {
-        playbin = gst_element_factory_make("playbin", "play");
-    }
+    factory = gst_element_factory_find("playbin3") ? "playbin3" : "playbin";
+    decks[0].pipeline = gst_element_factory_make(factory, "play");
+    decks[1].pipeline = gst_element_factory_make(factory, "standby");
 
-    if (!playbin) {
-        g_printerr("Failed to create playback element.\n");
+    if (!decks[0].pipeline) {
+        log_error("Failed to create playback element.");
         return -1;
     }
+    playbin = live->pipeline;
 
     /*
-     * Attempt to use modern, hardware-accelerated sinks first.
-     * If this path succeeds, it handles widget creation and attachment.
+     * Without a window, render into the headless sinks. Otherwise attempt
+     * to use modern, hardware-accelerated sinks first. If this path
+     * succeeds, it handles widget creation and attachment.
      */
-    if (!setup_modern_sink(win)) {
+    if (!win) {
+        g_headless = TRUE;
+        if (!setup_headless_sink())
+            return -1;
+    } else if (!setup_modern_sink(win)) {
         /* Fall back to legacy GstVideoOverlay embedding. */
         setup_fallback_sink(win);
     }
 
-    bus = gst_pipeline_get_bus(GST_PIPELINE(playbin));
-
-    /* Synchronous handler (only active if !g_using_gtksink) */
-    gst_bus_set_sync_handler(bus, bus_sync_handler, NULL, NULL);
-
-    /* Async watch for state changes/EOS/errors */
-    bus_watch_id = gst_bus_add_watch(bus, bus_call, NULL);
-    gst_object_unref(GST_OBJECT(bus));
+    for (i = 0; i < 2; i++) {
+        if (decks[i].pipeline)
+            deck_connect(&decks[i]);
+    }
 
-    g_signal_connect(playbin, "about-to-finish", G_CALLBACK(on_about_to_finish), NULL);
+    if (decks[1].pipeline) {
+        standby = &decks[1];
+        g_atomic_int_set(&preroll_enabled, 1);
+    } else {
+        log_warning("Pre-roll disabled: cannot create a standby pipeline.");
+    }
 
     /* Start clean */
     g_atomic_int_set(&g_next_uri_scheduled, 0);
+    snapshot_refresh(SNAP_RESET | SNAP_STATE);
+    snapshot_tick = g_timeout_add(SNAPSHOT_TICK_MS, snapshot_tick_cb, NULL);
 
     return 0;
 }
@@ -0,0 +1,95 @@
+/*
+ * Interned string pool for queue URIs.
+ *
+ * Each distinct URI is stored once, in a single allocation holding a
+ * small header and the characters, and shared by every queue entry that
+ * refers to it (a looping schedule repeats the same few paths many
+ * times). Entries are reference counted and freed with their last user.
+ *
+ * Not thread-safe on its own; callers hold the queue lock. Freed
+ * strings go through rcu_retire(), so a reader inside an RCU read
+ * section may keep using a URI it found in a published queue view.
+ */
+
+#include "VTserver.h"
+
+typedef struct {
+    gint   refcount;
+    guint  len;
+    char   str[];
+} InternEntry;
+
+#define INTERN_ENTRY(s) ((InternEntry *) ((char *) (s) - G_STRUCT_OFFSET(InternEntry, str)))
+
+/* str -> InternEntry, keyed by the entry's own characters */
+static GHashTable *pool = NULL;
+static gsize pool_bytes = 0;
+
+void intern_init (void)
+{
+    if (pool == NULL)
+        pool = g_hash_table_new(g_str_hash, g_str_equal);
+    pool_bytes = 0;
+}
+
+void intern_cleanup (void)
+{
+    if (pool) {
+        GHashTableIter it;
+        gpointer value;
+
+        g_hash_table_iter_init(&it, pool);
+        while (g_hash_table_iter_next(&it, NULL, &value))
+            g_free(value);
+        g_hash_table_destroy(pool);
+        pool = NULL;
+    }
+    pool_bytes = 0;
+}
+
+const char *intern_ref (const char *s)
+{
+    InternEntry *e = g_hash_table_lookup(pool, s);
+
+    if (e == NULL) {
+        gsize len = strlen(s);
+
+        e = g_malloc(sizeof(InternEntry) + len + 1);
+        e->refcount = 0;
+        e->len = len;
+        memcpy(e->str, s, len + 1);
+        g_hash_table_insert(pool, e->str, e);
+        pool_bytes += sizeof(InternEntry) + len + 1;
+    }
+
+    e->refcount++;
+    return e->str;
+}
+
+void intern_unref (const char *s)
+{
+    InternEntry *e;
+
+    if (s == NULL)
+        return;
+
+    e = INTERN_ENTRY(s);
+    if (--e->refcount > 0)
+        return;
+
+    g_hash_table_remove(pool, e->str);
+    pool_bytes -= sizeof(InternEntry) + e->len + 1;
+    rcu_retire(e, g_free);
+}
+
+/* Number of distinct strings currently pooled. */
+guint intern_count (void)
+{
+    return pool ? g_hash_table_size(pool) : 0;
+}
+
+/* Bytes held by pooled strings (headers and characters). */
+gsize intern_bytes (void)
+{
+    return pool_bytes;
+}
@@ -0,0 +1,336 @@
+/*
+ * Load test: the IPC loop, the old select() loop vs. unix.c.
+ *
+ * Runs each loop in-process over a stub command layer and drives it
+ * with closed-loop text clients that send requests back to back, one
+ * connection per request. Throughput and the latency percentiles of
+ * those requests are reported for each loop under four loads:
+ *
+ *   status        STATUS only (~5 us of work each)
+ *   slow list     plus one client sending LIST that takes 20 ms, like
+ *                 a LIST over a very long queue
+ *   idle client   plus one client that connects every 100 ms and
+ *                 sends nothing
+ *   insert+sync   INSERT, and a 2 ms journal sync before each reply;
+ *                 the old loop syncs once per request, unix.c's
+ *                 workers share one sync (group commit)
+ *
+ * unix.c takes over the server's socket path while it runs, so do not
+ * run this next to a live VTserver.
+ *
+ *   make -C src/server bench && ./src/server/ipc-bench [SECONDS] [CLIENTS]
+ */
+
+#include "VTserver.h"
+
+#define BENCH_SECONDS       2
+#define BENCH_CLIENTS       8
+#define BENCH_STATUS_US     5
+#define BENCH_LIST_MS       20
+#define BENCH_SYNC_MS       2
+#define BENCH_IDLE_EVERY_MS 100
+#define BENCH_LEGACY_PATH   "/tmp/VTmpegd.bench"
+
+typedef enum {
+    LOAD_STATUS = 0,
+    LOAD_SLOW_LIST,
+    LOAD_IDLE_CLIENT,
+    LOAD_INSERT_SYNC
+} BenchLoad;
+
+static const char *load_names[] = { "status", "slow list", "idle client", "insert+sync" };
+
+static BenchLoad load;
+static gint running;
+
+/* Group commit: one sync covers every mutation made before it started. */
+static GMutex sync_lock;
+static gint   mutations = 0;
+static gint   synced = 0;
+
+/* ---- Stub command layer ---- */
+
+char *command_process (const char *payload)
+{
+    int id = atoi(payload);
+
+    if (id == COMMAND_LIST)
+        g_usleep(BENCH_LIST_MS * 1000);
+    else if (id == COMMAND_INSERT)
+        g_atomic_int_inc(&mutations);
+    else
+        g_usleep(BENCH_STATUS_US);
+    return g_strdup_printf("%c\nStatus: Stopped\n%c\n", COMMAND_OK, COMMAND_DELIM);
+}
+
+void commands_commit (void)
+{
+    gint target = g_atomic_int_get(&mutations);
+
+    g_mutex_lock(&sync_lock);
+    if (synced < target) {
+        target = g_atomic_int_get(&mutations);
+        g_usleep(BENCH_SYNC_MS * 1000);
+        synced = target;
+    }
+    g_mutex_unlock(&sync_lock);
+}
+
+void md_gst_get_snapshot (PlaybackSnapshot *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+}
+
+const char *md_gst_state_name (const PlaybackSnapshot *snap)
+{
+    (void)snap;
+    return "Stopped";
+}
+
+/* ---- The select() loop as it was before unix.c used epoll ---- */
+
+static int legacy_fd = -1;
+static pthread_t legacy_th;
+
+static void legacy_client (int fd)
+{
+    char temp[PATH_MAX + 128];
+    ssize_t bytes_read;
+
+    memset(temp, 0, sizeof(temp));
+    bytes_read = read(fd, temp, sizeof(temp) - 1);
+    if (bytes_read <= 0) return;
+    temp[bytes_read] = '\0';
+
+    char *response = command_process(temp);
+    /* What a journal would have cost it: a sync per request. */
+    commands_commit();
+    if (response) {
+        dprintf(fd, "%s", response);
+        g_free(response);
+    }
+}
+
+static void *legacy_loop (void *arg)
+{
+    fd_set fds;
+    int cfd;
+    struct timeval tv;
+
+    (void)arg;
+
+    while (g_atomic_int_get(&running)) {
+        FD_ZERO(&fds);
+        FD_SET(legacy_fd, &fds);
+        tv.tv_sec = 1; tv.tv_usec = 0;
+
+        if (select(legacy_fd + 1, &fds, NULL, NULL, &tv) <= 0)
+            continue;
+        if ((cfd = accept(legacy_fd, NULL, NULL)) < 0)
+            continue;
+
+        struct timeval rtv = { 1, 0 };
+        setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &rtv, sizeof(rtv));
+        legacy_client(cfd);
+        shutdown(cfd, 2);
+        close(cfd);
+    }
+    return NULL;
+}
+
+static gboolean legacy_start (void)
+{
+    struct sockaddr_un s;
+
+    memset(&s, 0, sizeof(s));
+    s.sun_family = AF_UNIX;
+    snprintf(s.sun_path, sizeof(s.sun_path), "%s", BENCH_LEGACY_PATH);
+    unlink(BENCH_LEGACY_PATH);
+
+    if ((legacy_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(legacy_fd, (struct sockaddr *) &s, sizeof(s)) < 0 ||
+        listen(legacy_fd, SOMAXCONN) < 0) {
+        perror("legacy socket");
+        return FALSE;
+    }
+    pthread_create(&legacy_th, NULL, legacy_loop, NULL);
+    return TRUE;
+}
+
+static void legacy_stop (void)
+{
+    pthread_join(legacy_th, NULL);
+    close(legacy_fd);
+    unlink(BENCH_LEGACY_PATH);
+}
+
+/* ---- Clients ---- */
+
+typedef struct {
+    const char *path;
+    const char *request;
+    GArray     *latencies;      /* gint64 us, NULL: not measured */
+    gint64      until;
+} BenchClient;
+
+static gint64 now_us (void)
+{
+    return g_get_monotonic_time();
+}
+
+static int bench_connect (const char *path)
+{
+    struct sockaddr_un s;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&s, 0, sizeof(s));
+    s.sun_family = AF_UNIX;
+    snprintf(s.sun_path, sizeof(s.sun_path), "%s", path);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &s, sizeof(s)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* One request on its own connection; the reply ends at EOF. */
+static gboolean bench_request (const char *path, const char *request)
+{
+    char buf[256];
+    gboolean ok = FALSE;
+    ssize_t r;
+    int fd = bench_connect(path);
+
+    if (fd < 0)
+        return FALSE;
+    if (write(fd, request, strlen(request) + 1) > 0) {
+        while ((r = read(fd, buf, sizeof(buf))) > 0)
+            ok |= buf[0] == COMMAND_OK;
+    }
+    close(fd);
+    return ok;
+}
+
+static gpointer bench_client (gpointer data)
+{
+    BenchClient *c = (BenchClient *) data;
+
+    while (now_us() < c->until) {
+        gint64 start = now_us();
+
+        if (bench_request(c->path, c->request) && c->latencies) {
+            gint64 us = now_us() - start;
+            g_array_append_val(c->latencies, us);
+        }
+    }
+    return NULL;
+}
+
+/* Connects and sends nothing, again and again; a server gives up on it after 1 s. */
+static gpointer bench_idler (gpointer data)
+{
+    BenchClient *c = (BenchClient *) data;
+
+    while (now_us() < c->until) {
+        int fd = bench_connect(c->path);
+
+        g_usleep(BENCH_IDLE_EVERY_MS * 1000);
+        if (fd >= 0)
+            close(fd);
+    }
+    return NULL;
+}
+
+static gint compare_i64 (gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_run (const char *impl, const char *path, int seconds, int clients)
+{
+    BenchClient *c = g_new0(BenchClient, clients + 1);
+    GThread **th = g_new0(GThread *, clients + 1);
+    GArray *all = g_array_new(FALSE, FALSE, sizeof(gint64));
+    char status[16], insert[32], list[16];
+    gint64 until = now_us() + (gint64) seconds * G_USEC_PER_SEC;
+    int i, n = clients;
+
+    g_snprintf(status, sizeof(status), "%d", COMMAND_STATUS);
+    g_snprintf(insert, sizeof(insert), "%d /dev/null", COMMAND_INSERT);
+    g_snprintf(list, sizeof(list), "%d", COMMAND_LIST);
+
+    for (i = 0; i < clients; i++) {
+        c[i].path = path;
+        c[i].request = load == LOAD_INSERT_SYNC ? insert : status;
+        c[i].latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+        c[i].until = until;
+        th[i] = g_thread_new("client", bench_client, &c[i]);
+    }
+    if (load == LOAD_SLOW_LIST || load == LOAD_IDLE_CLIENT) {
+        c[n].path = path;
+        c[n].request = list;
+        c[n].until = until;
+        th[n] = g_thread_new("noise", load == LOAD_SLOW_LIST ? bench_client : bench_idler, &c[n]);
+        n++;
+    }
+
+    for (i = 0; i < n; i++)
+        g_thread_join(th[i]);
+    for (i = 0; i < clients; i++) {
+        g_array_append_vals(all, c[i].latencies->data, c[i].latencies->len);
+        g_array_free(c[i].latencies, TRUE);
+    }
+
+    g_array_sort(all, compare_i64);
+    if (all->len > 0) {
+        printf("%-8s %-12s %10.0f req/s  p50 %8" G_GINT64_FORMAT " us  p99 %8" G_GINT64_FORMAT " us  max %8" G_GINT64_FORMAT " us\n",
+                impl, load_names[load], all->len / (double) seconds,
+                g_array_index(all, gint64, all->len / 2),
+                g_array_index(all, gint64, all->len * 99 / 100),
+                g_array_index(all, gint64, all->len - 1));
+    } else {
+        printf("%-8s %-12s          0 req/s\n", impl, load_names[load]);
+    }
+
+    g_array_free(all, TRUE);
+    g_free(th);
+    g_free(c);
+}
+
+int main (int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_SECONDS;
+    int clients = argc > 2 ? atoi(argv[2]) : BENCH_CLIENTS;
+    int fd;
+
+    if (seconds <= 0 || clients <= 0) {
+        fprintf(stderr, "usage: %s [SECONDS] [CLIENTS]\n", argv[0]);
+        return 1;
+    }
+    if ((fd = bench_connect(UNIX_PATH)) >= 0) {
+        fprintf(stderr, "%s: a server is listening on %s; stop it first\n", argv[0], UNIX_PATH);
+        close(fd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    metrics_init();
+
+    printf("%d clients, %d s per run\n", clients, seconds);
+    for (load = LOAD_STATUS; load <= LOAD_INSERT_SYNC; load++) {
+        g_atomic_int_set(&running, 1);
+        if (!legacy_start())
+            return 1;
+        bench_run("select", BENCH_LEGACY_PATH, seconds, clients);
+        g_atomic_int_set(&running, 0);
+        legacy_stop();
+
+        if (!unix_server())
+            return 1;
+        bench_run("epoll", UNIX_PATH, seconds, clients);
+        unix_finish();
+        unlink(unix_sockname());
+        unlink(UNIX_PATH);
+    }
+    return 0;
+}
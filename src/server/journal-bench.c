@@ -0,0 +1,206 @@
+/*
+ * Benchmark: queue mutation throughput without and with the journal.
+ *
+ * THREADS threads stand in for the IPC workers. Each one applies a batch
+ * of random inserts and removals to a VTQueue of about QUEUE items under
+ * one lock, journals them like commands.c does, then calls
+ * journal_commit() before its next batch, the way a worker replies.
+ * The queue is compacted into a snapshot whenever the journal asks.
+ * Batch sizes of 1, 16 and 256 mutations are timed, and the latency
+ * from taking the lock to the end of the commit is reported.
+ *
+ * The journal is written under DIR (default ./journal-bench.d), which
+ * must be on the disk under test: on tmpfs fdatasync() costs nothing.
+ * DIR is emptied before every run and removed at the end.
+ *
+ *   make -C src/server bench && ./src/server/journal-bench [SECONDS] [THREADS] [DIR]
+ */
+
+#include "VTserver.h"
+
+#define BENCH_SECONDS   2
+#define BENCH_THREADS   4
+#define BENCH_QUEUE     10000
+#define BENCH_DIR       "journal-bench.d"
+
+static const guint batches[] = { 1, 16, 256 };
+
+typedef struct {
+    guint    batch;
+    gint64   until;
+    guint32  seed;
+    guint64  mutations;
+    GArray  *latencies;     /* gint64 us per batch */
+} BenchThread;
+
+static GMutex  qlock;
+static VTQueue queue;
+static guint64 next_id = 1;
+
+static void bench_uri (char *buf, gsize len, guint64 id)
+{
+    g_snprintf(buf, len, "/srv/media/bench/clip-%08" G_GUINT64_FORMAT ".mpg", id);
+}
+
+/* Same records as command_snapshot(). Queue lock held. */
+static void bench_snapshot (void)
+{
+    GString *snap = journal_snapshot_begin();
+    VTQueueNode *iter;
+    char uri[64];
+
+    for (iter = vtq_first(&queue); iter; iter = vtq_next(iter)) {
+        guint64 id = GPOINTER_TO_UINT(iter->data);
+        bench_uri(uri, sizeof(uri), id);
+        journal_snapshot_add(snap, JOURNAL_INSERT, -1, id, uri);
+    }
+    journal_snapshot_add(snap, JOURNAL_NEXT_ID, 0, next_id, NULL);
+    journal_snapshot_add(snap, JOURNAL_CURSOR, 0, 0, NULL);
+    journal_snapshot_add(snap, JOURNAL_CURRENT, 0, 0, NULL);
+    journal_snapshot_submit(snap);
+}
+
+static gpointer bench_thread (gpointer data)
+{
+    BenchThread *t = (BenchThread *) data;
+    GRand *rand = g_rand_new_with_seed(t->seed);
+    char uri[64];
+    guint i;
+
+    while (g_get_monotonic_time() < t->until) {
+        gint64 start = g_get_monotonic_time(), us;
+
+        g_mutex_lock(&qlock);
+        for (i = 0; i < t->batch; i++) {
+            guint len = vtq_length(&queue);
+            guint pos = g_rand_int_range(rand, 0, len + 1);
+
+            if (len < BENCH_QUEUE || g_rand_boolean(rand)) {
+                guint64 id = next_id++;
+                bench_uri(uri, sizeof(uri), id);
+                vtq_insert(&queue, pos, GUINT_TO_POINTER((guint) id));
+                journal_append(JOURNAL_INSERT, pos, id, uri);
+            } else {
+                pos = MIN(pos, len - 1);
+                vtq_remove(&queue, pos);
+                journal_append(JOURNAL_REMOVE, pos, 0, NULL);
+            }
+        }
+        if (journal_wants_snapshot())
+            bench_snapshot();
+        g_mutex_unlock(&qlock);
+
+        journal_commit();
+
+        us = g_get_monotonic_time() - start;
+        g_array_append_val(t->latencies, us);
+        t->mutations += t->batch;
+    }
+
+    g_rand_free(rand);
+    return NULL;
+}
+
+static void bench_empty_dir (const char *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    if (dir == NULL)
+        return;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        char *file = g_build_filename(path, name, NULL);
+        unlink(file);
+        g_free(file);
+    }
+    g_dir_close(dir);
+}
+
+static gint compare_i64 (gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_run (const char *dir, guint batch, int seconds, int threads)
+{
+    BenchThread *t = g_new0(BenchThread, threads);
+    GThread **th = g_new0(GThread *, threads);
+    GArray *all = g_array_new(FALSE, FALSE, sizeof(gint64));
+    gint64 until;
+    guint64 mutations = 0;
+    guint i;
+    int n;
+
+    vtq_init(&queue);
+    for (i = 0; i < BENCH_QUEUE; i++)
+        vtq_insert(&queue, i, GUINT_TO_POINTER((guint) next_id++));
+
+    if (dir) {
+        bench_empty_dir(dir);
+        if (!journal_open(dir, NULL)) {
+            fprintf(stderr, "journal-bench: cannot open a journal in %s\n", dir);
+            exit(EXIT_FAILURE);
+        }
+        /* Start from a snapshot of the prefilled queue, as after a restart. */
+        g_mutex_lock(&qlock);
+        bench_snapshot();
+        g_mutex_unlock(&qlock);
+        journal_commit();
+    }
+
+    until = g_get_monotonic_time() + (gint64) seconds * G_USEC_PER_SEC;
+    for (n = 0; n < threads; n++) {
+        t[n].batch = batch;
+        t[n].until = until;
+        t[n].seed = 0x5eed + n;
+        t[n].latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+        th[n] = g_thread_new("worker", bench_thread, &t[n]);
+    }
+    for (n = 0; n < threads; n++) {
+        g_thread_join(th[n]);
+        mutations += t[n].mutations;
+        g_array_append_vals(all, t[n].latencies->data, t[n].latencies->len);
+        g_array_free(t[n].latencies, TRUE);
+    }
+
+    if (dir)
+        journal_close();
+    vtq_clear(&queue, NULL);
+
+    g_array_sort(all, compare_i64);
+    printf("%-8s batch %4u %12.0f mutations/s %9.0f commits/s  p50 %7" G_GINT64_FORMAT " us  p99 %7" G_GINT64_FORMAT " us\n",
+            dir ? "journal" : "none", batch,
+            mutations / (double) seconds, all->len / (double) seconds,
+            g_array_index(all, gint64, all->len / 2),
+            g_array_index(all, gint64, all->len * 99 / 100));
+
+    g_array_free(all, TRUE);
+    g_free(th);
+    g_free(t);
+}
+
+int main (int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_SECONDS;
+    int threads = argc > 2 ? atoi(argv[2]) : BENCH_THREADS;
+    const char *dir = argc > 3 ? argv[3] : BENCH_DIR;
+    guint i;
+
+    if (seconds <= 0 || threads <= 0) {
+        fprintf(stderr, "usage: %s [SECONDS] [THREADS] [DIR]\n", argv[0]);
+        return 1;
+    }
+    logger_set_level(LOG_LEVEL_WARNING);
+
+    printf("%d threads, %d s per run, queue of %d, journal in %s\n",
+            threads, seconds, BENCH_QUEUE, dir);
+    for (i = 0; i < G_N_ELEMENTS(batches); i++) {
+        bench_run(NULL, batches[i], seconds, threads);
+        bench_run(dir, batches[i], seconds, threads);
+    }
+
+    bench_empty_dir(dir);
+    rmdir(dir);
+    return 0;
+}
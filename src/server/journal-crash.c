@@ -0,0 +1,305 @@
+/*
+ * Crash test: the journal under kill -9 during large bulk writes.
+ *
+ * Each round forks a writer that reopens the journal, replays it into
+ * a model of the queue, then applies batches of random mutations:
+ * bulk inserts of up to BULK items with long URIs, removals and moves.
+ * It calls journal_commit() after each batch and then reports the
+ * batch number over a pipe, like a worker replying to a client. The
+ * queue is compacted into a snapshot whenever the journal asks, so
+ * kills also land during compaction. After a random delay the writer
+ * is killed with SIGKILL.
+ *
+ * The parent replays the same batches from the same seed and checks
+ * that the recovered queue is the state after the last reported batch,
+ * or a state partway through the batch after it (that batch may have
+ * been synced, whole or in part, but not reported). Anything else,
+ * including a journal that fails to open, is a failure.
+ *
+ *   make -C src/server bench && ./src/server/journal-crash [ROUNDS] [DIR]
+ */
+
+#include "VTserver.h"
+#include <sys/wait.h>
+
+#define CRASH_ROUNDS    20
+#define CRASH_DIR       "journal-crash.d"
+#define CRASH_QUEUE     50000
+#define CRASH_BULK      2000
+#define CRASH_BATCH_OPS 8
+#define CRASH_KILL_MIN_MS 50
+#define CRASH_KILL_MAX_MS 1500
+
+/* The queue as a plain array of item IDs; URIs are derived from them. */
+static GArray  *model = NULL;
+static guint64  next_id = 1;
+static gboolean replay_bad = FALSE;
+
+static void crash_uri (char *buf, gsize len, guint64 id)
+{
+    g_snprintf(buf, len, "/srv/media/archive/%06" G_GUINT64_FORMAT "/"
+               "a-rather-long-programme-title-to-fill-the-log-%08" G_GUINT64_FORMAT ".mpg",
+               id % 1000, id);
+}
+
+static void model_insert (guint pos, guint64 id)
+{
+    g_array_insert_val(model, MIN(pos, model->len), id);
+}
+
+static void model_replay (JournalOp op, gint32 pos, guint64 arg, const char *uri)
+{
+    char want[256];
+    guint64 id;
+
+    switch (op) {
+        case JOURNAL_INSERT:
+            crash_uri(want, sizeof(want), arg);
+            if (uri == NULL || strcmp(uri, want) != 0)
+                replay_bad = TRUE;
+            model_insert(pos < 0 ? model->len : (guint) pos, arg);
+            if (arg >= next_id) next_id = arg + 1;
+            break;
+        case JOURNAL_REMOVE:
+            if (pos >= 0 && (guint) pos < model->len)
+                g_array_remove_index(model, pos);
+            else
+                replay_bad = TRUE;
+            break;
+        case JOURNAL_MOVE:
+            if (pos >= 0 && (guint) pos < model->len) {
+                id = g_array_index(model, guint64, pos);
+                g_array_remove_index(model, pos);
+                model_insert((guint) arg, id);
+            } else {
+                replay_bad = TRUE;
+            }
+            break;
+        case JOURNAL_NEXT_ID:
+            if (arg > next_id) next_id = arg;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * One batch: a few bulk inserts, removals and moves. Calls step() after
+ * each single mutation so the checker can compare every intermediate
+ * state; the writer journals from it.
+ */
+typedef void (*CrashStep)(JournalOp op, gint32 pos, guint64 arg);
+
+static void crash_batch (GRand *rand, CrashStep step)
+{
+    guint i, j, n;
+
+    for (i = 0; i < CRASH_BATCH_OPS; i++) {
+        guint len = model->len;
+        guint32 kind = g_rand_int_range(rand, 0, 4);
+
+        if (len < CRASH_QUEUE / 2 || (kind < 2 && len < CRASH_QUEUE)) {
+            guint pos = g_rand_int_range(rand, 0, len + 1);
+            n = g_rand_int_range(rand, 1, CRASH_BULK + 1);
+            for (j = 0; j < n; j++) {
+                guint64 id = next_id++;
+                model_insert(pos + j, id);
+                if (step) step(JOURNAL_INSERT, pos + j, id);
+            }
+        } else if (kind == 2 || len >= CRASH_QUEUE) {
+            n = g_rand_int_range(rand, 1, CRASH_BULK + 1);
+            for (j = 0; j < n && model->len > 0; j++) {
+                guint pos = g_rand_int_range(rand, 0, model->len);
+                g_array_remove_index(model, pos);
+                if (step) step(JOURNAL_REMOVE, pos, 0);
+            }
+        } else {
+            n = g_rand_int_range(rand, 1, 65);
+            for (j = 0; j < n; j++) {
+                guint from = g_rand_int_range(rand, 0, model->len);
+                guint to = g_rand_int_range(rand, 0, model->len);
+                guint64 id = g_array_index(model, guint64, from);
+                g_array_remove_index(model, from);
+                model_insert(to, id);
+                if (step) step(JOURNAL_MOVE, from, to);
+            }
+        }
+    }
+}
+
+/* ---- Writer (child) ---- */
+
+static void writer_step (JournalOp op, gint32 pos, guint64 arg)
+{
+    char uri[256];
+
+    if (op == JOURNAL_INSERT)
+        crash_uri(uri, sizeof(uri), arg);
+    journal_append(op, pos, arg, op == JOURNAL_INSERT ? uri : NULL);
+}
+
+/* Same records as command_snapshot(). */
+static void writer_snapshot (void)
+{
+    GString *snap = journal_snapshot_begin();
+    char uri[256];
+    guint i;
+
+    for (i = 0; i < model->len; i++) {
+        guint64 id = g_array_index(model, guint64, i);
+        crash_uri(uri, sizeof(uri), id);
+        journal_snapshot_add(snap, JOURNAL_INSERT, -1, id, uri);
+    }
+    journal_snapshot_add(snap, JOURNAL_NEXT_ID, 0, next_id, NULL);
+    journal_snapshot_submit(snap);
+}
+
+static void crash_writer (const char *dir, guint32 seed, int out)
+{
+    GRand *rand = g_rand_new_with_seed(seed);
+    guint32 batch;
+
+    g_array_set_size(model, 0);
+    next_id = 1;
+    if (!journal_open(dir, model_replay) || replay_bad)
+        _exit(2);
+
+    for (batch = 1; ; batch++) {
+        crash_batch(rand, writer_step);
+        if (journal_wants_snapshot())
+            writer_snapshot();
+        journal_commit();
+        if (write(out, &batch, sizeof(batch)) != sizeof(batch))
+            _exit(3);
+    }
+}
+
+/* ---- Checker (parent) ---- */
+
+static GArray  *expect = NULL;
+static gboolean expect_hit = FALSE;
+
+static void checker_step (JournalOp op, gint32 pos, guint64 arg)
+{
+    (void)op; (void)pos; (void)arg;
+
+    if (!expect_hit && model->len == expect->len &&
+        memcmp(model->data, expect->data, model->len * sizeof(guint64)) == 0)
+        expect_hit = TRUE;
+}
+
+static void crash_remove_dir (const char *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const char *name;
+
+    if (dir == NULL)
+        return;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        char *file = g_build_filename(path, name, NULL);
+        unlink(file);
+        g_free(file);
+    }
+    g_dir_close(dir);
+    rmdir(path);
+}
+
+int main (int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : CRASH_ROUNDS;
+    const char *dir = argc > 2 ? argv[2] : CRASH_DIR;
+    GRand *rand = g_rand_new_with_seed(time(NULL));
+    guint64 acked_total = 0;
+    int round, failed = 0;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: %s [ROUNDS] [DIR]\n", argv[0]);
+        return 1;
+    }
+    logger_set_level(LOG_LEVEL_ERROR);
+    model = g_array_new(FALSE, FALSE, sizeof(guint64));
+    expect = g_array_new(FALSE, FALSE, sizeof(guint64));
+    crash_remove_dir(dir);
+
+    for (round = 1; round <= rounds; round++) {
+        guint32 seed = g_rand_int(rand), acked = 0, batch, b;
+        guint delay = g_rand_int_range(rand, CRASH_KILL_MIN_MS, CRASH_KILL_MAX_MS);
+        GArray *start;
+        guint64 start_id;
+        int status, p[2];
+        pid_t pid;
+
+        /* The state the writer will start from. */
+        g_array_set_size(model, 0);
+        next_id = 1;
+        replay_bad = FALSE;
+        if (journal_open(dir, model_replay))
+            journal_close();
+        start = g_array_sized_new(FALSE, FALSE, sizeof(guint64), model->len);
+        g_array_append_vals(start, model->data, model->len);
+        start_id = next_id;
+
+        if (pipe(p) < 0 || (pid = fork()) < 0) {
+            perror("journal-crash");
+            return 1;
+        }
+        if (pid == 0) {
+            close(p[0]);
+            crash_writer(dir, seed, p[1]);
+        }
+        close(p[1]);
+        g_usleep(delay * 1000);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        while (read(p[0], &batch, sizeof(batch)) == sizeof(batch))
+            acked = batch;
+        close(p[0]);
+
+        if (!WIFSIGNALED(status)) {
+            printf("round %2d: writer exited early (status %d)\n", round, WEXITSTATUS(status));
+            failed++;
+            g_array_free(start, TRUE);
+            break;
+        }
+
+        /* What survived. */
+        g_array_set_size(expect, 0);
+        next_id = 1;
+        replay_bad = FALSE;
+        g_array_set_size(model, 0);
+        if (!journal_open(dir, model_replay)) {
+            printf("round %2d: journal does not open after the crash\n", round);
+            failed++;
+            g_array_free(start, TRUE);
+            break;
+        }
+        journal_close();
+        g_array_append_vals(expect, model->data, model->len);
+
+        /* Replay the writer's batches up to the acked one, then step through the next. */
+        GRand *replay = g_rand_new_with_seed(seed);
+        g_array_set_size(model, 0);
+        g_array_append_vals(model, start->data, start->len);
+        next_id = start_id;
+        for (b = 1; b <= acked; b++)
+            crash_batch(replay, NULL);
+        expect_hit = model->len == expect->len &&
+                     memcmp(model->data, expect->data, model->len * sizeof(guint64)) == 0;
+        crash_batch(replay, checker_step);
+        g_rand_free(replay);
+        g_array_free(start, TRUE);
+
+        printf("round %2d: killed after %4u ms, %4u batches acked, %6u items recovered: %s\n",
+                round, delay, acked, expect->len,
+                expect_hit && !replay_bad ? "ok" : "LOST OR CORRUPT");
+        if (!expect_hit || replay_bad)
+            failed++;
+        acked_total += acked;
+    }
+
+    printf("%d rounds, %" G_GUINT64_FORMAT " batches acked, %d failed\n",
+            rounds, acked_total, failed);
+    if (failed == 0)
+        crash_remove_dir(dir);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,556 @@
+/*
+ * Crash-safe queue journal.
+ *
+ * Queue mutations are appended as records to an in-memory buffer (cheap,
+ * done under the queue lock by whichever thread mutates) and a writer
+ * thread moves them to an append-only write-ahead log with one
+ * write() + fdatasync() per batch: every mutation that arrives while a
+ * sync is in flight rides on the next one (group commit). Each IPC
+ * worker calls journal_commit() once per batch of requests before it
+ * replies, and workers that commit together share a sync.
+ *
+ * The log is compacted by writing a snapshot of the whole queue and
+ * starting a new log generation:
+ *
+ *   <dir>/snapshot    full queue state as of LSN S, next generation G
+ *   <dir>/wal.<gen>   records with LSN > S, generations >= G
+ *
+ * Every record carries a CRC and a monotonically increasing LSN, so a
+ * torn tail is detected and cut off on replay, and records already
+ * covered by the snapshot are skipped if a crash hits mid-compaction.
+ */
+
+#include "VTserver.h"
+#include <dirent.h>
+
+/* Background (no waiter) appends are synced at least this often. */
+#define JOURNAL_FLUSH_INTERVAL_MS 100
+/* Log bytes after which the queue asks for a compacting snapshot. */
+#define JOURNAL_COMPACT_BYTES     (4 * 1024 * 1024)
+
+#define JOURNAL_SNAP_MAGIC        "VTSNAP02"
+#define JOURNAL_SNAP_MAGIC_LEN    8
+/* magic + u64 lsn + u32 generation */
+#define JOURNAL_SNAP_HEADER_LEN   (JOURNAL_SNAP_MAGIC_LEN + 8 + 4)
+
+/* [u32 body length][u32 crc32(body)] */
+#define JOURNAL_REC_HEADER_LEN    8
+/* body: [u64 lsn][u8 op][i32 pos][u64 arg][u32 uri length][uri] */
+#define JOURNAL_BODY_FIXED_LEN    (8 + 1 + 4 + 8 + 4)
+
+/* Snapshot terminator; a snapshot without it is incomplete. */
+#define JOURNAL_END               0xff
+
+typedef struct {
+    GString *tail;      /* records of the generation being retired */
+    GString *snap;      /* serialized snapshot */
+    guint32  gen;       /* generation the snapshot starts */
+} JournalJob;
+
+static char    *journal_dir = NULL;
+static int      wal_fd = -1;
+static guint32  wal_gen = 0;    /* generation being written (writer thread) */
+
+static GMutex   jlock;
+static GCond    jcond;          /* wakes the writer */
+static GCond    jdone;          /* signals durable_lsn progress */
+static GThread *jthread = NULL;
+static gboolean jrunning = FALSE;
+static GString *pending = NULL;
+static JournalJob *job = NULL;
+static guint32  next_gen = 0;   /* last generation handed to a snapshot */
+static guint64  last_lsn = 0;
+static guint64  durable_lsn = 0;
+static gsize    wal_bytes = 0;
+static guint    waiters = 0;
+static gboolean compact_on_open = FALSE;
+
+static guint32 crc_table[256];
+
+static void journal_crc_init (void)
+{
+    guint32 i, j, c;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static guint32 journal_crc32 (const guint8 *p, gsize len)
+{
+    guint32 c = 0xffffffffu;
+
+    while (len--)
+        c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffffu;
+}
+
+static void journal_put_u32 (GString *buf, guint32 v)
+{
+    g_string_append_len(buf, (const char *) &v, sizeof(v));
+}
+
+static void journal_put_record (GString *buf, guint64 lsn, guint8 op, gint32 pos,
+                                guint64 arg, const char *uri)
+{
+    guint32 ulen = uri ? strlen(uri) : 0;
+    guint32 blen = JOURNAL_BODY_FIXED_LEN + ulen;
+    gsize start;
+
+    journal_put_u32(buf, blen);
+    journal_put_u32(buf, 0);            /* crc, patched below */
+    start = buf->len;
+    g_string_append_len(buf, (const char *) &lsn, sizeof(lsn));
+    g_string_append_c(buf, (char) op);
+    g_string_append_len(buf, (const char *) &pos, sizeof(pos));
+    g_string_append_len(buf, (const char *) &arg, sizeof(arg));
+    journal_put_u32(buf, ulen);
+    if (ulen)
+        g_string_append_len(buf, uri, ulen);
+
+    guint32 crc = journal_crc32((const guint8 *) buf->str + start, blen);
+    memcpy(buf->str + start - 4, &crc, sizeof(crc));
+}
+
+/*
+ * Decodes the record at *off. Returns FALSE on a short or corrupt
+ * record, leaving *off at its start. 'uri' points into a scratch copy
+ * owned by the caller.
+ */
+static gboolean journal_get_record (const char *buf, gsize len, gsize *off,
+                                    guint64 *lsn, guint8 *op, gint32 *pos, guint64 *arg,
+                                    GString *uri)
+{
+    guint32 blen, crc, ulen;
+    const char *body;
+
+    if (len - *off < JOURNAL_REC_HEADER_LEN)
+        return FALSE;
+    memcpy(&blen, buf + *off, 4);
+    memcpy(&crc, buf + *off + 4, 4);
+    if (blen < JOURNAL_BODY_FIXED_LEN || blen > len - *off - JOURNAL_REC_HEADER_LEN)
+        return FALSE;
+
+    body = buf + *off + JOURNAL_REC_HEADER_LEN;
+    if (journal_crc32((const guint8 *) body, blen) != crc)
+        return FALSE;
+
+    memcpy(lsn, body, 8);
+    *op = (guint8) body[8];
+    memcpy(pos, body + 9, 4);
+    memcpy(arg, body + 13, 8);
+    memcpy(&ulen, body + 21, 4);
+    if (ulen != blen - JOURNAL_BODY_FIXED_LEN)
+        return FALSE;
+
+    g_string_truncate(uri, 0);
+    g_string_append_len(uri, body + JOURNAL_BODY_FIXED_LEN, ulen);
+
+    *off += JOURNAL_REC_HEADER_LEN + blen;
+    return TRUE;
+}
+
+static int write_full (int fd, const char *p, gsize len)
+{
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static void journal_sync_dir (void)
+{
+    int dfd = open(journal_dir, O_RDONLY | O_DIRECTORY);
+
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+static int journal_open_wal (guint32 gen)
+{
+    char *path = g_strdup_printf("%s/wal.%u", journal_dir, gen);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        log_error("%s: %s", path, g_strerror(errno));
+    g_free(path);
+    journal_sync_dir();
+    return fd;
+}
+
+/* Lists existing log generations, ascending. */
+static GArray *journal_list_gens (void)
+{
+    GArray *gens = g_array_new(FALSE, FALSE, sizeof(guint32));
+    DIR *d = opendir(journal_dir);
+    struct dirent *de;
+
+    if (d == NULL)
+        return gens;
+
+    while ((de = readdir(d)) != NULL) {
+        char *end = NULL;
+        guint32 gen;
+
+        if (strncmp(de->d_name, "wal.", 4) != 0)
+            continue;
+        gen = (guint32) strtoul(de->d_name + 4, &end, 10);
+        if (end && *end == '\0')
+            g_array_append_val(gens, gen);
+    }
+    closedir(d);
+
+    /* few files: insertion sort */
+    guint i, j;
+    for (i = 1; i < gens->len; i++) {
+        guint32 v = g_array_index(gens, guint32, i);
+        for (j = i; j > 0 && g_array_index(gens, guint32, j - 1) > v; j--)
+            g_array_index(gens, guint32, j) = g_array_index(gens, guint32, j - 1);
+        g_array_index(gens, guint32, j) = v;
+    }
+    return gens;
+}
+
+/* Retires the old generation and installs a snapshot (writer thread). */
+static void journal_run_job (JournalJob *j)
+{
+    char *tmp = g_strdup_printf("%s/snapshot.tmp", journal_dir);
+    char *path = g_strdup_printf("%s/snapshot", journal_dir);
+    int fd;
+
+    /* 1. Make the tail of the old generation durable. */
+    if (wal_fd >= 0) {
+        if (write_full(wal_fd, j->tail->str, j->tail->len) < 0 || fdatasync(wal_fd) < 0)
+            log_error("journal: wal: %s", g_strerror(errno));
+        close(wal_fd);
+    }
+
+    /* 2. Start the new generation before the snapshot points at it. */
+    wal_gen = j->gen;
+    wal_fd = journal_open_wal(wal_gen);
+
+    /* 3. Atomically replace the snapshot. */
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || write_full(fd, j->snap->str, j->snap->len) < 0 || fsync(fd) < 0) {
+        log_error("journal: snapshot: %s", g_strerror(errno));
+        if (fd >= 0) close(fd);
+        unlink(tmp);
+    } else {
+        close(fd);
+        if (rename(tmp, path) < 0) {
+            log_error("journal: rename: %s", g_strerror(errno));
+        } else {
+            journal_sync_dir();
+
+            /* 4. Generations before the snapshot's are now covered by it. */
+            GArray *gens = journal_list_gens();
+            guint i;
+            for (i = 0; i < gens->len; i++) {
+                guint32 gen = g_array_index(gens, guint32, i);
+                if (gen < j->gen) {
+                    char *wal = g_strdup_printf("%s/wal.%u", journal_dir, gen);
+                    unlink(wal);
+                    g_free(wal);
+                }
+            }
+            g_array_free(gens, TRUE);
+        }
+    }
+
+    g_free(tmp);
+    g_free(path);
+    g_string_free(j->tail, TRUE);
+    g_string_free(j->snap, TRUE);
+    g_free(j);
+}
+
+static gpointer journal_thread (gpointer data)
+{
+    GString *spare = g_string_sized_new(4096);
+
+    (void)data;
+
+    g_mutex_lock(&jlock);
+    for (;;) {
+        while (jrunning && pending->len == 0 && job == NULL)
+            g_cond_wait(&jcond, &jlock);
+
+        if (!jrunning && pending->len == 0 && job == NULL)
+            break;
+
+        /* Group commit window for appends nobody is waiting on yet. */
+        if (jrunning && waiters == 0 && job == NULL) {
+            gint64 deadline = g_get_monotonic_time() + JOURNAL_FLUSH_INTERVAL_MS * 1000;
+            while (jrunning && waiters == 0 && job == NULL)
+                if (!g_cond_wait_until(&jcond, &jlock, deadline))
+                    break;
+        }
+
+        GString *buf = pending;
+        JournalJob *j = job;
+        guint64 upto = last_lsn;
+
+        pending = spare;
+        job = NULL;
+        g_mutex_unlock(&jlock);
+
+        if (j)
+            journal_run_job(j);
+
+        if (buf->len > 0 && wal_fd >= 0) {
+            if (write_full(wal_fd, buf->str, buf->len) < 0 || fdatasync(wal_fd) < 0)
+                log_error("journal: wal: %s", g_strerror(errno));
+        }
+        g_string_truncate(buf, 0);
+
+        g_mutex_lock(&jlock);
+        spare = buf;
+        durable_lsn = upto;
+        g_cond_broadcast(&jdone);
+    }
+    g_mutex_unlock(&jlock);
+
+    g_string_free(spare, TRUE);
+    return NULL;
+}
+
+/*
+ * Replays one file's records. Records with LSN <= skip_lsn are ignored.
+ * Returns the offset of the first undecodable byte (== len if clean).
+ */
+static gsize journal_replay_buf (const char *buf, gsize len, gsize off, guint64 skip_lsn,
+                                 JournalReplayFunc replay, gboolean *saw_end)
+{
+    GString *uri = g_string_new(NULL);
+    guint64 lsn;
+    guint8 op;
+    gint32 pos;
+    guint64 arg;
+
+    while (journal_get_record(buf, len, &off, &lsn, &op, &pos, &arg, uri)) {
+        if (op == JOURNAL_END) {
+            if (saw_end) *saw_end = TRUE;
+            break;
+        }
+        if (lsn > last_lsn) last_lsn = lsn;
+        if (lsn != 0 && lsn <= skip_lsn)
+            continue;
+        replay((JournalOp) op, pos, arg, uri->len ? uri->str : NULL);
+    }
+
+    g_string_free(uri, TRUE);
+    return off;
+}
+
+gboolean journal_open (const char *dir, JournalReplayFunc replay)
+{
+    char *path, *data = NULL;
+    gsize len = 0;
+    guint64 snap_lsn = 0;
+    guint32 snap_gen = 0, max_gen = 0;
+    GArray *gens;
+    guint i;
+
+    journal_crc_init();
+
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        log_error("%s: %s", dir, g_strerror(errno));
+        return FALSE;
+    }
+    journal_dir = g_strdup(dir);
+
+    /* 1. Snapshot */
+    path = g_strdup_printf("%s/snapshot", journal_dir);
+    if (g_file_get_contents(path, &data, &len, NULL)) {
+        gboolean complete = FALSE;
+
+        if (len < JOURNAL_SNAP_HEADER_LEN ||
+            memcmp(data, JOURNAL_SNAP_MAGIC, JOURNAL_SNAP_MAGIC_LEN) != 0) {
+            log_error("journal: %s is not a queue snapshot.", path);
+            g_free(data);
+            g_free(path);
+            return FALSE;
+        }
+        memcpy(&snap_lsn, data + JOURNAL_SNAP_MAGIC_LEN, 8);
+        memcpy(&snap_gen, data + JOURNAL_SNAP_MAGIC_LEN + 8, 4);
+
+        journal_replay_buf(data, len, JOURNAL_SNAP_HEADER_LEN, 0, replay, &complete);
+        if (!complete) {
+            /* Snapshots are renamed into place whole; this is real damage. */
+            log_error("journal: %s is truncated or corrupt.", path);
+            g_free(data);
+            g_free(path);
+            return FALSE;
+        }
+        if (snap_lsn > last_lsn) last_lsn = snap_lsn;
+        g_free(data);
+    }
+    g_free(path);
+
+    /* 2. Log generations not covered by the snapshot, oldest first */
+    gens = journal_list_gens();
+    for (i = 0; i < gens->len; i++) {
+        guint32 gen = g_array_index(gens, guint32, i);
+        char *wal = g_strdup_printf("%s/wal.%u", journal_dir, gen);
+
+        if (gen > max_gen) max_gen = gen;
+
+        if (gen < snap_gen) {
+            unlink(wal);        /* stale: compaction finished but crashed before cleanup */
+        } else if (g_file_get_contents(wal, &data, &len, NULL)) {
+            gsize good = journal_replay_buf(data, len, 0, snap_lsn, replay, NULL);
+            if (good < len) {
+                log_warning("journal: dropping %zu torn bytes at the end of %s.", len - good, wal);
+                if (truncate(wal, good) < 0)
+                    log_error("%s: %s", wal, g_strerror(errno));
+            }
+            if (len > 0) compact_on_open = TRUE;
+            g_free(data);
+        }
+        g_free(wal);
+    }
+    g_array_free(gens, TRUE);
+
+    /* 3. Continue in a fresh generation */
+    wal_gen = next_gen = MAX(max_gen, snap_gen) + 1;
+    if ((wal_fd = journal_open_wal(wal_gen)) < 0)
+        return FALSE;
+
+    durable_lsn = last_lsn;
+    pending = g_string_sized_new(4096);
+    jrunning = TRUE;
+    jthread = g_thread_new("journal", journal_thread, NULL);
+
+    log_info("Journal: %s (generation %u, LSN %" G_GUINT64_FORMAT ")",
+               journal_dir, wal_gen, last_lsn);
+    return TRUE;
+}
+
+gboolean journal_enabled (void)
+{
+    return jthread != NULL;
+}
+
+void journal_append (JournalOp op, gint32 pos, guint64 arg, const char *uri)
+{
+    if (!jthread)
+        return;
+
+    g_mutex_lock(&jlock);
+    gsize before = pending->len;
+    journal_put_record(pending, ++last_lsn, (guint8) op, pos, arg, uri);
+    wal_bytes += pending->len - before;
+    /* Wake the writer so its group-commit window starts now. */
+    if (before == 0)
+        g_cond_signal(&jcond);
+    g_mutex_unlock(&jlock);
+}
+
+void journal_commit (void)
+{
+    if (!jthread)
+        return;
+
+    g_mutex_lock(&jlock);
+    guint64 target = last_lsn;
+    if (durable_lsn < target) {
+        waiters++;
+        g_cond_signal(&jcond);
+        while (durable_lsn < target && jrunning)
+            g_cond_wait(&jdone, &jlock);
+        waiters--;
+    }
+    g_mutex_unlock(&jlock);
+}
+
+gboolean journal_wants_snapshot (void)
+{
+    gboolean wants;
+
+    if (!jthread)
+        return FALSE;
+
+    g_mutex_lock(&jlock);
+    wants = job == NULL && (compact_on_open || wal_bytes >= JOURNAL_COMPACT_BYTES);
+    g_mutex_unlock(&jlock);
+    return wants;
+}
+
+GString *journal_snapshot_begin (void)
+{
+    GString *snap = g_string_sized_new(64 * 1024);
+
+    g_string_append_len(snap, JOURNAL_SNAP_MAGIC, JOURNAL_SNAP_MAGIC_LEN);
+    g_string_append_len(snap, "\0\0\0\0\0\0\0\0\0\0\0\0", 12);  /* lsn + gen, set on submit */
+    return snap;
+}
+
+void journal_snapshot_add (GString *snap, JournalOp op, gint32 pos, guint64 arg, const char *uri)
+{
+    journal_put_record(snap, 0, (guint8) op, pos, arg, uri);
+}
+
+/*
+ * Hands a snapshot to the writer. Must be called with the queue lock
+ * held, so the snapshot reflects exactly the records appended so far.
+ */
+void journal_snapshot_submit (GString *snap)
+{
+    g_mutex_lock(&jlock);
+    if (job != NULL) {
+        g_mutex_unlock(&jlock);
+        g_string_free(snap, TRUE);
+        return;
+    }
+
+    journal_put_record(snap, 0, JOURNAL_END, 0, 0, NULL);
+
+    job = g_new0(JournalJob, 1);
+    job->tail = pending;
+    job->snap = snap;
+    /* The writer may still be switching to the last one: never reuse it. */
+    job->gen = ++next_gen;
+    memcpy(snap->str + JOURNAL_SNAP_MAGIC_LEN, &last_lsn, 8);
+    memcpy(snap->str + JOURNAL_SNAP_MAGIC_LEN + 8, &job->gen, 4);
+
+    pending = g_string_sized_new(4096);
+    wal_bytes = 0;
+    compact_on_open = FALSE;
+    g_cond_signal(&jcond);
+    g_mutex_unlock(&jlock);
+}
+
+void journal_close (void)
+{
+    if (!jthread)
+        return;
+
+    g_mutex_lock(&jlock);
+    jrunning = FALSE;
+    g_cond_broadcast(&jcond);
+    g_cond_broadcast(&jdone);
+    g_mutex_unlock(&jlock);
+
+    g_thread_join(jthread);
+    jthread = NULL;
+
+    if (wal_fd >= 0) {
+        close(wal_fd);
+        wal_fd = -1;
+    }
+    g_string_free(pending, TRUE);
+    pending = NULL;
+    g_free(journal_dir);
+    journal_dir = NULL;
+}
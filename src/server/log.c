@@ -0,0 +1,322 @@
+/*
+ * Asynchronous logger.
+ *
+ * Every thread that logs gets its own single-producer ring of
+ * fixed-size slots, so logging never takes a lock, never allocates
+ * (after a thread's first message) and never touches the output: the
+ * message is formatted straight into the slot. A writer thread drains
+ * all rings and is the only one that writes to stderr, the log file or
+ * syslog, so a slow pipe or a full terminal stalls the writer alone.
+ * When a ring is full the message is dropped and counted; the writer
+ * reports drops in the log itself and STATUS shows the totals.
+ *
+ * Rings are registered under a mutex once per thread and released by
+ * the writer after their thread exited and they were drained.
+ */
+
+#include "VTserver.h"
+#include <poll.h>
+#include <syslog.h>
+#include <sys/eventfd.h>
+
+/* Slots per thread; a power of two. */
+#define LOG_RING_SLOTS  128
+#define LOG_RING_MASK   (LOG_RING_SLOTS - 1)
+/* Longer messages are truncated. */
+#define LOG_LINE_MAX    240
+/* The writer polls this often even without a wakeup. */
+#define LOG_IDLE_MS     200
+/* Output is written in batches of up to this many bytes. */
+#define LOG_BATCH       (16 * 1024)
+
+typedef struct {
+    gint64  time;           /* real time, us */
+    gint    level;
+    char    text[LOG_LINE_MAX];
+} LogSlot;
+
+typedef struct LogRing {
+    guint           head;       /* next slot to fill (its thread) */
+    guint           tail;       /* next slot to drain (writer) */
+    gint            dropped;    /* messages lost to a full ring */
+    gint            reported;   /* drops already reported (writer) */
+    gint            orphaned;   /* its thread exited */
+    char            name[16];
+    struct LogRing *next;
+    LogSlot         slots[LOG_RING_SLOTS];
+} LogRing;
+
+static const char *level_names[] = { "error", "warning", "info", "debug" };
+
+static gint      log_level = LOG_LEVEL_INFO;
+static gint      log_running = 0;
+static LogTarget log_target = LOG_TARGET_STDERR;
+static int       log_fd = STDERR_FILENO;
+static int       wake_fd = -1;
+static gint      writer_idle = 0;
+static GThread  *writer = NULL;
+
+static GMutex    rings_lock;
+static LogRing  *rings = NULL;
+
+/* Writer only; STATUS reads racily. */
+static guint     stat_written = 0;
+static guint     stat_dropped = 0;
+
+static void logger_thread_exit (gpointer data)
+{
+    g_atomic_int_set(&((LogRing *) data)->orphaned, 1);
+}
+
+static GPrivate ring_key = G_PRIVATE_INIT(logger_thread_exit);
+
+static LogRing *logger_ring (void)
+{
+    LogRing *ring = g_private_get(&ring_key);
+
+    if (ring == NULL) {
+        ring = g_new0(LogRing, 1);
+        if (pthread_getname_np(pthread_self(), ring->name, sizeof(ring->name)) != 0)
+            g_strlcpy(ring->name, "?", sizeof(ring->name));
+        g_private_set(&ring_key, ring);
+
+        g_mutex_lock(&rings_lock);
+        ring->next = rings;
+        rings = ring;
+        g_mutex_unlock(&rings_lock);
+    }
+    return ring;
+}
+
+static void logger_wake (void)
+{
+    guint64 one = 1;
+
+    if (g_atomic_int_get(&writer_idle) && g_atomic_int_compare_and_exchange(&writer_idle, 1, 0)) {
+        ssize_t r = write(wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+void logger_write (LogLevel level, const char *fmt, ...)
+{
+    LogRing *ring;
+    LogSlot *slot;
+    va_list ap;
+    guint head;
+
+    if ((gint) level > g_atomic_int_get(&log_level))
+        return;
+
+    va_start(ap, fmt);
+    if (!g_atomic_int_get(&log_running)) {
+        /* Before logger_start() and after logger_stop(): synchronous. */
+        vfprintf(stderr, fmt, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+        return;
+    }
+
+    ring = logger_ring();
+    head = ring->head;
+    if (head - (guint) g_atomic_int_get(&ring->tail) >= LOG_RING_SLOTS) {
+        g_atomic_int_inc(&ring->dropped);
+        va_end(ap);
+        logger_wake();
+        return;
+    }
+
+    slot = &ring->slots[head & LOG_RING_MASK];
+    slot->time = g_get_real_time();
+    slot->level = level;
+    vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+    va_end(ap);
+
+    g_atomic_int_set(&ring->head, head + 1);
+    logger_wake();
+}
+
+static void logger_flush (GString *out)
+{
+    gsize off = 0;
+    ssize_t n;
+
+    while (off < out->len) {
+        n = write(log_fd, out->str + off, out->len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;      /* nowhere left to complain to */
+        }
+        off += n;
+    }
+    g_string_truncate(out, 0);
+}
+
+static void logger_emit (GString *out, gint64 time, gint level, const char *name, const char *text)
+{
+    static const int priorities[] = { LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG };
+    time_t sec = time / G_USEC_PER_SEC;
+    struct tm tm;
+
+    stat_written++;
+    if (log_target == LOG_TARGET_SYSLOG) {
+        syslog(priorities[level], "[%s] %s", name, text);
+        return;
+    }
+
+    localtime_r(&sec, &tm);
+    g_string_append_printf(out, "%04d-%02d-%02d %02d:%02d:%02d.%03d %-7s [%s] %s\n",
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+            (int) (time % G_USEC_PER_SEC / 1000), level_names[level], name, text);
+    if (out->len >= LOG_BATCH)
+        logger_flush(out);
+}
+
+/* One pass over every ring. Returns the number of messages written. */
+static guint logger_drain (GString *out)
+{
+    LogRing *ring, **link;
+    guint n = 0;
+
+    g_mutex_lock(&rings_lock);
+    for (link = &rings; (ring = *link) != NULL; ) {
+        guint tail = ring->tail, head = (guint) g_atomic_int_get(&ring->head);
+        gint dropped = g_atomic_int_get(&ring->dropped);
+        /* Read before draining: a thread that exits after this drained everything. */
+        gboolean orphaned = g_atomic_int_get(&ring->orphaned);
+
+        for (; tail != head; tail++, n++) {
+            LogSlot *slot = &ring->slots[tail & LOG_RING_MASK];
+            logger_emit(out, slot->time, slot->level, ring->name, slot->text);
+        }
+        g_atomic_int_set(&ring->tail, tail);
+
+        if (dropped != ring->reported) {
+            char text[64];
+
+            g_snprintf(text, sizeof(text), "%d messages dropped (log ring full)", dropped - ring->reported);
+            logger_emit(out, g_get_real_time(), LOG_LEVEL_WARNING, ring->name, text);
+            stat_dropped += dropped - ring->reported;
+            ring->reported = dropped;
+        }
+
+        if (orphaned) {
+            *link = ring->next;
+            g_free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    g_mutex_unlock(&rings_lock);
+
+    logger_flush(out);
+    return n;
+}
+
+static gpointer logger_thread (gpointer data)
+{
+    GString *out = g_string_sized_new(LOG_BATCH * 2);
+    struct pollfd pfd = { 0, POLLIN, 0 };
+    guint64 count;
+
+    (void)data;
+    pfd.fd = wake_fd;
+
+    while (g_atomic_int_get(&log_running)) {
+        if (logger_drain(out) > 0)
+            continue;
+
+        /* Publish "idle" first, then look again: a producer either saw it or we see its message. */
+        g_atomic_int_set(&writer_idle, 1);
+        if (logger_drain(out) == 0 && g_atomic_int_get(&log_running))
+            poll(&pfd, 1, LOG_IDLE_MS);
+        g_atomic_int_set(&writer_idle, 0);
+        if (read(wake_fd, &count, sizeof(count)) < 0)
+            count = 0;
+    }
+    logger_drain(out);
+
+    g_string_free(out, TRUE);
+    return NULL;
+}
+
+/*
+ * Starts the writer. 'path' is the log file for LOG_TARGET_FILE
+ * (appended to). Returns FALSE if the output cannot be opened.
+ */
+gboolean logger_start (LogTarget target, const char *path, LogLevel level)
+{
+    if (target == LOG_TARGET_FILE) {
+        log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (log_fd < 0) {
+            perror(path);
+            log_fd = STDERR_FILENO;
+            return FALSE;
+        }
+    } else if (target == LOG_TARGET_SYSLOG) {
+        openlog("VTmpegd", LOG_PID, LOG_DAEMON);
+    }
+
+    if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        return FALSE;
+    }
+
+    log_target = target;
+    g_atomic_int_set(&log_level, level);
+    g_atomic_int_set(&log_running, 1);
+    writer = g_thread_new("logger", logger_thread, NULL);
+    return TRUE;
+}
+
+/* Drains what is queued and stops the writer; later messages are synchronous. */
+void logger_stop (void)
+{
+    guint64 one = 1;
+    ssize_t r;
+
+    if (writer == NULL)
+        return;
+
+    g_atomic_int_set(&log_running, 0);
+    r = write(wake_fd, &one, sizeof(one));
+    (void)r;
+    g_thread_join(writer);
+    writer = NULL;
+
+    if (log_target == LOG_TARGET_FILE)
+        close(log_fd);
+    else if (log_target == LOG_TARGET_SYSLOG)
+        closelog();
+    log_fd = STDERR_FILENO;
+    close(wake_fd);
+}
+
+/* Parses a level name ("error", "warning", "info", "debug"); -1 if unknown. */
+int logger_parse_level (const char *name)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(level_names); i++) {
+        if (g_ascii_strcasecmp(name, level_names[i]) == 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+void logger_set_level (LogLevel level)
+{
+    g_atomic_int_set(&log_level, level);
+}
+
+const char *logger_level_name (void)
+{
+    return level_names[g_atomic_int_get(&log_level)];
+}
+
+/* Appends the logger counters to a STATS response. */
+void logger_report (GString *out)
+{
+    g_string_append_printf(out, "Log: level %s, %u written, %u dropped\n",
+            logger_level_name(), stat_written, stat_dropped);
+}
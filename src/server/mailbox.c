@@ -0,0 +1,338 @@
+/*
+ * Control mailbox: playback commands from the IPC workers to the main loop.
+ *
+ * A bounded multi-producer/single-consumer ring (one sequence number per
+ * slot, producers claim slots with a CAS on the head). Posting never
+ * blocks, never allocates and takes no lock; the first post after a
+ * drain signals an eventfd the main loop watches, and that one wakeup
+ * drains everything queued so far.
+ *
+ * Before anything touches the pipeline the drained run is coalesced:
+ * consecutive skips become one skip-by-N, pause/resume runs collapse to
+ * their net effect (nothing if the pipeline is already there), a skip
+ * supersedes any pause/resume before it, mute toggles cancel in pairs
+ * and repeated start/stop requests merge. Seeks merge into one (relative
+ * ones add up), the last rate wins, and a skip drops both: they were
+ * meant for the item it leaves.
+ *
+ * The streaming thread's gapless handoffs come through here too (one at
+ * a time, so a single slot), and are committed before the ring drains.
+ */
+
+#include "VTserver.h"
+#include <glib-unix.h>
+#include <sys/eventfd.h>
+
+/* Slots in the ring; a power of two. */
+#define MAILBOX_SIZE  256
+#define MAILBOX_MASK  (MAILBOX_SIZE - 1)
+/* Waits longer than this are logged. */
+#define MAILBOX_SLOW_WAIT_US  (50 * 1000)
+
+typedef struct {
+    gint    seq;
+    gint    op;
+    gint64  posted;     /* monotonic us, when the IPC worker posted it */
+    gint64  arg;        /* MAIL_SEEK: position or offset, ns */
+    guint   flags;      /* MAIL_SEEK: SEEK_* */
+    gdouble rate;       /* MAIL_RATE */
+} MailSlot;
+
+static MailSlot slots[MAILBOX_SIZE];
+static gint     head = 0;           /* next slot to claim (producers) */
+static guint    tail = 0;           /* next slot to drain (main loop only) */
+static gint     wake_armed = 0;     /* an idle drain is already scheduled */
+static gint     start_missed = 0;   /* a START found the ring full */
+static int      wake_fd = -1;
+static Handoff *handoff_done = NULL;    /* taken by the streaming thread, to commit */
+
+/* Instrumentation. The wait totals are main-loop only; STATUS reads them racily. */
+static gint     stat_posted = 0;
+static gint     stat_dropped = 0;
+static gint     stat_drained = 0;
+static gint     stat_executed = 0;
+static gint64   stat_wait_total = 0;
+static gint64   stat_wait_max = 0;
+
+static gboolean mailbox_ready (gint fd, GIOCondition cond, gpointer data);
+
+/* Called once from main() before anything is posted. */
+void mailbox_init (void)
+{
+    guint i;
+
+    for (i = 0; i < MAILBOX_SIZE; i++)
+        slots[i].seq = (gint) i;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        log_error("mailbox: eventfd: %s", g_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    g_unix_fd_add(wake_fd, G_IO_IN, mailbox_ready, NULL);
+}
+
+static void mailbox_wake (void)
+{
+    guint64 one = 1;
+
+    if (g_atomic_int_compare_and_exchange(&wake_armed, 0, 1)) {
+        /* Can only fail with the counter saturated, i.e. a wakeup pending. */
+        ssize_t r = write(wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+static gboolean mailbox_post_full (MailOp op, gint64 arg, guint flags, gdouble rate)
+{
+    guint pos = (guint) g_atomic_int_get(&head);
+    MailSlot *slot;
+
+    for (;;) {
+        slot = &slots[pos & MAILBOX_MASK];
+        gint diff = (gint) ((guint) g_atomic_int_get(&slot->seq) - pos);
+
+        if (diff == 0) {
+            if (g_atomic_int_compare_and_exchange(&head, (gint) pos, (gint) (pos + 1)))
+                break;
+            pos = (guint) g_atomic_int_get(&head);
+        } else if (diff < 0) {
+            /* Full: the consumer has not released this slot yet. */
+            g_atomic_int_inc(&stat_dropped);
+            if (op == MAIL_START) {
+                /* Never lose a start: it is how a new queue begins playing. */
+                g_atomic_int_set(&start_missed, 1);
+                mailbox_wake();
+                return TRUE;
+            }
+            mailbox_wake();
+            return FALSE;
+        } else {
+            pos = (guint) g_atomic_int_get(&head);
+        }
+    }
+
+    slot->op = op;
+    slot->arg = arg;
+    slot->flags = flags;
+    slot->rate = rate;
+    slot->posted = g_get_monotonic_time();
+    g_atomic_int_set(&slot->seq, (gint) (pos + 1));
+    g_atomic_int_inc(&stat_posted);
+
+    mailbox_wake();
+    return TRUE;
+}
+
+/*
+ * Posts a command; safe from any thread. Returns FALSE if the ring is
+ * full (the command is dropped, the caller reports it).
+ */
+gboolean mailbox_post (MailOp op)
+{
+    return mailbox_post_full(op, 0, 0, 1.0);
+}
+
+/* Posts a seek to 'ns' (SEEK_RELATIVE: by 'ns'); see mailbox_post(). */
+gboolean mailbox_post_seek (gint64 ns, guint flags)
+{
+    return mailbox_post_full(MAIL_SEEK, ns, flags, 1.0);
+}
+
+/* Posts a playback rate change; see mailbox_post(). */
+gboolean mailbox_post_rate (gdouble rate)
+{
+    return mailbox_post_full(MAIL_RATE, 0, 0, rate);
+}
+
+/*
+ * Hands a gapless handoff to the main loop for commit. Streaming thread;
+ * wait-free like mailbox_post(), and never refused.
+ */
+void mailbox_post_handoff (Handoff *h)
+{
+    g_atomic_pointer_set(&handoff_done, h);
+    mailbox_wake();
+}
+
+/* Pops one command into 'out' (main loop only). */
+static gboolean mailbox_pop (MailSlot *out)
+{
+    MailSlot *slot = &slots[tail & MAILBOX_MASK];
+
+    if ((gint) ((guint) g_atomic_int_get(&slot->seq) - (tail + 1)) < 0)
+        return FALSE;
+
+    *out = *slot;
+    g_atomic_int_set(&slot->seq, (gint) (tail + MAILBOX_SIZE));
+    tail++;
+    return TRUE;
+}
+
+static void mailbox_start (void)
+{
+    /* Only start if the pipeline is explicitly in GST_STATE_NULL. */
+    if (md_gst_is_stopped()) {
+        guint64 id = 0;
+        ItemTrim trim;
+        char *filename = command_get_next_video(&id, &trim);
+        if (filename) {
+            log_info("Starting playback (event-driven): %s", filename);
+            md_gst_play_item(filename, id, &trim);
+            g_free(filename);
+        }
+    }
+}
+
+/* Pending, already-coalesced work of the current run. */
+typedef struct {
+    guint   skips;
+    MailOp  transport;      /* MAIL_PAUSE, MAIL_RESUME or -1 */
+    gboolean seek;
+    gint64  seek_ns;
+    guint   seek_flags;
+    gdouble rate;           /* 0: unchanged */
+} MailRun;
+
+static void mailbox_flush_run (MailRun *run)
+{
+    if (run->skips > 0) {
+        md_gst_skip_n(run->skips);
+        g_atomic_int_inc(&stat_executed);
+    }
+
+    /* The rate first, so the seek plays on at it. */
+    if (run->rate != 0.0) {
+        md_gst_set_rate(run->rate);
+        g_atomic_int_inc(&stat_executed);
+    }
+    if (run->seek) {
+        md_gst_seek(run->seek_ns, (run->seek_flags & SEEK_RELATIVE) != 0, (run->seek_flags & SEEK_ACCURATE) != 0);
+        g_atomic_int_inc(&stat_executed);
+    }
+
+    if (run->transport == MAIL_PAUSE) {
+        if (md_gst_is_playing()) {
+            md_gst_pause();
+            g_atomic_int_inc(&stat_executed);
+        }
+    } else if (run->transport == MAIL_RESUME) {
+        if (!md_gst_is_playing()) {
+            md_gst_resume();
+            g_atomic_int_inc(&stat_executed);
+        }
+    }
+
+    run->skips = 0;
+    run->transport = (MailOp) -1;
+    run->seek = FALSE;
+    run->rate = 0.0;
+}
+
+static gboolean mailbox_ready (gint fd, GIOCondition cond, gpointer data)
+{
+    MailRun run = { 0, (MailOp) -1, FALSE, 0, 0, 0.0 };
+    MailOp op, last = (MailOp) -1;
+    MailSlot mail;
+    gint64 now;
+    guint64 count;
+    guint mutes = 0;
+    Handoff *h;
+
+    (void)cond;
+    (void)data;
+
+    /* Re-arm first: anything posted from here on signals a new drain. */
+    g_atomic_int_set(&wake_armed, 0);
+    if (read(fd, &count, sizeof(count)) < 0)
+        count = 0;  /* EAGAIN: spurious, the drain below finds nothing */
+    now = g_get_monotonic_time();
+
+    /* It happened before anything still in the ring was drained. */
+    if ((h = g_atomic_pointer_exchange(&handoff_done, NULL)) != NULL)
+        command_commit_handoff(h);
+
+    while (mailbox_pop(&mail)) {
+        gint64 wait = now - mail.posted;
+
+        op = (MailOp) mail.op;
+        stat_wait_total += wait;
+        if (wait > stat_wait_max) stat_wait_max = wait;
+        if (wait > MAILBOX_SLOW_WAIT_US)
+            log_warning("Control command waited %" G_GINT64_FORMAT " ms for the main loop.", wait / 1000);
+        g_atomic_int_inc(&stat_drained);
+
+        switch (op) {
+            case MAIL_SKIP:
+                /* A skip always ends up playing; earlier pause/resume is moot. */
+                run.skips++;
+                run.transport = (MailOp) -1;
+                run.seek = FALSE;
+                run.rate = 0.0;
+                break;
+
+            case MAIL_SEEK:
+                /* A relative seek moves on from a pending one; an absolute one replaces it. */
+                if (run.seek && (mail.flags & SEEK_RELATIVE)) {
+                    run.seek_ns += mail.arg;
+                    run.seek_flags = (run.seek_flags & SEEK_RELATIVE) | (mail.flags & SEEK_ACCURATE);
+                } else {
+                    run.seek = TRUE;
+                    run.seek_ns = mail.arg;
+                    run.seek_flags = mail.flags;
+                }
+                break;
+
+            case MAIL_RATE:
+                run.rate = mail.rate;
+                break;
+
+            case MAIL_PAUSE:
+            case MAIL_RESUME:
+                run.transport = op;
+                break;
+
+            case MAIL_MUTE:
+                mutes++;
+                break;
+
+            case MAIL_START:
+            case MAIL_STOP:
+                if (op == last && run.skips == 0 && run.transport == (MailOp) -1)
+                    break;      /* repeated start/stop */
+                mailbox_flush_run(&run);
+                if (op == MAIL_STOP) md_gst_stop();
+                else mailbox_start();
+                g_atomic_int_inc(&stat_executed);
+                break;
+        }
+        last = op;
+    }
+
+    mailbox_flush_run(&run);
+
+    if (g_atomic_int_compare_and_exchange(&start_missed, 1, 0)) {
+        mailbox_start();
+        g_atomic_int_inc(&stat_executed);
+    }
+
+    if (mutes & 1) {
+        md_gst_toggle_mute();
+        g_atomic_int_inc(&stat_executed);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Appends the mailbox counters to a STATS response. */
+void mailbox_report (GString *out)
+{
+    gint drained = g_atomic_int_get(&stat_drained);
+    gint executed = g_atomic_int_get(&stat_executed);
+
+    g_string_append_printf(out, "Control: %d posted, %d coalesced, %d dropped; wait avg %.2f ms, max %.2f ms\n",
+            g_atomic_int_get(&stat_posted), MAX(drained - executed, 0),
+            g_atomic_int_get(&stat_dropped),
+            drained ? (double) stat_wait_total / drained / 1000.0 : 0.0,
+            (double) stat_wait_max / 1000.0);
+}
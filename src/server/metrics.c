@@ -0,0 +1,499 @@
+/*
+ * Instrumentation: counters, a gauge and latency histograms.
+ *
+ * Recording is per-thread and takes no lock: a thread claims one of a
+ * fixed set of shards on its first record and is that shard's only
+ * writer, so a record is a thread-local lookup and a few plain stores
+ * (no lock prefix, no shared cache line). A thread that exits gives its
+ * shard back with everything it recorded, and the next thread to claim
+ * it keeps adding to the same totals: shards are never folded, freed
+ * or allocated, so recording never allocates either, not even on a
+ * streaming thread's first about-to-finish. Threads beyond the last
+ * shard share an overflow shard with atomic adds.
+ *
+ * Readers (STATS, the Prometheus endpoint, STATUS lines) sum the shards
+ * with relaxed loads: totals can be a record behind, never torn.
+ *
+ * Histograms are HDR-style log-linear: 16 linear sub-buckets per power
+ * of two, so any value is recorded within 1/16 (6%) of its magnitude,
+ * from 1 ns up to about 18 minutes, in a fixed 608-bucket array.
+ */
+
+#include "VTserver.h"
+#include <poll.h>
+
+#define METRICS_SHARDS       32
+
+#define HIST_SUB_BITS        4
+#define HIST_SUB             (1 << HIST_SUB_BITS)
+#define HIST_MAX_BIT         40     /* values up to 2^41 ns */
+#define HIST_BUCKETS         ((HIST_MAX_BIT - HIST_SUB_BITS + 2) * HIST_SUB)
+
+/* The Prometheus endpoint polls its socket this often to notice a stop. */
+#define METRICS_IDLE_MS      200
+/* A scraper gets this long to send its request line, then gets the page anyway. */
+#define METRICS_REQUEST_MS   100
+
+typedef struct {
+    guint64 count;
+    guint64 sum;                /* ns */
+    guint64 max;                /* ns */
+    guint64 buckets[HIST_BUCKETS];
+} MetricsHist;
+
+typedef struct {
+    gint        owned;
+    guint64     commands[METRICS_COMMANDS];
+    guint64     counters[METRIC_COUNTERS];
+    MetricsHist hists[METRIC_HISTS];
+} MetricsShard;
+
+static MetricsShard shards[METRICS_SHARDS];
+static MetricsShard overflow;
+static gint64       started = 0;
+static gint64       queue_depth = 0;
+
+static const char *command_names[METRICS_COMMANDS] = {
+    "other", "list", "insert", "remove", "play", "pause", "stop", "next",
+    "prev", "mute", "status", "insert_bulk", "remove_bulk", "limits",
+    "remove_id", "move_id", "insert_after", "log_level", "subscribe", "stats", "graphics",
+    "seek", "rate"
+};
+
+/* Name (Prometheus, without the vtmpegd_ prefix and _total suffix) and STATS label. */
+static const struct {
+    const char *name;
+    const char *label;
+    const char *help;
+} counter_info[METRIC_COUNTERS] = {
+    { "items_played",     "Items played",     "Items that started playing." },
+    { "gapless",          "Gapless",          "Items started by a gapless about-to-finish handoff." },
+    { "hard_starts",      "Hard starts",      "Items started by (re)building or swapping a pipeline." },
+    { "handoff_idle",     "Idle handoffs",    "about-to-finish calls with nothing queued to hand off." },
+    { "pipeline_errors",  "Pipeline errors",  "Errors posted by the live pipeline." },
+    { "qos_drops",        "QoS drops",        "Buffers dropped late by the live pipeline (QoS messages)." },
+    { "frames",           "Frames",           "Video frames that reached the live pipeline's sink." }
+};
+
+static const struct {
+    const char *name;
+    const char *label;
+    const char *help;
+} hist_info[METRIC_HISTS] = {
+    { "command",           "Command processing",               "Time in command_process(), per command." },
+    { "about_to_finish",   "About-to-finish",                  "Duration of the about-to-finish handler." },
+    { "skip_prerolled",    "Skip to first frame (pre-rolled)", "Skip to first frame when the standby deck was swapped in." },
+    { "skip_rebuilt",      "Skip to first frame (rebuilt)",    "Skip to first frame when the pipeline was rebuilt." },
+    { "overlay",           "Overlay draw",                     "Time to draw the graphics layers, per frame and deck." },
+    { "standby_draw",      "Standby draw",                     "Time to draw the standby card, per expose." },
+    { "seek",              "Seek to first frame",              "Seek to the first frame at the new position." }
+};
+
+/* Prometheus histogram bounds, seconds. */
+static const double prom_bounds[] = {
+    0.000001, 0.0000025, 0.000005, 0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005,
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+static void metrics_thread_exit (gpointer data)
+{
+    /* Release: the next owner sees everything recorded here. */
+    if (data != &overflow)
+        __atomic_store_n(&((MetricsShard *) data)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static GPrivate shard_key = G_PRIVATE_INIT(metrics_thread_exit);
+
+static MetricsShard *metrics_shard (void)
+{
+    MetricsShard *shard = g_private_get(&shard_key);
+    guint i;
+
+    if (G_LIKELY(shard != NULL))
+        return shard;
+
+    shard = &overflow;
+    for (i = 0; i < METRICS_SHARDS; i++) {
+        gint free_ = 0;
+
+        if (__atomic_compare_exchange_n(&shards[i].owned, &free_, 1, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            shard = &shards[i];
+            break;
+        }
+    }
+    g_private_set(&shard_key, shard);
+    return shard;
+}
+
+/* One writer per shard except the overflow one. */
+static inline void metrics_add (MetricsShard *shard, guint64 *p, guint64 v)
+{
+    if (G_UNLIKELY(shard == &overflow))
+        __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_max (MetricsShard *shard, guint64 *p, guint64 v)
+{
+    guint64 old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    if (G_LIKELY(shard != &overflow)) {
+        if (v > old)
+            __atomic_store_n(p, v, __ATOMIC_RELAXED);
+        return;
+    }
+    while (v > old && !__atomic_compare_exchange_n(p, &old, v, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static guint hist_bucket (guint64 v)
+{
+    guint e;
+
+    if (v < HIST_SUB)
+        return (guint) v;
+    e = g_bit_storage(v) - 1;
+    if (e > HIST_MAX_BIT)
+        return HIST_BUCKETS - 1;
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (guint) ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value recorded in bucket 'i'. */
+static guint64 hist_lower (guint i)
+{
+    guint e;
+
+    if (i < HIST_SUB)
+        return i;
+    e = i / HIST_SUB + HIST_SUB_BITS - 1;
+    return (guint64) (HIST_SUB + i % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+/* First value past bucket 'i'. */
+static guint64 hist_upper (guint i)
+{
+    return i + 1 < HIST_BUCKETS ? hist_lower(i + 1) : G_MAXUINT64;
+}
+
+void metrics_init (void)
+{
+    started = g_get_monotonic_time();
+}
+
+/* Monotonic clock in ns, for timing what is recorded. */
+gint64 metrics_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_count (MetricCounter c)
+{
+    MetricsShard *shard = metrics_shard();
+
+    metrics_add(shard, &shard->counters[c], 1);
+}
+
+void metrics_command (int id, gint64 ns)
+{
+    MetricsShard *shard = metrics_shard();
+
+    if (id < 0 || id >= METRICS_COMMANDS)
+        id = 0;
+    metrics_add(shard, &shard->commands[id], 1);
+    metrics_record(METRIC_HIST_COMMAND, ns);
+}
+
+void metrics_record (MetricHist h, gint64 ns)
+{
+    MetricsShard *shard = metrics_shard();
+    MetricsHist *hist = &shard->hists[h];
+    guint64 v = ns > 0 ? (guint64) ns : 0;
+
+    metrics_add(shard, &hist->buckets[hist_bucket(v)], 1);
+    metrics_add(shard, &hist->sum, v);
+    metrics_add(shard, &hist->count, 1);
+    metrics_max(shard, &hist->max, v);
+}
+
+void metrics_set_queue_depth (guint depth)
+{
+    __atomic_store_n(&queue_depth, (gint64) depth, __ATOMIC_RELAXED);
+}
+
+static guint64 metrics_sum (const guint64 *first)
+{
+    /* 'first' points into shards[0]; the same field of every shard follows at a fixed stride. */
+    gsize off = (const char *) first - (const char *) &shards[0];
+    guint64 total = __atomic_load_n((const guint64 *) ((const char *) &overflow + off), __ATOMIC_RELAXED);
+    guint i;
+
+    for (i = 0; i < METRICS_SHARDS; i++)
+        total += __atomic_load_n((const guint64 *) ((const char *) &shards[i] + off), __ATOMIC_RELAXED);
+    return total;
+}
+
+guint64 metrics_counter (MetricCounter c)
+{
+    return metrics_sum(&shards[0].counters[c]);
+}
+
+/* Sums histogram 'h' over all shards into 'out'. */
+static void metrics_hist (MetricHist h, MetricsHist *out)
+{
+    guint i;
+
+    out->count = metrics_sum(&shards[0].hists[h].count);
+    out->sum = metrics_sum(&shards[0].hists[h].sum);
+    out->max = __atomic_load_n(&overflow.hists[h].max, __ATOMIC_RELAXED);
+    for (i = 0; i < METRICS_SHARDS; i++)
+        out->max = MAX(out->max, __atomic_load_n(&shards[i].hists[h].max, __ATOMIC_RELAXED));
+    for (i = 0; i < HIST_BUCKETS; i++)
+        out->buckets[i] = metrics_sum(&shards[0].hists[h].buckets[i]);
+}
+
+/*
+ * Value at quantile 'q' (0..1): the upper bound of the bucket holding
+ * it, capped at the largest value recorded.
+ */
+static guint64 metrics_quantile (const MetricsHist *hist, double q)
+{
+    guint64 seen = 0, want = (guint64) (q * hist->count);
+    guint i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > want)
+            return MIN(hist_upper(i) - 1, hist->max);
+    }
+    return hist->max;
+}
+
+void metrics_summary (MetricHist h, MetricsSummary *out)
+{
+    MetricsHist *hist = g_new(MetricsHist, 1);
+
+    metrics_hist(h, hist);
+    out->count = hist->count;
+    out->avg = hist->count ? (gint64) (hist->sum / hist->count) : 0;
+    out->p50 = metrics_quantile(hist, 0.50);
+    out->p90 = metrics_quantile(hist, 0.90);
+    out->p99 = metrics_quantile(hist, 0.99);
+    out->p999 = metrics_quantile(hist, 0.999);
+    out->max = hist->max;
+    g_free(hist);
+}
+
+/* Logs the non-empty buckets of 'h' (for soak tests, at shutdown). */
+void metrics_log_histogram (MetricHist h)
+{
+    MetricsHist *hist = g_new(MetricsHist, 1);
+    guint i;
+
+    metrics_hist(h, hist);
+    if (hist->count > 0) {
+        log_info("%s: %" G_GUINT64_FORMAT " samples, histogram:", hist_info[h].label, hist->count);
+        for (i = 0; i < HIST_BUCKETS; i++) {
+            if (hist->buckets[i])
+                log_info("  < %10.3f us: %" G_GUINT64_FORMAT, hist_upper(i) / 1000.0, hist->buckets[i]);
+        }
+    }
+    g_free(hist);
+}
+
+/* Appends the counters and histogram summaries to a STATS response. */
+void metrics_report (GString *out)
+{
+    MetricsSummary s;
+    guint i;
+
+    g_string_append_printf(out, "Uptime: %" G_GINT64_FORMAT " s\n", (g_get_monotonic_time() - started) / G_USEC_PER_SEC);
+    g_string_append(out, "Commands:");
+    for (i = 0; i < METRICS_COMMANDS; i++) {
+        guint64 n = metrics_sum(&shards[0].commands[i]);
+
+        if (n > 0)
+            g_string_append_printf(out, " %s %" G_GUINT64_FORMAT, command_names[i], n);
+    }
+    g_string_append_c(out, '\n');
+    for (i = 0; i < METRIC_COUNTERS; i++)
+        g_string_append_printf(out, "%s: %" G_GUINT64_FORMAT "\n", counter_info[i].label, metrics_counter(i));
+    g_string_append_printf(out, "Queue depth: %" G_GINT64_FORMAT "\n", __atomic_load_n(&queue_depth, __ATOMIC_RELAXED));
+
+    for (i = 0; i < METRIC_HISTS; i++) {
+        metrics_summary(i, &s);
+        g_string_append_printf(out, "%s: %" G_GUINT64_FORMAT " (avg %.1f us, p50 %.1f us, p90 %.1f us, "
+                "p99 %.1f us, p999 %.1f us, max %.1f us)\n", hist_info[i].label, s.count, s.avg / 1000.0,
+                s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+    }
+}
+
+/* The Prometheus text exposition format, version 0.0.4. */
+static char *metrics_prometheus (void)
+{
+    GString *out = g_string_new(NULL);
+    MetricsHist *hist = g_new(MetricsHist, 1);
+    guint i, j, b;
+
+    g_string_append(out, "# HELP vtmpegd_uptime_seconds Time since the server started.\n"
+            "# TYPE vtmpegd_uptime_seconds gauge\n");
+    g_string_append_printf(out, "vtmpegd_uptime_seconds %.3f\n", (g_get_monotonic_time() - started) / 1e6);
+
+    g_string_append(out, "# HELP vtmpegd_commands_total Protocol commands processed, by type.\n"
+            "# TYPE vtmpegd_commands_total counter\n");
+    for (i = 0; i < METRICS_COMMANDS; i++)
+        g_string_append_printf(out, "vtmpegd_commands_total{command=\"%s\"} %" G_GUINT64_FORMAT "\n",
+                command_names[i], metrics_sum(&shards[0].commands[i]));
+
+    for (i = 0; i < METRIC_COUNTERS; i++) {
+        g_string_append_printf(out, "# HELP vtmpegd_%s_total %s\n# TYPE vtmpegd_%s_total counter\n",
+                counter_info[i].name, counter_info[i].help, counter_info[i].name);
+        g_string_append_printf(out, "vtmpegd_%s_total %" G_GUINT64_FORMAT "\n", counter_info[i].name, metrics_counter(i));
+    }
+
+    g_string_append(out, "# HELP vtmpegd_queue_depth Items in the play queue.\n"
+            "# TYPE vtmpegd_queue_depth gauge\n");
+    g_string_append_printf(out, "vtmpegd_queue_depth %" G_GINT64_FORMAT "\n", __atomic_load_n(&queue_depth, __ATOMIC_RELAXED));
+
+    for (i = 0; i < METRIC_HISTS; i++) {
+        guint64 cum = 0;
+
+        metrics_hist(i, hist);
+        g_string_append_printf(out, "# HELP vtmpegd_%s_seconds %s\n# TYPE vtmpegd_%s_seconds histogram\n",
+                hist_info[i].name, hist_info[i].help, hist_info[i].name);
+        /* A bucket counts toward 'le' once all of it is below the bound. */
+        for (j = 0, b = 0; j < G_N_ELEMENTS(prom_bounds); j++) {
+            guint64 le = (guint64) (prom_bounds[j] * 1e9);
+
+            for (; b < HIST_BUCKETS && hist_upper(b) <= le + 1; b++)
+                cum += hist->buckets[b];
+            g_string_append_printf(out, "vtmpegd_%s_seconds_bucket{le=\"%g\"} %" G_GUINT64_FORMAT "\n",
+                    hist_info[i].name, prom_bounds[j], cum);
+        }
+        g_string_append_printf(out, "vtmpegd_%s_seconds_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n",
+                hist_info[i].name, hist->count);
+        g_string_append_printf(out, "vtmpegd_%s_seconds_sum %.9f\n", hist_info[i].name, hist->sum / 1e9);
+        g_string_append_printf(out, "vtmpegd_%s_seconds_count %" G_GUINT64_FORMAT "\n", hist_info[i].name, hist->count);
+    }
+
+    g_free(hist);
+    return g_string_free(out, FALSE);
+}
+
+/*
+ * Prometheus endpoint: a second UNIX socket, served by its own thread
+ * so a scraper never touches the IPC loop. An HTTP request ("GET ...",
+ * e.g. curl --unix-socket) gets an HTTP/1.0 response; a client that
+ * sends nothing (nc -U, socat) gets the bare text. Either way the
+ * connection is closed after the page.
+ */
+static GThread *serve_thread = NULL;
+static gint     serve_running = 0;
+static int      serve_fd = -1;
+static char    *serve_path = NULL;
+
+static void metrics_write_all (int fd, const char *buf, gsize len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void metrics_serve_one (int fd)
+{
+    struct pollfd pfd = { 0, POLLIN, 0 };
+    struct timeval tv = { 1, 0 };
+    char req[512];
+    ssize_t n = 0;
+    char *page;
+
+    pfd.fd = fd;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0)
+        n = read(fd, req, sizeof(req) - 1);
+
+    page = metrics_prometheus();
+    if (n >= 4 && memcmp(req, "GET ", 4) == 0) {
+        char *head = g_strdup_printf("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %zu\r\nConnection: close\r\n\r\n", strlen(page));
+        metrics_write_all(fd, head, strlen(head));
+        g_free(head);
+    }
+    metrics_write_all(fd, page, strlen(page));
+    g_free(page);
+}
+
+static gpointer metrics_serve (gpointer data)
+{
+    struct pollfd pfd = { 0, POLLIN, 0 };
+    int fd;
+
+    (void)data;
+    pfd.fd = serve_fd;
+    while (g_atomic_int_get(&serve_running)) {
+        if (poll(&pfd, 1, METRICS_IDLE_MS) <= 0)
+            continue;
+        if ((fd = accept4(serve_fd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+            continue;
+        metrics_serve_one(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Starts the Prometheus endpoint on 'path'. FALSE if the socket cannot be created. */
+gboolean metrics_serve_start (const char *path)
+{
+    struct sockaddr_un s;
+
+    memset(&s, 0, sizeof(s));
+    s.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(s.sun_path)) {
+        log_error("Metrics socket path too long: %s", path);
+        return FALSE;
+    }
+    g_strlcpy(s.sun_path, path, sizeof(s.sun_path));
+
+    if ((serve_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        log_error("metrics socket: %s", g_strerror(errno));
+        return FALSE;
+    }
+    unlink(path);
+    if (bind(serve_fd, (struct sockaddr *) &s, sizeof(s)) < 0 || listen(serve_fd, 16) < 0) {
+        log_error("metrics socket %s: %s", path, g_strerror(errno));
+        close(serve_fd);
+        serve_fd = -1;
+        return FALSE;
+    }
+    chmod(path, 0666);
+
+    serve_path = g_strdup(path);
+    g_atomic_int_set(&serve_running, 1);
+    serve_thread = g_thread_new("metrics", metrics_serve, NULL);
+    return TRUE;
+}
+
+void metrics_serve_stop (void)
+{
+    if (serve_thread == NULL)
+        return;
+
+    g_atomic_int_set(&serve_running, 0);
+    g_thread_join(serve_thread);
+    serve_thread = NULL;
+    close(serve_fd);
+    serve_fd = -1;
+    unlink(serve_path);
+    g_free(serve_path);
+    serve_path = NULL;
+}
@@ -0,0 +1,188 @@
+/*
+ * Per-frame cost of the graphics overlay at 1080p50.
+ *
+ * Pushes frames from videotestsrc through each overlay chain into an
+ * unsynchronised fakesink and divides the process CPU time by the frame
+ * count; the chain without an overlay is the baseline. The frames are
+ * I420 (the decoders' usual output) unless another format is given, so
+ * the cairooverlay chains pay for the conversion to and from ARGB like
+ * the server's fallback and headless sinks did:
+ *
+ *   per-frame text    the old draw_overlay(): layout and two show_text
+ *                     passes on every frame
+ *   cached (cairo)    overlay.c on cairooverlay (GStreamer < 1.20)
+ *   composition       overlay.c on overlaycomposition; fakesink cannot
+ *                     composite, so the element blends into the I420
+ *                     frame itself (a sink that can is cheaper still)
+ *   all layers        watermark, clock, lower third and ticker on air
+ *                     together: the clock re-renders once a second,
+ *                     the ticker moves every frame
+ *
+ *   make -C src/server bench && ./src/server/overlay-bench [FRAMES] [FORMAT]
+ */
+
+#include "VTserver.h"
+#include <cairo.h>
+#include <sys/resource.h>
+
+#define BENCH_FRAMES    1000
+#define BENCH_ROUNDS    3
+#define BENCH_SOURCE    "videotestsrc num-buffers=%d ! video/x-raw,format=%s,width=1920,height=1080,framerate=50/1"
+
+/* draw_overlay() as it was before overlay.c, for comparison. */
+static void legacy_draw (GstElement *overlay, cairo_t *cr, guint64 timestamp, guint64 duration, gpointer data)
+{
+    double x1, y1, x2, y2;
+    cairo_text_extents_t extents;
+    const char *text = OVERLAY_WATERMARK_TEXT;
+
+    (void)overlay; (void)timestamp; (void)duration; (void)data;
+
+    cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, 24.0);
+    cairo_text_extents(cr, text, &extents);
+
+    double x = x2 - extents.width - 20;
+    double y = y1 + extents.height + 20;
+
+    cairo_set_source_rgba(cr, 0, 0, 0, 0.5);
+    cairo_move_to(cr, x + 2, y + 2);
+    cairo_show_text(cr, text);
+
+    cairo_set_source_rgba(cr, 1, 1, 1, 0.5);
+    cairo_move_to(cr, x, y);
+    cairo_show_text(cr, text);
+}
+
+static double cpu_ms (void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+/* CPU ms per frame for one chain, best of BENCH_ROUNDS; < 0 if it cannot run. */
+static double run (const char *chain, GCallback draw, int frames, const char *format)
+{
+    double best = -1.0;
+    int round;
+
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        GError *error = NULL;
+        GstElement *pipeline, *ov;
+        GstMessage *msg;
+        GstBus *bus;
+        char *desc;
+        double t;
+
+        /* The caps filter makes the chains hand the sink the format they were given. */
+        desc = g_strdup_printf(BENCH_SOURCE " ! %s ! video/x-raw,format=%s ! fakesink sync=false",
+                               frames, format, chain, format);
+        pipeline = gst_parse_launch(desc, &error);
+        g_free(desc);
+        if (!pipeline || error) {
+            fprintf(stderr, "%s: %s\n", chain, error ? error->message : "cannot build");
+            if (error) g_error_free(error);
+            if (pipeline) gst_object_unref(GST_OBJECT(pipeline));
+            return -1.0;
+        }
+        if ((ov = gst_bin_get_by_name(GST_BIN(pipeline), "overlay")) != NULL) {
+            if (draw)
+                g_signal_connect(ov, "draw", draw, NULL);
+            else
+                overlay_connect(ov);
+            gst_object_unref(GST_OBJECT(ov));
+        }
+
+        t = cpu_ms();
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        bus = gst_element_get_bus(pipeline);
+        msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        t = cpu_ms() - t;
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+            gst_message_parse_error(msg, &error, NULL);
+            fprintf(stderr, "%s: %s\n", chain, error ? error->message : "(unknown)");
+            if (error) g_error_free(error);
+            t = -1.0;
+        }
+        gst_message_unref(msg);
+        gst_object_unref(GST_OBJECT(bus));
+        gst_object_unref(GST_OBJECT(pipeline));
+
+        if (t < 0.0)
+            return -1.0;
+        if (best < 0.0 || t / frames < best)
+            best = t / frames;
+    }
+    return best;
+}
+
+static void report (const char *label, double ms, double baseline)
+{
+    if (ms < 0.0)
+        printf("%-24s unavailable\n", label);
+    else if (baseline < 0.0)
+        printf("%-24s %8.3f ms/frame\n", label, ms);
+    else
+        printf("%-24s %8.3f ms/frame  overlay %8.3f ms/frame  %5.1f%% of a 50 fps frame\n",
+               label, ms, ms - baseline, (ms - baseline) / 20.0 * 100.0);
+}
+
+/* Everything but the bug, which needs an image. */
+static void all_layers (gboolean on)
+{
+    overlay_set_clock(on ? GRAPHICS_CLOCK_FORMAT : NULL, OVERLAY_TOP_LEFT);
+    overlay_set_lower_third(on ? "Overlay benchmark" : NULL, "Lower third, held on air", 0);
+    overlay_set_ticker(on ? "Ticker text scrolling along the bottom of the frame, every frame" : NULL, 0);
+}
+
+int main (int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : BENCH_FRAMES;
+    const char *format = argc > 2 ? argv[2] : "I420";
+    GstElementFactory *f;
+    MetricsSummary s;
+    double none;
+
+    gst_init(&argc, &argv);
+    metrics_init();
+    if (frames <= 0) {
+        fprintf(stderr, "usage: %s [FRAMES] [FORMAT]\n", argv[0]);
+        return 1;
+    }
+    overlay_set_watermark(OVERLAY_WATERMARK_TEXT);
+
+    printf("1920x1080 %s, %d frames, best of %d\n", format, frames, BENCH_ROUNDS);
+    none = run("identity", NULL, frames, format);
+    report("no overlay", none, -1.0);
+    if (none < 0.0)
+        return 1;
+
+    report("per-frame text",
+           run("videoconvert ! cairooverlay name=overlay ! videoconvert", G_CALLBACK(legacy_draw), frames, format), none);
+    report("cached (cairo)",
+           run("videoconvert ! cairooverlay name=overlay ! videoconvert", NULL, frames, format), none);
+
+    if ((f = gst_element_factory_find("overlaycomposition")) != NULL)
+        gst_object_unref(GST_OBJECT(f));
+    report("composition",
+           f ? run("overlaycomposition name=overlay", NULL, frames, format) : -1.0, none);
+
+    all_layers(TRUE);
+    report("all layers (cairo)",
+           run("videoconvert ! cairooverlay name=overlay ! videoconvert", NULL, frames, format), none);
+    report("all layers (composition)",
+           f ? run("overlaycomposition name=overlay", NULL, frames, format) : -1.0, none);
+    all_layers(FALSE);
+
+    /* What the draw callbacks alone took, as STATS reports it. */
+    metrics_summary(METRIC_HIST_OVERLAY, &s);
+    printf("draw: %" G_GUINT64_FORMAT " frames, avg %.1f us, p99 %.1f us, max %.1f us\n",
+           s.count, s.avg / 1000.0, s.p99 / 1000.0, s.max / 1000.0);
+    return 0;
+}
@@ -0,0 +1,743 @@
+/*
+ * On-air graphics: watermark, channel bug, clock, lower third and ticker.
+ *
+ * Layers are set from any thread (the GRAPHICS command, the watermark
+ * options) and drawn by the overlay element in front of each deck's
+ * video sink, whichever sink path built it. Nothing is laid out or
+ * rasterised per frame. Each layer is rendered into a premultiplied
+ * ARGB surface just big enough for its content, and rendered again
+ * only when its settings or the frame size change or, for the clock,
+ * when the second it shows changes. The ticker's text is rendered once
+ * into a strip and scrolls by showing a moving window of it.
+ *
+ * Each deck's overlay element keeps its own rendered copies (the decks
+ * can play items of different sizes), refreshed on its streaming
+ * thread. With overlaycomposition (GStreamer 1.20) each layer is a
+ * GstVideoOverlayRectangle kept until the layer changes, and they all
+ * go out in one GstVideoOverlayComposition per frame: a sink that can
+ * composite it does so, otherwise the element blends every layer into
+ * the frame in one pass, in the frame's own format. The ticker's window
+ * shares the strip's memory, so scrolling copies no pixels. Older
+ * GStreamer falls back to cairooverlay, which then only paints the
+ * rendered surfaces.
+ *
+ * A frame where nothing changed costs a few clock and pointer checks.
+ * Text is capped at GRAPHICS_TEXT_MAX bytes and surfaces at
+ * OVERLAY_SURFACE_MAX pixels wide, which bounds a re-render. Every draw
+ * is timed into METRIC_HIST_OVERLAY (see STATS).
+ */
+
+#include "VTserver.h"
+#include <cairo.h>
+#include <math.h>
+#include <time.h>
+#include <gst/video/video.h>
+
+#define OVERLAY_SURFACE_MAX 32767   /* Cairo's image surface limit */
+#define OVERLAY_FONT        "Sans"
+#define WATERMARK_SIZE      24.0    /* px, whatever the frame size */
+#define WATERMARK_MARGIN    20      /* from the top-right corner */
+#define WATERMARK_SHADOW    2       /* drop shadow offset */
+
+typedef enum {
+    LAYER_WATERMARK = 0,
+    LAYER_BUG,
+    LAYER_CLOCK,
+    LAYER_LOWER_THIRD,
+    LAYER_TICKER,
+    LAYERS                          /* bottom to top */
+} LayerId;
+
+static const char *layer_names[LAYERS] = { "watermark", "bug", "clock", "lower", "ticker" };
+static const char *corner_names[] = { "tl", "tr", "bl", "br" };
+
+/* A layer as set. */
+typedef struct {
+    gint     generation;        /* bumped on every change */
+    gboolean on;
+    char    *text;              /* watermark, clock format, lower-third title, ticker */
+    char    *text2;             /* lower-third subtitle */
+    char    *path;              /* bug image, as given */
+    cairo_surface_t *image;     /* bug image, as loaded */
+    OverlayCorner corner;       /* bug, clock */
+    gint     speed;             /* ticker, px/s */
+    gint64   since;             /* monotonic us it was set */
+    gint64   until;             /* lower third: monotonic us it goes off air, 0 = never */
+} LayerSettings;
+
+/* One element's rendering of a layer. */
+typedef struct {
+    LayerSettings s;            /* the settings it was rendered from */
+    cairo_surface_t *surface;   /* NULL: nothing to draw */
+    gint     x, y;              /* where the surface goes in the frame */
+    GstVideoOverlayRectangle *rect;     /* overlaycomposition only */
+    gint64   shown;             /* clock: the second on the surface */
+    gboolean visible;           /* on the last frame */
+    /* Ticker: 'surface' is the band, the text scrolls over it. */
+    cairo_surface_t *strip;
+    GstBuffer *strip_pixels;    /* overlaycomposition only */
+    gint     strip_y;
+} LayerImage;
+
+typedef struct {
+    guint    width, height;     /* frame size, 0 until known */
+    guint    rendered_width, rendered_height;
+    gint     generation;        /* graphics_generation last seen */
+    gboolean compose;           /* overlaycomposition, else cairooverlay */
+    LayerImage layers[LAYERS];
+    GstVideoOverlayComposition *composition;    /* the last frame's */
+} OverlayCache;
+
+static GMutex        layer_lock;        /* guards settings */
+static LayerSettings settings[LAYERS];
+static gint          graphics_generation = 1;
+static const char   *factory = NULL;
+
+static void layer_settings_clear (LayerSettings *l)
+{
+    g_free(l->text);
+    g_free(l->text2);
+    g_free(l->path);
+    if (l->image) cairo_surface_destroy(l->image);
+    l->text = l->text2 = l->path = NULL;
+    l->image = NULL;
+    l->on = FALSE;
+    l->until = 0;
+}
+
+/* layer_lock held. */
+static void layer_settings_copy (LayerSettings *dst, const LayerSettings *src)
+{
+    *dst = *src;
+    dst->text = g_strdup(src->text);
+    dst->text2 = g_strdup(src->text2);
+    dst->path = g_strdup(src->path);
+    if (src->image) cairo_surface_reference(src->image);
+}
+
+/* layer_lock held: clears a layer for new settings. */
+static LayerSettings *layer_begin (LayerId id)
+{
+    layer_settings_clear(&settings[id]);
+    settings[id].generation++;
+    settings[id].since = g_get_monotonic_time();
+    return &settings[id];
+}
+
+/* layer_lock held: the new settings are in place. */
+static void layer_commit (void)
+{
+    g_atomic_int_inc(&graphics_generation);
+    g_mutex_unlock(&layer_lock);
+}
+
+static void layer_off (LayerId id)
+{
+    g_mutex_lock(&layer_lock);
+    layer_begin(id);
+    layer_commit();
+}
+
+/* Sets the watermark text; NULL takes it off air. Any thread. */
+void overlay_set_watermark (const char *text)
+{
+    LayerSettings *l;
+
+    if (!text || !*text) {
+        layer_off(LAYER_WATERMARK);
+        return;
+    }
+    g_mutex_lock(&layer_lock);
+    l = layer_begin(LAYER_WATERMARK);
+    l->on = TRUE;
+    l->text = g_strndup(text, GRAPHICS_TEXT_MAX);
+    layer_commit();
+}
+
+/* Shows the PNG at 'path' in a corner; NULL takes it off air. FALSE if it cannot be loaded. */
+gboolean overlay_set_bug (const char *path, OverlayCorner corner)
+{
+    cairo_surface_t *image;
+    LayerSettings *l;
+
+    if (!path || !*path) {
+        layer_off(LAYER_BUG);
+        return TRUE;
+    }
+    /* Decoded once, here; the elements only scale it. */
+    image = cairo_image_surface_create_from_png(path);
+    if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS ||
+            cairo_image_surface_get_width(image) == 0 || cairo_image_surface_get_height(image) == 0) {
+        cairo_surface_destroy(image);
+        return FALSE;
+    }
+
+    g_mutex_lock(&layer_lock);
+    l = layer_begin(LAYER_BUG);
+    l->on = TRUE;
+    l->path = g_strdup(path);
+    l->image = image;
+    l->corner = corner;
+    layer_commit();
+    return TRUE;
+}
+
+/* Shows the local time in strftime() 'format' in a corner; NULL takes it off air. */
+void overlay_set_clock (const char *format, OverlayCorner corner)
+{
+    LayerSettings *l;
+
+    if (!format || !*format) {
+        layer_off(LAYER_CLOCK);
+        return;
+    }
+    g_mutex_lock(&layer_lock);
+    l = layer_begin(LAYER_CLOCK);
+    l->on = TRUE;
+    l->text = g_strndup(format, GRAPHICS_TEXT_MAX);
+    l->corner = corner;
+    layer_commit();
+}
+
+/* Shows a lower third for 'seconds' (0: until replaced); a NULL title takes it off air. */
+void overlay_set_lower_third (const char *title, const char *subtitle, guint seconds)
+{
+    LayerSettings *l;
+
+    if (!title || !*title) {
+        layer_off(LAYER_LOWER_THIRD);
+        return;
+    }
+    g_mutex_lock(&layer_lock);
+    l = layer_begin(LAYER_LOWER_THIRD);
+    l->on = TRUE;
+    l->text = g_strndup(title, GRAPHICS_TEXT_MAX);
+    l->text2 = (subtitle && *subtitle) ? g_strndup(subtitle, GRAPHICS_TEXT_MAX) : NULL;
+    l->until = seconds ? l->since + (gint64) seconds * G_USEC_PER_SEC : 0;
+    layer_commit();
+}
+
+/* Scrolls 'text' along the bottom at 'speed' px/s (0: the default); NULL takes it off air. */
+void overlay_set_ticker (const char *text, guint speed)
+{
+    LayerSettings *l;
+
+    if (!text || !*text) {
+        layer_off(LAYER_TICKER);
+        return;
+    }
+    g_mutex_lock(&layer_lock);
+    l = layer_begin(LAYER_TICKER);
+    l->on = TRUE;
+    l->text = g_strndup(text, GRAPHICS_TEXT_MAX);
+    l->speed = speed ? (gint) MIN(speed, GRAPHICS_TICKER_SPEED_MAX) : GRAPHICS_TICKER_SPEED;
+    layer_commit();
+}
+
+/* "tl", "tr", "bl" or "br"; -1 if it is none of them. */
+int overlay_parse_corner (const char *s)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (g_ascii_strcasecmp(s, corner_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/* One line per layer, for GRAPHICS without arguments. */
+void overlay_report (GString *out)
+{
+    gint64 now = g_get_monotonic_time();
+    int i;
+
+    g_mutex_lock(&layer_lock);
+    for (i = 0; i < LAYERS; i++) {
+        LayerSettings *l = &settings[i];
+
+        g_string_append_printf(out, "%s: ", layer_names[i]);
+        if (!l->on || (l->until && now >= l->until)) {
+            g_string_append(out, "off\n");
+            continue;
+        }
+        switch (i) {
+            case LAYER_WATERMARK:
+                g_string_append_printf(out, "%s\n", l->text);
+                break;
+            case LAYER_BUG:
+                g_string_append_printf(out, "%s (%s)\n", l->path, corner_names[l->corner]);
+                break;
+            case LAYER_CLOCK:
+                g_string_append_printf(out, "%s (%s)\n", l->text, corner_names[l->corner]);
+                break;
+            case LAYER_LOWER_THIRD:
+                g_string_append_printf(out, "%s;%s", l->text, l->text2 ? l->text2 : "");
+                if (l->until)
+                    g_string_append_printf(out, " (%" G_GINT64_FORMAT " s left)",
+                            (l->until - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC);
+                g_string_append_c(out, '\n');
+                break;
+            case LAYER_TICKER:
+                g_string_append_printf(out, "%s (%d px/s)\n", l->text, l->speed);
+                break;
+        }
+    }
+    g_mutex_unlock(&layer_lock);
+}
+
+/* The overlay element to put in front of a video sink. */
+const char *overlay_factory (void)
+{
+    GstElementFactory *f;
+
+    if (factory == NULL) {
+        f = gst_element_factory_find("overlaycomposition");
+        factory = f ? "overlaycomposition" : "cairooverlay";
+        if (f) gst_object_unref(GST_OBJECT(f));
+    }
+    return factory;
+}
+
+/*
+ * Rasterises 'text' into a surface that fits its ink and a drop shadow
+ * 'shadow' px down and right, plus a pixel of antialiasing all round.
+ * NULL if there is no ink.
+ */
+static cairo_surface_t *text_surface (const char *text, double size, cairo_font_weight_t weight,
+                                      double alpha, double shadow)
+{
+    cairo_surface_t *surface;
+    cairo_text_extents_t ext;
+    cairo_t *cr;
+    int w, h;
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    cr = cairo_create(surface);
+    cairo_select_font_face(cr, OVERLAY_FONT, CAIRO_FONT_SLANT_NORMAL, weight);
+    cairo_set_font_size(cr, size);
+    cairo_text_extents(cr, text, &ext);
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+
+    if (ext.width <= 0 || ext.height <= 0)
+        return NULL;
+    w = MIN((int) ceil(ext.width + shadow) + 2, OVERLAY_SURFACE_MAX);
+    h = MIN((int) ceil(ext.height + shadow) + 2, OVERLAY_SURFACE_MAX);
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    cr = cairo_create(surface);
+    cairo_select_font_face(cr, OVERLAY_FONT, CAIRO_FONT_SLANT_NORMAL, weight);
+    cairo_set_font_size(cr, size);
+
+    if (shadow > 0) {
+        cairo_set_source_rgba(cr, 0, 0, 0, alpha);
+        cairo_move_to(cr, 1 - ext.x_bearing + shadow, 1 - ext.y_bearing + shadow);
+        cairo_show_text(cr, text);
+    }
+    cairo_set_source_rgba(cr, 1, 1, 1, alpha);
+    cairo_move_to(cr, 1 - ext.x_bearing, 1 - ext.y_bearing);
+    cairo_show_text(cr, text);
+
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    return surface;
+}
+
+/* Places a rendered layer 'margin' px in from a corner of the frame. */
+static void layer_place (OverlayCache *cache, LayerImage *img, OverlayCorner corner, int margin)
+{
+    int w = cairo_image_surface_get_width(img->surface);
+    int h = cairo_image_surface_get_height(img->surface);
+
+    img->x = (corner == OVERLAY_TOP_RIGHT || corner == OVERLAY_BOTTOM_RIGHT) ? (int) cache->width - w - margin : margin;
+    img->y = (corner == OVERLAY_BOTTOM_LEFT || corner == OVERLAY_BOTTOM_RIGHT) ? (int) cache->height - h - margin : margin;
+}
+
+/* The bug image, scaled down to at most an eighth of the frame height. */
+static cairo_surface_t *bug_surface (cairo_surface_t *image, guint height)
+{
+    int iw = cairo_image_surface_get_width(image), ih = cairo_image_surface_get_height(image);
+    double scale = MIN(1.0, (height / 8.0) / ih);
+    int w = MIN(MAX(1, (int) (iw * scale)), OVERLAY_SURFACE_MAX), h = MAX(1, (int) (ih * scale));
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    cairo_t *cr = cairo_create(surface);
+
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, image, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    return surface;
+}
+
+/* The lower third: title over subtitle on a translucent box with an accent bar. */
+static cairo_surface_t *lower_third_surface (const char *title, const char *subtitle, guint height)
+{
+    cairo_surface_t *t = text_surface(title, height / 16.0, CAIRO_FONT_WEIGHT_BOLD, 1.0, 0);
+    cairo_surface_t *s = subtitle ? text_surface(subtitle, height / 26.0, CAIRO_FONT_WEIGHT_NORMAL, 0.85, 0) : NULL;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    int pad = MAX(4, (int) height / 60);
+    int w, h;
+
+    if (!t) {
+        if (s) cairo_surface_destroy(s);
+        return NULL;
+    }
+    w = cairo_image_surface_get_width(t);
+    h = cairo_image_surface_get_height(t);
+    if (s) {
+        w = MAX(w, cairo_image_surface_get_width(s));
+        h += pad / 2 + cairo_image_surface_get_height(s);
+    }
+    w = MIN(w + 3 * pad, OVERLAY_SURFACE_MAX);
+    h += 2 * pad;
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    cr = cairo_create(surface);
+    cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+    cairo_paint(cr);
+    cairo_set_source_rgba(cr, 0.85, 0.1, 0.1, 0.9);
+    cairo_rectangle(cr, 0, 0, pad / 2, h);
+    cairo_fill(cr);
+
+    cairo_set_source_surface(cr, t, 2 * pad, pad);
+    cairo_paint(cr);
+    if (s) {
+        cairo_set_source_surface(cr, s, 2 * pad, pad + cairo_image_surface_get_height(t) + pad / 2);
+        cairo_paint(cr);
+        cairo_surface_destroy(s);
+    }
+    cairo_surface_destroy(t);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    return surface;
+}
+
+/* A surface's pixels in a buffer. Cairo's ARGB32 is overlaycomposition's RGB format. */
+static GstBuffer *surface_pixels (cairo_surface_t *surface)
+{
+    gsize size = (gsize) cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+
+    gst_buffer_fill(buffer, 0, cairo_image_surface_get_data(surface), size);
+    return buffer;
+}
+
+/* A w x h rectangle at x, y of the pixels at 'offset' in 'pixels', sharing their memory. */
+static GstVideoOverlayRectangle *rect_new (GstBuffer *pixels, gsize offset, gint stride,
+                                           int x, int y, int w, int h)
+{
+    GstVideoOverlayRectangle *rect;
+    GstBuffer *buffer = gst_buffer_new();
+    gsize offsets[GST_VIDEO_MAX_PLANES] = { 0 };
+    gint strides[GST_VIDEO_MAX_PLANES] = { 0 };
+
+    offsets[0] = offset;
+    strides[0] = stride;
+    gst_buffer_append_memory(buffer, gst_buffer_get_memory(pixels, 0));
+    gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+            GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, w, h, 1, offsets, strides);
+    rect = gst_video_overlay_rectangle_new_raw(buffer, x, y, w, h,
+            GST_VIDEO_OVERLAY_FORMAT_FLAG_PREMULTIPLIED_ALPHA);
+    gst_buffer_unref(buffer);
+    return rect;
+}
+
+static void layer_image_clear (LayerImage *img)
+{
+    if (img->rect) gst_video_overlay_rectangle_unref(img->rect);
+    if (img->surface) cairo_surface_destroy(img->surface);
+    if (img->strip) cairo_surface_destroy(img->strip);
+    if (img->strip_pixels) gst_buffer_unref(img->strip_pixels);
+    img->rect = NULL;
+    img->surface = img->strip = NULL;
+    img->strip_pixels = NULL;
+}
+
+/* The ticker: a band across the bottom and the text strip that scrolls over it. */
+static void ticker_render (OverlayCache *cache, LayerImage *img)
+{
+    int band = MAX(16, (int) cache->height / 14);
+    cairo_t *cr;
+
+    if (!(img->strip = text_surface(img->s.text, band * 0.55, CAIRO_FONT_WEIGHT_BOLD, 1.0, 0)))
+        return;
+    if (cairo_image_surface_get_height(img->strip) > band) {
+        layer_image_clear(img);
+        return;
+    }
+    img->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, MIN((int) cache->width, OVERLAY_SURFACE_MAX), band);
+    cr = cairo_create(img->surface);
+    cairo_set_source_rgba(cr, 0, 0, 0, 0.6);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(img->surface);
+
+    img->x = 0;
+    img->y = (int) cache->height - band;
+    img->strip_y = img->y + (band - cairo_image_surface_get_height(img->strip)) / 2;
+    if (cache->compose)
+        img->strip_pixels = surface_pixels(img->strip);
+}
+
+/* Renders a layer from img->s for the element's frame size. */
+static void layer_render (OverlayCache *cache, LayerId id, LayerImage *img)
+{
+    guint height = cache->height;
+    int margin = MAX(8, (int) height / 27);
+    char buf[128];
+    struct tm tm;
+    time_t t;
+
+    layer_image_clear(img);
+    if (!img->s.on || cache->width == 0 || height == 0)
+        return;
+
+    switch (id) {
+        case LAYER_WATERMARK:
+            /* As it has always looked, whatever the frame size. */
+            if ((img->surface = text_surface(img->s.text, WATERMARK_SIZE, CAIRO_FONT_WEIGHT_BOLD, 0.5, WATERMARK_SHADOW)))
+                layer_place(cache, img, OVERLAY_TOP_RIGHT, WATERMARK_MARGIN);
+            break;
+        case LAYER_BUG:
+            img->surface = bug_surface(img->s.image, height);
+            layer_place(cache, img, img->s.corner, margin);
+            break;
+        case LAYER_CLOCK:
+            img->shown = g_get_real_time() / G_USEC_PER_SEC;
+            t = (time_t) img->shown;
+            localtime_r(&t, &tm);
+            if (strftime(buf, sizeof(buf), img->s.text, &tm) > 0 &&
+                    (img->surface = text_surface(buf, height / 22.0, CAIRO_FONT_WEIGHT_BOLD, 1.0, MAX(1.0, height / 400.0))))
+                layer_place(cache, img, img->s.corner, margin);
+            break;
+        case LAYER_LOWER_THIRD:
+            if ((img->surface = lower_third_surface(img->s.text, img->s.text2, height))) {
+                img->x = (int) cache->width / 20;
+                img->y = (int) (height * 0.8) - cairo_image_surface_get_height(img->surface);
+            }
+            break;
+        case LAYER_TICKER:
+            ticker_render(cache, img);
+            break;
+        default:
+            break;
+    }
+
+    /* Nothing that does not fit the frame. */
+    if (img->surface && (img->x < 0 || img->y < 0 ||
+            img->x + cairo_image_surface_get_width(img->surface) > (int) cache->width ||
+            img->y + cairo_image_surface_get_height(img->surface) > (int) height)) {
+        layer_image_clear(img);
+        return;
+    }
+
+    if (img->surface && cache->compose) {
+        GstBuffer *pixels = surface_pixels(img->surface);
+
+        img->rect = rect_new(pixels, 0, cairo_image_surface_get_stride(img->surface), img->x, img->y,
+                cairo_image_surface_get_width(img->surface), cairo_image_surface_get_height(img->surface));
+        gst_buffer_unref(pixels);
+    }
+}
+
+/*
+ * The part of the ticker strip on screen at 'now': 'w' columns from
+ * column 'x0' of the strip, at column 'dx' of the frame. The text
+ * enters on the right, leaves on the left and starts over. FALSE if
+ * none of it is on screen.
+ */
+static gboolean ticker_window (OverlayCache *cache, LayerImage *img, gint64 now, int *x0, int *w, int *dx)
+{
+    int sw = cairo_image_surface_get_width(img->strip);
+    gint64 cycle = (gint64) cache->width + sw;
+    gint64 travel = (now - img->s.since) * img->s.speed / G_USEC_PER_SEC;
+    int x = (int) cache->width - (int) (travel % cycle);     /* the strip's left edge in the frame */
+
+    *x0 = MAX(0, -x);
+    *w = MIN(sw, (int) cache->width - x) - *x0;
+    *dx = x + *x0;
+    return *w > 0;
+}
+
+/*
+ * Streaming thread. Brings the element's layers up to date, rendering
+ * only those that changed, and says whether this frame's graphics
+ * differ from the last frame's.
+ */
+static gboolean overlay_refresh (OverlayCache *cache, gint64 now)
+{
+    gint generation = g_atomic_int_get(&graphics_generation);
+    gboolean resized = cache->width != cache->rendered_width || cache->height != cache->rendered_height;
+    gboolean changed = FALSE;
+    int i;
+
+    if (resized || generation != cache->generation) {
+        cache->generation = generation;
+        cache->rendered_width = cache->width;
+        cache->rendered_height = cache->height;
+
+        for (i = 0; i < LAYERS; i++) {
+            LayerImage *img = &cache->layers[i];
+
+            g_mutex_lock(&layer_lock);
+            if (!resized && settings[i].generation == img->s.generation) {
+                g_mutex_unlock(&layer_lock);
+                continue;
+            }
+            layer_settings_clear(&img->s);
+            layer_settings_copy(&img->s, &settings[i]);
+            g_mutex_unlock(&layer_lock);
+
+            layer_render(cache, i, img);
+            changed = TRUE;
+        }
+    }
+
+    /* The clock is the only layer that changes by itself, once a second. */
+    if (cache->layers[LAYER_CLOCK].s.on &&
+            g_get_real_time() / G_USEC_PER_SEC != cache->layers[LAYER_CLOCK].shown) {
+        layer_render(cache, LAYER_CLOCK, &cache->layers[LAYER_CLOCK]);
+        changed = TRUE;
+    }
+
+    for (i = 0; i < LAYERS; i++) {
+        LayerImage *img = &cache->layers[i];
+        gboolean visible = img->surface != NULL && (img->s.until == 0 || now < img->s.until);
+
+        if (visible != img->visible)
+            changed = TRUE;
+        img->visible = visible;
+    }
+
+    /* The ticker moves every frame. */
+    return changed || cache->layers[LAYER_TICKER].visible;
+}
+
+static void overlay_cache_free (gpointer data)
+{
+    OverlayCache *cache = (OverlayCache *) data;
+    int i;
+
+    for (i = 0; i < LAYERS; i++) {
+        layer_image_clear(&cache->layers[i]);
+        layer_settings_clear(&cache->layers[i].s);
+    }
+    if (cache->composition) gst_video_overlay_composition_unref(cache->composition);
+    g_free(cache);
+}
+
+/* overlaycomposition: the negotiated frame size. */
+static void overlay_caps_changed (GstElement *element, GstCaps *caps, guint window_width, guint window_height, gpointer data)
+{
+    OverlayCache *cache = (OverlayCache *) data;
+    GstVideoInfo info;
+
+    (void)element; (void)window_width; (void)window_height;
+
+    if (gst_video_info_from_caps(&info, caps)) {
+        cache->width = GST_VIDEO_INFO_WIDTH(&info);
+        cache->height = GST_VIDEO_INFO_HEIGHT(&info);
+    }
+}
+
+static void composition_add (GstVideoOverlayComposition **comp, GstVideoOverlayRectangle *rect)
+{
+    if (*comp == NULL)
+        *comp = gst_video_overlay_composition_new(rect);
+    else
+        gst_video_overlay_composition_add_rectangle(*comp, rect);
+}
+
+/*
+ * overlaycomposition: once per frame. Unchanged frames reuse the last
+ * composition; otherwise the layers' rectangles are reused and only
+ * the ticker's window is new.
+ */
+static GstVideoOverlayComposition *overlay_draw_composition (GstElement *element, GstSample *sample, gpointer data)
+{
+    OverlayCache *cache = (OverlayCache *) data;
+    gint64 started = metrics_now(), now = g_get_monotonic_time();
+    GstVideoOverlayComposition *comp = NULL;
+    int i;
+
+    (void)element; (void)sample;
+
+    if (overlay_refresh(cache, now)) {
+        for (i = 0; i < LAYERS; i++) {
+            LayerImage *img = &cache->layers[i];
+            int x0, w, dx;
+
+            if (!img->visible)
+                continue;
+            composition_add(&comp, img->rect);
+            if (i == LAYER_TICKER && ticker_window(cache, img, now, &x0, &w, &dx)) {
+                GstVideoOverlayRectangle *rect = rect_new(img->strip_pixels, (gsize) x0 * 4,
+                        cairo_image_surface_get_stride(img->strip), dx, img->strip_y,
+                        w, cairo_image_surface_get_height(img->strip));
+
+                composition_add(&comp, rect);
+                gst_video_overlay_rectangle_unref(rect);
+            }
+        }
+        if (cache->composition) gst_video_overlay_composition_unref(cache->composition);
+        cache->composition = comp;
+    }
+
+    metrics_record(METRIC_HIST_OVERLAY, metrics_now() - started);
+    return cache->composition ? gst_video_overlay_composition_ref(cache->composition) : NULL;
+}
+
+/* cairooverlay: once per frame, paints the rendered surfaces. */
+static void overlay_draw_cairo (GstElement *element, cairo_t *cr, guint64 timestamp, guint64 duration, gpointer data)
+{
+    OverlayCache *cache = (OverlayCache *) data;
+    gint64 started = metrics_now(), now = g_get_monotonic_time();
+    double x1, y1, x2, y2;
+    int i;
+
+    (void)element; (void)timestamp; (void)duration;
+
+    cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    cache->width = (guint) (x2 - x1);
+    cache->height = (guint) (y2 - y1);
+    overlay_refresh(cache, now);
+
+    for (i = 0; i < LAYERS; i++) {
+        LayerImage *img = &cache->layers[i];
+        int x0, w, dx;
+
+        if (!img->visible)
+            continue;
+        cairo_set_source_surface(cr, img->surface, x1 + img->x, y1 + img->y);
+        cairo_paint(cr);
+        if (i == LAYER_TICKER && ticker_window(cache, img, now, &x0, &w, &dx)) {
+            cairo_save(cr);
+            cairo_rectangle(cr, x1 + dx, y1 + img->strip_y, w, cairo_image_surface_get_height(img->strip));
+            cairo_clip(cr);
+            cairo_set_source_surface(cr, img->strip, x1 + dx - x0, y1 + img->strip_y);
+            cairo_paint(cr);
+            cairo_restore(cr);
+        }
+    }
+
+    metrics_record(METRIC_HIST_OVERLAY, metrics_now() - started);
+}
+
+/* Makes an overlaycomposition or cairooverlay element draw the graphics. */
+void overlay_connect (GstElement *element)
+{
+    GstElementFactory *f = gst_element_get_factory(element);
+    OverlayCache *cache = g_new0(OverlayCache, 1);
+
+    g_object_set_data_full(G_OBJECT(element), "vt-overlay", cache, overlay_cache_free);
+    cache->compose = f && strcmp(GST_OBJECT_NAME(f), "overlaycomposition") == 0;
+    if (cache->compose) {
+        g_signal_connect(element, "caps-changed", G_CALLBACK(overlay_caps_changed), cache);
+        g_signal_connect(element, "draw", G_CALLBACK(overlay_draw_composition), cache);
+    } else {
+        g_signal_connect(element, "draw", G_CALLBACK(overlay_draw_cairo), cache);
+    }
+}
@@ -0,0 +1,171 @@
+/*
+ * Cold-cache benchmark: time to read the start of each file, with and
+ * without the prefetcher having warmed it first.
+ *
+ * Every round evicts the files from the page cache (posix_fadvise
+ * DONTNEED; with --drop-caches, as root, all clean caches are dropped),
+ * then reads the first head bytes of each file the way a demuxer opening
+ * it would. The "prefetched" round runs prefetch.c over the file list and
+ * waits for it before reading. Use large files on the storage the server
+ * plays from: on tmpfs both rounds are warm, on a local SSD the gap is
+ * small, on NFS, spinning disks or a throttled device (cgroup io.max,
+ * dm-delay) it is what the gapless handoff saves.
+ *
+ *   make -C src/server bench && ./src/server/prefetch-bench [--drop-caches] FILE...
+ */
+
+#include "VTserver.h"
+#include <sys/mman.h>
+
+#define BENCH_HEAD   (8 << 20)
+#define BENCH_BUF    (256 * 1024)
+
+static char **files;
+static int nfiles;
+static gboolean drop_caches = FALSE;
+
+static double now_ms (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static GPtrArray *bench_upcoming (guint n)
+{
+    GPtrArray *out = g_ptr_array_new_with_free_func(g_free);
+    int i;
+
+    for (i = 0; i < nfiles && (guint) i < n; i++)
+        g_ptr_array_add(out, g_strdup(files[i]));
+    return out;
+}
+
+static void cool (void)
+{
+    int i, fd;
+
+    if (drop_caches) {
+        sync();
+        if ((fd = open("/proc/sys/vm/drop_caches", O_WRONLY)) >= 0) {
+            if (write(fd, "3\n", 2) != 2)
+                perror("drop_caches");
+            close(fd);
+        } else {
+            perror("drop_caches");
+        }
+    }
+    for (i = 0; i < nfiles; i++) {
+        if ((fd = open(files[i], O_RDONLY)) < 0)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/* Fraction of the first 'len' bytes that is in the page cache. */
+static double resident (const char *path, gsize len)
+{
+    struct stat st;
+    unsigned char *vec;
+    void *map;
+    gsize pages, i, in = 0, page = sysconf(_SC_PAGESIZE);
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return 0.0;
+    }
+    len = MIN(len, (gsize) st.st_size);
+    map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0.0;
+
+    pages = (len + page - 1) / page;
+    vec = g_malloc(pages);
+    if (mincore(map, len, vec) == 0)
+        for (i = 0; i < pages; i++)
+            in += vec[i] & 1;
+    g_free(vec);
+    munmap(map, len);
+    return (double) in / pages;
+}
+
+static double read_head (const char *path, gsize len)
+{
+    static char buf[BENCH_BUF];
+    double t = now_ms();
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return 0.0;
+    }
+    while (len > 0 && (n = read(fd, buf, MIN(len, sizeof(buf)))) > 0)
+        len -= n;
+    close(fd);
+    return now_ms() - t;
+}
+
+static void round_report (const char *label, double warm_ms)
+{
+    double total = 0.0, worst = 0.0;
+    int i;
+
+    for (i = 0; i < nfiles; i++) {
+        double res = resident(files[i], BENCH_HEAD);
+        double ms = read_head(files[i], BENCH_HEAD);
+
+        printf("%-10s %5.0f%% cached  %9.2f ms  %s\n", label, res * 100.0, ms, files[i]);
+        total += ms;
+        worst = MAX(worst, ms);
+    }
+    printf("%-10s total %.2f ms, worst %.2f ms", label, total, worst);
+    if (warm_ms >= 0.0)
+        printf(", prefetch took %.2f ms in the background", warm_ms);
+    printf("\n\n");
+}
+
+int main (int argc, char **argv)
+{
+    PrefetchStats s;
+    double t;
+    int i;
+
+    if (argc > 1 && strcmp(argv[1], "--drop-caches") == 0) {
+        drop_caches = TRUE;
+        argv++;
+        argc--;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s [--drop-caches] FILE...\n", argv[0]);
+        return 1;
+    }
+    files = argv + 1;
+    nfiles = argc - 1;
+    for (i = 0; i < nfiles; i++) {
+        if (access(files[i], R_OK) < 0) {
+            perror(files[i]);
+            return 1;
+        }
+    }
+
+    cool();
+    round_report("cold", -1.0);
+
+    cool();
+    t = now_ms();
+    prefetch_start(bench_upcoming, nfiles, BENCH_HEAD, 0);
+    do {
+        g_usleep(1000);
+        prefetch_get_stats(&s);
+    } while (s.warmed < (guint) nfiles && now_ms() - t < 60000.0);
+    t = now_ms() - t;
+    prefetch_stop();
+    round_report("prefetched", t);
+
+    printf("warmed %u files, %.1f MiB\n", s.warmed, s.bytes / (1024.0 * 1024.0));
+    return 0;
+}
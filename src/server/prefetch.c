@@ -0,0 +1,355 @@
+/*
+ * Queue-aware page-cache prefetcher.
+ *
+ * A background thread keeps the next few queue items warm so the
+ * gapless handoff does not hand playbin a cold file. For each upcoming
+ * local file it reads ahead the first head_bytes and the container
+ * index: the MP4/MOV 'moov' box, wherever it is, or else the tail of
+ * the file (Matroska cues, moov-at-end files the box walk could not
+ * parse). Reads go through readahead(), falling back to
+ * posix_fadvise(WILLNEED) where readahead is not supported, in chunks
+ * paced by a token bucket so prefetch never takes more than rate_bytes
+ * per second from the disk the current item streams from. The thread
+ * also runs at idle I/O priority.
+ *
+ * The queue is only read through the source callback, which takes the
+ * queue read lock; the prefetcher never holds it while doing I/O.
+ */
+
+#include "VTserver.h"
+#include <sys/syscall.h>
+
+/* Bytes per readahead() call; also the token bucket granularity. */
+#define PREFETCH_CHUNK        (1024 * 1024)
+/* Tail warmed when no 'moov' box is found. */
+#define PREFETCH_TAIL_BYTES   (1024 * 1024)
+/* Top-level MP4 boxes examined before giving up on finding 'moov'. */
+#define PREFETCH_MAX_BOXES    64
+/* Burst allowance of the token bucket. */
+#define PREFETCH_BURST_US     (G_USEC_PER_SEC / 4)
+
+#define IOPRIO_CLASS_IDLE     3
+#define IOPRIO_CLASS_SHIFT    13
+#define IOPRIO_WHO_PROCESS    1
+
+typedef enum {
+    PREFETCH_PENDING = 0,
+    PREFETCH_DONE,
+    PREFETCH_FAILED
+} PrefetchState;
+
+static GMutex   plock;
+static GCond    pcond;
+static GThread *pthread = NULL;
+static gboolean prunning = FALSE;
+static gboolean pkicked = FALSE;
+/* path -> PrefetchState, for the items of the last pass only */
+static GHashTable *files = NULL;
+
+static PrefetchSourceFunc source = NULL;
+static guint  items = 0;
+static gsize  head_bytes = 0;
+static gsize  rate_bytes = 0;
+static gint64 bucket_next = 0;      /* when the bucket is empty again (prefetch thread) */
+
+static PrefetchStats stats;
+
+/* Local path for a queue entry, or NULL if it is not a local file. */
+static char *prefetch_path (const char *filename)
+{
+    if (g_path_is_absolute(filename))
+        return g_strdup(filename);
+    if (g_str_has_prefix(filename, "file://"))
+        return g_filename_from_uri(filename, NULL, NULL);
+    return NULL;
+}
+
+/* Sleeps as needed so that 'bytes' more stay within the rate budget. */
+static void prefetch_throttle (gsize bytes)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (rate_bytes == 0)
+        return;
+    if (bucket_next < now - PREFETCH_BURST_US)
+        bucket_next = now - PREFETCH_BURST_US;
+    bucket_next += (gint64) ((double) bytes * G_USEC_PER_SEC / rate_bytes);
+
+    if (bucket_next > now) {
+        g_usleep(bucket_next - now);
+        g_mutex_lock(&plock);
+        stats.throttled_us += bucket_next - now;
+        g_mutex_unlock(&plock);
+    }
+}
+
+/* Warms [off, off + len) in budgeted chunks. Returns FALSE if stopped. */
+static gboolean prefetch_range (int fd, off_t off, gsize len)
+{
+    while (len > 0) {
+        gsize n = MIN(len, PREFETCH_CHUNK);
+
+        if (!g_atomic_int_get(&prunning))
+            return FALSE;
+        prefetch_throttle(n);
+        if (readahead(fd, off, n) < 0)
+            posix_fadvise(fd, off, n, POSIX_FADV_WILLNEED);
+
+        g_mutex_lock(&plock);
+        stats.bytes += n;
+        g_mutex_unlock(&plock);
+        off += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+static guint64 prefetch_be (const guint8 *p, int n)
+{
+    guint64 v = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * Locates the MP4/MOV 'moov' box by walking the top-level boxes (one
+ * 16-byte read each). Returns FALSE if the file is not ISO-BMFF or has
+ * no moov.
+ */
+static gboolean prefetch_find_moov (int fd, off_t size, off_t *off, gsize *len)
+{
+    guint8 hdr[16];
+    off_t pos = 0;
+    int i;
+
+    for (i = 0; i < PREFETCH_MAX_BOXES && pos + 8 <= size; i++) {
+        guint64 box;
+
+        if (pread(fd, hdr, sizeof(hdr), pos) < 8)
+            return FALSE;
+        if (i == 0 && memcmp(hdr + 4, "ftyp", 4) != 0)
+            return FALSE;
+
+        box = prefetch_be(hdr, 4);
+        if (box == 1)
+            box = prefetch_be(hdr + 8, 8);
+        else if (box == 0)
+            box = size - pos;
+        if (box < 8)
+            return FALSE;
+
+        if (memcmp(hdr + 4, "moov", 4) == 0) {
+            *off = pos;
+            *len = (gsize) MIN((guint64) (size - pos), box);
+            return TRUE;
+        }
+        pos += box;
+    }
+    return FALSE;
+}
+
+/* Warms the head and the index of one file. */
+static gboolean prefetch_file (const char *path)
+{
+    struct stat st;
+    gsize head, len;
+    off_t off;
+    int fd;
+    gboolean ok = FALSE;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return FALSE;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+        goto out;
+
+    head = (gsize) MIN((guint64) st.st_size, head_bytes);
+    if (!prefetch_range(fd, 0, head))
+        goto out;
+
+    if (!prefetch_find_moov(fd, st.st_size, &off, &len)) {
+        len = MIN((gsize) st.st_size, PREFETCH_TAIL_BYTES);
+        off = st.st_size - len;
+    }
+    /* Only what the head did not already cover. */
+    if (off < (off_t) head) {
+        len = (off + (off_t) len > (off_t) head) ? (gsize) (off + len - head) : 0;
+        off = head;
+    }
+    if (len > 0 && !prefetch_range(fd, off, len))
+        goto out;
+
+    ok = TRUE;
+out:
+    close(fd);
+    return ok;
+}
+
+/*
+ * One pass: forget files that are no longer upcoming, then warm the
+ * new ones in queue order.
+ */
+static void prefetch_pass (GPtrArray *upcoming)
+{
+    GHashTable *next = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    guint i;
+
+    g_mutex_lock(&plock);
+    for (i = 0; i < upcoming->len; i++) {
+        char *path = prefetch_path(g_ptr_array_index(upcoming, i));
+        gpointer state;
+
+        if (path == NULL || g_hash_table_contains(next, path)) {
+            g_free(path);
+            continue;
+        }
+        state = g_hash_table_lookup(files, path);
+        g_hash_table_insert(next, path, state);
+    }
+    g_hash_table_unref(files);
+    files = next;
+    g_mutex_unlock(&plock);
+
+    for (i = 0; i < upcoming->len && g_atomic_int_get(&prunning); i++) {
+        char *path = prefetch_path(g_ptr_array_index(upcoming, i));
+        gboolean pending, ok;
+
+        if (path == NULL)
+            continue;
+
+        g_mutex_lock(&plock);
+        pending = g_hash_table_contains(files, path) &&
+            GPOINTER_TO_INT(g_hash_table_lookup(files, path)) == PREFETCH_PENDING;
+        g_mutex_unlock(&plock);
+
+        if (pending) {
+            ok = prefetch_file(path);
+            g_mutex_lock(&plock);
+            /* The table may have been replaced by an early pass; only update if still tracked. */
+            if (g_hash_table_contains(files, path)) {
+                g_hash_table_insert(files, g_strdup(path),
+                        GINT_TO_POINTER(ok ? PREFETCH_DONE : PREFETCH_FAILED));
+                if (ok) stats.warmed++;
+            }
+            g_mutex_unlock(&plock);
+        }
+        g_free(path);
+    }
+}
+
+static gpointer prefetch_thread (gpointer data)
+{
+    (void)data;
+
+    /* Best effort: yield the disk to the file on air. */
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    g_mutex_lock(&plock);
+    while (prunning) {
+        GPtrArray *upcoming;
+
+        while (prunning && !pkicked)
+            g_cond_wait(&pcond, &plock);
+        if (!prunning)
+            break;
+        pkicked = FALSE;
+        g_mutex_unlock(&plock);
+
+        upcoming = source(items);
+        prefetch_pass(upcoming);
+        g_ptr_array_unref(upcoming);
+
+        g_mutex_lock(&plock);
+    }
+    g_mutex_unlock(&plock);
+
+    return NULL;
+}
+
+/*
+ * Starts the prefetcher: the next 'n' items (as returned by 'upcoming')
+ * get their first 'head' bytes and their index warmed, at most 'rate'
+ * bytes per second (0: unthrottled). n == 0 leaves it disabled.
+ */
+void prefetch_start (PrefetchSourceFunc upcoming, guint n, gsize head, gsize rate)
+{
+    if (n == 0 || pthread != NULL)
+        return;
+
+    source = upcoming;
+    items = n;
+    head_bytes = head;
+    rate_bytes = rate;
+    files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    prunning = TRUE;
+    pthread = g_thread_new("prefetch", prefetch_thread, NULL);
+    prefetch_kick();
+}
+
+void prefetch_stop (void)
+{
+    if (pthread == NULL)
+        return;
+
+    g_mutex_lock(&plock);
+    g_atomic_int_set(&prunning, FALSE);
+    g_cond_signal(&pcond);
+    g_mutex_unlock(&plock);
+
+    g_thread_join(pthread);
+    pthread = NULL;
+    g_hash_table_unref(files);
+    files = NULL;
+}
+
+/* The upcoming items may have changed. Cheap; safe from any thread. */
+void prefetch_kick (void)
+{
+    if (pthread == NULL)
+        return;
+
+    g_mutex_lock(&plock);
+    pkicked = TRUE;
+    g_cond_signal(&pcond);
+    g_mutex_unlock(&plock);
+}
+
+/* Records whether an item that starts playing now had been warmed. */
+void prefetch_played (const char *filename)
+{
+    char *path;
+
+    if (pthread == NULL || (path = prefetch_path(filename)) == NULL)
+        return;
+
+    g_mutex_lock(&plock);
+    if (GPOINTER_TO_INT(g_hash_table_lookup(files, path)) == PREFETCH_DONE)
+        stats.hits++;
+    else
+        stats.misses++;
+    g_mutex_unlock(&plock);
+    g_free(path);
+}
+
+void prefetch_get_stats (PrefetchStats *out)
+{
+    g_mutex_lock(&plock);
+    *out = stats;
+    g_mutex_unlock(&plock);
+}
+
+/* Appends the prefetch counters to a STATS response. */
+void prefetch_report (GString *out)
+{
+    PrefetchStats s;
+
+    if (pthread == NULL)
+        return;
+
+    prefetch_get_stats(&s);
+    g_string_append_printf(out, "Prefetch: %u hits, %u misses; %u files, %.1f MiB warmed, throttled %.1f s\n",
+            s.hits, s.misses, s.warmed, s.bytes / (1024.0 * 1024.0), s.throttled_us / 1e6);
+}
@@ -0,0 +1,216 @@
+/*
+ * Microbenchmark: playout queue operations, GList vs. VTQueue.
+ *
+ * For each queue size the queue is pre-filled, then a fixed number of
+ * random-position inserts, next-video lookups (loop mode nth access),
+ * random-position removals and one full LIST walk are timed.
+ *
+ * Then the resident memory of a loaded queue is measured: a looping
+ * schedule of MEM_PATHS distinct paths is queued once with the old
+ * entries (a GList of structs embedding a PATH_MAX buffer) and once with
+ * the current ones (VTQueue, VTmpeg and interned URIs). Each load runs
+ * in a child process, so the figures are not skewed by memory the
+ * allocator kept from the previous run.
+ *
+ *   make -C src/server bench && ./src/server/queue-bench
+ */
+
+#include <sys/wait.h>
+
+#include "VTserver.h"
+
+#define BENCH_OPS 2000
+#define MEM_PATHS 50
+
+static const unsigned int sizes[] = { 2048, 100000, 1000000 };
+static const unsigned int mem_sizes[] = { 2048, 100000 };
+
+/* The queue entry before URIs were interned. */
+typedef struct {
+    char filename[PATH_MAX];
+    int  played;
+} LegacyMpeg;
+
+static double now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report (const char *impl, unsigned int n, const char *op, double ns, unsigned int ops)
+{
+    printf("%-8s %8u  %-8s %12.1f ns/op\n", impl, n, op, ns / ops);
+}
+
+static void bench_glist (unsigned int n)
+{
+    GList *list = NULL, *l;
+    unsigned int i, len = n;
+    unsigned long sink = 0;
+    double t;
+
+    for (i = 0; i < n; i++)
+        list = g_list_prepend(list, GUINT_TO_POINTER(i + 1));
+
+    srand(n);
+    t = now_ns();
+    for (i = 0; i < BENCH_OPS; i++)
+        list = g_list_insert(list, GUINT_TO_POINTER(i + 1), rand() % (++len));
+    report("GList", n, "insert", now_ns() - t, BENCH_OPS);
+
+    t = now_ns();
+    for (i = 0; i < BENCH_OPS; i++)
+        sink += GPOINTER_TO_INT(g_list_nth_data(list, (i * 7919u) % g_list_length(list)));
+    report("GList", n, "next", now_ns() - t, BENCH_OPS);
+
+    t = now_ns();
+    for (l = list; l; l = l->next)
+        sink += GPOINTER_TO_INT(l->data);
+    report("GList", n, "list", now_ns() - t, 1);
+
+    t = now_ns();
+    for (i = 0; i < BENCH_OPS; i++) {
+        gpointer d = g_list_nth_data(list, rand() % g_list_length(list));
+        list = g_list_remove(list, d);
+    }
+    report("GList", n, "remove", now_ns() - t, BENCH_OPS);
+
+    g_list_free(list);
+    if (sink == 42) printf("\n");
+}
+
+static void bench_vtqueue (unsigned int n)
+{
+    VTQueue q;
+    VTQueueNode *node;
+    unsigned int i, len = n;
+    unsigned long sink = 0;
+    double t;
+
+    vtq_init(&q);
+    for (i = 0; i < n; i++)
+        vtq_insert(&q, i, GUINT_TO_POINTER(i + 1));
+
+    srand(n);
+    t = now_ns();
+    for (i = 0; i < BENCH_OPS; i++)
+        vtq_insert(&q, rand() % (++len), GUINT_TO_POINTER(i + 1));
+    report("VTQueue", n, "insert", now_ns() - t, BENCH_OPS);
+
+    t = now_ns();
+    for (i = 0; i < BENCH_OPS; i++)
+        sink += GPOINTER_TO_INT(vtq_nth(&q, (i * 7919u) % vtq_length(&q)));
+    report("VTQueue", n, "next", now_ns() - t, BENCH_OPS);
+
+    t = now_ns();
+    for (node = vtq_first(&q); node; node = vtq_next(node))
+        sink += GPOINTER_TO_INT(node->data);
+    report("VTQueue", n, "list", now_ns() - t, 1);
+
+    t = now_ns();
+    for (i = 0; i < BENCH_OPS; i++)
+        vtq_remove(&q, rand() % vtq_length(&q));
+    report("VTQueue", n, "remove", now_ns() - t, BENCH_OPS);
+
+    vtq_clear(&q, NULL);
+    if (sink == 42) printf("\n");
+}
+
+static long rss_kib (void)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kib = -1;
+
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmRSS: %ld kB", &kib) == 1)
+            break;
+    fclose(f);
+    return kib;
+}
+
+/* A path of about 107 bytes, like a station's media archive. */
+static void mem_path (char *buf, gsize len, unsigned int i)
+{
+    g_snprintf(buf, len, "/srv/playout/media/archive/2024/programmes/"
+               "evening-schedule/episode-%04u-final-master-1080p50.mpg", i % MEM_PATHS);
+}
+
+static void mem_load_legacy (unsigned int n)
+{
+    GList *list = NULL;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        LegacyMpeg *mpeg = g_new0(LegacyMpeg, 1);
+        mem_path(mpeg->filename, sizeof(mpeg->filename), i);
+        list = g_list_prepend(list, mpeg);
+    }
+}
+
+static void mem_load_vtqueue (unsigned int n)
+{
+    VTQueue q;
+    char path[PATH_MAX];
+    unsigned int i;
+
+    intern_init();
+    vtq_init(&q);
+    for (i = 0; i < n; i++) {
+        VTmpeg *mpeg = g_new0(VTmpeg, 1);
+        mem_path(path, sizeof(path), i);
+        mpeg->filename = intern_ref(path);
+        mpeg->id = i + 1;
+        vtq_insert(&q, i, mpeg);
+    }
+}
+
+/* Reports the RSS growth of one load, run in a child process. */
+static void bench_memory (const char *impl, unsigned int n, void (*load)(unsigned int))
+{
+    pid_t pid;
+    int p[2];
+    long kib = -1;
+
+    if (pipe(p) < 0 || (pid = fork()) < 0) {
+        perror("queue-bench");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        long before = rss_kib();
+        load(n);
+        kib = rss_kib() - before;
+        if (write(p[1], &kib, sizeof(kib)) != sizeof(kib))
+            _exit(1);
+        _exit(0);
+    }
+    close(p[1]);
+    if (read(p[0], &kib, sizeof(kib)) != sizeof(kib))
+        kib = -1;
+    close(p[0]);
+    waitpid(pid, NULL, 0);
+
+    printf("%-8s %8u  %-8s %12.1f MiB\n", impl, n, "rss", kib / 1024.0);
+}
+
+int main (void)
+{
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        bench_glist(sizes[i]);
+        bench_vtqueue(sizes[i]);
+    }
+
+    printf("VTmpeg: %u bytes, before interning: %u bytes\n",
+           (unsigned int) sizeof(VTmpeg), (unsigned int) sizeof(LegacyMpeg));
+    for (i = 0; i < G_N_ELEMENTS(mem_sizes); i++) {
+        bench_memory("GList", mem_sizes[i], mem_load_legacy);
+        bench_memory("VTQueue", mem_sizes[i], mem_load_vtqueue);
+    }
+
+    return 0;
+}
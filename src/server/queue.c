@@ -0,0 +1,277 @@
+/*
+ * Indexed playout queue (implicit treap), see queue.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+
+/* Nodes per slab; a slab is one contiguous allocation. */
+#define VTQ_SLAB_NODES 1024
+
+struct _VTQueueSlab {
+    VTQueueSlab  *next;
+    VTQueueNode   nodes[VTQ_SLAB_NODES];
+};
+
+static inline unsigned int vtq_size (const VTQueueNode *n)
+{
+    return n ? n->size : 0;
+}
+
+/* Recomputes a node's size and re-parents its children. */
+static inline void vtq_update (VTQueueNode *n)
+{
+    n->size = 1 + vtq_size(n->left) + vtq_size(n->right);
+    if (n->left)  n->left->parent = n;
+    if (n->right) n->right->parent = n;
+}
+
+/* xorshift32: cheap, good enough for treap priorities */
+static unsigned int vtq_rand (VTQueue *q)
+{
+    unsigned int x = q->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    q->seed = x;
+    return x;
+}
+
+static VTQueueNode *vtq_node_alloc (VTQueue *q, void *data)
+{
+    VTQueueNode *n;
+
+    if (q->free_nodes == NULL) {
+        VTQueueSlab *slab = malloc(sizeof(VTQueueSlab));
+        int i;
+
+        if (slab == NULL) {
+            /* This is a fatal error for the server */
+            fprintf(stderr, "Not enough memory, server shutting down.\n");
+            exit(1);
+        }
+        slab->next = q->slabs;
+        q->slabs = slab;
+        q->nslabs++;
+
+        /* Thread the new nodes onto the free list in address order. */
+        for (i = VTQ_SLAB_NODES - 1; i >= 0; i--) {
+            slab->nodes[i].right = q->free_nodes;
+            q->free_nodes = &slab->nodes[i];
+        }
+    }
+
+    n = q->free_nodes;
+    q->free_nodes = n->right;
+
+    n->left = n->right = n->parent = NULL;
+    n->size = 1;
+    n->prio = vtq_rand(q);
+    n->data = data;
+    return n;
+}
+
+static void vtq_node_free (VTQueue *q, VTQueueNode *n)
+{
+    n->data = NULL;
+    n->left = n->parent = NULL;
+    n->right = q->free_nodes;
+    q->free_nodes = n;
+}
+
+/* Splits t into l (first k nodes) and r (the rest). */
+static void vtq_split (VTQueueNode *t, unsigned int k, VTQueueNode **l, VTQueueNode **r)
+{
+    if (t == NULL) {
+        *l = *r = NULL;
+        return;
+    }
+
+    if (vtq_size(t->left) < k) {
+        vtq_split(t->right, k - vtq_size(t->left) - 1, &t->right, r);
+        vtq_update(t);
+        *l = t;
+    } else {
+        vtq_split(t->left, k, l, &t->left);
+        vtq_update(t);
+        *r = t;
+    }
+}
+
+/* Concatenates a and b (every node of a precedes every node of b). */
+static VTQueueNode *vtq_merge (VTQueueNode *a, VTQueueNode *b)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    if (a->prio > b->prio) {
+        a->right = vtq_merge(a->right, b);
+        vtq_update(a);
+        return a;
+    }
+
+    b->left = vtq_merge(a, b->left);
+    vtq_update(b);
+    return b;
+}
+
+static void vtq_set_root (VTQueue *q, VTQueueNode *root)
+{
+    q->root = root;
+    if (root) root->parent = NULL;
+}
+
+void vtq_init (VTQueue *q)
+{
+    memset(q, 0, sizeof(VTQueue));
+    q->seed = 0x9e3779b9u;
+}
+
+void vtq_clear (VTQueue *q, void (*free_fn)(void *))
+{
+    VTQueueNode *n;
+    VTQueueSlab *slab;
+
+    if (free_fn) {
+        for (n = vtq_first(q); n; n = vtq_next(n))
+            free_fn(n->data);
+    }
+
+    while ((slab = q->slabs) != NULL) {
+        q->slabs = slab->next;
+        free(slab);
+    }
+
+    vtq_init(q);
+}
+
+unsigned int vtq_length (const VTQueue *q)
+{
+    return vtq_size(q->root);
+}
+
+size_t vtq_bytes (const VTQueue *q)
+{
+    return (size_t) q->nslabs * sizeof(VTQueueSlab);
+}
+
+VTQueueNode *vtq_nth_node (const VTQueue *q, unsigned int idx)
+{
+    VTQueueNode *n = q->root;
+
+    if (idx >= vtq_size(n))
+        return NULL;
+
+    while (n) {
+        unsigned int ls = vtq_size(n->left);
+
+        if (idx < ls) {
+            n = n->left;
+        } else if (idx == ls) {
+            return n;
+        } else {
+            idx -= ls + 1;
+            n = n->right;
+        }
+    }
+
+    return NULL;
+}
+
+void *vtq_nth (const VTQueue *q, unsigned int idx)
+{
+    VTQueueNode *n = vtq_nth_node(q, idx);
+    return n ? n->data : NULL;
+}
+
+unsigned int vtq_node_index (const VTQueueNode *node)
+{
+    unsigned int idx = vtq_size(node->left);
+
+    for (; node->parent; node = node->parent) {
+        if (node == node->parent->right)
+            idx += vtq_size(node->parent->left) + 1;
+    }
+
+    return idx;
+}
+
+VTQueueNode *vtq_insert (VTQueue *q, unsigned int idx, void *data)
+{
+    VTQueueNode *l, *r, *n = vtq_node_alloc(q, data);
+
+    vtq_split(q->root, idx, &l, &r);
+    vtq_set_root(q, vtq_merge(vtq_merge(l, n), r));
+    return n;
+}
+
+void vtq_insert_many (VTQueue *q, unsigned int idx, void **data, unsigned int n)
+{
+    VTQueueNode *l, *r, *mid = NULL;
+    unsigned int i;
+
+    if (n == 0)
+        return;
+
+    for (i = 0; i < n; i++)
+        mid = vtq_merge(mid, vtq_node_alloc(q, data[i]));
+
+    vtq_split(q->root, idx, &l, &r);
+    vtq_set_root(q, vtq_merge(vtq_merge(l, mid), r));
+}
+
+void *vtq_remove_node (VTQueue *q, VTQueueNode *node)
+{
+    VTQueueNode *p = node->parent, *x;
+    VTQueueNode *sub = vtq_merge(node->left, node->right);
+    void *data = node->data;
+
+    if (sub) sub->parent = p;
+
+    if (p == NULL)
+        q->root = sub;
+    else if (p->left == node)
+        p->left = sub;
+    else
+        p->right = sub;
+
+    for (x = p; x; x = x->parent)
+        x->size--;
+
+    vtq_node_free(q, node);
+    return data;
+}
+
+void *vtq_remove (VTQueue *q, unsigned int idx)
+{
+    VTQueueNode *n = vtq_nth_node(q, idx);
+    return n ? vtq_remove_node(q, n) : NULL;
+}
+
+VTQueueNode *vtq_first (const VTQueue *q)
+{
+    VTQueueNode *n = q->root;
+
+    if (n == NULL)
+        return NULL;
+    while (n->left)
+        n = n->left;
+    return n;
+}
+
+VTQueueNode *vtq_next (const VTQueueNode *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (VTQueueNode *) node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
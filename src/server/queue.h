@@ -0,0 +1,61 @@
+/*
+ * Indexed playout queue.
+ *
+ * An order-statistic tree (implicit treap) keyed by position: every node
+ * stores its subtree size, so the length is O(1) and positional lookup,
+ * insertion and removal are O(log n). Nodes carry parent pointers, which
+ * gives O(1) amortized in-order iteration and lets a node find its own
+ * position without a search. Nodes are carved out of contiguous slabs
+ * to keep the tree compact in memory.
+ *
+ * The queue is not thread-safe; callers provide locking.
+ */
+
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+typedef struct _VTQueueNode VTQueueNode;
+typedef struct _VTQueueSlab VTQueueSlab;
+
+struct _VTQueueNode {
+    VTQueueNode  *left;
+    VTQueueNode  *right;
+    VTQueueNode  *parent;
+    unsigned int  size;
+    unsigned int  prio;
+    void         *data;
+};
+
+typedef struct {
+    VTQueueNode  *root;
+    VTQueueNode  *free_nodes;
+    VTQueueSlab  *slabs;
+    unsigned int  nslabs;
+    unsigned int  seed;
+} VTQueue;
+
+extern void          vtq_init       (VTQueue *q);
+/* Frees every node; free_fn (may be NULL) is called on each item. */
+extern void          vtq_clear      (VTQueue *q, void (*free_fn)(void *));
+
+extern unsigned int  vtq_length     (const VTQueue *q);
+/* Memory held by the node slabs, free nodes included (kept until vtq_clear). */
+extern size_t        vtq_bytes      (const VTQueue *q);
+/* Positions are 0-based. Out-of-range lookups return NULL. */
+extern void         *vtq_nth        (const VTQueue *q, unsigned int idx);
+extern VTQueueNode  *vtq_nth_node   (const VTQueue *q, unsigned int idx);
+extern unsigned int  vtq_node_index (const VTQueueNode *node);
+
+/* Inserts before position idx; idx >= length appends. */
+extern VTQueueNode  *vtq_insert     (VTQueue *q, unsigned int idx, void *data);
+/* Inserts n items, in order, as one run starting at position idx. */
+extern void          vtq_insert_many(VTQueue *q, unsigned int idx, void **data, unsigned int n);
+/* Unlinks and returns the item (NULL if idx is out of range). */
+extern void         *vtq_remove     (VTQueue *q, unsigned int idx);
+extern void         *vtq_remove_node(VTQueue *q, VTQueueNode *node);
+
+/* In-order iteration: for (n = vtq_first(q); n; n = vtq_next(n)) */
+extern VTQueueNode  *vtq_first      (const VTQueue *q);
+extern VTQueueNode  *vtq_next       (const VTQueueNode *node);
+
+#endif /* __QUEUE_H__ */
@@ -0,0 +1,154 @@
+/*
+ * Shared-memory status page (layout in statuspage.h).
+ *
+ * The page mirrors what STATUS reports so that local readers can poll
+ * it without a round trip through the IPC thread. It is fed from the
+ * places that already track each field: the playback snapshot on the
+ * main loop, item changes and queue mutations under the queue lock,
+ * pipeline errors on the bus. Those run on different threads, so
+ * writers serialise on a mutex and each one republishes the whole body
+ * under the page's seqlock; writes are rare (the position tick is
+ * 100 ms) and a body is a few hundred bytes. Readers take no lock and
+ * never make the server do anything.
+ *
+ * Without a page (shm_open failed) every update is a no-op.
+ */
+
+#include "VTserver.h"
+#include <sys/mman.h>
+
+#define STATUS_PAGE_WORDS   (sizeof(VTStatusBody) / sizeof(gint64))
+
+G_STATIC_ASSERT(sizeof(VTStatusBody) % sizeof(gint64) == 0);
+G_STATIC_ASSERT(G_STRUCT_OFFSET(VTStatusPage, body) % sizeof(gint64) == 0);
+
+static GMutex        page_lock;     /* serialises writers */
+static VTStatusPage *page = NULL;
+static VTStatusBody  body;          /* the writers' copy, under page_lock */
+
+/* page_lock held. */
+static void status_page_publish (void)
+{
+    if (page == NULL)
+        return;     /* closed since the caller looked */
+    body.updated = g_get_real_time();
+    /* The page's int32 seq has SeqLock's layout. */
+    seqlock_write((SeqLock *) &page->seq, (gint64 *) &page->body, (const gint64 *) &body, STATUS_PAGE_WORDS);
+}
+
+/* Creates (or takes over) the page. FALSE if shared memory is unavailable. */
+gboolean status_page_open (void)
+{
+    int fd;
+    void *map;
+
+    if ((fd = shm_open(STATUS_PAGE_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        log_warning("Status page: shm_open: %s", g_strerror(errno));
+        return FALSE;
+    }
+    /* Readable by everyone whatever the umask. A page left by a server that crashed is reused. */
+    fchmod(fd, 0644);
+    if (ftruncate(fd, sizeof(VTStatusPage)) < 0 ||
+            (map = mmap(NULL, sizeof(VTStatusPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        log_warning("Status page: %s", g_strerror(errno));
+        close(fd);
+        shm_unlink(STATUS_PAGE_NAME);
+        return FALSE;
+    }
+    close(fd);
+
+    page = map;
+    g_atomic_int_set((gint *) &page->magic, 0);
+    page->version = STATUS_PAGE_VERSION;
+    page->size = sizeof(VTStatusPage);
+    page->pid = getpid();
+
+    memset(&body, 0, sizeof(body));
+    body.position = -1;
+    body.duration = -1;
+    g_mutex_lock(&page_lock);
+    status_page_publish();
+    g_mutex_unlock(&page_lock);
+
+    /* Last: a reader that sees the magic sees a complete header. */
+    __atomic_store_n(&page->magic, STATUS_PAGE_MAGIC, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/* Invalidates the page for readers that still map it and removes it. */
+void status_page_close (void)
+{
+    if (page == NULL)
+        return;
+
+    g_mutex_lock(&page_lock);
+    __atomic_store_n(&page->magic, 0, __ATOMIC_RELEASE);
+    munmap(page, sizeof(VTStatusPage));
+    page = NULL;
+    g_mutex_unlock(&page_lock);
+    shm_unlink(STATUS_PAGE_NAME);
+}
+
+/* Main loop: the playback snapshot changed. */
+void status_page_playback (const PlaybackSnapshot *s)
+{
+    if (page == NULL)
+        return;
+
+    g_mutex_lock(&page_lock);
+    if (s->state == GST_STATE_NULL || s->state == GST_STATE_READY)
+        body.state = STATUS_PAGE_STANDBY;
+    else if (s->state == GST_STATE_PLAYING || s->pending == GST_STATE_PLAYING)
+        body.state = STATUS_PAGE_PLAYING;
+    else
+        body.state = STATUS_PAGE_PAUSED;
+    /* Same condition md_gst_get_snapshot() extrapolates under. */
+    body.running = s->state == GST_STATE_PLAYING && s->pending == GST_STATE_VOID_PENDING;
+    body.position = s->position;
+    body.duration = s->duration;
+    body.sampled = s->sampled;
+    status_page_publish();
+    g_mutex_unlock(&page_lock);
+}
+
+/* Item 'id' ('uri' as queued; NULL: nothing) went on air. Queue lock held. */
+void status_page_item (guint64 id, const char *uri, gboolean gapless)
+{
+    if (page == NULL)
+        return;
+
+    g_mutex_lock(&page_lock);
+    body.item_id = id;
+    g_strlcpy(body.uri, uri ? uri : "", sizeof(body.uri));
+    if (uri) {
+        body.items_played++;
+        if (gapless)
+            body.gapless++;
+    }
+    status_page_publish();
+    g_mutex_unlock(&page_lock);
+}
+
+/* Queue lock held. */
+void status_page_queue (guint length)
+{
+    if (page == NULL || body.queue_length == (gint64) length)
+        return;
+
+    g_mutex_lock(&page_lock);
+    body.queue_length = length;
+    status_page_publish();
+    g_mutex_unlock(&page_lock);
+}
+
+/* Main loop: a playback error. */
+void status_page_error (void)
+{
+    if (page == NULL)
+        return;
+
+    g_mutex_lock(&page_lock);
+    body.errors++;
+    status_page_publish();
+    g_mutex_unlock(&page_lock);
+}
@@ -9,16 +9,154 @@
 
 #include "VTserver.h"
 
-pthread_mutex_t mutex  = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Queue lock. Mutations (and the streaming thread's next-video pick)
+ * take it for writing; readers only hold it long enough to copy what
+ * they need. Writers are preferred so a run of readers cannot starve
+ * the gapless handoff.
+ */
+static pthread_rwlock_t queue_rwlock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 
 void thread_lock (void)
 {
-	pthread_mutex_lock (&mutex);
+	pthread_rwlock_wrlock (&queue_rwlock);
+	return;
+}
+
+void thread_rdlock (void)
+{
+	pthread_rwlock_rdlock (&queue_rwlock);
 	return;
 }
 
 void thread_unlock (void)
 {
-	pthread_mutex_unlock (&mutex);
+	pthread_rwlock_unlock (&queue_rwlock);
 	return;
 }
+
+/*
+ * RCU-style publication of immutable objects.
+ *
+ * Readers bracket their use of a published pointer with
+ * rcu_read_lock()/rcu_read_unlock(): two atomic operations, no lock, no
+ * waiting. A writer swaps in a new object and hands the old one to
+ * rcu_retire(); it is freed only after every reader that could still
+ * see it has left its read section. Writers never wait for readers
+ * either, reclamation is attempted on each retire and simply deferred
+ * while old readers remain.
+ *
+ * Two reader phases: an object retired in phase P is freed when the
+ * phase next flips back to P, which requires all readers registered in
+ * P to be gone, and the flip to P's twin before it drained the rest.
+ */
+typedef struct {
+	gpointer       ptr;
+	GDestroyNotify free_fn;
+} RcuRetired;
+
+static gint    rcu_phase = 0;
+static gint    rcu_readers[2] = { 0, 0 };
+static GArray *rcu_retired[2] = { NULL, NULL };
+static GMutex  rcu_mutex;
+
+int rcu_read_lock (void)
+{
+	for (;;) {
+		int p = g_atomic_int_get (&rcu_phase);
+
+		g_atomic_int_inc (&rcu_readers[p]);
+		if (g_atomic_int_get (&rcu_phase) == p)
+			return p;
+		/* The phase flipped under us; register in the new one. */
+		g_atomic_int_add (&rcu_readers[p], -1);
+	}
+}
+
+void rcu_read_unlock (int phase)
+{
+	g_atomic_int_add (&rcu_readers[phase], -1);
+}
+
+/* Frees what is safe to free. rcu_mutex held. */
+static void rcu_reclaim_locked (void)
+{
+	int p = g_atomic_int_get (&rcu_phase), q = p ^ 1;
+	guint i;
+
+	if (g_atomic_int_get (&rcu_readers[q]) != 0)
+		return;
+
+	if (rcu_retired[q]) {
+		for (i = 0; i < rcu_retired[q]->len; i++) {
+			RcuRetired *r = &g_array_index (rcu_retired[q], RcuRetired, i);
+			r->free_fn (r->ptr);
+		}
+		g_array_set_size (rcu_retired[q], 0);
+	}
+	g_atomic_int_set (&rcu_phase, q);
+}
+
+void rcu_retire (gpointer ptr, GDestroyNotify free_fn)
+{
+	RcuRetired r;
+	int p;
+
+	if (ptr == NULL)
+		return;
+
+	r.ptr = ptr;
+	r.free_fn = free_fn;
+
+	g_mutex_lock (&rcu_mutex);
+	p = g_atomic_int_get (&rcu_phase);
+	if (rcu_retired[p] == NULL)
+		rcu_retired[p] = g_array_new (FALSE, FALSE, sizeof (RcuRetired));
+	g_array_append_val (rcu_retired[p], r);
+	rcu_reclaim_locked ();
+	g_mutex_unlock (&rcu_mutex);
+}
+
+void rcu_reclaim (void)
+{
+	g_mutex_lock (&rcu_mutex);
+	rcu_reclaim_locked ();
+	g_mutex_unlock (&rcu_mutex);
+}
+
+/*
+ * Sequence lock for small, frequently read snapshots with a single
+ * writer. The writer makes the sequence odd, stores the words and makes
+ * it even again; a reader copies the words and retries if the sequence
+ * was odd or moved meanwhile. Readers never block the writer and never
+ * write shared memory. The words are copied with relaxed atomic loads
+ * and stores so a torn copy is only ever discarded, never undefined.
+ */
+void seqlock_write (SeqLock *lock, gint64 *dst, const gint64 *src, guint words)
+{
+	gint seq = __atomic_load_n (&lock->seq, __ATOMIC_RELAXED);
+	guint i;
+
+	__atomic_store_n (&lock->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	for (i = 0; i < words; i++)
+		__atomic_store_n (&dst[i], src[i], __ATOMIC_RELAXED);
+	__atomic_store_n (&lock->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void seqlock_read (const SeqLock *lock, gint64 *dst, const gint64 *src, guint words)
+{
+	gint seq;
+	guint i;
+
+	for (;;) {
+		seq = __atomic_load_n (&lock->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;	/* the writer is a few stores away from done */
+		for (i = 0; i < words; i++)
+			dst[i] = __atomic_load_n (&src[i], __ATOMIC_RELAXED);
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (__atomic_load_n (&lock->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
@@ -8,14 +8,159 @@
  */
 
 #include "VTserver.h"
+#include <sys/eventfd.h>
+
+/* Upper bound on simultaneously connected control clients (DoS guard). */
+#define UNIX_MAX_CLIENTS        1024
+/* Events fetched per epoll_wait() call. */
+#define UNIX_MAX_EVENTS         64
+/* A client must finish its request/response exchange within this window. */
+#define UNIX_CLIENT_TIMEOUT_MS  1000
+/* Worker threads that run commands and wait for the journal. */
+#define UNIX_WORKERS            4
+/* Most framed requests handed to a worker at once. */
+#define UNIX_JOB_MAX_REQUESTS   64
+/* How often idle connections are swept and the run flag re-checked. */
+#define UNIX_SWEEP_INTERVAL_MS  250
+/* Largest text-protocol request accepted (path + IPC overhead). */
+#define UNIX_MAX_REQUEST_LEN    (PATH_MAX + 128)
+/* A framed client with a partial frame or unread replies must make progress within this window. */
+#define UNIX_FRAMED_STALL_MS    10000
+/* A framed client that sends and receives nothing for this long is dropped. */
+#define UNIX_IDLE_TIMEOUT_MS    (5 * 60 * 1000)
+/* Framed and subscriber connections allowed at once, in all and per user. */
+#define UNIX_MAX_PERSISTENT     256
+#define UNIX_MAX_PERSISTENT_UID 64
+/* Stop executing a framed client's requests while this much reply data is unread. */
+#define UNIX_MAX_PENDING_OUTPUT (1024 * 1024)
+/* Requests and replies buffered across all connections before reading and executing wait. */
+#define UNIX_MAX_BUFFERED       (64 * 1024 * 1024)
+/* While the budget is spent and others wait, a persistent client that reads nothing for this long is dropped. */
+#define UNIX_PRESSURE_STALL_MS  1000
+/* An empty buffer that grew past this is given back. */
+#define UNIX_BUFFER_KEEP        (64 * 1024)
+/* A subscriber with this much unread event data is disconnected. */
+#define UNIX_SUBSCRIBER_BACKLOG (256 * 1024)
+/* Progress interval bounds and default for SUBSCRIBE. */
+#define UNIX_MIN_PROGRESS_MS    50
+#define UNIX_DEFAULT_PROGRESS_MS 1000
 
 static int   server_fd = -1;
+static int   spare_fd = -1;         /* given up to turn a client away when out of descriptors */
+static gboolean accept_stalled = FALSE;     /* the backlog is retried at the next sweep */
+static int   epoll_fd = -1;
 static pthread_t server_th;
 static gint server_running = 0;
 static int server_thread_started = 0;
+/* The event broadcaster's wakeup, registered with its own cookie. */
+static int   event_wake_fd = -1;
+static char  event_cookie;
+static gboolean events_pending = FALSE;
+/* Workers hand finished jobs back through 'done' and wake the loop with this eventfd. */
+static GThreadPool *workers = NULL;
+static GAsyncQueue *done = NULL;
+static int   work_wake_fd = -1;
+static char  work_cookie;
+static gboolean fence_pending = FALSE;
+
+/*
+ * Per-connection state machine.
+ * A connection starts in UNIX_CONN_READING. If its first bytes are
+ * FRAME_MAGIC it switches to UNIX_CONN_FRAMED and stays open, carrying
+ * any number of length-prefixed requests and responses. Otherwise it is
+ * a legacy text client: the request is accumulated until it is
+ * complete (see unix_legacy_request()), the reply drains in
+ * UNIX_CONN_WRITING (possibly over several EPOLLOUT wakeups), and the
+ * connection is closed. Nothing here ever blocks: a slow client only
+ * delays itself.
+ *
+ * A text client that sends SUBSCRIBE moves to UNIX_CONN_SUBSCRIBED
+ * after its reply and stays open: from then on it only receives event
+ * lines (events.c), and is dropped if it lets UNIX_SUBSCRIBER_BACKLOG
+ * bytes of them pile up unread.
+ *
+ * The loop itself only moves bytes. Complete requests go to a pool of
+ * UNIX_WORKERS threads as jobs (UnixJob), at most one per connection
+ * at a time so replies keep their order: a framed connection hands
+ * over every complete frame it has, up to UNIX_JOB_MAX_REQUESTS. The
+ * worker runs them, then waits for the queue journal to make them
+ * durable before it hands the replies back: a client never sees OK for
+ * a mutation a crash could still lose. Concurrent workers share one
+ * sync (journal.c's group commit), and a long LIST, a PNG decode or a
+ * sync never stalls the other clients.
+ */
+typedef enum {
+    UNIX_CONN_READING = 0,
+    UNIX_CONN_WRITING,
+    UNIX_CONN_FRAMED,
+    UNIX_CONN_SUBSCRIBED,
+    UNIX_CONN_CLOSED
+} UnixConnState;
+
+typedef struct {
+    int            fd;
+    UnixConnState  state;
+    GString       *in;
+    GString       *out;
+    gsize          out_off;
+    gint64         deadline;
+    gint64         active;          /* framed: last time anything moved */
+    uid_t          uid;             /* peer's user, (uid_t) -1 if unknown */
+    gboolean       persistent;      /* counted against UNIX_MAX_PERSISTENT */
+    gboolean       read_paused;
+    gboolean       eof;
+    gboolean       busy;            /* a worker holds its job; freed only once it is back */
+    gsize          job_bytes;       /* requests the worker holds, or 'rest' */
+    gpointer       rest;            /* UnixJob a worker stopped short of finishing */
+    gsize          charged;         /* counted in 'buffered' */
+    gboolean       held;            /* listed in 'held' */
+    guint          events;          /* subscribed EventClass mask, 0 if not a subscriber */
+    gint64         progress_us;     /* progress event interval, 0 for none */
+    gint64         next_progress;
+    gboolean       slow;            /* dropped for not reading its events */
+} UnixConn;
+
+/*
+ * Requests of one connection for a worker, and their replies. 'ids'
+ * holds the frame IDs (NULL for a text request). The worker stops
+ * once UNIX_MAX_PENDING_OUTPUT of replies are made; the requests from
+ * 'next' on go back to the connection and run once those are read.
+ * A job without a connection is an event fence: it makes everything
+ * queued so far durable and records how far the events ring may then
+ * be delivered.
+ */
+typedef struct {
+    UnixConn  *conn;
+    GPtrArray *requests;
+    GArray    *ids;
+    GString   *reply;
+    guint      next;
+    guint      mark;
+} UnixJob;
+
+/* All live connections, used for the idle-timeout sweep and shutdown. */
+static GHashTable *connections = NULL;
+/* Connections in UNIX_CONN_SUBSCRIBED. */
+static GPtrArray  *subscribers = NULL;
+/* Text connections holding an unterminated request. */
+/* Connections waiting for the buffer budget, oldest first. */
+static GPtrArray  *held = NULL;
+/* Request and reply bytes buffered across all connections. */
+static gsize       buffered = 0;
+/* Persistent connections, in all and per peer uid. */
+static guint       persistent = 0;
+static GHashTable *persistent_uids = NULL;
 
-static void *unix_loop   (void *arg);
-static void  unix_client (int fd);
+static void *unix_loop    (void *arg);
+static void  unix_client  (UnixConn *conn, uint32_t events);
+static void  unix_work    (gpointer data, gpointer user_data);
+static void  unix_complete (void);
+static void  unix_fence   (void);
+static void  unix_conn_reply (UnixConn *conn);
+static void  unix_job_free (gpointer job);
+static void  unix_progress (gint64 now);
+static void  unix_resume  (void);
+static int   unix_wait_ms (gint64 now);
 
 char *unix_sockname (void)
 {
@@ -45,28 +190,84 @@ int unix_server (void)
     snprintf(s.sun_path, sizeof(s.sun_path), "%s", unix_sockname());
 
     if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-        perror("socket");
+        log_error("socket: %s", g_strerror(errno));
         return 0;
     }
     if (bind(fd, (struct sockaddr *) &s, sizeof(s)) < 0) {
-        perror("bind");
+        log_error("bind: %s", g_strerror(errno));
         close(fd);
         return 0;
     }
-    if (listen(fd, 1) < 0) {
-        perror("listen");
+    if (listen(fd, SOMAXCONN) < 0) {
+        log_error("listen: %s", g_strerror(errno));
+        close(fd);
+        return 0;
+    }
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        log_error("fcntl: %s", g_strerror(errno));
         close(fd);
         return 0;
     }
 
     chmod(unix_sockname(), 0666);
 
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        log_error("epoll_create1: %s", g_strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    /* The listening socket is registered with a NULL cookie. */
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        log_error("epoll_ctl: %s", g_strerror(errno));
+        close(epoll_fd);
+        epoll_fd = -1;
+        close(fd);
+        return 0;
+    }
+
+    /* A broadcaster without its wakeup only means SUBSCRIBE gets no events. */
+    if ((event_wake_fd = events_init()) >= 0) {
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &event_cookie;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_wake_fd, &ev) < 0)
+            log_error("epoll_ctl: %s", g_strerror(errno));
+    }
+
+    if ((work_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        log_error("eventfd: %s", g_strerror(errno));
+        close(epoll_fd);
+        epoll_fd = -1;
+        close(fd);
+        return 0;
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &work_cookie;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, work_wake_fd, &ev) < 0)
+        log_error("epoll_ctl: %s", g_strerror(errno));
+    done = g_async_queue_new();
+    workers = g_thread_pool_new(unix_work, NULL, UNIX_WORKERS, FALSE, NULL);
+
+    connections = g_hash_table_new(g_direct_hash, g_direct_equal);
+    subscribers = g_ptr_array_new();
+    held = g_ptr_array_new();
+    persistent_uids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    /* Out of descriptors, this one is freed to accept and refuse a client. */
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
     server_fd = fd;
     g_atomic_int_set(&server_running, 1);
     int err = pthread_create(&server_th, NULL, unix_loop, NULL);
     if (err != 0) {
-        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        log_error("pthread_create: %s", g_strerror(err));
         g_atomic_int_set(&server_running, 0);
+        close(epoll_fd);
+        epoll_fd = -1;
         close(fd);
         server_fd = -1;
         unlink(unix_sockname());
@@ -76,11 +277,162 @@ int unix_server (void)
 
     unlink(UNIX_PATH);
     if (symlink(unix_sockname(), UNIX_PATH) < 0)
-        perror("symlink");
+        log_error("symlink: %s", g_strerror(errno));
 
     return 1;
 }
 
+static void unix_conn_free (UnixConn *conn)
+{
+    if (conn->events) {
+        g_ptr_array_remove_fast(subscribers, conn);
+        events_unsubscribe(conn->slow);
+    }
+    if (conn->held)
+        g_ptr_array_remove(held, conn);
+    if (conn->persistent) {
+        gpointer key = GUINT_TO_POINTER(conn->uid);
+        guint n = GPOINTER_TO_UINT(g_hash_table_lookup(persistent_uids, key));
+
+        if (n > 1)
+            g_hash_table_insert(persistent_uids, key, GUINT_TO_POINTER(n - 1));
+        else
+            g_hash_table_remove(persistent_uids, key);
+        persistent--;
+    }
+    buffered -= conn->charged;
+    if (conn->rest)
+        unix_job_free(conn->rest);
+
+    /* Closing the fd also removes it from the epoll set. */
+    shutdown(conn->fd, 2);
+    close(conn->fd);
+    g_string_free(conn->in, TRUE);
+    g_string_free(conn->out, TRUE);
+    g_free(conn);
+}
+
+static gsize unix_conn_pending (UnixConn *conn)
+{
+    return conn->out->len - conn->out_off;
+}
+
+/*
+ * Brings the connection's share of 'buffered' up to date. A job out
+ * with a worker counts as the replies it may make.
+ */
+static void unix_conn_charge (UnixConn *conn)
+{
+    gsize now = conn->in->len + unix_conn_pending(conn) + conn->job_bytes;
+
+    if (conn->busy)
+        now += UNIX_MAX_PENDING_OUTPUT;
+    buffered = buffered - conn->charged + now;
+    conn->charged = now;
+}
+
+/* Bytes that may still be buffered before the budget is spent. */
+static gsize unix_budget_room (void)
+{
+    return buffered < UNIX_MAX_BUFFERED ? UNIX_MAX_BUFFERED - buffered : 0;
+}
+
+/* Parks a connection until the budget has room again (unix_resume()). */
+static void unix_conn_hold (UnixConn *conn)
+{
+    if (!conn->held) {
+        conn->held = TRUE;
+        g_ptr_array_add(held, conn);
+    }
+}
+
+/*
+ * Counts a connection that stays open (framed or subscribed). Returns
+ * FALSE if that would go over UNIX_MAX_PERSISTENT in all or
+ * UNIX_MAX_PERSISTENT_UID for its user, so no one user can lock the
+ * others out.
+ */
+static gboolean unix_conn_persist (UnixConn *conn)
+{
+    gpointer key = GUINT_TO_POINTER(conn->uid);
+    guint n = GPOINTER_TO_UINT(g_hash_table_lookup(persistent_uids, key));
+
+    if (persistent >= UNIX_MAX_PERSISTENT || n >= UNIX_MAX_PERSISTENT_UID) {
+        log_warning("Refused a persistent IPC connection from uid %d: %u open, %u of them from that uid.",
+                (int) conn->uid, persistent, n);
+        return FALSE;
+    }
+    g_hash_table_insert(persistent_uids, key, GUINT_TO_POINTER(n + 1));
+    persistent++;
+    conn->persistent = TRUE;
+    return TRUE;
+}
+
+/* Gives a grown buffer's memory back once it is empty. */
+static void unix_buffer_shrink (GString **buf)
+{
+    if ((*buf)->len == 0 && (*buf)->allocated_len > UNIX_BUFFER_KEEP) {
+        g_string_free(*buf, TRUE);
+        *buf = g_string_sized_new(256);
+    }
+}
+
+/*
+ * Called whenever the loop is done with a connection for now: updates
+ * the buffer budget, and frees the connection if it closed, unless a
+ * worker still holds its job.
+ */
+static void unix_conn_reap (UnixConn *conn)
+{
+    unix_conn_charge(conn);
+    if (conn->state == UNIX_CONN_CLOSED && !conn->busy) {
+        g_hash_table_remove(connections, conn);
+        unix_conn_free(conn);
+    }
+}
+
+static UnixJob *unix_job_new (UnixConn *conn, gboolean framed)
+{
+    UnixJob *job = g_new0(UnixJob, 1);
+
+    job->conn = conn;
+    job->requests = g_ptr_array_new_with_free_func(g_free);
+    job->ids = framed ? g_array_new(FALSE, FALSE, sizeof(guint32)) : NULL;
+    job->reply = g_string_new(NULL);
+    return job;
+}
+
+static void unix_job_free (gpointer data)
+{
+    UnixJob *job = (UnixJob *) data;
+
+    g_ptr_array_unref(job->requests);
+    if (job->ids)
+        g_array_free(job->ids, TRUE);
+    g_string_free(job->reply, TRUE);
+    g_free(job);
+}
+
+/* Bytes of the requests a job has not run yet. */
+static gsize unix_job_bytes (UnixJob *job)
+{
+    gsize bytes = 0;
+    guint i;
+
+    for (i = job->next; i < job->requests->len; i++)
+        bytes += strlen(g_ptr_array_index(job->requests, i));
+    return bytes;
+}
+
+static void unix_job_submit (UnixJob *job)
+{
+    if (job->conn) {
+        job->conn->busy = TRUE;
+        job->conn->job_bytes = unix_job_bytes(job);
+    }
+    g_thread_pool_push(workers, job, NULL);
+}
+
 void unix_finish (void)
 {
     g_atomic_int_set(&server_running, 0);
@@ -88,6 +440,52 @@ void unix_finish (void)
         pthread_join(server_th, NULL);
         server_thread_started = 0;
     }
+    if (workers) {
+        UnixJob *job;
+
+        /* Let the workers finish what they hold; nobody takes the replies now. */
+        g_thread_pool_free(workers, FALSE, TRUE);
+        workers = NULL;
+        while ((job = g_async_queue_try_pop(done)) != NULL) {
+            if (job->conn) {
+                job->conn->busy = FALSE;
+                job->conn->job_bytes = 0;
+            }
+            unix_job_free(job);
+        }
+        g_async_queue_unref(done);
+        done = NULL;
+        close(work_wake_fd);
+        work_wake_fd = -1;
+    }
+    if (connections) {
+        GHashTableIter it;
+        gpointer key;
+
+        g_hash_table_iter_init(&it, connections);
+        while (g_hash_table_iter_next(&it, &key, NULL))
+            unix_conn_free((UnixConn *) key);
+        g_hash_table_destroy(connections);
+        connections = NULL;
+    }
+    if (spare_fd >= 0) {
+        close(spare_fd);
+        spare_fd = -1;
+    }
+    if (subscribers) {
+        g_ptr_array_free(subscribers, TRUE);
+        g_ptr_array_free(held, TRUE);
+        g_hash_table_destroy(persistent_uids);
+        subscribers = held = NULL;
+        persistent_uids = NULL;
+    }
+    buffered = 0;
+    events_finish();
+    event_wake_fd = -1;
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
     if (server_fd >= 0) {
         shutdown(server_fd, 2);
         close(server_fd);
@@ -96,89 +494,866 @@ void unix_finish (void)
     return;
 }
 
-void *unix_loop (void *arg)
+/* Turns away a client the server has no room for, with an error reply. */
+static void unix_refuse (int cfd, const char *why)
 {
-    fd_set fds;
-    int fd, cfd;
-    socklen_t len;
-    struct timeval tv;
-    struct sockaddr_un s;
+    char reply[128];
+    int len = g_snprintf(reply, sizeof(reply), "%c\n%s\n%c\n", COMMAND_ERROR, why, COMMAND_DELIM);
+    ssize_t w = send(cfd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL);
 
-    (void)arg;
+    (void)w;
+    close(cfd);
+}
 
-    fd = server_fd;
+static void unix_accept (void)
+{
+    int cfd;
+    struct epoll_event ev;
 
+    /* Edge-triggered: drain the whole backlog before returning. */
     for (;;) {
-        if (!g_atomic_int_get(&server_running)) break;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        tv.tv_sec = 1; tv.tv_usec = 0;
-
-        /*
-         * FIX: Explicitly check for success (ret > 0) to avoid entering accept
-         * on errors (like EINTR from signals) or timeouts.
-         */
-        int ret = select(fd + 1, &fds, NULL, NULL, &tv);
-        if (ret > 0 && FD_ISSET(fd, &fds)) {
-            if (!g_atomic_int_get(&server_running)) break;
-
-            /* 
-             * FIX: Do not hold lock during accept() or unix_client() which calls read().
-             * This prevents DoS where a client connects but doesn't send data.
-             */
-            len = sizeof(s);
-            memset(&s, 0, sizeof(s));
-            if ((cfd = accept(fd, (struct sockaddr *) &s, &len)) < 0) {
-                /*
-                 * RESILIENCE: Log the error but do NOT exit. 
-                 * Transient network errors (EINTR, ECONNABORTED) must not kill the daemon.
-                 */
-                perror("accept");
+        cfd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            /* The client gave up while queued: on to the next. */
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
                 continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                accept_stalled = FALSE;
+                return;
             }
-            
             /*
-             * DEFENSE: Configure receive timeout on the accepted socket.
-             * This prevents the single-threaded loop from blocking indefinitely
-             * if a client connects but sends no data.
+             * RESILIENCE: out of descriptors, the spare one makes room to
+             * take the client off the backlog and refuse it, so the
+             * backlog still drains and clients are not left hanging.
              */
-            struct timeval rtv;
-            rtv.tv_sec = 1;
-            rtv.tv_usec = 0;
-            if (setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&rtv, sizeof(rtv)) < 0) {
-                perror("setsockopt");
-                /* Proceed anyway; robustness is preferred over crashing. */
+            if ((errno == EMFILE || errno == ENFILE) && spare_fd >= 0) {
+                int err;
+
+                close(spare_fd);
+                cfd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                err = errno;
+                if (cfd >= 0)
+                    unix_refuse(cfd, "Server busy: out of file descriptors.");
+                spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                /* The descriptor check comes before the queue: it may be empty. */
+                if (cfd < 0 && (err == EAGAIN || err == EWOULDBLOCK))
+                    return;
+                errno = err;
+                if (cfd >= 0) {
+                    if (!accept_stalled)
+                        log_warning("accept: out of file descriptors, refusing IPC clients.");
+                    accept_stalled = TRUE;
+                    continue;
+                }
+            }
+            /* Anything else must not kill the daemon either: retry at the next sweep. */
+            if (!accept_stalled)
+                log_error("accept: %s", g_strerror(errno));
+            accept_stalled = TRUE;
+            return;
+        }
+
+        /* DEFENSE: Bound the number of simultaneous clients. */
+        if (g_hash_table_size(connections) >= UNIX_MAX_CLIENTS) {
+            unix_refuse(cfd, "Server busy: too many clients.");
+            continue;
+        }
+
+        UnixConn *conn = g_new0(UnixConn, 1);
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+
+        conn->fd = cfd;
+        conn->uid = getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0 ? cred.uid : (uid_t) -1;
+        conn->state = UNIX_CONN_READING;
+        conn->in = g_string_sized_new(256);
+        conn->out = g_string_sized_new(256);
+        conn->deadline = g_get_monotonic_time() + UNIX_CLIENT_TIMEOUT_MS * 1000;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+            log_error("epoll_ctl: %s", g_strerror(errno));
+            unix_conn_free(conn);
+            continue;
+        }
+        g_hash_table_add(connections, conn);
+    }
+}
+
+/*
+ * Drops connections that have not completed their request (or drained
+ * their response) within UNIX_CLIENT_TIMEOUT_MS. This replaces the old
+ * per-socket SO_RCVTIMEO: an idle client no longer holds up the loop.
+ * While connections wait for the buffer budget, persistent clients
+ * sitting on unread replies get UNIX_PRESSURE_STALL_MS instead of
+ * UNIX_FRAMED_STALL_MS, so clients that read are not starved.
+ */
+static void unix_expire (gint64 now)
+{
+    GHashTableIter it;
+    gpointer key;
+    gboolean pressure = held->len > 0 && unix_budget_room() == 0;
+    gint64 early = (UNIX_FRAMED_STALL_MS - UNIX_PRESSURE_STALL_MS) * 1000;
+
+    g_hash_table_iter_init(&it, connections);
+    while (g_hash_table_iter_next(&it, &key, NULL)) {
+        UnixConn *conn = (UnixConn *) key;
+        gboolean stays_open = conn->state == UNIX_CONN_FRAMED || conn->state == UNIX_CONN_SUBSCRIBED;
+
+        if (now >= conn->deadline)
+            conn->state = UNIX_CONN_CLOSED;
+        else if (pressure && stays_open && unix_conn_pending(conn) > 0 && now >= conn->deadline - early)
+            conn->state = UNIX_CONN_CLOSED;
+        if (conn->state == UNIX_CONN_CLOSED && !conn->busy) {
+            g_hash_table_iter_remove(&it);
+            unix_conn_free(conn);
+        }
+    }
+}
+
+void *unix_loop (void *arg)
+{
+    struct epoll_event events[UNIX_MAX_EVENTS];
+    gint64 next_sweep = 0;
+    int i, n;
+
+    (void)arg;
+
+    for (;;) {
+        if (!g_atomic_int_get(&server_running)) break;
+
+        /* Bounded wait so shutdown, timeouts and progress events are noticed promptly. */
+        n = epoll_wait(epoll_fd, events, UNIX_MAX_EVENTS, unix_wait_ms(g_get_monotonic_time()));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait: %s", g_strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            UnixConn *conn = (UnixConn *) events[i].data.ptr;
+
+            if (conn == NULL) {
+                if (!g_atomic_int_get(&server_running)) break;
+                unix_accept();
+                continue;
+            }
+            if ((gpointer) conn == &event_cookie) {
+                events_pending = TRUE;
+                continue;
             }
+            if ((gpointer) conn == &work_cookie) {
+                unix_complete();
+                continue;
+            }
+
+            unix_client(conn, events[i].events);
+            unix_conn_reap(conn);
+        }
+
+        unix_resume();
 
-            unix_client(cfd);
+        /* Broadcast after a commit, never ahead of it. */
+        if (events_pending) {
+            events_pending = FALSE;
+            unix_fence();
+        }
 
-            shutdown(cfd, 2);
-            close(cfd);
+        gint64 now = g_get_monotonic_time();
+        unix_progress(now);
+        if (now >= next_sweep) {
+            unix_expire(now);
+            /* Edge-triggered: a stalled backlog gets no new wakeup by itself. */
+            if (accept_stalled)
+                unix_accept();
+            next_sweep = now + UNIX_SWEEP_INTERVAL_MS * 1000;
         }
     }
 
     return NULL;
 }
 
-void unix_client (int fd)
+/*
+ * Drains the socket (edge-triggered) into the request buffer.
+ * Reading stops early once 'limit' bytes are buffered; read_paused then
+ * tells the caller to come back after the buffer has been consumed.
+ */
+static void unix_conn_read (UnixConn *conn, gsize limit)
 {
-    char temp[PATH_MAX + 128];
+    char temp[4096];
     ssize_t bytes_read;
 
-    memset(temp, 0, sizeof(temp));
-    
-    /* Securely read from socket, ensuring null termination. */
-    /* This blocks, so we MUST NOT hold the mutex here. */
-    bytes_read = read(fd, temp, sizeof(temp) - 1);
-    if (bytes_read <= 0) return;
-    temp[bytes_read] = '\0';
-
-    /* Process command - all locking is now handled inside command_process */
-    char *response = command_process(temp);
-
-    /* Perform socket I/O */
-    if (response) {
-        dprintf(fd, "%s", response);
-        g_free(response);
+    conn->read_paused = FALSE;
+    while (conn->in->len < limit) {
+        gsize room = MIN(sizeof(temp), limit - conn->in->len);
+
+        bytes_read = read(conn->fd, temp, room);
+        if (bytes_read > 0) {
+            g_string_append_len(conn->in, temp, bytes_read);
+            continue;
+        }
+        if (bytes_read == 0) {
+            conn->eof = TRUE;
+            return;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            conn->state = UNIX_CONN_CLOSED;
+        return;
+    }
+    conn->read_paused = TRUE;
+}
+
+/*
+ * Writes as much of the response as the socket accepts.
+ * Returns TRUE if any bytes went out.
+ */
+static gboolean unix_conn_flush (UnixConn *conn)
+{
+    gboolean wrote = FALSE;
+
+    while (conn->out->len > conn->out_off) {
+        ssize_t w = write(conn->fd, conn->out->str + conn->out_off,
+                          conn->out->len - conn->out_off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                conn->state = UNIX_CONN_CLOSED;
+            break;
+        }
+        conn->out_off += w;
+        wrote = TRUE;
+    }
+
+    if (unix_conn_pending(conn) == 0) {
+        g_string_truncate(conn->out, 0);
+        conn->out_off = 0;
+        unix_buffer_shrink(&conn->out);
+    } else if (conn->out_off > conn->out->len / 2) {
+        /* Compact so a long-lived connection's buffer doesn't creep. */
+        g_string_erase(conn->out, 0, conn->out_off);
+        conn->out_off = 0;
+    }
+
+    return wrote;
+}
+
+static void unix_frame_put_u32 (GString *buf, guint32 v)
+{
+    guint32 be = htonl(v);
+    g_string_append_len(buf, (const char *) &be, sizeof(be));
+}
+
+static guint32 unix_frame_get_u32 (const char *p)
+{
+    guint32 be;
+    memcpy(&be, p, sizeof(be));
+    return ntohl(be);
+}
+
+/*
+ * Hands every complete frame in the input buffer, in arrival order, to
+ * a worker as one job; the replies come back tagged with the requests'
+ * IDs. Waits while the previous job is out, and while the client is not
+ * reading its replies (backpressure).
+ * Returns TRUE if at least one frame was consumed.
+ */
+static gboolean unix_framed_dispatch (UnixConn *conn)
+{
+    UnixJob *job = NULL;
+    gsize off = 0;
+
+    if (conn->busy || unix_conn_pending(conn) >= UNIX_MAX_PENDING_OUTPUT)
+        return FALSE;
+    if (unix_budget_room() == 0) {
+        unix_conn_hold(conn);
+        return FALSE;
+    }
+    /* What the last worker left comes before any new frame. */
+    if (conn->rest) {
+        job = conn->rest;
+        conn->rest = NULL;
+        unix_job_submit(job);
+        return TRUE;
+    }
+
+    while (conn->state == UNIX_CONN_FRAMED &&
+           unix_conn_pending(conn) < UNIX_MAX_PENDING_OUTPUT &&
+           (job == NULL || job->requests->len < UNIX_JOB_MAX_REQUESTS) &&
+           conn->in->len - off >= FRAME_HEADER_LEN) {
+        const char *hdr = conn->in->str + off;
+        guint32 len = unix_frame_get_u32(hdr);
+        guint32 id  = unix_frame_get_u32(hdr + 4);
+
+        if (len > MAX_FRAME_LEN) {
+            /* DEFENSE: Oversized frame, drop the client. */
+            conn->state = UNIX_CONN_CLOSED;
+            break;
+        }
+        if (conn->in->len - off < FRAME_HEADER_LEN + len)
+            break;
+
+        if (job == NULL)
+            job = unix_job_new(conn, TRUE);
+        g_ptr_array_add(job->requests, g_strndup(hdr + FRAME_HEADER_LEN, len));
+        g_array_append_val(job->ids, id);
+
+        off += FRAME_HEADER_LEN + len;
+    }
+
+    if (off > 0) {
+        g_string_erase(conn->in, 0, off);
+        unix_buffer_shrink(&conn->in);
+    }
+    if (job && conn->state == UNIX_CONN_FRAMED)
+        unix_job_submit(job);
+    else if (job)
+        unix_job_free(job);
+
+    return off > 0;
+}
+
+/* Moves a framed connection forward as far as it can go without blocking. */
+static void unix_framed_pump (UnixConn *conn, gboolean readable)
+{
+    gboolean progress = TRUE;
+    gboolean moved = readable;
+
+    while (progress && conn->state == UNIX_CONN_FRAMED) {
+        progress = FALSE;
+
+        if (readable || conn->read_paused) {
+            gsize room = unix_budget_room();
+
+            /* Over budget: the rest stays in the socket until unix_resume(). */
+            if (room == 0) {
+                conn->read_paused = TRUE;
+                unix_conn_hold(conn);
+            } else {
+                unix_conn_read(conn, MIN(FRAME_HEADER_LEN + MAX_FRAME_LEN, conn->in->len + room));
+                unix_conn_charge(conn);
+            }
+        }
+        readable = FALSE;
+
+        if (unix_framed_dispatch(conn))
+            progress = TRUE;
+        if (unix_conn_pending(conn) > 0 && unix_conn_flush(conn))
+            progress = TRUE;
+        moved |= progress;
+    }
+
+    if (conn->state != UNIX_CONN_FRAMED)
+        return;
+
+    /* Peer closed its side: finish any replies, then hang up. */
+    if (conn->eof && !conn->busy && !conn->rest && !conn->held && unix_conn_pending(conn) == 0) {
+        conn->state = UNIX_CONN_CLOSED;
+        return;
+    }
+
+    /*
+     * A stalled client (partial frame or unread replies) must move
+     * within UNIX_FRAMED_STALL_MS, an idle one within
+     * UNIX_IDLE_TIMEOUT_MS; none expires while a worker has its requests.
+     */
+    if (moved)
+        conn->active = g_get_monotonic_time();
+    if (conn->busy)
+        conn->deadline = G_MAXINT64;
+    else if (conn->in->len > 0 || unix_conn_pending(conn) > 0)
+        conn->deadline = conn->active + UNIX_FRAMED_STALL_MS * 1000;
+    else
+        conn->deadline = conn->active + UNIX_IDLE_TIMEOUT_MS * 1000;
+}
+
+/* Writes what a subscriber can take; one that stops reading eventually expires. */
+static void unix_subscriber_flush (UnixConn *conn)
+{
+    gboolean wrote = unix_conn_pending(conn) > 0 && unix_conn_flush(conn);
+
+    if (unix_conn_pending(conn) == 0)
+        conn->deadline = G_MAXINT64;
+    else if (wrote || conn->deadline == G_MAXINT64)
+        conn->deadline = g_get_monotonic_time() + UNIX_FRAMED_STALL_MS * 1000;
+}
+
+/* Queues an event line on a subscriber, dropping it once its backlog is full. */
+static void unix_subscriber_put (UnixConn *conn, const char *line, gsize len)
+{
+    if (conn->state != UNIX_CONN_SUBSCRIBED)
+        return;
+    if (unix_conn_pending(conn) + len > UNIX_SUBSCRIBER_BACKLOG) {
+        conn->slow = TRUE;
+        conn->state = UNIX_CONN_CLOSED;
+        return;
+    }
+    g_string_append_len(conn->out, line, len);
+}
+
+/* Writes every subscriber's new events once, and frees the ones that went away. */
+static void unix_subscribers_flush (void)
+{
+    guint i;
+
+    /* Backwards: freeing swaps the last subscriber into the hole. */
+    for (i = subscribers->len; i-- > 0; ) {
+        UnixConn *conn = g_ptr_array_index(subscribers, i);
+
+        if (conn->state == UNIX_CONN_SUBSCRIBED)
+            unix_subscriber_flush(conn);
+        unix_conn_reap(conn);
+    }
+}
+
+static void unix_event_deliver (EventClass cls, const char *line, gsize len, gpointer data)
+{
+    guint i;
+
+    (void)data;
+    for (i = 0; i < subscribers->len; i++) {
+        UnixConn *conn = g_ptr_array_index(subscribers, i);
+
+        if (cls == 0 || (conn->events & cls))
+            unix_subscriber_put(conn, line, len);
+    }
+}
+
+/*
+ * Asks a worker for an event fence (unless one is out): once it is
+ * back, the events posted before it are delivered.
+ */
+static void unix_fence (void)
+{
+    if (fence_pending)
+        return;
+    fence_pending = TRUE;
+    unix_job_submit(unix_job_new(NULL, FALSE));
+}
+
+/* Fans the broadcaster's events posted before 'upto' out to the subscribers. */
+static void unix_events (guint upto)
+{
+    events_drain(upto, unix_event_deliver, NULL);
+    unix_subscribers_flush();
+
+    /* Posted while the fence was out: they need one of their own. */
+    if (events_mark() != upto)
+        unix_fence();
+}
+
+/* Progress events are made here, per subscriber, from the playback snapshot. */
+static void unix_progress (gint64 now)
+{
+    GString *line = NULL;
+    guint i;
+
+    for (i = 0; i < subscribers->len; i++) {
+        UnixConn *conn = g_ptr_array_index(subscribers, i);
+
+        if (conn->progress_us == 0 || now < conn->next_progress)
+            continue;
+        if (line == NULL) {
+            PlaybackSnapshot snap;
+            char text[96];
+
+            md_gst_get_snapshot(&snap);
+            g_snprintf(text, sizeof(text), "%s pos=%" G_GINT64_FORMAT " dur=%" G_GINT64_FORMAT,
+                    md_gst_state_name(&snap), MAX(snap.position, 0) / GST_MSECOND,
+                    MAX(snap.duration, 0) / GST_MSECOND);
+            line = g_string_sized_new(128);
+            events_format(line, g_get_real_time() / 1000, EVENT_PROGRESS, text);
+        }
+        unix_subscriber_put(conn, line->str, line->len);
+        conn->next_progress += conn->progress_us;
+        if (conn->next_progress <= now)
+            conn->next_progress = now + conn->progress_us;
+    }
+
+    if (line) {
+        g_string_free(line, TRUE);
+        unix_subscribers_flush();
+    }
+}
+
+/*
+ * epoll_wait() timeout: the sweep interval, or sooner if a progress
+ * event is due.
+ */
+static int unix_wait_ms (gint64 now)
+{
+    gint64 wait = UNIX_SWEEP_INTERVAL_MS * 1000;
+    guint i;
+
+    for (i = 0; i < subscribers->len; i++) {
+        UnixConn *conn = g_ptr_array_index(subscribers, i);
+
+        if (conn->progress_us)
+            wait = MIN(wait, MAX(conn->next_progress - now, 0));
+    }
+    return (int) ((wait + 999) / 1000);
+}
+
+/*
+ * SUBSCRIBE [classes];[progress ms]. Replies, then keeps the connection
+ * open and streams one event line per event. Text mode only: a framed
+ * connection carries replies, not a stream (command_process refuses it).
+ */
+static void unix_subscribe (UnixConn *conn, const char *args)
+{
+    char **parts = g_strsplit(args ? args + 1 : "", ";", 2);
+    char *classes = g_strstrip(parts[0] ? parts[0] : (char *) "");
+    int interval = (parts[0] && parts[1]) ? atoi(parts[1]) : -1;
+    guint mask = EVENT_ALL, i;
+    GString *reply = conn->out;
+
+    if (*classes && !events_parse_classes(classes, &mask)) {
+        g_string_append_printf(reply, "%c\nUnknown event class in: %s (state, item, queue, error, progress, all).\n%c\n",
+                COMMAND_ERROR, classes, COMMAND_DELIM);
+        mask = 0;
+    } else if (interval == 0) {
+        mask &= ~EVENT_PROGRESS;
+    }
+    g_strfreev(parts);
+
+    if (mask == 0) {
+        if (reply->len == 0)
+            g_string_append_printf(reply, "%c\nNo event classes selected.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+        unix_conn_reply(conn);
+        return;
+    }
+
+    if (!unix_conn_persist(conn)) {
+        g_string_append_printf(reply, "%c\nToo many open connections, try again later.\n%c\n", COMMAND_ERROR, COMMAND_DELIM);
+        unix_conn_reply(conn);
+        return;
+    }
+
+    if (mask & EVENT_PROGRESS) {
+        if (interval < 0) interval = UNIX_DEFAULT_PROGRESS_MS;
+        conn->progress_us = (gint64) MAX(interval, UNIX_MIN_PROGRESS_MS) * 1000;
+        conn->next_progress = g_get_monotonic_time();
+    }
+    conn->events = mask;
+
+    g_string_append_printf(reply, "%c\nSubscribed:", COMMAND_OK);
+    for (i = 0; (1u << i) <= EVENT_ALL; i++) {
+        if (mask & (1 << i))
+            g_string_append_printf(reply, " %s", event_class_name((EventClass) (1 << i)));
+    }
+    if (conn->progress_us)
+        g_string_append_printf(reply, "; progress every %" G_GINT64_FORMAT " ms", conn->progress_us / 1000);
+    g_string_append_printf(reply, "\n%c\n", COMMAND_DELIM);
+
+    /* Start from the current state rather than waiting for the next change. */
+    if (mask & EVENT_STATE) {
+        PlaybackSnapshot snap;
+        GString *line = g_string_sized_new(64);
+
+        md_gst_get_snapshot(&snap);
+        events_format(line, g_get_real_time() / 1000, EVENT_STATE, md_gst_state_name(&snap));
+        g_string_append_len(reply, line->str, line->len);
+        g_string_free(line, TRUE);
+    }
+
+    conn->state = UNIX_CONN_SUBSCRIBED;
+    g_ptr_array_add(subscribers, conn);
+    events_subscribe();
+    unix_subscriber_flush(conn);
+}
+
+/* Commands that are not valid without arguments. */
+static gboolean unix_text_needs_args (int id)
+{
+    switch (id) {
+        case COMMAND_INSERT:
+        case COMMAND_REMOVE:
+        case COMMAND_INSERT_BULK:
+        case COMMAND_REMOVE_BULK:
+        case COMMAND_REMOVE_ID:
+        case COMMAND_MOVE_ID:
+        case COMMAND_INSERT_AFTER:
+        case COMMAND_SEEK:
+        case COMMAND_RATE:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+/*
+ * Whether an unterminated text request is complete by the command
+ * grammar: "[id]" when the command's arguments are optional, "[id]
+ * [args]" otherwise, and for a batch its first item line. A request
+ * ending in a newline is complete too, except a batch, whose items are
+ * lines. A request that cannot become valid is complete as well, so
+ * its error reply goes out at once.
+ */
+static gboolean unix_text_complete (const GString *in)
+{
+    const char *p = in->str, *nl;
+    int id = 0, digits = 0;
+
+    while (g_ascii_isdigit(*p) && digits < 9) {
+        id = id * 10 + (*p++ - '0');
+        digits++;
+    }
+    if (digits == 0)
+        return in->len > 0;
+    if (*p == '\0')
+        return !unix_text_needs_args(id);
+    if (*p != ' ')
+        return TRUE;
+
+    if (id == COMMAND_INSERT_BULK || id == COMMAND_REMOVE_BULK) {
+        nl = strchr(p + 1, '\n');
+        return nl && nl[1] != '\0' && nl[1] != '\n';
+    }
+    if (in->str[in->len - 1] == '\n')
+        return TRUE;
+    for (p++; *p; p++)
+        if (!g_ascii_isspace(*p))
+            return TRUE;
+    return !unix_text_needs_args(id);
+}
+
+/*
+ * Handles a legacy one-shot text request once it is complete: the
+ * client ends it with a NUL byte or by shutting down its side of the
+ * socket, or, like older clients that do neither and just wait for the
+ * reply, sends a whole command (unix_text_complete()). Until then the
+ * request is buffered, however many reads it arrives in; one that
+ * never completes is dropped after UNIX_CLIENT_TIMEOUT_MS. 'resumed'
+ * is set for a request that was complete before it was held.
+ */
+static void unix_legacy_request (UnixConn *conn, gboolean resumed)
+{
+    char *end = memchr(conn->in->str, '\0', conn->in->len);
+
+    if (end)
+        g_string_truncate(conn->in, end - conn->in->str);
+    else if (!conn->eof && !resumed && !unix_text_complete(conn->in))
+        return;
+
+    if (conn->in->len == 0) {
+        conn->state = UNIX_CONN_CLOSED;
+        return;
+    }
+
+    if (atoi(conn->in->str) == COMMAND_SUBSCRIBE) {
+        gint64 started = metrics_now();
+
+        unix_subscribe(conn, strchr(conn->in->str, ' '));
+        metrics_command(COMMAND_SUBSCRIBE, metrics_now() - started);
+        return;
+    }
+
+    /* Over budget: wait for the replies ahead of it to drain (unix_resume()). */
+    if (unix_budget_room() == 0) {
+        conn->deadline = G_MAXINT64;
+        unix_conn_hold(conn);
+        return;
+    }
+
+    /* A worker runs it; the reply is written once it is back (unix_complete()). */
+    UnixJob *job = unix_job_new(conn, FALSE);
+    g_ptr_array_add(job->requests, g_strdup(conn->in->str));
+    conn->state = UNIX_CONN_WRITING;
+    conn->deadline = G_MAXINT64;
+    unix_job_submit(job);
+}
+
+/* Lets held connections go on, oldest first, while the budget has room. */
+static void unix_resume (void)
+{
+    while (held->len > 0 && unix_budget_room() > 0) {
+        UnixConn *conn = g_ptr_array_remove_index(held, 0);
+
+        conn->held = FALSE;
+        if (conn->state == UNIX_CONN_READING)
+            unix_legacy_request(conn, TRUE);
+        else if (conn->state == UNIX_CONN_FRAMED)
+            unix_framed_pump(conn, FALSE);
+        unix_conn_reap(conn);
+    }
+}
+
+/*
+ * Worker thread: runs a job's requests in order, then waits until the
+ * journal has made them durable; the replies go back to the loop.
+ */
+static void unix_work (gpointer data, gpointer user_data)
+{
+    UnixJob *job = (UnixJob *) data;
+    guint64 one = 1;
+    guint i;
+
+    (void)user_data;
+
+    if (job->conn == NULL) {
+        /* The queue lock: no mutation is halfway between its event and its record. */
+        thread_rdlock();
+        job->mark = events_mark();
+        thread_unlock();
+    }
+
+    for (i = job->next; i < job->requests->len && job->reply->len < UNIX_MAX_PENDING_OUTPUT; i++) {
+        char *response = command_process(g_ptr_array_index(job->requests, i));
+        gsize rlen = response ? strlen(response) : 0;
+
+        if (job->ids) {
+            unix_frame_put_u32(job->reply, (guint32) rlen);
+            unix_frame_put_u32(job->reply, g_array_index(job->ids, guint32, i));
+        }
+        if (response) {
+            g_string_append_len(job->reply, response, rlen);
+            g_free(response);
+        }
+    }
+    job->next = i;
+
+    /* Concurrent workers share one sync (group commit). */
+    commands_commit();
+
+    g_async_queue_push(done, job);
+    if (write(work_wake_fd, &one, sizeof(one)) < 0)
+        log_error("eventfd: %s", g_strerror(errno));
+}
+
+/* Writes a text-mode reply; the connection closes once it is out. */
+static void unix_conn_reply (UnixConn *conn)
+{
+    conn->state = UNIX_CONN_WRITING;
+    conn->deadline = g_get_monotonic_time() + UNIX_CLIENT_TIMEOUT_MS * 1000;
+    unix_conn_flush(conn);
+    if (conn->state == UNIX_CONN_WRITING && unix_conn_pending(conn) == 0)
+        conn->state = UNIX_CONN_CLOSED;
+}
+
+/* Takes back the jobs the workers finished and sends their replies. */
+static void unix_complete (void)
+{
+    UnixJob *job;
+    guint64 count;
+
+    if (read(work_wake_fd, &count, sizeof(count)) < 0)
+        count = 0;
+
+    while ((job = g_async_queue_try_pop(done)) != NULL) {
+        UnixConn *conn = job->conn;
+
+        if (conn == NULL) {
+            fence_pending = FALSE;
+            unix_events(job->mark);
+            unix_job_free(job);
+            continue;
+        }
+
+        conn->busy = FALSE;
+        conn->job_bytes = 0;
+        conn->active = g_get_monotonic_time();
+        g_string_append_len(conn->out, job->reply->str, job->reply->len);
+        if (job->next < job->requests->len && conn->state == UNIX_CONN_FRAMED) {
+            /* The worker stopped at the output limit: keep the rest for later. */
+            g_string_truncate(job->reply, 0);
+            conn->job_bytes = unix_job_bytes(job);
+            conn->rest = job;
+        } else {
+            unix_job_free(job);
+        }
+
+        if (conn->state == UNIX_CONN_WRITING)
+            unix_conn_reply(conn);
+        else if (conn->state == UNIX_CONN_FRAMED)
+            unix_framed_pump(conn, FALSE);
+        unix_conn_reap(conn);
+    }
+}
+
+void unix_client (UnixConn *conn, uint32_t events)
+{
+    gboolean readable = (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0;
+
+    switch (conn->state) {
+        case UNIX_CONN_READING:
+            /* A held request is complete; unix_resume() takes it from here. */
+            if (!readable || conn->held) break;
+
+            unix_conn_read(conn, UNIX_MAX_REQUEST_LEN + 1);
+            if (conn->state == UNIX_CONN_CLOSED) break;
+
+            /* Protocol detection: framed clients open with FRAME_MAGIC. */
+            if (conn->in->len > 0 && conn->in->str[0] == FRAME_MAGIC[0]) {
+                if (conn->in->len < FRAME_MAGIC_LEN) {
+                    if (conn->eof) conn->state = UNIX_CONN_CLOSED;
+                    break;
+                }
+                if (memcmp(conn->in->str, FRAME_MAGIC, FRAME_MAGIC_LEN) != 0) {
+                    conn->state = UNIX_CONN_CLOSED;
+                    break;
+                }
+                if (!unix_conn_persist(conn)) {
+                    conn->state = UNIX_CONN_CLOSED;
+                    break;
+                }
+                g_string_erase(conn->in, 0, FRAME_MAGIC_LEN);
+                conn->state = UNIX_CONN_FRAMED;
+                unix_framed_pump(conn, TRUE);
+                break;
+            }
+
+            if (conn->in->len > UNIX_MAX_REQUEST_LEN) {
+                /* DEFENSE: Oversized request, drop the client. */
+                conn->state = UNIX_CONN_CLOSED;
+                break;
+            }
+            unix_legacy_request(conn, FALSE);
+            break;
+
+        case UNIX_CONN_WRITING:
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                conn->state = UNIX_CONN_CLOSED;
+                break;
+            }
+            /* Response fully written: one request per connection. */
+            if ((events & EPOLLOUT) && !conn->busy) {
+                unix_conn_flush(conn);
+                if (unix_conn_pending(conn) == 0)
+                    conn->state = UNIX_CONN_CLOSED;
+            }
+            break;
+
+        case UNIX_CONN_FRAMED:
+            if (events & EPOLLERR) {
+                conn->state = UNIX_CONN_CLOSED;
+                break;
+            }
+            unix_framed_pump(conn, readable);
+            break;
+
+        case UNIX_CONN_SUBSCRIBED:
+            if (events & EPOLLERR) {
+                conn->state = UNIX_CONN_CLOSED;
+                break;
+            }
+            if (readable) {
+                /* Nothing more is read from a subscriber; only its hangup matters. */
+                do {
+                    g_string_truncate(conn->in, 0);
+                    unix_conn_read(conn, 4096);
+                } while (conn->read_paused && conn->state != UNIX_CONN_CLOSED);
+                if (conn->eof) {
+                    conn->state = UNIX_CONN_CLOSED;
+                    break;
+                }
+            }
+            if (events & EPOLLOUT)
+                unix_subscriber_flush(conn);
+            break;
+
+        case UNIX_CONN_CLOSED:
+            break;
     }
 }
@@ -12,6 +12,37 @@
 #include <gst/video/videooverlay.h>
 #include <cairo.h>
 
+#define STANDBY_LOGO        "VT-TV"
+#define STANDBY_FONT        "Sans"
+#define STANDBY_BASE_HEIGHT 480.0   /* text sizes are given for this height */
+
+/*
+ * Standby card settings, set from any thread (options, GRAPHICS) and
+ * read by the main loop when it renders the card.
+ */
+static GMutex           standby_lock;
+static char            *standby_text = NULL;    /* NULL: STANDBY_TEXT */
+static char            *standby_path = NULL;
+static cairo_surface_t *standby_image = NULL;   /* slate, as loaded */
+static gint64           standby_countdown = 0;  /* unix time of the next item, 0: none */
+static gint             standby_generation = 1;
+
+/*
+ * Main loop only. The card is rendered once per allocation size (and
+ * settings change) into a surface like the window's, and every expose
+ * only paints it. The countdown line is a second, small surface,
+ * rendered once a second while it runs; its timer invalidates only its
+ * own rectangle.
+ */
+static GtkWidget       *standby_area = NULL;
+static gboolean         standby_playing = FALSE;
+static cairo_surface_t *card = NULL;
+static gint             card_width, card_height, card_scale, card_generation;
+static cairo_surface_t *countdown = NULL;
+static gint64           countdown_shown = -1;   /* seconds left on the surface */
+static GdkRectangle     countdown_rect;
+static guint            countdown_timer = 0;
+
 /* Callback to pass the XID/Window Handle to GStreamer once the widget is realized */
 static void realize_cb (GtkWidget *widget, gpointer data)
 {
@@ -21,76 +52,290 @@ static void realize_cb (GtkWidget *widget, gpointer data)
     if (!gdk_window_ensure_native(window))
         g_error("Couldn't create native window needed for GstVideoOverlay!");
 
-    /* NOTE: This logic is X11-dependent. Wayland support requires GstVideoOverlay 
+    /* NOTE: This logic is X11-dependent. Wayland support requires GstVideoOverlay
        to use wayland-specific surface handles. */
     window_handle = GDK_WINDOW_XID(window);
-    
+
     /* Pass the window handle to the backend. It will be stored and used
        in the synchronous bus handler whenever a new sink is created. */
     md_gst_set_window_handle(window_handle);
 }
 
+/* Shows 'text' centred on x, with its baseline at y. */
+static void standby_show_text (cairo_t *cr, const char *text, double size, double x, double y)
+{
+    cairo_text_extents_t ext;
+
+    cairo_set_font_size(cr, size);
+    cairo_text_extents(cr, text, &ext);
+    cairo_move_to(cr, x - (ext.width / 2) - ext.x_bearing, y);
+    cairo_show_text(cr, text);
+}
+
+/* Renders the card for the widget's allocation: slate or logo, and the status line. */
+static void standby_render (GtkWidget *widget, int width, int height)
+{
+    double k = MAX(1.0, height / STANDBY_BASE_HEIGHT);
+    cairo_text_extents_t ext;
+    cairo_t *cr;
+
+    if (card) cairo_surface_destroy(card);
+    card_width = width;
+    card_height = height;
+    card_scale = gtk_widget_get_scale_factor(widget);
+    card = gdk_window_create_similar_image_surface(gtk_widget_get_window(widget), CAIRO_FORMAT_RGB24,
+                                                   width, height, card_scale);
+    cr = cairo_create(card);
+
+    /* 1. Paint Background (Dark Grey) */
+    cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
+    cairo_paint(cr);
+
+    g_mutex_lock(&standby_lock);
+    card_generation = standby_generation;
+
+    /* 2. The slate, scaled to fit and centred, or the logo */
+    if (standby_image) {
+        int iw = cairo_image_surface_get_width(standby_image);
+        int ih = cairo_image_surface_get_height(standby_image);
+        double s = MIN((double) width / iw, (double) height / ih);
+
+        cairo_save(cr);
+        cairo_translate(cr, (width - iw * s) / 2, (height - ih * s) / 2);
+        cairo_scale(cr, s, s);
+        cairo_set_source_surface(cr, standby_image, 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+        cairo_paint(cr);
+        cairo_restore(cr);
+    }
+
+    cairo_select_font_face(cr, STANDBY_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    if (!standby_image) {
+        cairo_set_font_size(cr, 64.0 * k);
+        cairo_text_extents(cr, STANDBY_LOGO, &ext);
+        cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+        cairo_move_to(cr, (width / 2) - (ext.width / 2) - ext.x_bearing,
+                          (height / 2) - (ext.height / 2) - ext.y_bearing);
+        cairo_show_text(cr, STANDBY_LOGO);
+    }
+
+    /* 3. Status (Bottom) */
+    cairo_set_source_rgb(cr, 0.5, 0.5, 0.5);
+    standby_show_text(cr, standby_text ? standby_text : STANDBY_TEXT, 18.0 * k, width / 2.0, height - 40 * k);
+    g_mutex_unlock(&standby_lock);
+
+    cairo_destroy(cr);
+
+    /* The countdown goes between the logo and the status line. */
+    countdown_shown = -1;
+    countdown_rect.width = width;
+    countdown_rect.height = (int) (48 * k);
+    countdown_rect.x = 0;
+    countdown_rect.y = (int) (height * 0.7) - countdown_rect.height / 2;
+}
+
+/* Renders the countdown line for 'left' seconds over its strip of the card. */
+static void countdown_render (GtkWidget *widget, gint64 left)
+{
+    double k = MAX(1.0, card_height / STANDBY_BASE_HEIGHT);
+    char text[64];
+    cairo_t *cr;
+
+    if (countdown) cairo_surface_destroy(countdown);
+    countdown_shown = left;
+    countdown = gdk_window_create_similar_image_surface(gtk_widget_get_window(widget), CAIRO_FORMAT_RGB24,
+                                                        countdown_rect.width, countdown_rect.height, card_scale);
+    cr = cairo_create(countdown);
+
+    /* The card underneath, so painting the line needs no blending. */
+    cairo_set_source_surface(cr, card, -countdown_rect.x, -countdown_rect.y);
+    cairo_paint(cr);
+
+    if (left > 0)
+        g_snprintf(text, sizeof(text), "ON AIR IN %02" G_GINT64_FORMAT ":%02d:%02d",
+                   left / 3600, (int) (left / 60 % 60), (int) (left % 60));
+    else
+        g_snprintf(text, sizeof(text), "ON AIR SHORTLY");
+    cairo_select_font_face(cr, STANDBY_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    standby_show_text(cr, text, 28.0 * k, countdown_rect.width / 2.0, countdown_rect.height * 0.7);
+
+    cairo_destroy(cr);
+}
+
+/* Seconds to the countdown's target, clamped at 0; -1 if there is none. */
+static gint64 countdown_left (void)
+{
+    gint64 target;
+
+    g_mutex_lock(&standby_lock);
+    target = standby_countdown;
+    g_mutex_unlock(&standby_lock);
+
+    if (target == 0)
+        return -1;
+    return MAX(0, target - g_get_real_time() / G_USEC_PER_SEC);
+}
+
+/* Once a second while the card shows a running countdown: redraws only its line. */
+static gboolean countdown_tick_cb (gpointer data)
+{
+    gint64 left = countdown_left();
+
+    (void)data;
+
+    if (!standby_area || standby_playing || left < 0) {
+        countdown_timer = 0;
+        return G_SOURCE_REMOVE;
+    }
+    gtk_widget_queue_draw_area(standby_area, countdown_rect.x, countdown_rect.y,
+                               countdown_rect.width, countdown_rect.height);
+    if (left == 0) {
+        countdown_timer = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* Main loop: starts the countdown timer if the card shows one. */
+static void countdown_arm (void)
+{
+    if (countdown_timer == 0 && standby_area && !standby_playing && countdown_left() > 0)
+        countdown_timer = g_timeout_add_seconds(1, countdown_tick_cb, NULL);
+}
+
 /* Standby screen drawing callback for when playback is idle */
 static gboolean draw_cb (GtkWidget *widget, cairo_t *cr, gpointer data)
 {
+    GtkAllocation alloc;
+    gint64 started, left;
+
+    (void)data;
+
     /* If GStreamer is playing, let it handle the surface.
        Return TRUE to prevent GTK from clearing the background. */
-    if (md_gst_is_playing())
+    if (standby_playing)
         return TRUE;
 
-    GtkAllocation alloc;
+    started = metrics_now();
     gtk_widget_get_allocation(widget, &alloc);
 
-    /* 1. Paint Background (Dark Grey) */
-    cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
+    if (!card || alloc.width != card_width || alloc.height != card_height ||
+            gtk_widget_get_scale_factor(widget) != card_scale ||
+            g_atomic_int_get(&standby_generation) != card_generation)
+        standby_render(widget, alloc.width, alloc.height);
+
+    /* GTK has clipped cr to the damage; only that much is painted. */
+    cairo_set_source_surface(cr, card, 0, 0);
     cairo_paint(cr);
 
-    /* 2. Setup Typography */
-    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    
-    cairo_text_extents_t ext;
-    const char *logo = "VT-TV";
-    const char *status = "STATION STANDBY - OFF AIR";
-
-    /* 3. Draw Logo (Center) */
-    cairo_set_font_size(cr, 64.0);
-    cairo_text_extents(cr, logo, &ext);
-    cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
-    cairo_move_to(cr, (alloc.width / 2) - (ext.width / 2) - ext.x_bearing, 
-                      (alloc.height / 2) - (ext.height / 2) - ext.y_bearing);
-    cairo_show_text(cr, logo);
-
-    /* 4. Draw Status (Bottom) */
-    cairo_set_font_size(cr, 18.0);
-    cairo_text_extents(cr, status, &ext);
-    cairo_set_source_rgb(cr, 0.5, 0.5, 0.5);
-    cairo_move_to(cr, (alloc.width / 2) - (ext.width / 2) - ext.x_bearing, 
-                      alloc.height - 40);
-    cairo_show_text(cr, status);
+    if ((left = countdown_left()) >= 0) {
+        if (left != countdown_shown || !countdown)
+            countdown_render(widget, left);
+        cairo_set_source_surface(cr, countdown, countdown_rect.x, countdown_rect.y);
+        cairo_paint(cr);
+    }
+
+    metrics_record(METRIC_HIST_STANDBY, metrics_now() - started);
 
     /* Return TRUE to signal we've handled the drawing, preventing default clear */
     return TRUE;
 }
 
+static gboolean standby_changed_cb (gpointer data)
+{
+    (void)data;
+
+    if (standby_area && !standby_playing) {
+        gtk_widget_queue_draw(standby_area);
+        countdown_arm();
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Sets the standby card: a status line (NULL: STANDBY_TEXT), a PNG slate
+ * shown instead of the logo (NULL: none), and the unix time of the next
+ * item to count down to (0: no countdown). Any thread. Returns FALSE,
+ * changing nothing, if the slate cannot be loaded.
+ */
+gboolean standby_set_card (const char *text, const char *image_path, gint64 countdown_to)
+{
+    cairo_surface_t *image = NULL;
+
+    if (image_path && *image_path) {
+        image = cairo_image_surface_create_from_png(image_path);
+        if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS ||
+                cairo_image_surface_get_width(image) == 0 || cairo_image_surface_get_height(image) == 0) {
+            cairo_surface_destroy(image);
+            return FALSE;
+        }
+    }
+
+    g_mutex_lock(&standby_lock);
+    g_free(standby_text);
+    g_free(standby_path);
+    if (standby_image) cairo_surface_destroy(standby_image);
+    standby_text = (text && *text) ? g_strndup(text, GRAPHICS_TEXT_MAX) : NULL;
+    standby_path = image ? g_strdup(image_path) : NULL;
+    standby_image = image;
+    standby_countdown = MAX(0, countdown_to);
+    g_atomic_int_inc(&standby_generation);
+    g_mutex_unlock(&standby_lock);
+
+    g_idle_add(standby_changed_cb, NULL);
+    return TRUE;
+}
+
+/* One line for GRAPHICS. */
+void standby_report (GString *out)
+{
+    g_mutex_lock(&standby_lock);
+    g_string_append_printf(out, "standby: %s;%s", standby_text ? standby_text : STANDBY_TEXT,
+                           standby_path ? standby_path : "");
+    if (standby_countdown)
+        g_string_append_printf(out, ";%" G_GINT64_FORMAT, standby_countdown);
+    g_string_append_c(out, '\n');
+    g_mutex_unlock(&standby_lock);
+}
+
+/*
+ * Main loop, from the playback snapshot: whether the live pipeline
+ * plays, so draw_cb() knows without reading the snapshot. Coming off
+ * air shows the card at once.
+ */
+void gst_player_video_set_playing (gboolean playing)
+{
+    if (playing == standby_playing)
+        return;
+    standby_playing = playing;
+    if (standby_area && !playing) {
+        gtk_widget_queue_draw(standby_area);
+        countdown_arm();
+    }
+}
+
 GtkWidget *gst_player_video_new (GstElement *playbin)
 {
     GtkWidget *area = gtk_drawing_area_new();
-    
+
     /* Critical: Disable default background painting to allow GStreamer overlay */
     gtk_widget_set_app_paintable(area, TRUE);
 
     /* Connect to realize signal to capture XID */
     g_signal_connect(area, "realize", G_CALLBACK(realize_cb), playbin);
-    
+
     /* Connect to draw signal to handle idle state (Off-Air screen) */
     g_signal_connect(area, "draw", G_CALLBACK(draw_cb), NULL);
-    
+
     /* Set a reasonable default size */
     gtk_widget_set_size_request(area, 640, 480);
-    
+
     /* Allow the widget to expand */
     gtk_widget_set_hexpand(area, TRUE);
     gtk_widget_set_vexpand(area, TRUE);
 
+    standby_area = area;
+    countdown_arm();
     return area;
 }
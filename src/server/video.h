@@ -8,7 +8,15 @@
 #include <gtk/gtk.h>
 #include <gst/gst.h>
 
+#define STANDBY_TEXT "STATION STANDBY - OFF AIR"
+
 /* Creates a GtkDrawingArea that handles GstVideoOverlay */
 GtkWidget *gst_player_video_new (GstElement *playbin);
+/* Main loop: whether the live pipeline plays (the standby card is hidden) */
+void gst_player_video_set_playing (gboolean playing);
+
+/* Standby card; any thread. FALSE if the PNG slate cannot be loaded. */
+gboolean standby_set_card (const char *text, const char *image_path, gint64 countdown_to);
+void     standby_report   (GString *out);
 
 #endif /* __VIDEO_H__ */